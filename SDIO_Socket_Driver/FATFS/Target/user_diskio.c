@@ -35,14 +35,126 @@
 /* Includes ------------------------------------------------------------------*/
 #include <string.h>
 #include "ff_gen_drv.h"
+#include "user_diskio.h"
 #include "sd_device.h"
+#include "sd_readahead.h"
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
+#ifdef USE_SD_READAHEAD
+#define SD_CARD_STATE()  SD_RA_GetCardState()   // 后台预读时不等待, 下一次读写会先等待预读结束
+#else
+#define SD_CARD_STATE()  BSP_SD_GetCardState(0)
+#endif
 
 /* Private variables ---------------------------------------------------------*/
 /* Disk status */
 static volatile DSTATUS Stat = STA_NOINIT;
 
+#ifdef USE_SD_READAHEAD
+/* FatFs的顺序读数据流 */
+static SD_RA_Stream_t USER_Stream = { .Slot = -1 };
+#endif
+
+/* SD卡状态跟踪, 缓存最近一次CMD13的结果, 卡忙时按逐渐加大的间隔查询 */
+static struct
+{
+  int32_t  State;       // 最近一次查询的结果, BSP_ERROR_NONE或BSP_ERROR_BUSY
+  uint32_t Tick;        // 最近一次查询的时间
+  uint32_t Interval;    // 卡忙时到下一次查询的间隔, 单位ms
+  uint32_t BusySince;   // 开始观察到卡忙的时间
+  uint8_t  Valid;       // 缓存有效, 每次读写后清除
+} USER_Card = { BSP_ERROR_NONE, 0, USER_POLL_MIN, 0, 0 };
+
+/* 非阻塞模式, 卡忙时读写不等待直接返回RES_NOTRDY */
+static uint8_t USER_NonBlocking = 0;
+
+DSTATUS USER_initialize (BYTE pdrv);
+
+
+/**
+  * @brief  设置非阻塞模式
+  * @note   非阻塞模式下卡忙时读写和同步立即返回RES_NOTRDY, FatFs会把它当作磁盘错误,
+  *         适合在卡空闲时才访问文件的应用. 注意CTRL_SYNC也不等待: 卡还在编程时f_sync()/f_close()
+  *         返回FR_DISK_ERR, 需要在同步前切换回阻塞模式, 或者之后重试
+  * @param  enable: 1: 非阻塞, 0: 等待卡就绪(默认)
+  * @retval 无
+  */
+void USER_SetNonBlocking(uint8_t enable)
+{
+  USER_NonBlocking = enable;
+}
+
+/**
+  * @brief  查询SD卡状态
+  * @note   缓存有效且距离上次查询不到查询间隔时直接返回缓存的状态, 不发送CMD13;
+  *         卡一直忙时查询间隔从USER_POLL_MIN逐次加倍到USER_POLL_MAX. 上次的忙采样已经过时
+  *         (非阻塞模式下调用者退避了更长时间)时从这次重新开始计算忙的时间, 不能确定卡中间一直忙
+  * @param  无
+  * @retval BSP_ERROR_NONE: 就绪, BSP_ERROR_BUSY: 忙
+  */
+static int32_t USER_CardState(void)
+{
+  uint32_t now = HAL_GetTick();
+  int32_t state;
+
+  if (USER_Card.Valid
+      && now - USER_Card.Tick < ((USER_Card.State == BSP_ERROR_NONE) ? USER_STATE_VALID : USER_Card.Interval))
+  {
+    return USER_Card.State;
+  }
+
+  state = SD_CARD_STATE();
+  if (state == BSP_ERROR_NONE)
+  {
+    USER_Card.Interval = USER_POLL_MIN;
+  }
+  else if (!USER_Card.Valid || USER_Card.State == BSP_ERROR_NONE || now - USER_Card.Tick > 2 * USER_Card.Interval)
+  {
+    USER_Card.BusySince = now;
+    USER_Card.Interval = USER_POLL_MIN;
+  }
+  else if (USER_Card.Interval < USER_POLL_MAX)
+  {
+    USER_Card.Interval *= 2;
+  }
+
+  USER_Card.State = state;
+  USER_Card.Tick = now;
+  USER_Card.Valid = 1;
+  return state;
+}
+
+/**
+  * @brief  等待SD卡就绪
+  * @note   从观察到卡忙开始最多等待USER_READY_TIMEOUT, 超时后报告未初始化; 之前超时过时先重新初始化
+  *         (diskio.c只调用一次USER_initialize(), FatFs看到STA_NOINIT也不会再初始化)
+  * @param  无
+  * @retval RES_OK: 就绪, RES_NOTRDY: 非阻塞模式下卡忙或重新初始化失败, RES_ERROR: 超时
+  */
+static DRESULT USER_WaitReady(void)
+{
+  if ((Stat & STA_NOINIT) && USER_initialize(0) != 0)
+  {
+    return RES_NOTRDY;
+  }
+
+  while (USER_CardState() != BSP_ERROR_NONE)
+  {
+    if (HAL_GetTick() - USER_Card.BusySince >= USER_READY_TIMEOUT)
+    {
+      Stat |= STA_NOINIT;
+      return RES_ERROR;
+    }
+    if (USER_NonBlocking)
+    {
+      return RES_NOTRDY;
+    }
+    SD_WAIT_EVENT();
+  }
+
+  return RES_OK;
+}
+
 /* USER CODE END DECL */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -85,10 +197,13 @@ DSTATUS USER_initialize (
   
   res = BSP_SD_Init(0);
   
-  if (res == BSP_ERROR_NONE)
-    return RES_OK;
-  else
-    return RES_ERROR;
+#ifdef USE_SD_READAHEAD
+  SD_RA_Init(&USER_Stream);
+#endif
+
+  USER_Card.Valid = 0;
+  Stat = (res == BSP_ERROR_NONE) ? 0 : STA_NOINIT;
+  return Stat;
   /* USER CODE END INIT */
 }
 
@@ -102,12 +217,9 @@ DSTATUS USER_status (
 )
 {
   /* USER CODE BEGIN STATUS */
-  /* Wait until SD card is ready to use for new operation */
-  while (BSP_SD_GetCardState(0) != BSP_ERROR_NONE)
-  {
-  }
-  
-  return BSP_ERROR_NONE;
+  /* 不发送CMD13, 也不根据缓存的卡状态判断超时(采样可能早已过时, 卡其实已经就绪);
+     卡忙超时只在读写前的USER_WaitReady()中实际查询时判断, 超时后报告未初始化 */
+  return Stat;
   /* USER CODE END STATUS */
 }
 
@@ -130,7 +242,19 @@ DRESULT USER_read (
   int32_t res;
   DRESULT ret;
   
+  /* 等待上一次写入的编程结束 */
+  ret = USER_WaitReady();
+  if (ret != RES_OK)
+  {
+    return ret;
+  }
+
+#ifdef USE_SD_READAHEAD
+  res = SD_RA_Read(&USER_Stream, buff, sector, count);
+#else
   res = BSP_SD_ReadBlocks(0, (uint32_t *) buff, sector, count);
+#endif
+  USER_Card.Valid = 0;
   if (res == BSP_ERROR_NONE)
   {
     ret = RES_OK;
@@ -140,10 +264,6 @@ DRESULT USER_read (
     ret = RES_ERROR;
   }
 
-  /* Wait until SD card is ready to use for new operation */
-  while (BSP_SD_GetCardState(0) != BSP_ERROR_NONE)
-  {
-  }
   return ret;
   /* USER CODE END READ */
 }
@@ -169,7 +289,19 @@ DRESULT USER_write (
   int32_t res;
   DRESULT ret;
   
+  /* 等待上一次写入的编程结束, 这次写入的编程在下一次访问前等待 */
+  ret = USER_WaitReady();
+  if (ret != RES_OK)
+  {
+    return ret;
+  }
+
+#ifdef USE_SD_READAHEAD
+  res = SD_RA_Write(buff, sector, count);
+#else
   res = BSP_SD_WriteBlocks(0, (uint32_t *) buff, sector, count);
+#endif
+  USER_Card.Valid = 0;
   if (res == BSP_ERROR_NONE)
   {
     ret = RES_OK;
@@ -179,10 +311,6 @@ DRESULT USER_write (
     ret = RES_ERROR;
   }
 
-  /* Wait until SD card is ready to use for new operation */
-  while (BSP_SD_GetCardState(0) != BSP_ERROR_NONE)
-  {
-  }
   return ret;
   /* USER CODE END WRITE */
 }
@@ -205,15 +333,45 @@ DRESULT USER_ioctl (
   /* USER CODE BEGIN IOCTL */
   SD_CardInfoTypeDef SDCardInfo;
   DRESULT ret;
+#if _USE_TRIM == 1
+  int32_t res;
+#endif
   
   if (pdrv == 0) 
   {
     switch(cmd) 
     {
       case CTRL_SYNC:
-        ret = RES_OK;
+        /* 擦除TRIM等待中的范围 */
+#ifdef USE_SD_READAHEAD
+        if (SD_RA_Sync() != BSP_ERROR_NONE)
+        {
+          ret = RES_NOTRDY;
+          break;
+        }
+#endif
+        /* 等待写入的数据编程结束 */
+        ret = USER_WaitReady();
+        if (ret == RES_OK)
+        {
+          ret = (BSP_SD_DiscardFlush(0) == BSP_ERROR_NONE) ? RES_OK : RES_ERROR;
+          USER_Card.Valid = 0;
+        }
         break;
 
+#if _USE_TRIM == 1
+      case CTRL_TRIM:
+        /* buff为{起始扇区, 结束扇区}, 包括结束扇区 */
+#ifdef USE_SD_READAHEAD
+        res = SD_RA_Discard(((DWORD*)buff)[0], ((DWORD*)buff)[1] - ((DWORD*)buff)[0] + 1);
+#else
+        res = BSP_SD_Discard(0, ((DWORD*)buff)[0], ((DWORD*)buff)[1] - ((DWORD*)buff)[0] + 1);
+#endif
+        USER_Card.Valid = 0;
+        ret = (res == BSP_ERROR_NONE) ? RES_OK : RES_ERROR;
+        break;
+#endif
+
       case GET_SECTOR_SIZE:
         *(DWORD*)buff = 512;
         ret = RES_OK;
@@ -31,9 +31,16 @@
 /* Includes ------------------------------------------------------------------*/
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
+#define USER_READY_TIMEOUT    1000    // 等待SD卡就绪的最长时间, 单位ms, 超过时报告未初始化(STA_NOINIT), 下一次读写时重新初始化
+#define USER_POLL_MIN         1       // CMD13查询卡状态的最小间隔, 单位ms
+#define USER_POLL_MAX         16      // 卡一直忙时查询间隔逐次加倍, 最大到该值, 单位ms
+#define USER_STATE_VALID      1000    // 缓存的就绪状态的有效时间, 单位ms, 读写后立即失效
+
 /* Exported functions ------------------------------------------------------- */
 extern Diskio_drvTypeDef  USER_Driver;
 
+void USER_SetNonBlocking(uint8_t enable);
+
 /* USER CODE END 0 */
 
 #ifdef __cplusplus
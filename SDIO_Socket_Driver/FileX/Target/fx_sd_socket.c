@@ -2,8 +2,14 @@
 /* Includes ------------------------------------------------------------------*/
 #include "fx_sd_socket.h"
 #include "fx_stm32_sd_driver.h"
+#include "sd_readahead.h"
 
 
+#ifdef USE_SD_READAHEAD
+/* FileX的顺序读数据流 */
+static SD_RA_Stream_t FX_Stream = { .Slot = -1 };
+#endif
+
 
 
 /**
@@ -19,6 +25,9 @@ INT fx_stm32_sd_init(UINT Instance)
 	if (Instance == FX_STM32_SD_INSTANCE)
 	{
 		res = BSP_SD_Init(0);
+#ifdef USE_SD_READAHEAD
+		SD_RA_Init(&FX_Stream);
+#endif
 	}
 	
 	if (res == 0)
@@ -70,7 +79,11 @@ INT fx_stm32_sd_get_status(UINT Instance)
 	
 	if (Instance == FX_STM32_SD_INSTANCE)
 	{
+#ifdef USE_SD_READAHEAD
+		res = SD_RA_GetCardState();
+#else
 		res = BSP_SD_GetCardState(0);
+#endif
 	}
 	
 	if (res == 0)
@@ -99,7 +112,11 @@ INT fx_stm32_sd_read_blocks(UINT Instance, UINT *Buffer, UINT StartSector, UINT
 	
 	if (Instance == FX_STM32_SD_INSTANCE)
 	{
+#ifdef USE_SD_READAHEAD
+		res = SD_RA_Read(&FX_Stream, (uint8_t *) Buffer, StartSector, NbrOfBlocks);
+#else
 		res = BSP_SD_ReadBlocks(0, Buffer, StartSector, NbrOfBlocks);
+#endif
 	}
 	
 	if (res == 0)
@@ -128,7 +145,73 @@ INT fx_stm32_sd_write_blocks(UINT Instance, UINT *Buffer, UINT StartSector, UINT
 	
 	if (Instance == FX_STM32_SD_INSTANCE)
 	{
+#ifdef USE_SD_READAHEAD
+		res = SD_RA_Write((uint8_t *) Buffer, StartSector, NbrOfBlocks);
+#else
 		res = BSP_SD_WriteBlocks(0, Buffer, StartSector, NbrOfBlocks);
+#endif
+	}
+	
+	if (res == 0)
+	{
+	  return 0;
+	}
+	else
+	{
+		return 1;
+	}
+}
+
+
+/**
+  * @brief  FileX底层的同步磁盘函数
+  * @note   擦除释放扇区时等待中的范围
+  * @param  Instance: 磁盘编号
+  * @retval 结果 0-成功，其他-失败
+  */
+INT fx_stm32_sd_flush(UINT Instance)
+{
+	int32_t res = 0;
+	
+	if (Instance == FX_STM32_SD_INSTANCE)
+	{
+#ifdef USE_SD_READAHEAD
+		res = SD_RA_Sync();
+		if (res == BSP_ERROR_NONE)
+#endif
+		res = BSP_SD_DiscardFlush(0);
+	}
+	
+	if (res == 0)
+	{
+	  return 0;
+	}
+	else
+	{
+		return 1;
+	}
+}
+
+
+/**
+  * @brief  FileX底层的释放扇区函数
+  * @note   FileX释放簇时调用, 扇区放入等待擦除的列表, 在fx_stm32_sd_flush()中擦除
+  * @param  Instance: 磁盘编号
+  * @param  StartSector: 扇区编号
+  * @param  NbrOfBlocks: 扇区数
+  * @retval 结果 0-成功，其他-失败
+  */
+INT fx_stm32_sd_release_blocks(UINT Instance, UINT StartSector, UINT NbrOfBlocks)
+{
+	int32_t res = 0;
+	
+	if (Instance == FX_STM32_SD_INSTANCE)
+	{
+#ifdef USE_SD_READAHEAD
+		res = SD_RA_Discard(StartSector, NbrOfBlocks);
+#else
+		res = BSP_SD_Discard(0, StartSector, NbrOfBlocks);
+#endif
 	}
 	
 	if (res == 0)
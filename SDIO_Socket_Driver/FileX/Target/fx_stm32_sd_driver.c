@@ -89,6 +89,9 @@ VOID  fx_stm32_sd_driver(FX_MEDIA *media_ptr)
     {
       media_ptr->fx_media_driver_status = FX_SUCCESS;
 
+      /* request FX_DRIVER_RELEASE_SECTORS when clusters are freed */
+      media_ptr->fx_media_driver_free_sector_update = FX_TRUE;
+
       FX_STM32_SD_PRE_INIT(media_ptr);
 
 #if (FX_STM32_SD_INIT == 1)
@@ -162,11 +165,33 @@ VOID  fx_stm32_sd_driver(FX_MEDIA *media_ptr)
 
   case FX_DRIVER_FLUSH:
     {
+      /* erase the sectors released since the last flush */
+      if (fx_stm32_sd_flush(FX_STM32_SD_INSTANCE) != 0)
+      {
+        media_ptr->fx_media_driver_status = FX_IO_ERROR;
+        break;
+      }
+
       /* Return driver success.  */
       media_ptr->fx_media_driver_status =  FX_SUCCESS;
       break;
     }
 
+  case FX_DRIVER_RELEASE_SECTORS:
+    {
+      /* queue the freed sectors for erase, they are erased on the next flush */
+      if (fx_stm32_sd_release_blocks(FX_STM32_SD_INSTANCE,
+                                     (UINT)(media_ptr->fx_media_driver_logical_sector + media_ptr->fx_media_hidden_sectors),
+                                     media_ptr->fx_media_driver_sectors) != 0)
+      {
+        media_ptr->fx_media_driver_status = FX_IO_ERROR;
+        break;
+      }
+
+      media_ptr->fx_media_driver_status =  FX_SUCCESS;
+      break;
+    }
+
   case FX_DRIVER_ABORT:
     {
       /* Return driver success.  */
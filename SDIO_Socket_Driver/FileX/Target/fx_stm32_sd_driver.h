@@ -202,6 +202,9 @@ VOID  fx_stm32_sd_driver(FX_MEDIA *media_ptr);
 
 /* USER CODE BEGIN EFP */
 
+INT fx_stm32_sd_flush(UINT Instance);
+INT fx_stm32_sd_release_blocks(UINT Instance, UINT StartSector, UINT NbrOfBlocks);
+
 /* USER CODE END EFP */
 
 /* Private defines -----------------------------------------------------------*/
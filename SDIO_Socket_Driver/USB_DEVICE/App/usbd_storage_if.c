@@ -23,6 +23,7 @@
 
 /* USER CODE BEGIN INCLUDE */
 #include "sd_device.h"
+#include "sd_readahead.h"
 /* USER CODE END INCLUDE */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -67,6 +68,11 @@
 #define STORAGE_BLK_SIZ                  0x200
 
 /* USER CODE BEGIN PRIVATE_DEFINES */
+#ifdef USE_SD_READAHEAD
+#define SD_CARD_STATE()  SD_RA_GetCardState()   // 后台预读时不等待, 下一次读写会先等待预读结束
+#else
+#define SD_CARD_STATE()  BSP_SD_GetCardState(0)
+#endif
 
 /* USER CODE END PRIVATE_DEFINES */
 
@@ -113,6 +119,10 @@ const int8_t STORAGE_Inquirydata_FS[] = {/* 36 */
 /* USER CODE END INQUIRY_DATA_FS */
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
+#ifdef USE_SD_READAHEAD
+/* USB主机的顺序读数据流 */
+static SD_RA_Stream_t STORAGE_Stream = { .Slot = -1 };
+#endif
 
 /* USER CODE END PRIVATE_VARIABLES */
 
@@ -180,6 +190,9 @@ int8_t STORAGE_Init_FS(uint8_t lun)
   int32_t res;
 
   res = BSP_ERROR_NONE;
+#ifdef USE_SD_READAHEAD
+  SD_RA_Init(&STORAGE_Stream);
+#endif
   if (res == BSP_ERROR_NONE)
   {
     res = USBD_OK;
@@ -222,9 +235,10 @@ int8_t STORAGE_GetCapacity_FS(uint8_t lun, uint32_t *block_num, uint16_t *block_
 int8_t STORAGE_IsReady_FS(uint8_t lun)
 {
   /* USER CODE BEGIN 4 */
-  /* Wait until SD card is ready to use for new operation */
-  while (BSP_SD_GetCardState(0) != BSP_ERROR_NONE)
+  /* 在USB中断中调用, 不能等待: 卡忙或FatFs/FileX正在访问SD卡时报告未就绪, 由MSC类重试 */
+  if (SD_CARD_STATE() != BSP_ERROR_NONE)
   {
+    return (USBD_FAIL);
   }
 
   return (USBD_OK);
@@ -258,7 +272,17 @@ int8_t STORAGE_Read_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t bl
   /* USER CODE BEGIN 6 */
   int32_t res;
 
+  /* 在USB中断中调用, 不能等待上一次写入的编程忙或被打断的FatFs/FileX访问, 返回失败由MSC类重试 */
+  if (SD_CARD_STATE() != BSP_ERROR_NONE)
+  {
+    return (USBD_FAIL);
+  }
+
+#ifdef USE_SD_READAHEAD
+  res = SD_RA_Read(&STORAGE_Stream, buf, blk_addr, blk_len);
+#else
   res = BSP_SD_ReadBlocks(0, (uint32_t *) buf, blk_addr, blk_len);
+#endif
   if (res == BSP_ERROR_NONE)
   {
     res = USBD_OK;
@@ -268,11 +292,6 @@ int8_t STORAGE_Read_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t bl
     res = USBD_FAIL;
   }
 
-  /* Wait until SD card is ready to use for new operation */
-  while (BSP_SD_GetCardState(0) != BSP_ERROR_NONE)
-  {
-  }
-
   return res;
   /* USER CODE END 6 */
 }
@@ -290,7 +309,17 @@ int8_t STORAGE_Write_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t b
   /* USER CODE BEGIN 7 */
   int32_t res;
 
+  /* 在USB中断中调用, 不能等待上一次写入的编程忙或被打断的FatFs/FileX访问, 返回失败由MSC类重试 */
+  if (SD_CARD_STATE() != BSP_ERROR_NONE)
+  {
+    return (USBD_FAIL);
+  }
+
+#ifdef USE_SD_READAHEAD
+  res = SD_RA_Write(buf, blk_addr, blk_len);
+#else
   res = BSP_SD_WriteBlocks(0, (uint32_t *) buf, blk_addr, blk_len);
+#endif
   if (res == BSP_ERROR_NONE)
   {
     res = USBD_OK;
@@ -300,11 +329,6 @@ int8_t STORAGE_Write_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t b
     res = USBD_FAIL;
   }
 
-  /* Wait until SD card is ready to use for new operation */
-  while (BSP_SD_GetCardState(0) != BSP_ERROR_NONE)
-  {
-  }
-
   return res;
   /* USER CODE END 7 */
 }
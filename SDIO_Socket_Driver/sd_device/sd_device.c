@@ -3,28 +3,115 @@
 #include <string.h>
 
 
-__IO uint8_t RxCplt = 0;
-__IO uint8_t TxCplt = 0;
+/* 同步DMA传输的结果, 传输中为SD_DMA_PENDING, 由完成/出错/中止回调写入BSP status */
+#define SD_DMA_PENDING  1
+static __IO int32_t SD_DMA_Result = BSP_ERROR_NONE;
 
-/******** SD Transmission Buffer definition *******/
+/******** SD DMA Bounce Buffer definition, 调用者的缓冲区不能直接DMA时使用, 32字节对齐以便按Cache行维护 *******/
 #if defined ( __ICCARM__ )
-#pragma location = 0x24100000
+#pragma location = ".RAM_D1"
+#pragma data_alignment = 32
 #elif defined ( __CC_ARM )
-__attribute__((section (".RAM_D1")))
+__attribute__((section (".RAM_D1"), aligned (32)))
 #elif defined ( __GNUC__ )
-__attribute__((section (".RAM_D1")))
+__attribute__((section (".RAM_D1"), aligned (32)))
 #endif
-uint8_t aTxBuffer[512];
+static uint8_t SD_DmaBuffer[SD_DMA_BOUNCE_BLOCKS * 512];
 
-/******** SD Receive Buffer definition *******/
-#if defined ( __ICCARM__ )
-#pragma location = 0x24100200
-#elif defined ( __CC_ARM )
-__attribute__((section (".RAM_D1")))
-#elif defined ( __GNUC__ )
-__attribute__((section (".RAM_D1")))
+/* BSP_SD_ReadBlocks_DMA_Start()的接收缓冲, 为空时是同步的DMA读取 */
+static uint8_t *RxUserBuffer = NULL;
+static uint32_t RxUserSize = 0;
+
+/* 擦除单元和擦除超时, 在BSP_SD_Init()中从SD状态(ACMD13)读取 */
+static struct
+{
+  uint32_t Unit;          // 擦除单元(AU)大小, 单位扇区
+  uint16_t EraseSize;     // 一次擦除的AU数 ERASE_SIZE
+  uint8_t  EraseTimeout;  // 擦除ERASE_SIZE个AU的超时时间, 单位s
+  uint8_t  EraseOffset;   // 擦除时间偏移, 单位s
+} SD_EraseInfo = { 1, 0, 0, 0 };
+
+/* 速度模式, 按速度从高到低排列, Freq为模式的最高时钟频率 */
+static const struct
+{
+  uint32_t Mode;
+  uint32_t Freq;
+} SD_SpeedModes[] =
+{
+  { SDMMC_SPEED_MODE_ULTRA_SDR104, 208000000 },
+  { SDMMC_SPEED_MODE_ULTRA_SDR50,  100000000 },
+  { SDMMC_SPEED_MODE_DDR,           50000000 },
+  { SDMMC_SPEED_MODE_HIGH,          50000000 },
+  { SDMMC_SPEED_MODE_DEFAULT,       25000000 },
+};
+
+/* 协商的速度模式和当前时钟, CRC错误时重新校准或降低时钟 */
+static struct
+{
+  uint8_t  Mode;          // SD_SpeedModes[]的下标
+  uint8_t  Retuned;       // 上次达到CRC错误次数时已重新校准, 再达到时降低时钟
+  uint8_t  CrcErrors;     // 累计的CRC错误次数
+  uint32_t Clock;         // 当前SDMMC_CK频率, 单位Hz
+} SD_Speed = { 4, 0, 0, 0 };
+
+/* 读写超时和CMD23支持, 在BSP_SD_Init()中从CSD/SCR/SD状态读取 */
+static struct
+{
+  uint16_t ReadTimeout;   // 读取访问超时, 单位ms
+  uint16_t WriteTimeout;  // 单个块的写入忙超时, 单位ms
+  uint16_t WriteSpeed;    // 速度等级保证的最低写入速度, 单位KB/s, 0为没有速度等级
+  uint8_t  Cmd23;         // 支持CMD23 SET_BLOCK_COUNT
+} SD_Timing = { 100, 250, 0, 0 };
+
+#ifdef USE_SD_STREAM
+/* 双缓冲数据流, 第k个缓冲区使用IDMA缓冲(k % 2), 一个缓冲区传输完成后把环中的下一个缓冲区装入该IDMA缓冲 */
+static struct
+{
+  uint8_t **Ring;         // 应用提供的缓冲区环
+  uint32_t RingSize;      // 环中的缓冲区个数
+  uint32_t Size;          // 每个缓冲区的字节数
+  uint32_t Total;         // 数据流的缓冲区总数
+  uint32_t Loaded;        // 已装入IDMA的缓冲区个数
+  uint32_t Done;          // 已完成的缓冲区个数
+  uint8_t *Slot[2];       // IDMA缓冲0/1当前的缓冲区
+  uint8_t  Write;
+  __IO uint8_t Active;
+  __IO int32_t Result;
+} SD_Stream;
+
+static void SD_Stream_BufferCplt(uint32_t slot);
+static void SD_Stream_Deliver(uint32_t slot);
+static void SD_Stream_Cplt(void);
+static void SD_Stream_End(int32_t result);
+#endif
+
+#ifdef USE_SD_DISCARD
+/* 等待擦除的TRIM范围[Start, End), End <= Start时为空 */
+static struct
+{
+  uint32_t Start;
+  uint32_t End;
+} SD_Discard[SD_DISCARD_RANGES];
+static void SD_Discard_Clip(uint32_t BlockIdx, uint32_t BlocksNbr);
+#endif
+
+static void SD_ReadEraseInfo(void);
+static void SD_ReadTiming(void);
+static uint32_t SD_ReadSCR(uint32_t *scr);
+static uint32_t SD_TransferTimeout(uint32_t BlocksNbr, uint8_t write);
+static HAL_StatusTypeDef SD_StartDMA(uint8_t *buff, uint32_t BlockIdx, uint32_t BlocksNbr, uint8_t write);
+#ifdef USE_SD_CMD23
+static HAL_StatusTypeDef SD_StartClosedDMA(uint8_t *buff, uint32_t BlockIdx, uint32_t BlocksNbr, uint8_t write);
 #endif
-uint8_t aRxBuffer[512];
+static void SD_ConfigSpeed(void);
+static void SD_SetClock(uint32_t freq);
+static void SD_Calibrate(void);
+static void SD_CheckRetune(void);
+static void SD_NoteError(uint32_t ErrorCode);
+static int32_t SD_ErrorStatus(uint32_t ErrorCode);
+static uint8_t SD_DMA_IsDirect(const uint8_t *buff, uint32_t BlocksNbr, uint32_t align);
+static int32_t SD_DMA_Wait(uint32_t timeout);
+static int32_t SD_DMA_WaitTransfer(uint32_t timeout);
 
 /**
   * @brief  Initializes the SD card device.
@@ -40,12 +127,20 @@ int32_t BSP_SD_Init(uint32_t Instance)
   hsd1.Init.ClockPowerSave = SDMMC_CLOCK_POWER_SAVE_DISABLE;
   hsd1.Init.BusWide = SDMMC_BUS_WIDE_4B;
   hsd1.Init.HardwareFlowControl = SDMMC_HARDWARE_FLOW_CONTROL_DISABLE;
-  hsd1.Init.ClockDiv = 2;				// 80MHz / (2 * 2) = 20MHz
+  hsd1.Init.ClockDiv = 2;				// 80MHz / (2 * 2) = 20MHz, 初始化后按协商的速度模式重新设置
+#ifdef USE_SD_TRANSCEIVER
+  hsd1.Init.TranceiverPresent = SDMMC_TRANSCEIVER_PRESENT;
+#else
   hsd1.Init.TranceiverPresent = SDMMC_TRANSCEIVER_NOT_PRESENT;
+#endif
   if (HAL_SD_Init(&hsd1) != HAL_OK)
   {
-    Error_Handler();
+    return BSP_ERROR_PERIPH_FAILURE;   // 卡不响应时由调用者处理, 不进入Error_Handler()停机
   }
+
+  SD_ConfigSpeed();
+  SD_ReadEraseInfo();
+  SD_ReadTiming();
 	
   return retval;
 }
@@ -60,7 +155,15 @@ int32_t BSP_SD_Init(uint32_t Instance)
   */
 int32_t BSP_SD_GetCardState(uint32_t Instance)
 {
-  int32_t retval = HAL_SD_GetCardState(&hsd1);
+  int32_t retval;
+
+  /* DMA传输进行中时不能发送CMD13 */
+  if (HAL_SD_GetState(&hsd1) == HAL_SD_STATE_BUSY)
+  {
+    return BSP_ERROR_BUSY;
+  }
+
+  retval = HAL_SD_GetCardState(&hsd1);
 	
   if (retval == HAL_SD_CARD_TRANSFER)
   {
@@ -97,6 +200,7 @@ int32_t BSP_SD_GetCardInfo(uint32_t Instance, SD_CardInfoTypeDef *CardInfo)
 
 /**
   * @brief  Reads block(s) from a specified address in an SD card, in polling mode.
+  * @note   定义USE_SD_DMA_TRANSFER时使用DMA传输, 等待期间CPU休眠; 在中断中调用时仍使用查询方式
   * @param  Instance   SD Instance
   * @param  pData      Pointer to the buffer that will contain the data to transmit
   * @param  BlockIdx   Block index from where data is to be read
@@ -106,10 +210,20 @@ int32_t BSP_SD_GetCardInfo(uint32_t Instance, SD_CardInfoTypeDef *CardInfo)
 int32_t BSP_SD_ReadBlocks(uint32_t Instance, uint32_t *pData, uint32_t BlockIdx, uint32_t BlocksNbr)
 {
   int32_t ret = BSP_ERROR_NONE;
-  uint32_t timeout = 100 * BlocksNbr;
+  uint32_t timeout;
+
+#ifdef USE_SD_DMA_TRANSFER
+  if (!SD_IN_ISR())
+  {
+    return BSP_SD_ReadBlocks_DMA(Instance, pData, BlockIdx, BlocksNbr);
+  }
+#endif
 
+  timeout = SD_TransferTimeout(BlocksNbr, 0);
+  SD_CheckRetune();
   if (HAL_SD_ReadBlocks(&hsd1, (uint8_t *)pData, BlockIdx, BlocksNbr, timeout) != HAL_OK)
   {
+    SD_NoteError(hsd1.ErrorCode);
     ret = BSP_ERROR_BUSY;
   }
 
@@ -120,6 +234,7 @@ int32_t BSP_SD_ReadBlocks(uint32_t Instance, uint32_t *pData, uint32_t BlockIdx,
 
 /**
   * @brief  Writes block(s) to a specified address in an SD card, in polling mode.
+  * @note   定义USE_SD_DMA_TRANSFER时使用DMA传输, 等待期间CPU休眠; 在中断中调用时仍使用查询方式
   * @param  Instance   SD Instance
   * @param  pData      Pointer to the buffer that will contain the data to transmit
   * @param  BlockIdx   Block index from where data is to be written
@@ -129,10 +244,25 @@ int32_t BSP_SD_ReadBlocks(uint32_t Instance, uint32_t *pData, uint32_t BlockIdx,
 int32_t BSP_SD_WriteBlocks(uint32_t Instance, uint32_t *pData, uint32_t BlockIdx, uint32_t BlocksNbr)
 {
   int32_t ret = BSP_ERROR_NONE;
-  uint32_t timeout = 100 * BlocksNbr;
+  uint32_t timeout;
+
+#ifdef USE_SD_DMA_TRANSFER
+  if (!SD_IN_ISR())
+  {
+    return BSP_SD_WriteBlocks_DMA(Instance, pData, BlockIdx, BlocksNbr);
+  }
+#endif
+
+  timeout = SD_TransferTimeout(BlocksNbr, 1);
+
+#ifdef USE_SD_DISCARD
+  SD_Discard_Clip(BlockIdx, BlocksNbr);   // 写入的扇区不能再被擦除
+#endif
 
+  SD_CheckRetune();
   if (HAL_SD_WriteBlocks(&hsd1, (uint8_t *)pData, BlockIdx, BlocksNbr, timeout) != HAL_OK)
   {
+    SD_NoteError(hsd1.ErrorCode);
     ret = BSP_ERROR_BUSY;
   }
 
@@ -141,8 +271,203 @@ int32_t BSP_SD_WriteBlocks(uint32_t Instance, uint32_t *pData, uint32_t BlockIdx
 }
 
 
+/**
+  * @brief  判断缓冲区能否直接用于DMA传输
+  * @note   整个缓冲区都要在IDMA能访问的内存中, 地址按align对齐
+  * @param  buff       缓冲区
+  * @param  BlocksNbr  扇区数
+  * @param  align      地址对齐
+  * @retval 1: 能, 0: 不能
+  */
+static uint8_t SD_DMA_IsDirect(const uint8_t *buff, uint32_t BlocksNbr, uint32_t align)
+{
+  return (((uint32_t)buff & (align - 1)) == 0) && SD_DMA_REACHABLE(buff) && SD_DMA_REACHABLE(buff + BlocksNbr * 512 - 1);
+}
+
+
+/**
+  * @brief  等待一次DMA传输完成
+  * @note   在SD_WAIT_EVENT()中休眠, 由完成/出错/中止回调写入结果并唤醒; 中断中先结束句柄的忙状态
+  *         再调用回调, 因此句柄不忙而结果仍为SD_DMA_PENDING说明传输结束时没有回调; 超时时中止传输
+  * @param  timeout  超时时间, 单位ms
+  * @retval BSP status
+  */
+static int32_t SD_DMA_Wait(uint32_t timeout)
+{
+  uint32_t start = HAL_GetTick();
+
+  while (SD_DMA_Result == SD_DMA_PENDING)
+  {
+    if (HAL_SD_GetState(&hsd1) != HAL_SD_STATE_BUSY && SD_DMA_Result == SD_DMA_PENDING)
+    {
+      SD_DMA_Result = BSP_ERROR_PERIPH_FAILURE;
+      break;
+    }
+    if (HAL_GetTick() - start > timeout)
+    {
+      HAL_SD_Abort(&hsd1);
+      SD_DMA_Result = BSP_ERROR_BUSY;
+      break;
+    }
+    SD_WAIT_EVENT();
+  }
+
+  return SD_DMA_Result;
+}
+
+
+/**
+  * @brief  等待SD卡回到传输状态
+  * @note   用于分段写入时等待上一段数据编程结束; 编程结束没有中断, 每次SD_WAIT_EVENT()唤醒后查询一次CMD13
+  * @param  timeout  超时时间, 单位ms
+  * @retval BSP status
+  */
+static int32_t SD_DMA_WaitTransfer(uint32_t timeout)
+{
+  uint32_t start = HAL_GetTick();
+
+  while (HAL_SD_GetCardState(&hsd1) != HAL_SD_CARD_TRANSFER)
+  {
+    if (HAL_GetTick() - start > timeout)
+    {
+      return BSP_ERROR_BUSY;
+    }
+    SD_WAIT_EVENT();
+  }
+
+  return BSP_ERROR_NONE;
+}
+
+
+/**
+  * @brief  开始一次DMA读写
+  * @note   支持CMD23时多块传输使用预定义块数, 否则使用HAL的开放式传输(结束时发送CMD12)
+  * @param  buff       DMA缓冲区
+  * @param  BlockIdx   起始扇区
+  * @param  BlocksNbr  扇区数
+  * @param  write      1: 写入, 0: 读取
+  * @retval HAL status
+  */
+static HAL_StatusTypeDef SD_StartDMA(uint8_t *buff, uint32_t BlockIdx, uint32_t BlocksNbr, uint8_t write)
+{
+#ifdef USE_SD_CMD23
+  if (SD_Timing.Cmd23 && BlocksNbr > 1)
+  {
+    return SD_StartClosedDMA(buff, BlockIdx, BlocksNbr, write);
+  }
+#endif
+
+  return write ? HAL_SD_WriteBlocks_DMA(&hsd1, buff, BlockIdx, BlocksNbr)
+               : HAL_SD_ReadBlocks_DMA(&hsd1, buff, BlockIdx, BlocksNbr);
+}
+
+
+#ifdef USE_SD_CMD23
+/**
+  * @brief  用CMD23预定义块数开始一次多块DMA读写
+  * @note   写入前先用ACMD23提示卡预擦除, 传输结束后卡自动回到传输状态; 句柄的Context按单块传输设置,
+  *         使HAL_SD_IRQHandler()结束时不发送CMD12, 出错时HAL仍然发送CMD12中止传输
+  * @param  buff       DMA缓冲区
+  * @param  BlockIdx   起始扇区
+  * @param  BlocksNbr  扇区数
+  * @param  write      1: 写入, 0: 读取
+  * @retval HAL status
+  */
+static HAL_StatusTypeDef SD_StartClosedDMA(uint8_t *buff, uint32_t BlockIdx, uint32_t BlocksNbr, uint8_t write)
+{
+  SDMMC_DataInitTypeDef config;
+  uint32_t errorstate = HAL_SD_ERROR_NONE;
+  uint32_t add = BlockIdx;
+
+  if (hsd1.State != HAL_SD_STATE_READY)
+  {
+    return HAL_BUSY;
+  }
+  if (BlockIdx + BlocksNbr > hsd1.SdCard.LogBlockNbr)
+  {
+    hsd1.ErrorCode |= HAL_SD_ERROR_ADDR_OUT_OF_RANGE;
+    return HAL_ERROR;
+  }
+
+  hsd1.ErrorCode = HAL_SD_ERROR_NONE;
+  hsd1.State = HAL_SD_STATE_BUSY;
+  hsd1.Instance->DCTRL = 0U;
+  if (hsd1.SdCard.CardType != CARD_SDHC_SDXC)
+  {
+    add *= 512U;
+  }
+
+  /* 命令在使能CMDTRANS之前发送, 否则会被当作数据传输命令 */
+  if (write)
+  {
+    errorstate = SDMMC_CmdAppCommand(hsd1.Instance, hsd1.SdCard.RelCardAdd << 16U);
+    if (errorstate == HAL_SD_ERROR_NONE)
+    {
+      errorstate = SDMMC_CmdBlockCount(hsd1.Instance, BlocksNbr);   // ACMD23 SET_WR_BLK_ERASE_COUNT
+    }
+  }
+  if (errorstate == HAL_SD_ERROR_NONE)
+  {
+    errorstate = SDMMC_CmdBlockCount(hsd1.Instance, BlocksNbr);     // CMD23 SET_BLOCK_COUNT
+  }
+
+  if (errorstate == HAL_SD_ERROR_NONE)
+  {
+    config.DataTimeOut   = (write ? SD_Timing.WriteTimeout : SD_Timing.ReadTimeout) * (SD_Speed.Clock / 1000);
+    config.DataLength    = BlocksNbr * 512;
+    config.DataBlockSize = SDMMC_DATABLOCK_SIZE_512B;
+    config.TransferDir   = write ? SDMMC_TRANSFER_DIR_TO_CARD : SDMMC_TRANSFER_DIR_TO_SDMMC;
+    config.TransferMode  = SDMMC_TRANSFER_MODE_BLOCK;
+    config.DPSM          = SDMMC_DPSM_DISABLE;
+    (void)SDMMC_ConfigData(hsd1.Instance, &config);
+    __SDMMC_CMDTRANS_ENABLE(hsd1.Instance);
+
+    hsd1.Instance->IDMABASE0 = (uint32_t)buff;
+    hsd1.Instance->IDMACTRL  = SDMMC_ENABLE_IDMA_SINGLE_BUFF;
+
+    if (write)
+    {
+      hsd1.pTxBuffPtr = buff;
+      hsd1.TxXferSize = BlocksNbr * 512;
+      hsd1.Context = SD_CONTEXT_WRITE_SINGLE_BLOCK | SD_CONTEXT_DMA;
+      errorstate = SDMMC_CmdWriteMultiBlock(hsd1.Instance, add);
+    }
+    else
+    {
+      hsd1.pRxBuffPtr = buff;
+      hsd1.RxXferSize = BlocksNbr * 512;
+      hsd1.Context = SD_CONTEXT_READ_SINGLE_BLOCK | SD_CONTEXT_DMA;
+      errorstate = SDMMC_CmdReadMultiBlock(hsd1.Instance, add);
+    }
+  }
+
+  if (errorstate != HAL_SD_ERROR_NONE)
+  {
+    __HAL_SD_CLEAR_FLAG(&hsd1, SDMMC_STATIC_FLAGS);
+    hsd1.ErrorCode |= errorstate;
+    hsd1.State = HAL_SD_STATE_READY;
+    hsd1.Context = SD_CONTEXT_NONE;
+    return HAL_ERROR;
+  }
+
+  if (write)
+  {
+    __HAL_SD_ENABLE_IT(&hsd1, (SDMMC_IT_DCRCFAIL | SDMMC_IT_DTIMEOUT | SDMMC_IT_TXUNDERR | SDMMC_IT_DATAEND));
+  }
+  else
+  {
+    __HAL_SD_ENABLE_IT(&hsd1, (SDMMC_IT_DCRCFAIL | SDMMC_IT_DTIMEOUT | SDMMC_IT_RXOVERR | SDMMC_IT_DATAEND));
+  }
+
+  return HAL_OK;
+}
+#endif
+
+
 /**
   * @brief  Reads block(s) to a specified address in an SD card, in DMA mode.
+  * @note   pData按SD_DMA_ALIGN对齐且IDMA能访问时直接DMA到pData, 否则每次最多
+  *         SD_DMA_BOUNCE_BLOCKS个扇区经过中转缓冲读取后拷贝
   * @param  Instance   SD Instance
   * @param  pData      Pointer to the buffer that will contain the data to transmit
   * @param  BlockIdx   Block index from where data is to be written
@@ -152,16 +477,67 @@ int32_t BSP_SD_WriteBlocks(uint32_t Instance, uint32_t *pData, uint32_t BlockIdx
 int32_t BSP_SD_ReadBlocks_DMA(uint32_t Instance, uint32_t *pData, uint32_t BlockIdx, uint32_t BlocksNbr)
 {
   int32_t retval = BSP_ERROR_NONE;
+  uint8_t *buff = (uint8_t *)pData;
+  uint8_t direct = SD_DMA_IsDirect(buff, BlocksNbr, SD_DMA_ALIGN);
+  uint8_t *dma;
+  uint32_t count;
+
+  SD_CheckRetune();
+  while (BlocksNbr > 0 && retval == BSP_ERROR_NONE)
+  {
+    count = direct ? BlocksNbr : (BlocksNbr < SD_DMA_BOUNCE_BLOCKS ? BlocksNbr : SD_DMA_BOUNCE_BLOCKS);
+    dma = direct ? buff : SD_DmaBuffer;
+
+    /* 传输前失效, 避免传输期间Cache中的脏数据被写回覆盖DMA的数据 */
+    SCB_InvalidateDCache_by_Addr((uint32_t *)dma, count * 512);
+    SD_DMA_Result = SD_DMA_PENDING;
+    if (SD_StartDMA(dma, BlockIdx, count, 0) != HAL_OK)
+    {
+      SD_DMA_Result = BSP_ERROR_NONE;
+      return BSP_ERROR_BUSY;
+    }
+
+    retval = SD_DMA_Wait(SD_TransferTimeout(count, 0));
+    SCB_InvalidateDCache_by_Addr((uint32_t *)dma, count * 512);
+    if (retval == BSP_ERROR_NONE && !direct)
+    {
+      memcpy(buff, SD_DmaBuffer, count * 512);
+    }
+
+    buff += count * 512;
+    BlockIdx += count;
+    BlocksNbr -= count;
+  }
+
+  return retval;
+}
+
+
+/**
+  * @brief  Starts reading block(s) from a specified address in an SD card, in DMA mode.
+  * @note   Returns without waiting, BSP_SD_ReadCpltCallback() is called from the
+  *         interrupt when the data has arrived, BSP_SD_ReadErrorCallback() when the
+  *         transfer fails or is aborted. pData must be 32-byte aligned and
+  *         reachable by the SDMMC IDMA, it is written directly without a bounce buffer.
+  * @param  Instance   SD Instance
+  * @param  pData      Pointer to the buffer that will contain the data
+  * @param  BlockIdx   Block index from where data is to be read
+  * @param  BlocksNbr  Number of SD blocks to read
+  * @retval BSP status
+  */
+int32_t BSP_SD_ReadBlocks_DMA_Start(uint32_t Instance, uint32_t *pData, uint32_t BlockIdx, uint32_t BlocksNbr)
+{
+  int32_t retval = BSP_ERROR_NONE;
+
+  SD_CheckRetune();
+  RxUserBuffer = (uint8_t *)pData;
+  RxUserSize = BlocksNbr * 512;
 
-  if (HAL_SD_ReadBlocks_DMA(&hsd1, (uint8_t *)aRxBuffer, BlockIdx, BlocksNbr) != HAL_OK)
+  if (SD_StartDMA((uint8_t *)pData, BlockIdx, BlocksNbr, 0) != HAL_OK)
   {
+    RxUserBuffer = NULL;
     retval = BSP_ERROR_BUSY;
   }
-	
-  while (RxCplt != 1){}
-  RxCplt = 0;
-	
-  memcpy((uint8_t *)pData, (uint8_t *)aRxBuffer, BlocksNbr * 512);
 
   return retval;
 }
@@ -169,6 +545,8 @@ int32_t BSP_SD_ReadBlocks_DMA(uint32_t Instance, uint32_t *pData, uint32_t Block
 
 /**
   * @brief  Writes block(s) to a specified address in an SD card, in DMA mode.
+  * @note   pData按字对齐且IDMA能访问时直接从pData发送(写回Cache不影响相邻的数据, 不需要按Cache行对齐),
+  *         否则每次最多SD_DMA_BOUNCE_BLOCKS个扇区拷贝到中转缓冲后发送
   * @param  Instance   SD Instance
   * @param  pData      Pointer to the buffer that will contain the data to transmit
   * @param  BlockIdx   Block index from where data is to be written
@@ -178,40 +556,997 @@ int32_t BSP_SD_ReadBlocks_DMA(uint32_t Instance, uint32_t *pData, uint32_t Block
 int32_t BSP_SD_WriteBlocks_DMA(uint32_t Instance, uint32_t *pData, uint32_t BlockIdx, uint32_t BlocksNbr)
 {
   int32_t retval = BSP_ERROR_NONE;
-	
-  memcpy((uint8_t *)aTxBuffer, (uint8_t *)pData, BlocksNbr * 512);
+  uint8_t *buff = (uint8_t *)pData;
+  uint8_t direct = SD_DMA_IsDirect(buff, BlocksNbr, 4);
+  uint8_t *dma;
+  uint32_t count;
+
+#ifdef USE_SD_DISCARD
+  SD_Discard_Clip(BlockIdx, BlocksNbr);
+#endif
 
-  if (HAL_SD_WriteBlocks_DMA(&hsd1, (uint8_t *)aTxBuffer, BlockIdx, BlocksNbr) != HAL_OK)
+  SD_CheckRetune();
+  while (BlocksNbr > 0 && retval == BSP_ERROR_NONE)
   {
-    retval = BSP_ERROR_BUSY;
+    count = direct ? BlocksNbr : (BlocksNbr < SD_DMA_BOUNCE_BLOCKS ? BlocksNbr : SD_DMA_BOUNCE_BLOCKS);
+    dma = direct ? buff : SD_DmaBuffer;
+
+    if (!direct)
+    {
+      memcpy(SD_DmaBuffer, buff, count * 512);
+    }
+    SCB_CleanDCache_by_Addr((uint32_t *)dma, count * 512);   // 把Cache中的数据写回内存后再DMA
+
+    /* 分段写入时等待上一段编程结束 */
+    if (buff != (uint8_t *)pData && SD_DMA_WaitTransfer(SD_TransferTimeout(count, 1)) != BSP_ERROR_NONE)
+    {
+      return BSP_ERROR_BUSY;
+    }
+
+    SD_DMA_Result = SD_DMA_PENDING;
+    if (SD_StartDMA(dma, BlockIdx, count, 1) != HAL_OK)
+    {
+      SD_DMA_Result = BSP_ERROR_NONE;
+      return BSP_ERROR_BUSY;
+    }
+
+    retval = SD_DMA_Wait(SD_TransferTimeout(count, 1));
+
+    buff += count * 512;
+    BlockIdx += count;
+    BlocksNbr -= count;
   }
-	
-  while (TxCplt != 1){}
-  TxCplt = 0;
 
   return retval;
 }
 
 
+#ifdef USE_SD_STREAM
 /**
-  * @brief Rx Transfer completed callbacks
-  * @param hsd: SD handle
-  * @retval None
+  * @brief  开始双缓冲数据流
+  * @note   从BlockIdx开始连续读写BlocksNbr个扇区, 中间不停止传输; 每个缓冲区传输完成后在中断中
+  *         调用BSP_SD_StreamCallback(), 读取时缓冲区中是读到的数据, 写入时缓冲区可以重新填充;
+  *         缓冲区按环的顺序循环使用, 应用要在它再次装入IDMA之前处理完(环中有RingSize-2个缓冲区的余量).
+  *         写入时重新填充后要清除D-Cache(SCB_CleanDCache_by_Addr)或者使用不缓存的内存.
+  *         数据流结束或出错时以pData为NULL调用BSP_SD_StreamCallback()
+  * @param  Instance      SD Instance
+  * @param  Ring          缓冲区环, 每个缓冲区按SD_DMA_ALIGN对齐且IDMA能访问
+  * @param  RingSize      缓冲区个数, 至少2个
+  * @param  BufferBlocks  每个缓冲区的扇区数, 不超过SD_STREAM_MAX_BUFFER_BLOCKS
+  * @param  BlockIdx      起始扇区
+  * @param  BlocksNbr     扇区数, BufferBlocks的整数倍, 不超过SD_STREAM_MAX_BLOCKS
+  * @param  Write         1: 写入, 0: 读取
+  * @retval BSP status
   */
-void HAL_SD_RxCpltCallback(SD_HandleTypeDef *hsd)
+int32_t BSP_SD_StreamStart(uint32_t Instance, uint8_t **Ring, uint32_t RingSize, uint32_t BufferBlocks,
+                           uint32_t BlockIdx, uint32_t BlocksNbr, uint8_t Write)
 {
-  SCB_InvalidateDCache_by_Addr((uint32_t*)aRxBuffer, 512);
-  RxCplt = 1;
+  HAL_StatusTypeDef status;
+  uint32_t i;
+
+  if (RingSize < 2 || BufferBlocks == 0 || BufferBlocks > SD_STREAM_MAX_BUFFER_BLOCKS
+      || BlocksNbr == 0 || BlocksNbr % BufferBlocks != 0 || BlocksNbr > SD_STREAM_MAX_BLOCKS)
+  {
+    return BSP_ERROR_WRONG_PARAM;
+  }
+  for (i = 0; i < RingSize; i++)
+  {
+    if (!SD_DMA_IsDirect(Ring[i], BufferBlocks, SD_DMA_ALIGN))
+    {
+      return BSP_ERROR_WRONG_PARAM;
+    }
+  }
+  if (SD_Stream.Active || HAL_SD_GetState(&hsd1) == HAL_SD_STATE_BUSY)
+  {
+    return BSP_ERROR_BUSY;
+  }
+
+#ifdef USE_SD_DISCARD
+  if (Write)
+  {
+    SD_Discard_Clip(BlockIdx, BlocksNbr);
+  }
+#endif
+  SD_CheckRetune();
+
+  SD_Stream.Ring = Ring;
+  SD_Stream.RingSize = RingSize;
+  SD_Stream.Size = BufferBlocks * 512;
+  SD_Stream.Total = BlocksNbr / BufferBlocks;
+  SD_Stream.Loaded = 2;
+  SD_Stream.Done = 0;
+  SD_Stream.Slot[0] = Ring[0];
+  SD_Stream.Slot[1] = Ring[1];
+  SD_Stream.Write = Write;
+
+  for (i = 0; i < RingSize; i++)
+  {
+    if (Write)
+    {
+      SCB_CleanDCache_by_Addr((uint32_t *)Ring[i], SD_Stream.Size);
+    }
+    else
+    {
+      SCB_InvalidateDCache_by_Addr((uint32_t *)Ring[i], SD_Stream.Size);
+    }
+  }
+
+  if (HAL_SDEx_ConfigDMAMultiBuffer(&hsd1, (uint32_t *)Ring[0], (uint32_t *)Ring[1], BufferBlocks) != HAL_OK)
+  {
+    return BSP_ERROR_BUSY;
+  }
+
+  SD_Stream.Result = SD_DMA_PENDING;
+  SD_Stream.Active = 1;
+  if (Write)
+  {
+    status = HAL_SDEx_WriteBlocksDMAMultiBuffer(&hsd1, BlockIdx, BlocksNbr);
+  }
+  else
+  {
+    status = HAL_SDEx_ReadBlocksDMAMultiBuffer(&hsd1, BlockIdx, BlocksNbr);
+  }
+  if (status != HAL_OK)
+  {
+    SD_Stream.Active = 0;
+    SD_Stream.Result = BSP_ERROR_NONE;
+    return BSP_ERROR_BUSY;
+  }
+
+  return BSP_ERROR_NONE;
 }
 
 
 /**
-  * @brief Tx Transfer completed callbacks
-  * @param hsd: SD handle
-  * @retval None
+  * @brief  停止双缓冲数据流
+  * @note   数据流还在进行时中止传输(正在传输的缓冲区不完整), 然后等待卡编程结束; 数据流已经结束时
+  *         只等待编程结束. 检查和中止期间屏蔽SDMMC中断, 避免传输恰好在中断中结束时重复结束数据流
+  * @param  Instance  SD Instance
+  * @retval 数据流的结果, BSP status; 中止了还在进行的数据流时为BSP_ERROR_SD_STREAM_ABORTED
   */
-void HAL_SD_TxCpltCallback(SD_HandleTypeDef *hsd)
+int32_t BSP_SD_StreamStop(uint32_t Instance)
+{
+  uint32_t irq = NVIC_GetEnableIRQ(SDMMC1_IRQn);
+
+  HAL_NVIC_DisableIRQ(SDMMC1_IRQn);
+  if (SD_Stream.Active)
+  {
+    HAL_SD_Abort(&hsd1);
+    SD_Stream_End(BSP_ERROR_SD_STREAM_ABORTED);
+  }
+  if (irq)
+  {
+    HAL_NVIC_EnableIRQ(SDMMC1_IRQn);
+  }
+
+  if (SD_DMA_WaitTransfer(SD_TransferTimeout(1, 1)) != BSP_ERROR_NONE)
+  {
+    return BSP_ERROR_BUSY;
+  }
+
+  return SD_Stream.Result;
+}
+
+
+/**
+  * @brief  数据流的一个IDMA缓冲传输完成, 在中断中调用
+  * @note   第k个缓冲区总是在IDMA缓冲k%2中传输. 完成的缓冲和按顺序应该完成的不同时, 说明前一个缓冲的
+  *         完成中断丢失或和这一次合并了: 它的IDMA缓冲已经开始传输下一个缓冲区, 来不及换成环中的下一个,
+  *         之后的数据会写到错误的缓冲区, 因此中止并以BSP_ERROR_BUS_DMA_FAILURE结束数据流;
+  *         环中的缓冲区都已装入时不需要换缓冲, 先补交前一个缓冲区
+  * @param  slot: 完成的IDMA缓冲, 0或1, 由HAL的Buf0/Buf1完成回调传入
+  * @retval 无
+  */
+static void SD_Stream_BufferCplt(uint32_t slot)
+{
+  if (!SD_Stream.Active || SD_Stream.Done >= SD_Stream.Total)
+  {
+    return;
+  }
+
+  if (SD_Stream.Done % 2 != slot)
+  {
+    if (SD_Stream.Loaded < SD_Stream.Total)
+    {
+      SD_Stream_End(BSP_ERROR_BUS_DMA_FAILURE);
+      HAL_SD_Abort_IT(&hsd1);   // 数据流已经结束, 中止回调不再处理数据流
+      return;
+    }
+    SD_Stream_Deliver(SD_Stream.Done % 2);   // 最后的缓冲区不需要重新装入, 按顺序补交前一个
+  }
+  SD_Stream_Deliver(slot);
+}
+
+
+/**
+  * @brief  交付IDMA缓冲中传输完成的缓冲区, 在中断中调用
+  * @note   把环中的下一个缓冲区装入这个IDMA缓冲, IDMA此时正在传输另一个缓冲
+  * @param  slot: IDMA缓冲, 0或1
+  * @retval 无
+  */
+static void SD_Stream_Deliver(uint32_t slot)
+{
+  uint8_t *done = SD_Stream.Slot[slot];
+  uint8_t *next;
+
+  SD_Stream.Done++;
+  if (SD_Stream.Loaded < SD_Stream.Total)
+  {
+    next = SD_Stream.Ring[SD_Stream.Loaded % SD_Stream.RingSize];
+    SD_Stream.Loaded++;
+    SD_Stream.Slot[slot] = next;
+    HAL_SDEx_ChangeDMABuffer(&hsd1, (slot == 0) ? SD_DMA_BUFFER0 : SD_DMA_BUFFER1, (uint32_t *)next);
+  }
+
+  if (!SD_Stream.Write)
+  {
+    SCB_InvalidateDCache_by_Addr((uint32_t *)done, SD_Stream.Size);
+  }
+  BSP_SD_StreamCallback(0, done);
+}
+
+
+/**
+  * @brief  数据流传输完成, 在中断中调用
+  * @note   先交付还没有回调的缓冲区, 最后一个缓冲区的完成标志可能和传输结束一起处理
+  * @param  无
+  * @retval 无
+  */
+static void SD_Stream_Cplt(void)
+{
+  while (SD_Stream.Done < SD_Stream.Total)
+  {
+    SD_Stream_Deliver(SD_Stream.Done % 2);
+  }
+  SD_Stream_End(BSP_ERROR_NONE);
+}
+
+
+/**
+  * @brief  结束数据流, 在中断中或停止时调用
+  * @param  result: 数据流的结果
+  * @retval 无
+  */
+static void SD_Stream_End(int32_t result)
+{
+  SD_Stream.Result = result;
+  SD_Stream.Active = 0;
+  BSP_SD_StreamCallback(0, NULL);
+  SD_SIGNAL_EVENT();
+}
+#endif
+
+
+/**
+  * @brief  协商总线速度模式
+  * @note   从SD_MAX_SPEED_MODE开始依次尝试, UHS-I模式需要电平转换器且卡已在初始化时切换到1.8V;
+  *         切换命令CMD6在当前的默认速度时钟下发送, 成功后才设置该模式的时钟; UHS-I模式的延迟块校准
+  *         (代替CMD19调谐)由HAL_SD_ConfigSpeedBusOperation()在当前时钟下完成, 因此在新时钟下用SD_Calibrate()
+  *         再校准一次; 都不支持时保持默认速度
+  * @param  无
+  * @retval 无
+  */
+static void SD_ConfigSpeed(void)
+{
+  uint32_t i = 0;
+  uint32_t mode;
+
+  while (SD_SpeedModes[i].Mode != SD_MAX_SPEED_MODE && SD_SpeedModes[i].Mode != SDMMC_SPEED_MODE_DEFAULT)
+  {
+    i++;
+  }
+
+  for (; SD_SpeedModes[i].Mode != SDMMC_SPEED_MODE_DEFAULT; i++)
+  {
+    mode = SD_SpeedModes[i].Mode;
+#ifdef USE_SD_TRANSCEIVER
+    if (mode != SDMMC_SPEED_MODE_HIGH && hsd1.SdCard.CardSpeed != CARD_ULTRA_HIGH_SPEED)
+#else
+    if (mode != SDMMC_SPEED_MODE_HIGH)
+#endif
+    {
+      continue;
+    }
+    if (HAL_SD_ConfigSpeedBusOperation(&hsd1, mode) == HAL_OK)   // CMD6在切换前的(默认速度)时钟下发送
+    {
+      break;
+    }
+    hsd1.ErrorCode = HAL_SD_ERROR_NONE;   // 卡不支持该模式, 尝试下一个
+  }
+
+  /* 切换成功后再提高时钟, 在最终的时钟下校准一次 */
+  SD_Speed.Mode = i;
+  SD_SetClock(SD_SpeedModes[i].Freq);
+  SD_Calibrate();
+  SD_Speed.Retuned = 0;
+  SD_Speed.CrcErrors = 0;
+}
+
+
+/**
+  * @brief  设置SDMMC_CK频率
+  * @note   SDMMC_CK = 内核时钟 / (2 * CLKDIV), CLKDIV为0时旁路分频; DDR模式下不能旁路
+  * @param  freq: 最高频率, 单位Hz
+  * @retval 无
+  */
+static void SD_SetClock(uint32_t freq)
 {
-  TxCplt = 1;
+  uint32_t ker = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_SDMMC);
+  uint32_t div = 0;
+
+  if (ker > freq || SD_SpeedModes[SD_Speed.Mode].Mode == SDMMC_SPEED_MODE_DDR)
+  {
+    div = (ker + 2 * freq - 1) / (2 * freq);
+    if (div == 0)
+    {
+      div = 1;
+    }
+    if (div > SDMMC_CLKCR_CLKDIV)
+    {
+      div = SDMMC_CLKCR_CLKDIV;
+    }
+  }
+
+  hsd1.Init.ClockDiv = div;
+  MODIFY_REG(hsd1.Instance->CLKCR, SDMMC_CLKCR_CLKDIV, div);
+  SD_Speed.Clock = (div == 0) ? ker : ker / (2 * div);
 }
 
+
+/**
+  * @brief  在当前时钟下重新切换速度模式, UHS-I模式同时校准延迟块
+  * @note   改变SDMMC_CK后调用, 默认速度不需要校准
+  * @param  无
+  * @retval 无
+  */
+static void SD_Calibrate(void)
+{
+  if (SD_SpeedModes[SD_Speed.Mode].Mode != SDMMC_SPEED_MODE_DEFAULT
+      && HAL_SD_ConfigSpeedBusOperation(&hsd1, SD_SpeedModes[SD_Speed.Mode].Mode) != HAL_OK)
+  {
+    hsd1.ErrorCode = HAL_SD_ERROR_NONE;
+  }
+}
+
+
+/**
+  * @brief  CRC错误累计到SD_RETUNE_CRC_ERRORS次时重新校准, 校准后仍出错时时钟减半并在新时钟下校准
+  * @note   在开始传输前调用, 此时SDMMC上没有正在进行的传输
+  * @param  无
+  * @retval 无
+  */
+static void SD_CheckRetune(void)
+{
+  if (SD_Speed.CrcErrors < SD_RETUNE_CRC_ERRORS || HAL_SD_GetState(&hsd1) == HAL_SD_STATE_BUSY)
+  {
+    return;
+  }
+
+  SD_Speed.CrcErrors = 0;
+  if (!SD_Speed.Retuned)
+  {
+    SD_Speed.Retuned = 1;
+    SD_Calibrate();
+  }
+  else if (SD_Speed.Clock > 400000)
+  {
+    SD_Speed.Retuned = 0;
+    SD_SetClock(SD_Speed.Clock / 2);
+    SD_Calibrate();
+  }
+}
+
+
+/**
+  * @brief  把HAL SD错误码转换为BSP status
+  * @param  ErrorCode: HAL SD错误码
+  * @retval CRC错误为BSP_ERROR_BUS_CRC_ERROR, 其他为BSP_ERROR_PERIPH_FAILURE
+  */
+static int32_t SD_ErrorStatus(uint32_t ErrorCode)
+{
+  if (ErrorCode & (HAL_SD_ERROR_DATA_CRC_FAIL | HAL_SD_ERROR_CMD_CRC_FAIL))
+  {
+    return BSP_ERROR_BUS_CRC_ERROR;
+  }
+  return BSP_ERROR_PERIPH_FAILURE;
+}
+
+
+/**
+  * @brief  记录传输错误, 用于CRC错误时重新校准
+  * @param  ErrorCode: HAL SD错误码
+  * @retval 无
+  */
+static void SD_NoteError(uint32_t ErrorCode)
+{
+  if ((ErrorCode & (HAL_SD_ERROR_DATA_CRC_FAIL | HAL_SD_ERROR_CMD_CRC_FAIL)) && SD_Speed.CrcErrors < 0xFF)
+  {
+    SD_Speed.CrcErrors++;
+  }
+}
+
+
+/**
+  * @brief  读取擦除单元和擦除超时
+  * @note   AU_SIZE: 1~10为16KB*2^(n-1), 11~15为12MB/16MB/24MB/32MB/64MB; 读取失败时按单个扇区对齐
+  * @param  无
+  * @retval 无
+  */
+static void SD_ReadEraseInfo(void)
+{
+  static const uint8_t ausize_mb[5] = {12, 16, 24, 32, 64};
+  HAL_SD_CardStatusTypeDef status;
+
+  SD_EraseInfo.Unit = 1;
+  SD_EraseInfo.EraseSize = 0;
+  SD_EraseInfo.EraseTimeout = 0;
+  SD_EraseInfo.EraseOffset = 0;
+
+  if (HAL_SD_GetCardStatus(&hsd1, &status) != HAL_OK)
+  {
+    return;
+  }
+
+  if (status.AllocationUnitSize >= 1 && status.AllocationUnitSize <= 10)
+  {
+    SD_EraseInfo.Unit = (uint32_t)32 << (status.AllocationUnitSize - 1);
+  }
+  else if (status.AllocationUnitSize > 10)
+  {
+    SD_EraseInfo.Unit = (uint32_t)ausize_mb[status.AllocationUnitSize - 11] * 2048;
+  }
+  SD_EraseInfo.EraseSize = status.EraseSize;
+  SD_EraseInfo.EraseTimeout = status.EraseTimeout;
+  SD_EraseInfo.EraseOffset = status.EraseOffset;
+}
+
+
+/**
+  * @brief  读取读写超时和CMD23支持
+  * @note   SDSC的访问时间为CSD中(TAAC + NSAC*100个时钟)的100倍, 读取不超过100ms, 写入再乘以2^R2W_FACTOR,
+  *         不超过250ms; SDHC固定为100ms/250ms, SDXC写入为500ms. 最低写入速度取SD状态中速度等级/
+  *         UHS速度等级/视频速度等级的最大值
+  * @param  无
+  * @retval 无
+  */
+static void SD_ReadTiming(void)
+{
+  static const uint8_t taac_value[16] = {0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80};
+  static const uint8_t speed_class_mb[5] = {0, 2, 4, 6, 10};
+  HAL_SD_CardCSDTypeDef csd;
+  HAL_SD_CardStatusTypeDef status;
+  uint32_t scr[2];
+  uint32_t taac_ns;
+  uint32_t ms;
+  uint32_t mb = 0;
+
+  SD_Timing.ReadTimeout = 100;
+  SD_Timing.WriteTimeout = (hsd1.SdCard.BlockNbr > 64UL * 1024 * 1024) ? 500 : 250;   // 大于32GB为SDXC
+  SD_Timing.WriteSpeed = 0;
+  SD_Timing.Cmd23 = 0;
+
+  if (hsd1.SdCard.CardType != CARD_SDHC_SDXC && HAL_SD_GetCardCSD(&hsd1, &csd) == HAL_OK)
+  {
+    taac_ns = (uint32_t)taac_value[(csd.TAAC >> 3) & 0x0F];
+    for (ms = csd.TAAC & 0x07; ms > 0; ms--)
+    {
+      taac_ns *= 10;
+    }
+    taac_ns /= 10;
+    ms = taac_ns / 10000 + (uint32_t)csd.NSAC * 10000 / (SD_Speed.Clock / 1000) + 1;
+    SD_Timing.ReadTimeout = (ms < 100) ? ms : 100;
+    ms <<= csd.WrSpeedFact;
+    SD_Timing.WriteTimeout = (ms < 250) ? ms : 250;
+  }
+
+  if (HAL_SD_GetCardStatus(&hsd1, &status) == HAL_OK)
+  {
+    if (status.SpeedClass < sizeof(speed_class_mb))
+    {
+      mb = speed_class_mb[status.SpeedClass];
+    }
+    if (status.UhsSpeedGrade * 10 > mb)
+    {
+      mb = status.UhsSpeedGrade * 10;
+    }
+    if (status.VideoSpeedClass > mb)
+    {
+      mb = status.VideoSpeedClass;
+    }
+    SD_Timing.WriteSpeed = mb * 1024;
+  }
+
+  /* CMD_SUPPORT在SCR的[35:32], bit33为CMD23 */
+  if (SD_ReadSCR(scr) == HAL_SD_ERROR_NONE && (scr[1] & 0x00000002))
+  {
+    SD_Timing.Cmd23 = 1;
+  }
+}
+
+
+/**
+  * @brief  读取SCR寄存器(ACMD51)
+  * @note   HAL没有提供读取SCR的接口, 参照HAL_SD的SD_FindSCR()读取, 读取后块长度恢复为512
+  * @param  scr: scr[1]为SCR的[63:32], scr[0]为[31:0]
+  * @retval HAL SD错误码
+  */
+static uint32_t SD_ReadSCR(uint32_t *scr)
+{
+  SDMMC_DataInitTypeDef config;
+  uint32_t errorstate;
+  uint32_t tickstart = HAL_GetTick();
+  uint32_t data[2] = {0, 0};
+  uint32_t index = 0;
+
+  errorstate = SDMMC_CmdBlockLength(hsd1.Instance, 8U);
+  if (errorstate == HAL_SD_ERROR_NONE)
+  {
+    errorstate = SDMMC_CmdAppCommand(hsd1.Instance, hsd1.SdCard.RelCardAdd << 16U);
+  }
+  if (errorstate != HAL_SD_ERROR_NONE)
+  {
+    (void)SDMMC_CmdBlockLength(hsd1.Instance, 512U);
+    return errorstate;
+  }
+
+  config.DataTimeOut   = SDMMC_DATATIMEOUT;
+  config.DataLength    = 8U;
+  config.DataBlockSize = SDMMC_DATABLOCK_SIZE_8B;
+  config.TransferDir   = SDMMC_TRANSFER_DIR_TO_SDMMC;
+  config.TransferMode  = SDMMC_TRANSFER_MODE_BLOCK;
+  config.DPSM          = SDMMC_DPSM_ENABLE;
+  (void)SDMMC_ConfigData(hsd1.Instance, &config);
+
+  errorstate = SDMMC_CmdSendSCR(hsd1.Instance);
+  while (errorstate == HAL_SD_ERROR_NONE
+         && !__HAL_SD_GET_FLAG(&hsd1, SDMMC_FLAG_RXOVERR | SDMMC_FLAG_DCRCFAIL | SDMMC_FLAG_DTIMEOUT | SDMMC_FLAG_DBCKEND | SDMMC_FLAG_DATAEND))
+  {
+    if (!__HAL_SD_GET_FLAG(&hsd1, SDMMC_FLAG_RXFIFOE) && index == 0)
+    {
+      data[0] = SDMMC_ReadFIFO(hsd1.Instance);
+      data[1] = SDMMC_ReadFIFO(hsd1.Instance);
+      index++;
+    }
+    if (HAL_GetTick() - tickstart >= SDMMC_SWDATATIMEOUT)
+    {
+      errorstate = HAL_SD_ERROR_TIMEOUT;
+    }
+  }
+
+  if (errorstate == HAL_SD_ERROR_NONE)
+  {
+    if (__HAL_SD_GET_FLAG(&hsd1, SDMMC_FLAG_DTIMEOUT))
+    {
+      errorstate = HAL_SD_ERROR_DATA_TIMEOUT;
+    }
+    else if (__HAL_SD_GET_FLAG(&hsd1, SDMMC_FLAG_DCRCFAIL))
+    {
+      errorstate = HAL_SD_ERROR_DATA_CRC_FAIL;
+    }
+    else if (__HAL_SD_GET_FLAG(&hsd1, SDMMC_FLAG_RXOVERR))
+    {
+      errorstate = HAL_SD_ERROR_RX_OVERRUN;
+    }
+  }
+  __HAL_SD_CLEAR_FLAG(&hsd1, SDMMC_STATIC_DATA_FLAGS);
+  (void)SDMMC_CmdBlockLength(hsd1.Instance, 512U);
+
+  /* SCR按大端从FIFO读出 */
+  scr[1] = __REV(data[0]);
+  scr[0] = __REV(data[1]);
+
+  return errorstate;
+}
+
+
+/**
+  * @brief  计算一次读写的超时时间
+  * @note   读取: 访问超时 + 2倍的总线传输时间(4位总线每个时钟半个字节);
+  *         写入: 有速度等级时为忙超时 + 2倍按最低写入速度的时间, 否则每个块一个忙超时
+  * @param  BlocksNbr  扇区数
+  * @param  write      1: 写入, 0: 读取
+  * @retval 超时时间, 单位ms
+  */
+static uint32_t SD_TransferTimeout(uint32_t BlocksNbr, uint8_t write)
+{
+  uint32_t bus = SD_Speed.Clock / 2048;   // 总线速度, 单位KB/s
+  uint32_t ms = (bus != 0) ? BlocksNbr * 1000 / bus + 1 : BlocksNbr * 100;
+
+  if (!write)
+  {
+    return SD_Timing.ReadTimeout + ms;
+  }
+  if (SD_Timing.WriteSpeed != 0)
+  {
+    return SD_Timing.WriteTimeout + ms + BlocksNbr * 1000 / SD_Timing.WriteSpeed;
+  }
+  return SD_Timing.WriteTimeout * BlocksNbr + ms;
+}
+
+
+/**
+  * @brief  计算擦除的超时时间
+  * @note   SD状态中有擦除信息时为 ERASE_TIMEOUT / ERASE_SIZE * AU数 + ERASE_OFFSET, 否则每个AU SD_ERASE_TIMEOUT
+  * @param  units: 擦除单元数
+  * @retval 超时时间, 单位ms
+  */
+static uint32_t SD_EraseTimeout(uint32_t units)
+{
+  if (SD_EraseInfo.EraseSize != 0 && SD_EraseInfo.EraseTimeout != 0)
+  {
+    return (uint32_t)SD_EraseInfo.EraseTimeout * 1000 * units / SD_EraseInfo.EraseSize
+           + (uint32_t)SD_EraseInfo.EraseOffset * 1000 + SD_ERASE_TIMEOUT;
+  }
+  return SD_ERASE_TIMEOUT * (units + 1);
+}
+
+
+/**
+  * @brief  Erases the specified memory area of the given SD card.
+  * @note   每次最多擦除SD_ERASE_MAX_UNITS个擦除单元, 每次擦除后等待卡回到传输状态(SD_WAIT_EVENT()唤醒后查询CMD13);
+  *         擦除后的扇区读出全0或全1, 之后写入时卡不需要先擦除, 写入速度更快
+  * @param  Instance   SD Instance
+  * @param  BlockIdx   Block index from where the erase starts
+  * @param  BlocksNbr  Number of SD blocks to erase
+  * @retval BSP status
+  */
+int32_t BSP_SD_Erase(uint32_t Instance, uint32_t BlockIdx, uint32_t BlocksNbr)
+{
+  uint32_t max = SD_EraseInfo.Unit * SD_ERASE_MAX_UNITS;
+  uint32_t n, timeout, start;
+
+  while (BlocksNbr != 0)
+  {
+    n = (BlocksNbr > max) ? max : BlocksNbr;
+
+    if (HAL_SD_Erase(&hsd1, BlockIdx, BlockIdx + n - 1) != HAL_OK)
+    {
+      return (hsd1.ErrorCode & HAL_SD_ERROR_REQUEST_NOT_APPLICABLE) ? BSP_ERROR_FEATURE_NOT_SUPPORTED : BSP_ERROR_PERIPH_FAILURE;
+    }
+
+    /* 擦除期间卡处于编程状态 */
+    timeout = SD_EraseTimeout((n + SD_EraseInfo.Unit - 1) / SD_EraseInfo.Unit);
+    start = HAL_GetTick();
+    while (HAL_SD_GetCardState(&hsd1) != HAL_SD_CARD_TRANSFER)
+    {
+      if (HAL_GetTick() - start > timeout)
+      {
+        return BSP_ERROR_BUSY;
+      }
+      if (!SD_IN_ISR())
+      {
+        SD_WAIT_EVENT();   // 擦除可能持续数秒, 两次CMD13之间休眠
+      }
+    }
+
+    BlockIdx += n;
+    BlocksNbr -= n;
+  }
+
+  return BSP_ERROR_NONE;
+}
+
+
+/**
+  * @brief  放弃扇区中的数据(TRIM)
+  * @note   范围先放入等待列表, 和列表中重叠或相邻的范围合并, 在BSP_SD_DiscardFlush()中擦除;
+  *         列表满时先擦除列表中的范围. 之后写入的扇区会从等待的范围中去掉, 不会被擦除.
+  *         未定义USE_SD_DISCARD时不做任何操作
+  * @param  Instance   SD Instance
+  * @param  BlockIdx   Block index from where the range starts
+  * @param  BlocksNbr  Number of SD blocks
+  * @retval BSP status
+  */
+int32_t BSP_SD_Discard(uint32_t Instance, uint32_t BlockIdx, uint32_t BlocksNbr)
+{
+  int32_t ret = BSP_ERROR_NONE;
+#ifdef USE_SD_DISCARD
+  uint32_t end = BlockIdx + BlocksNbr;
+  uint8_t merged, i, slot;
+
+  if (BlocksNbr == 0)
+  {
+    return BSP_ERROR_NONE;
+  }
+
+  /* 合并后的范围可能又和前面检查过的范围相邻, 重复直到不能再合并 */
+  do
+  {
+    merged = 0;
+    slot = SD_DISCARD_RANGES;
+    for (i = 0; i < SD_DISCARD_RANGES; i++)
+    {
+      if (SD_Discard[i].End > SD_Discard[i].Start && SD_Discard[i].Start <= end && BlockIdx <= SD_Discard[i].End)
+      {
+        BlockIdx = (SD_Discard[i].Start < BlockIdx) ? SD_Discard[i].Start : BlockIdx;
+        end = (SD_Discard[i].End > end) ? SD_Discard[i].End : end;
+        SD_Discard[i].Start = SD_Discard[i].End = 0;
+        merged = 1;
+      }
+      if (SD_Discard[i].End <= SD_Discard[i].Start && slot == SD_DISCARD_RANGES)
+      {
+        slot = i;
+      }
+    }
+  }
+  while (merged);
+
+  if (slot == SD_DISCARD_RANGES)
+  {
+    ret = BSP_SD_DiscardFlush(Instance);
+    slot = 0;
+  }
+
+  SD_Discard[slot].Start = BlockIdx;
+  SD_Discard[slot].End = end;
+#endif
+  return ret;
+}
+
+
+/**
+  * @brief  擦除等待中的TRIM范围
+  * @note   每个范围只擦除其中完整的擦除单元(起始向上、结束向下对齐到AU), 不完整的部分直接丢弃;
+  *         在CTRL_SYNC/FX_DRIVER_FLUSH时调用, SDMMC上不能有正在进行的传输; 卡不支持擦除时只清空列表
+  * @param  Instance   SD Instance
+  * @retval BSP status
+  */
+int32_t BSP_SD_DiscardFlush(uint32_t Instance)
+{
+  int32_t ret = BSP_ERROR_NONE;
+#ifdef USE_SD_DISCARD
+  uint32_t unit = SD_EraseInfo.Unit;
+  uint32_t start, end;
+  int32_t res;
+  uint8_t i;
+
+  for (i = 0; i < SD_DISCARD_RANGES; i++)
+  {
+    start = (SD_Discard[i].Start + unit - 1) / unit * unit;
+    end = SD_Discard[i].End / unit * unit;
+    SD_Discard[i].Start = SD_Discard[i].End = 0;
+
+    if (end > start)
+    {
+      res = BSP_SD_Erase(Instance, start, end - start);
+      if (res != BSP_ERROR_NONE && res != BSP_ERROR_FEATURE_NOT_SUPPORTED)
+      {
+        ret = res;
+      }
+    }
+  }
+#endif
+  return ret;
+}
+
+
+#ifdef USE_SD_DISCARD
+/**
+  * @brief  从等待擦除的范围中去掉要写入的扇区
+  * @note   写入的扇区在范围中间时, 保留较长的一段, 较短的一段不再擦除
+  * @param  BlockIdx   Block index from where data is to be written
+  * @param  BlocksNbr  Number of SD blocks to write
+  * @retval None
+  */
+static void SD_Discard_Clip(uint32_t BlockIdx, uint32_t BlocksNbr)
+{
+  uint32_t end = BlockIdx + BlocksNbr;
+  uint8_t i;
+
+  for (i = 0; i < SD_DISCARD_RANGES; i++)
+  {
+    if (SD_Discard[i].End > SD_Discard[i].Start && SD_Discard[i].Start < end && BlockIdx < SD_Discard[i].End)
+    {
+      if (SD_Discard[i].End > end &&
+          (SD_Discard[i].Start >= BlockIdx || SD_Discard[i].End - end > BlockIdx - SD_Discard[i].Start))
+      {
+        SD_Discard[i].Start = end;      // 保留写入之后的部分
+      }
+      else
+      {
+        SD_Discard[i].End = BlockIdx;   // 保留写入之前的部分, 没有时范围为空
+      }
+    }
+  }
+}
+#endif
+
+
+/**
+  * @brief Rx Transfer completed callbacks
+  * @param hsd: SD handle
+  * @retval None
+  */
+void HAL_SD_RxCpltCallback(SD_HandleTypeDef *hsd)
+{
+  uint8_t *buffer = RxUserBuffer;
+
+#ifdef USE_SD_STREAM
+  if (SD_Stream.Active)
+  {
+    SD_Stream_Cplt();
+    return;
+  }
+#endif
+
+  if (buffer != NULL)
+  {
+    SCB_InvalidateDCache_by_Addr((uint32_t*)buffer, RxUserSize);
+    RxUserBuffer = NULL;
+    BSP_SD_ReadCpltCallback(0);
+  }
+  else if (SD_DMA_Result == SD_DMA_PENDING)   // CMD12失败时HAL先调用出错回调, 不覆盖其结果
+  {
+    SD_DMA_Result = BSP_ERROR_NONE;   // 同步读取的Cache在BSP_SD_ReadBlocks_DMA()中失效
+  }
+
+  SD_SIGNAL_EVENT();
+}
+
+
+/**
+  * @brief Tx Transfer completed callbacks
+  * @param hsd: SD handle
+  * @retval None
+  */
+void HAL_SD_TxCpltCallback(SD_HandleTypeDef *hsd)
+{
+#ifdef USE_SD_STREAM
+  if (SD_Stream.Active)
+  {
+    SD_Stream_Cplt();
+    return;
+  }
+#endif
+
+  if (SD_DMA_Result == SD_DMA_PENDING)
+  {
+    SD_DMA_Result = BSP_ERROR_NONE;
+  }
+  SD_SIGNAL_EVENT();
+}
+
+
+/**
+  * @brief SD error callbacks
+  * @note  CRC错误返回BSP_ERROR_BUS_CRC_ERROR, 其他错误返回BSP_ERROR_PERIPH_FAILURE;
+  *        后台读取出错时放弃接收缓冲并调用BSP_SD_ReadErrorCallback().
+  *        多块传输结束时CMD12失败, HAL在本回调之后仍会调用完成回调
+  * @param hsd: SD handle
+  * @retval None
+  */
+void HAL_SD_ErrorCallback(SD_HandleTypeDef *hsd)
+{
+  SD_NoteError(hsd->ErrorCode);
+
+#ifdef USE_SD_STREAM
+  if (SD_Stream.Active)
+  {
+    SD_Stream_End(SD_ErrorStatus(hsd->ErrorCode));
+    return;
+  }
+#endif
+
+  if (RxUserBuffer != NULL)
+  {
+    RxUserBuffer = NULL;
+    BSP_SD_ReadErrorCallback(0);
+  }
+  else if (SD_DMA_Result == SD_DMA_PENDING)
+  {
+    SD_DMA_Result = SD_ErrorStatus(hsd->ErrorCode);
+  }
+
+  SD_SIGNAL_EVENT();
+}
+
+
+/**
+  * @brief SD abort callbacks
+  * @param hsd: SD handle
+  * @retval None
+  */
+void HAL_SD_AbortCallback(SD_HandleTypeDef *hsd)
+{
+#ifdef USE_SD_STREAM
+  if (SD_Stream.Active)
+  {
+    SD_Stream_End(BSP_ERROR_BUSY);
+    return;
+  }
+#endif
+
+  if (RxUserBuffer != NULL)
+  {
+    RxUserBuffer = NULL;
+    BSP_SD_ReadErrorCallback(0);
+  }
+  else if (SD_DMA_Result == SD_DMA_PENDING)
+  {
+    SD_DMA_Result = BSP_ERROR_BUSY;
+  }
+
+  SD_SIGNAL_EVENT();
+}
+
+
+/**
+  * @brief BSP SD Read Complete callback, called when BSP_SD_ReadBlocks_DMA_Start() finishes
+  * @param Instance  SD Instance
+  * @retval None
+  */
+__weak void BSP_SD_ReadCpltCallback(uint32_t Instance)
+{
+  UNUSED(Instance);
+}
+
+
+/**
+  * @brief BSP SD Read Error callback, called when BSP_SD_ReadBlocks_DMA_Start() fails or is aborted
+  * @param Instance  SD Instance
+  * @retval None
+  */
+__weak void BSP_SD_ReadErrorCallback(uint32_t Instance)
+{
+  UNUSED(Instance);
+}
+
+
+#ifdef USE_SD_STREAM
+/**
+  * @brief Read DMA Buffer 0 Transfer completed callbacks
+  * @param hsd: SD handle
+  * @retval None
+  */
+void HAL_SDEx_Read_DMADoubleBuf0CpltCallback(SD_HandleTypeDef *hsd)
+{
+  SD_Stream_BufferCplt(0U);
+}
+
+
+/**
+  * @brief Read DMA Buffer 1 Transfer completed callbacks
+  * @param hsd: SD handle
+  * @retval None
+  */
+void HAL_SDEx_Read_DMADoubleBuf1CpltCallback(SD_HandleTypeDef *hsd)
+{
+  SD_Stream_BufferCplt(1U);
+}
+
+
+/**
+  * @brief Write DMA Buffer 0 Transfer completed callbacks
+  * @param hsd: SD handle
+  * @retval None
+  */
+void HAL_SDEx_Write_DMADoubleBuf0CpltCallback(SD_HandleTypeDef *hsd)
+{
+  SD_Stream_BufferCplt(0U);
+}
+
+
+/**
+  * @brief Write DMA Buffer 1 Transfer completed callbacks
+  * @param hsd: SD handle
+  * @retval None
+  */
+void HAL_SDEx_Write_DMADoubleBuf1CpltCallback(SD_HandleTypeDef *hsd)
+{
+  SD_Stream_BufferCplt(1U);
+}
+
+
+/**
+  * @brief BSP SD stream callback, called from the interrupt when a buffer of
+  *        BSP_SD_StreamStart() has been transferred, or with pData NULL when the stream ends
+  * @param Instance  SD Instance
+  * @param pData     The buffer that has been transferred
+  * @retval None
+  */
+__weak void BSP_SD_StreamCallback(uint32_t Instance, uint8_t *pData)
+{
+  UNUSED(Instance);
+  UNUSED(pData);
+}
+#endif
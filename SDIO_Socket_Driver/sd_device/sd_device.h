@@ -41,6 +41,40 @@
 #define  BSP_ERROR_BUS_DMA_FAILURE            -107
 
 
+/* 擦除/TRIM配置 */
+#define USE_SD_DISCARD                    // 定义TRIM时擦除SD卡: 合并相邻的范围, 同步时擦除其中完整的擦除单元(预擦除后写入更快)
+#define SD_DISCARD_RANGES         4       // 等待擦除的范围个数
+#define SD_ERASE_MAX_UNITS        16      // 一次擦除的最大擦除单元数, 限制单次擦除的忙时间
+#define SD_ERASE_TIMEOUT          250     // SD状态中没有擦除超时信息时每个擦除单元的超时时间, 单位ms
+
+/* 总线速度配置, 需要STM32H7 HAL V1.10以上(HAL_SD_ConfigSpeedBusOperation()支持SDR50) */
+//#define USE_SD_TRANSCEIVER                // 有1.8V电平转换器时定义, 允许UHS-I模式(SDR104/SDR50/DDR50); 需实现HAL_SDEx_DriveTransceiver_1_8V_Callback()切换电平
+#define SD_MAX_SPEED_MODE         SDMMC_SPEED_MODE_ULTRA_SDR104   // 协商的最高速度模式, 从它开始依次尝试SDR104/SDR50/DDR50/HS
+#define SD_RETUNE_CRC_ERRORS      3       // CRC错误累计达到该次数时重新校准(UHS-I为延迟块), 之后再达到时时钟减半
+
+/* DMA传输配置 */
+#define SD_DMA_BOUNCE_BLOCKS      8       // DMA中转缓冲的扇区数, 调用者的缓冲区不能直接DMA时分段经过中转缓冲传输
+#define SD_DMA_ALIGN              32      // 直接DMA读取的缓冲区地址对齐, 等于Cache行大小(按Cache行失效时不影响相邻的数据)
+#define SD_DMA_REACHABLE(addr)    ((((uint32_t)(addr)) & 0xFFF80000) == 0x24000000)   // SDMMC1的IDMA能访问的内存(AXI SRAM), 使用SDMMC2时加上D2 SRAM
+#define USE_SD_CMD23                      // 卡在SCR中声明支持CMD23时, 多块DMA传输用CMD23预先声明块数(写入前用ACMD23提示预擦除), 不再发送CMD12
+#define USE_SD_DMA_TRANSFER               // 定义时BSP_SD_ReadBlocks()/BSP_SD_WriteBlocks()也使用DMA传输, 等待期间CPU休眠;
+                                          // 在中断中调用(如USB MSC)时SDMMC/SysTick中断可能无法抢占, 自动改用查询方式
+
+/* 双缓冲数据流配置 */
+#define USE_SD_STREAM                     // 定义时提供BSP_SD_StreamStart(), 用IDMA双缓冲连续读写, 缓冲区之间不停止传输
+#define SD_STREAM_MAX_BLOCKS      65535   // 一次数据流的最大扇区数, 受数据长度寄存器DLEN(25位)限制
+#define SD_STREAM_MAX_BUFFER_BLOCKS  (SDMMC_IDMABSIZE_IDMABSIZE / 512)   // 每个缓冲区的最大扇区数, 受IDMABSIZE限制(H743/H750为8160字节, 即15个扇区)
+#define BSP_ERROR_SD_STREAM_ABORTED  -200   // BSP_SD_StreamStop()中止了还在进行的数据流, 最后一个缓冲区没有传输完整
+
+/* 传输完成的等待和唤醒, 默认在WFI中等待中断, SysTick至少每1ms唤醒一次重新检查;
+   使用RTOS时可以改为信号量, 例如:
+   #define SD_WAIT_EVENT()    osSemaphoreAcquire(SD_EventHandle, 1)
+   #define SD_SIGNAL_EVENT()  osSemaphoreRelease(SD_EventHandle)  */
+#define SD_WAIT_EVENT()           __WFI()
+#define SD_SIGNAL_EVENT()
+#define SD_IN_ISR()               (__get_IPSR() != 0U)   // 在中断中调用, 不能休眠等待其他中断
+
+
 int32_t  BSP_SD_Init(uint32_t Instance);
 int32_t  BSP_SD_GetCardState(uint32_t Instance);
 int32_t  BSP_SD_GetCardInfo(uint32_t Instance, SD_CardInfoTypeDef *CardInfo);
@@ -48,6 +82,18 @@ int32_t  BSP_SD_WriteBlocks(uint32_t Instance, uint32_t *pData, uint32_t BlockId
 int32_t  BSP_SD_ReadBlocks(uint32_t Instance, uint32_t *pData, uint32_t BlockIdx, uint32_t BlocksNbr);
 int32_t  BSP_SD_WriteBlocks_DMA(uint32_t Instance, uint32_t *pData, uint32_t BlockIdx, uint32_t BlocksNbr);
 int32_t  BSP_SD_ReadBlocks_DMA(uint32_t Instance, uint32_t *pData, uint32_t BlockIdx, uint32_t BlocksNbr);
+int32_t  BSP_SD_ReadBlocks_DMA_Start(uint32_t Instance, uint32_t *pData, uint32_t BlockIdx, uint32_t BlocksNbr);
+int32_t  BSP_SD_Erase(uint32_t Instance, uint32_t BlockIdx, uint32_t BlocksNbr);
+int32_t  BSP_SD_Discard(uint32_t Instance, uint32_t BlockIdx, uint32_t BlocksNbr);
+int32_t  BSP_SD_DiscardFlush(uint32_t Instance);
+void     BSP_SD_ReadCpltCallback(uint32_t Instance);
+void     BSP_SD_ReadErrorCallback(uint32_t Instance);
+#ifdef USE_SD_STREAM
+int32_t  BSP_SD_StreamStart(uint32_t Instance, uint8_t **Ring, uint32_t RingSize, uint32_t BufferBlocks,
+                            uint32_t BlockIdx, uint32_t BlocksNbr, uint8_t Write);
+int32_t  BSP_SD_StreamStop(uint32_t Instance);
+void     BSP_SD_StreamCallback(uint32_t Instance, uint8_t *pData);
+#endif
 
 
 
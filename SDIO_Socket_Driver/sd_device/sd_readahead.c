@@ -0,0 +1,549 @@
+/* Includes ------------------------------------------------------------------*/
+#include "sd_readahead.h"
+#include <string.h>
+
+
+/* 预读缓冲状态 */
+#define SD_RA_SLOT_EMPTY      0
+#define SD_RA_SLOT_LOADING    1   // 后台DMA读取中
+#define SD_RA_SLOT_READY      2
+
+typedef struct
+{
+  SD_RA_Stream_t  *Owner;         // 使用该缓冲的数据流
+  uint32_t         Sector;        // 缓冲中第一个扇区
+  uint16_t         Count;         // 缓冲中的扇区数
+  uint16_t         Used;          // 已经被读取到的位置(扇区数)
+  uint32_t         Stamp;         // 最近一次使用的时间, 缓冲不够时替换最久没有使用的
+  volatile uint8_t State;
+} SD_RA_Slot_t;
+
+static SD_RA_Slot_t SD_RA_Slot[SD_RA_SLOTS];
+static SD_RA_Slot_t * volatile SD_RA_Loading = NULL;   // 正在后台读取的缓冲, SDMMC同时只能进行一次传输
+static uint32_t SD_RA_Clock = 0;
+static volatile uint8_t SD_RA_Locked = 0;              // 有使用者正在接口函数中
+
+/******** Read-ahead Buffer definition, 32字节对齐以便按Cache行失效 *******/
+#if defined ( __ICCARM__ )
+#pragma location = ".RAM_D1"
+#pragma data_alignment = 32
+#elif defined ( __CC_ARM )
+__attribute__((section (".RAM_D1"), aligned (32)))
+#elif defined ( __GNUC__ )
+__attribute__((section (".RAM_D1"), aligned (32)))
+#endif
+static uint8_t SD_RA_Buffer[SD_RA_SLOTS][SD_RA_MAX_SECTORS * 512];
+
+
+/**
+  * @brief  进入接口函数
+  * @note   已经有使用者在接口函数中(被当前的中断抢占)时失败
+  * @param  无
+  * @retval 1: 成功, 0: 失败
+  */
+static uint8_t SD_RA_Lock(void)
+{
+  uint32_t primask = __get_PRIMASK();
+  uint8_t ret = 0;
+
+  __disable_irq();
+  if (!SD_RA_Locked)
+  {
+    SD_RA_Locked = 1;
+    ret = 1;
+  }
+  __set_PRIMASK(primask);
+
+  return ret;
+}
+
+
+/**
+  * @brief  退出接口函数
+  * @param  无
+  * @retval 无
+  */
+static void SD_RA_Unlock(void)
+{
+  SD_RA_Locked = 0;
+}
+
+
+/**
+  * @brief  等待中断时的空闲处理
+  * @note   在中断中调用时不休眠: 优先级不高于当前中断的中断不会唤醒WFI
+  * @param  无
+  * @retval 无
+  */
+static void SD_RA_Idle(void)
+{
+  if (!SD_IN_ISR())
+  {
+    SD_WAIT_EVENT();
+  }
+}
+
+
+/**
+  * @brief  等待后台读取结束
+  * @note   等待期间在SD_WAIT_EVENT()中休眠(中断中查询); 读取出错或超时时放弃该缓冲中的数据, 之后的读取直接访问SD卡
+  * @param  无
+  * @retval 无
+  */
+static void SD_RA_Wait(void)
+{
+  SD_RA_Slot_t *slot = SD_RA_Loading;
+  uint32_t start = HAL_GetTick();
+
+  if (slot == NULL)
+  {
+    return;
+  }
+
+  while (SD_RA_Loading != NULL)
+  {
+    /* 中断中先结束句柄的忙状态再调用完成回调, 因此句柄不忙而回调还没有清除SD_RA_Loading说明传输出错 */
+    if ((HAL_SD_GetState(&hsd1) != HAL_SD_STATE_BUSY && SD_RA_Loading != NULL) || HAL_GetTick() - start > SD_RA_TIMEOUT)
+    {
+      HAL_SD_Abort(&hsd1);
+      slot->State = SD_RA_SLOT_EMPTY;
+      SD_RA_Loading = NULL;
+      break;
+    }
+    SD_RA_Idle();
+  }
+}
+
+
+/**
+  * @brief  等待SD卡回到传输状态
+  * @note   无
+  * @param  无
+  * @retval BSP status
+  */
+static int32_t SD_RA_WaitCard(void)
+{
+  uint32_t start = HAL_GetTick();
+
+  while (BSP_SD_GetCardState(0) != BSP_ERROR_NONE)
+  {
+    if (HAL_GetTick() - start > SD_RA_TIMEOUT)
+    {
+      return BSP_ERROR_BUSY;
+    }
+    SD_RA_Idle();
+  }
+
+  return BSP_ERROR_NONE;
+}
+
+
+/**
+  * @brief  释放数据流占用的预读缓冲
+  * @note   缓冲中还有没被读取的扇区时说明预读过多, 预读窗口减半
+  * @param  stream: 数据流
+  * @retval 无
+  */
+static void SD_RA_Release(SD_RA_Stream_t *stream)
+{
+  SD_RA_Slot_t *slot;
+
+  if (stream->Slot < 0)
+  {
+    return;
+  }
+
+  slot = &SD_RA_Slot[stream->Slot];
+  if (slot == SD_RA_Loading)
+  {
+    SD_RA_Wait();
+  }
+
+  if (slot->State == SD_RA_SLOT_READY && slot->Used < slot->Count)
+  {
+    stream->Wasted += slot->Count - slot->Used;
+    stream->Window = (stream->Window / 2 > SD_RA_MIN_SECTORS) ? stream->Window / 2 : SD_RA_MIN_SECTORS;
+  }
+
+  slot->State = SD_RA_SLOT_EMPTY;
+  slot->Owner = NULL;
+  stream->Slot = -1;
+}
+
+
+/**
+  * @brief  为数据流分配预读缓冲
+  * @note   优先使用空闲的缓冲, 否则替换其他数据流中最久没有使用的缓冲
+  * @param  stream: 数据流
+  * @retval 缓冲编号, -1: 没有可用的缓冲
+  */
+static int8_t SD_RA_Alloc(SD_RA_Stream_t *stream)
+{
+  int8_t i, victim = -1;
+
+  for (i = 0; i < SD_RA_SLOTS; i++)
+  {
+    if (SD_RA_Slot[i].Owner == NULL)
+    {
+      victim = i;
+      break;
+    }
+    if (&SD_RA_Slot[i] != SD_RA_Loading &&
+        (victim < 0 || (int32_t)(SD_RA_Slot[i].Stamp - SD_RA_Slot[victim].Stamp) < 0))
+    {
+      victim = i;
+    }
+  }
+
+  if (victim < 0)
+  {
+    return -1;
+  }
+
+  if (SD_RA_Slot[victim].Owner != NULL)
+  {
+    SD_RA_Release(SD_RA_Slot[victim].Owner);
+  }
+
+  SD_RA_Slot[victim].Owner = stream;
+  SD_RA_Slot[victim].State = SD_RA_SLOT_EMPTY;
+  stream->Slot = victim;
+  return victim;
+}
+
+
+/**
+  * @brief  在后台预读数据流的下一个窗口
+  * @note   缓冲中的数据全部被读取后才开始下一次预读, 并且说明预读窗口不够大, 窗口加倍
+  * @param  stream: 数据流
+  * @retval 无
+  */
+static void SD_RA_Prefetch(SD_RA_Stream_t *stream)
+{
+  SD_CardInfoTypeDef CardInfo;
+  SD_RA_Slot_t *slot;
+  uint32_t count;
+
+  if (stream->Slot >= 0)
+  {
+    slot = &SD_RA_Slot[stream->Slot];
+    if (slot->State != SD_RA_SLOT_EMPTY && stream->NextSector - slot->Sector < slot->Count)
+    {
+      return;   // 缓冲中还有没被读取的数据
+    }
+    if (slot->State == SD_RA_SLOT_READY && slot->Used == slot->Count)
+    {
+      stream->Window = (stream->Window * 2 < SD_RA_MAX_SECTORS) ? stream->Window * 2 : SD_RA_MAX_SECTORS;
+    }
+  }
+  else if (SD_RA_Alloc(stream) < 0)
+  {
+    return;
+  }
+
+  /* SDMMC同时只能进行一次传输, 等待正在进行的预读结束 */
+  SD_RA_Wait();
+
+  slot = &SD_RA_Slot[stream->Slot];
+  slot->State = SD_RA_SLOT_EMPTY;
+
+  if (BSP_SD_GetCardInfo(0, &CardInfo) != BSP_ERROR_NONE || stream->NextSector >= CardInfo.BlockNbr)
+  {
+    return;
+  }
+  count = CardInfo.BlockNbr - stream->NextSector;
+  if (count > stream->Window)
+  {
+    count = stream->Window;
+  }
+
+  if (SD_RA_WaitCard() != BSP_ERROR_NONE)
+  {
+    return;
+  }
+
+  slot->Sector = stream->NextSector;
+  slot->Count  = count;
+  slot->Used   = 0;
+  slot->Stamp  = ++SD_RA_Clock;
+  slot->State  = SD_RA_SLOT_LOADING;
+  SD_RA_Loading = slot;
+
+  if (BSP_SD_ReadBlocks_DMA_Start(0, (uint32_t *)SD_RA_Buffer[stream->Slot], slot->Sector, count) != BSP_ERROR_NONE)
+  {
+    slot->State = SD_RA_SLOT_EMPTY;
+    SD_RA_Loading = NULL;
+  }
+}
+
+
+/**
+  * @brief  初始化数据流
+  * @note   重新初始化时丢弃该数据流的预读数据
+  * @param  stream: 数据流
+  * @retval 无
+  */
+void SD_RA_Init(SD_RA_Stream_t *stream)
+{
+  if (stream->Slot >= 0 && stream->Slot < SD_RA_SLOTS && SD_RA_Slot[stream->Slot].Owner == stream)
+  {
+    SD_RA_Release(stream);
+  }
+
+  memset(stream, 0, sizeof(SD_RA_Stream_t));
+  stream->NextSector = 0xFFFFFFFF;
+  stream->Window = SD_RA_MIN_SECTORS;
+  stream->Slot = -1;
+}
+
+
+/**
+  * @brief  经过预读读扇区
+  * @note   已经预读的部分从预读缓冲拷贝(后台读取还没结束时先等待), 其余部分直接从SD卡读取;
+  *         连续SD_RA_TRIGGER次顺序读取后在后台预读下一个窗口, 函数返回时SD卡可能仍在读取
+  * @param  stream: 数据流
+  * @param  buff: 数据缓冲区
+  * @param  sector: 起始扇区
+  * @param  count: 扇区数
+  * @retval BSP status
+  */
+int32_t SD_RA_Read(SD_RA_Stream_t *stream, uint8_t *buff, uint32_t sector, uint32_t count)
+{
+  SD_RA_Slot_t *slot = (stream->Slot >= 0) ? &SD_RA_Slot[stream->Slot] : NULL;
+  int32_t ret = BSP_ERROR_NONE;
+  uint32_t n;
+
+  if (!SD_RA_Lock())
+  {
+    return BSP_ERROR_BUSY;
+  }
+
+  /* 顺序检测, 偶尔插入的其他读取(如FAT表)不打断预读 */
+  if (sector == stream->NextSector)
+  {
+    if (stream->SeqCount < SD_RA_TRIGGER)
+    {
+      stream->SeqCount++;
+    }
+    stream->Strays = 0;
+    stream->NextSector = sector + count;
+  }
+  else if (slot != NULL && slot->State != SD_RA_SLOT_EMPTY && sector - slot->Sector < slot->Count)
+  {
+    /* 在预读缓冲内回读 */
+  }
+  else if (slot != NULL && stream->Strays < SD_RA_MAX_STRAYS)
+  {
+    stream->Strays++;
+  }
+  else
+  {
+    SD_RA_Release(stream);
+    slot = NULL;
+    stream->SeqCount = 0;
+    stream->Strays = 0;
+    stream->NextSector = sector + count;
+  }
+
+  /* 先从预读缓冲读取 */
+  if (slot != NULL && slot->State != SD_RA_SLOT_EMPTY && sector - slot->Sector < slot->Count)
+  {
+    if (slot == SD_RA_Loading)
+    {
+      SD_RA_Wait();
+    }
+    if (slot->State == SD_RA_SLOT_READY)
+    {
+      n = slot->Sector + slot->Count - sector;
+      if (n > count)
+      {
+        n = count;
+      }
+      memcpy(buff, SD_RA_Buffer[stream->Slot] + (sector - slot->Sector) * 512, n * 512);
+      if (slot->Used < sector - slot->Sector + n)
+      {
+        slot->Used = sector - slot->Sector + n;
+      }
+      slot->Stamp = ++SD_RA_Clock;
+      stream->Hits += n;
+
+      buff += n * 512;
+      sector += n;
+      count -= n;
+    }
+  }
+
+  /* 其余部分直接从SD卡读取 */
+  if (count)
+  {
+    SD_RA_Wait();
+    ret = SD_RA_WaitCard();
+    if (ret == BSP_ERROR_NONE)
+    {
+      ret = BSP_SD_ReadBlocks(0, (uint32_t *)buff, sector, count);
+    }
+    stream->Misses += count;
+  }
+
+  if (ret == BSP_ERROR_NONE && stream->SeqCount >= SD_RA_TRIGGER)
+  {
+    SD_RA_Prefetch(stream);
+  }
+
+  SD_RA_Unlock();
+  return ret;
+}
+
+
+/**
+  * @brief  丢弃所有数据流中与区间重叠的预读数据
+  * @note   调用前先SD_RA_Wait()
+  * @param  sector: 起始扇区
+  * @param  count: 扇区数
+  * @retval 无
+  */
+static void SD_RA_Invalidate(uint32_t sector, uint32_t count)
+{
+  uint8_t i;
+
+  for (i = 0; i < SD_RA_SLOTS; i++)
+  {
+    if (SD_RA_Slot[i].Owner != NULL && SD_RA_Slot[i].State != SD_RA_SLOT_EMPTY &&
+        SD_RA_Slot[i].Sector < sector + count && sector < SD_RA_Slot[i].Sector + SD_RA_Slot[i].Count)
+    {
+      SD_RA_Release(SD_RA_Slot[i].Owner);
+    }
+  }
+}
+
+
+/**
+  * @brief  经过预读写扇区
+  * @note   写入前丢弃所有数据流中与写入区间重叠的预读数据
+  * @param  buff: 数据缓冲区
+  * @param  sector: 起始扇区
+  * @param  count: 扇区数
+  * @retval BSP status
+  */
+int32_t SD_RA_Write(const uint8_t *buff, uint32_t sector, uint32_t count)
+{
+  int32_t ret;
+
+  if (!SD_RA_Lock())
+  {
+    return BSP_ERROR_BUSY;
+  }
+
+  SD_RA_Wait();
+  SD_RA_Invalidate(sector, count);
+
+  ret = SD_RA_WaitCard();
+  if (ret == BSP_ERROR_NONE)
+  {
+    ret = BSP_SD_WriteBlocks(0, (uint32_t *)buff, sector, count);
+  }
+
+  SD_RA_Unlock();
+  return ret;
+}
+
+
+/**
+  * @brief  经过预读放弃扇区中的数据(TRIM)
+  * @note   丢弃与区间重叠的预读数据后交给BSP_SD_Discard(), 同步时调用SD_RA_Sync()和BSP_SD_DiscardFlush()擦除
+  * @param  sector: 起始扇区
+  * @param  count: 扇区数
+  * @retval BSP status
+  */
+int32_t SD_RA_Discard(uint32_t sector, uint32_t count)
+{
+  int32_t ret;
+
+  if (!SD_RA_Lock())
+  {
+    return BSP_ERROR_BUSY;
+  }
+
+  SD_RA_Wait();
+  SD_RA_Invalidate(sector, count);
+  ret = BSP_SD_Discard(0, sector, count);
+
+  SD_RA_Unlock();
+  return ret;
+}
+
+
+/**
+  * @brief  获取SD卡状态
+  * @note   后台预读进行中时返回就绪: 之后的读写会先等待预读结束, 使用者不需要等待
+  * @param  无
+  * @retval BSP_ERROR_NONE: 就绪, BSP_ERROR_BUSY: 忙
+  */
+int32_t SD_RA_GetCardState(void)
+{
+  int32_t ret = BSP_ERROR_NONE;
+
+  if (!SD_RA_Lock())
+  {
+    return BSP_ERROR_BUSY;
+  }
+
+  if (SD_RA_Loading == NULL)
+  {
+    ret = BSP_SD_GetCardState(0);
+  }
+
+  SD_RA_Unlock();
+  return ret;
+}
+
+
+/**
+  * @brief  等待后台预读结束
+  * @note   直接调用BSP_SD_xxx访问SD卡之前调用
+  * @param  无
+  * @retval BSP_ERROR_NONE: 没有后台预读, BSP_ERROR_BUSY: 其他使用者正在访问
+  */
+int32_t SD_RA_Sync(void)
+{
+  if (!SD_RA_Lock())
+  {
+    return BSP_ERROR_BUSY;
+  }
+
+  SD_RA_Wait();
+
+  SD_RA_Unlock();
+  return BSP_ERROR_NONE;
+}
+
+
+/**
+  * @brief  后台读取完成回调, 由HAL_SD_RxCpltCallback()在中断中调用
+  * @param  Instance  SD Instance
+  * @retval None
+  */
+void BSP_SD_ReadCpltCallback(uint32_t Instance)
+{
+  if (SD_RA_Loading != NULL)
+  {
+    SD_RA_Loading->State = SD_RA_SLOT_READY;
+    SD_RA_Loading = NULL;
+  }
+}
+
+
+/**
+  * @brief  后台读取出错回调, 由HAL_SD_ErrorCallback()/HAL_SD_AbortCallback()在中断中调用
+  * @note   放弃该缓冲中的数据, 之后的读取直接访问SD卡
+  * @param  Instance  SD Instance
+  * @retval None
+  */
+void BSP_SD_ReadErrorCallback(uint32_t Instance)
+{
+  if (SD_RA_Loading != NULL)
+  {
+    SD_RA_Loading->State = SD_RA_SLOT_EMPTY;
+    SD_RA_Loading = NULL;
+  }
+}
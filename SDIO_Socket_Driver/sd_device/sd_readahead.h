@@ -0,0 +1,41 @@
+#ifndef __SD_READAHEAD_H__
+#define __SD_READAHEAD_H__
+
+#include "sd_device.h"
+
+
+#define USE_SD_READAHEAD                  // 定义顺序读预读, 检测到顺序读取时在后台用DMA读取下一段数据
+
+#define SD_RA_SLOTS               2       // 预读缓冲个数, 即同时预读的数据流数
+#define SD_RA_MIN_SECTORS         2       // 预读窗口的最小扇区数
+#define SD_RA_MAX_SECTORS         16      // 预读窗口的最大扇区数, 每个预读缓冲占用SD_RA_MAX_SECTORS*512字节
+#define SD_RA_TRIGGER             2       // 连续顺序读取的次数达到该值时开始预读
+#define SD_RA_MAX_STRAYS          2       // 预读中允许插入的非顺序读取次数(如FAT表、目录), 超过时放弃预读
+#define SD_RA_TIMEOUT             100     // 等待后台读取或SD卡就绪的超时, 单位ms
+
+/* 多个使用者共用预读缓冲和SDMMC, 接口函数互斥: 一个使用者在接口函数中时, 抢占它的其他使用者(如USB MSC中断)
+   得到BSP_ERROR_BUSY, 需要稍后重试. 在中断中调用时不休眠, 后台读取的完成和超时依赖SDMMC和SysTick中断,
+   因此SDMMC和SysTick中断的优先级必须高于调用者的中断(如USB OTG), 否则等待不会结束 */
+
+/* 顺序读数据流, 每个使用者(FatFs/FileX/USB)一个, 使用前调用SD_RA_Init() */
+typedef struct
+{
+  uint32_t NextSector;    // 顺序读取时下一次读取的起始扇区
+  uint16_t SeqCount;      // 连续顺序读取的次数
+  uint16_t Strays;        // 连续的非顺序读取次数
+  uint16_t Window;        // 当前预读窗口的扇区数
+  int8_t   Slot;          // 占用的预读缓冲, -1: 无
+  uint32_t Hits;          // 从预读缓冲读到的扇区数
+  uint32_t Misses;        // 直接从SD卡读取的扇区数
+  uint32_t Wasted;        // 预读后没有被使用就丢弃的扇区数
+} SD_RA_Stream_t;
+
+
+void    SD_RA_Init(SD_RA_Stream_t *stream);
+int32_t SD_RA_Read(SD_RA_Stream_t *stream, uint8_t *buff, uint32_t sector, uint32_t count);
+int32_t SD_RA_Write(const uint8_t *buff, uint32_t sector, uint32_t count);
+int32_t SD_RA_Discard(uint32_t sector, uint32_t count);
+int32_t SD_RA_GetCardState(void);
+int32_t SD_RA_Sync(void);
+
+#endif
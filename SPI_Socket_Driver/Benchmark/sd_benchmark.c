@@ -0,0 +1,841 @@
+#include <string.h>
+#include <stdlib.h>
+#include "sd_benchmark.h"
+
+#ifdef SD_CARD_SIM
+#include "sd_card_sim.h"
+#else
+#include "main.h"
+#endif
+
+#if defined(SD_BENCH_USE_BSP) || defined(SD_BENCH_USE_CRC)
+#include "spi_tfcard.h"
+#endif
+
+#if defined(SD_BENCH_USE_DISKIO) || defined(SD_BENCH_USE_FATFS)
+#include "ff.h"
+#include "ff_gen_drv.h"
+#include "user_diskio.h"
+#endif
+
+#if defined(SD_BENCH_USE_FX_DRIVER) || defined(SD_BENCH_USE_FILEX)
+#include "fx_api.h"
+#include "fx_stm32_sd_driver.h"
+#endif
+
+#ifdef SD_BENCH_USE_USB
+#include "usbd_storage_if.h"
+#endif
+
+
+/* 读写数据缓冲区, 按32字节对齐以便DMA和Cache维护 */
+static uint8_t SD_Bench_Buffer[SD_BENCH_BUFFER_SIZE] __attribute__ ((aligned (32)));
+
+/* 当前测试 */
+static struct
+{
+  SD_Bench_Result_t Result;
+  uint32_t Samples[SD_BENCH_MAX_SAMPLES];   // 每次请求的延时, 单位us
+  uint32_t Start;                           // 测试开始的时间
+} SD_Bench;
+
+/* 随机读写的伪随机数状态, 每项随机测试开始时复位, 各后端访问同样的扇区序列 */
+static uint32_t SD_Bench_Seed;
+
+
+/**
+  * @brief  产生伪随机数
+  * @note   xorshift32
+  * @param  无
+  * @retval 随机数
+  */
+static uint32_t SD_Bench_Rand(void)
+{
+  SD_Bench_Seed ^= SD_Bench_Seed << 13;
+  SD_Bench_Seed ^= SD_Bench_Seed >> 17;
+  SD_Bench_Seed ^= SD_Bench_Seed << 5;
+  return SD_Bench_Seed;
+}
+
+
+/**
+  * @brief  默认的微秒计时
+  * @note   不依赖SD卡驱动: 使用DWT周期计数器(第一次调用时开启), 没有DWT的内核(Cortex-M0/M0+)
+  *         使用HAL_GetTick(), 精度只有1ms; 在SD_Sim上使用模拟时间.
+  *         两次调用的间隔不能超过周期计数器的溢出时间
+  * @param  无
+  * @retval 微秒计数值
+  */
+uint32_t SD_Bench_GetTick_us(void)
+{
+#if defined(SD_CARD_SIM)
+  return SD_Sim_GetTick_us();
+#elif defined(DWT_CTRL_CYCCNTENA_Msk)
+  static uint32_t lastcycles = 0;
+  static uint32_t remain = 0;
+  static uint32_t tick_us = 0;
+  uint32_t cycles, elapsed, cycles_per_us = SystemCoreClock / 1000000;
+
+  if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk))
+  {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    lastcycles = 0;
+  }
+
+  cycles = DWT->CYCCNT;
+  elapsed = cycles - lastcycles + remain;
+  lastcycles = cycles;
+
+  tick_us += elapsed / cycles_per_us;
+  remain = elapsed % cycles_per_us;
+
+  return tick_us;
+#else
+  return HAL_GetTick() * 1000;
+#endif
+}
+
+
+/**
+  * @brief  开始一项测试
+  * @note   无
+  * @param  backend: 后端名称
+  * @param  test: 测试名称
+  * @param  size: 每次请求的字节数
+  * @retval 无
+  */
+static void SD_Bench_Begin(const char *backend, const char *test, uint32_t size)
+{
+  memset(&SD_Bench.Result, 0, sizeof(SD_Bench.Result));
+  SD_Bench.Result.Backend = backend;
+  SD_Bench.Result.Test = test;
+  SD_Bench.Result.Size = size;
+  SD_Bench.Result.MinTime = 0xFFFFFFFF;
+  SD_Bench.Start = SD_BENCH_GET_US();
+}
+
+
+/**
+  * @brief  记录一次请求
+  * @note   失败的请求计入延时但不计入字节数
+  * @param  time: 请求的延时, 单位us
+  * @param  bytes: 请求的字节数
+  * @param  res: 请求的结果, 0: 成功
+  * @retval 无
+  */
+static void SD_Bench_Record(uint32_t time, uint32_t bytes, int32_t res)
+{
+  SD_Bench_Result_t *result = &SD_Bench.Result;
+
+  if (result->Ops < SD_BENCH_MAX_SAMPLES)
+  {
+    SD_Bench.Samples[result->Ops] = time;
+  }
+  result->Ops++;
+
+  if (res != 0)
+  {
+    result->Errors++;
+  }
+  else
+  {
+    result->Bytes += bytes;
+  }
+
+  if (time < result->MinTime)
+  {
+    result->MinTime = time;
+  }
+  if (time > result->MaxTime)
+  {
+    result->MaxTime = time;
+  }
+}
+
+
+/**
+  * @brief  比较两个延时, 用于qsort()
+  */
+static int SD_Bench_Compare(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+
+/**
+  * @brief  计算延时的分位数
+  * @note   最近秩法, 样本需要已经排序
+  * @param  n: 样本数
+  * @param  percent: 百分位, 1~100
+  * @retval 延时, 单位us
+  */
+static uint32_t SD_Bench_Percentile(uint32_t n, uint32_t percent)
+{
+  uint32_t rank;
+
+  if (n == 0)
+  {
+    return 0;
+  }
+
+  rank = (n * percent + 99) / 100;
+  return SD_Bench.Samples[rank > 0 ? rank - 1 : 0];
+}
+
+
+/**
+  * @brief  结束一项测试并输出结果
+  * @note   无
+  * @param  无
+  * @retval 无
+  */
+static void SD_Bench_End(void)
+{
+  SD_Bench_Result_t *result = &SD_Bench.Result;
+  uint32_t n;
+
+  result->TotalTime = SD_BENCH_GET_US() - SD_Bench.Start;
+
+  n = result->Ops < SD_BENCH_MAX_SAMPLES ? result->Ops : SD_BENCH_MAX_SAMPLES;
+  qsort(SD_Bench.Samples, n, sizeof(SD_Bench.Samples[0]), SD_Bench_Compare);
+
+  result->P50Time = SD_Bench_Percentile(n, 50);
+  result->P90Time = SD_Bench_Percentile(n, 90);
+  result->P99Time = SD_Bench_Percentile(n, 99);
+  if (result->Ops == 0)
+  {
+    result->MinTime = 0;
+  }
+
+  SD_Bench_Printf(result);
+}
+
+
+/**
+  * @brief  输出一项测试结果
+  * @note   每项结果一行JSON, 便于上位机脚本解析和比较:
+  *         mbps = 成功读写的字节数 / 总时间(1MB = 1000000字节), iops = 请求次数 / 总时间;
+  *         为了在不支持浮点printf的库上使用, 小数用整数运算输出
+  * @param  result: 测试结果
+  * @retval 无
+  */
+void SD_Bench_Printf(const SD_Bench_Result_t *result)
+{
+  uint32_t time = result->TotalTime ? result->TotalTime : 1;
+  uint32_t mbps = (uint32_t)((uint64_t)result->Bytes * 1000 / time);        // 单位0.001MB/s
+  uint32_t iops = (uint32_t)((uint64_t)result->Ops * 10000000 / time);      // 单位0.1IOPS
+
+  SD_BENCH_PRINTF("{\"backend\":\"%s\",\"test\":\"%s\",\"size\":%lu,\"ops\":%lu,\"errors\":%lu,"
+                  "\"bytes\":%lu,\"time_us\":%lu,\"mbps\":%lu.%03lu,\"iops\":%lu.%lu,"
+                  "\"min_us\":%lu,\"p50_us\":%lu,\"p90_us\":%lu,\"p99_us\":%lu,\"max_us\":%lu}\r\n",
+                  result->Backend, result->Test, (unsigned long)result->Size,
+                  (unsigned long)result->Ops, (unsigned long)result->Errors,
+                  (unsigned long)result->Bytes, (unsigned long)result->TotalTime,
+                  (unsigned long)(mbps / 1000), (unsigned long)(mbps % 1000),
+                  (unsigned long)(iops / 10), (unsigned long)(iops % 10),
+                  (unsigned long)result->MinTime, (unsigned long)result->P50Time,
+                  (unsigned long)result->P90Time, (unsigned long)result->P99Time,
+                  (unsigned long)result->MaxTime);
+}
+
+
+/**
+  * @brief  测试结束前把设备缓存的数据写入SD卡
+  * @note   写入时间计入总时间, 不计入单次请求的延时
+  * @param  dev: 块设备
+  * @retval 无
+  */
+static void SD_Bench_Sync(const SD_Bench_Device_t *dev)
+{
+  if (dev->Sync != NULL && dev->Sync() != 0)
+  {
+    SD_Bench.Result.Errors++;
+  }
+}
+
+
+/**
+  * @brief  块设备测试
+  * @note   在卡末尾SD_BENCH_AREA_SECTORS个扇区内依次进行:
+  *         各请求大小的顺序写、顺序读, SD_BENCH_RANDOM_SIZE的随机写、随机读;
+  *         测试区域的数据会被覆盖, 只在测试用的卡上运行
+  * @param  dev: 块设备
+  * @retval 0: 成功, 其他: 失败
+  */
+int32_t SD_Bench_Block(const SD_Bench_Device_t *dev)
+{
+  static const uint32_t sizes[] = SD_BENCH_SEQ_SIZES;
+  uint32_t area, size, cnt, ops, sector, start, i, j;
+  int32_t res;
+  uint8_t pass, write;
+
+  if (dev->Init() != 0)
+  {
+    SD_BENCH_PRINTF("{\"backend\":\"%s\",\"error\":\"init\"}\r\n", dev->Name);
+    return 1;
+  }
+
+  area = dev->GetSectors();
+  if (area < SD_BENCH_AREA_SECTORS)
+  {
+    SD_BENCH_PRINTF("{\"backend\":\"%s\",\"error\":\"capacity\"}\r\n", dev->Name);
+    return 1;
+  }
+  area -= SD_BENCH_AREA_SECTORS;
+
+  for (i = 0; i < SD_BENCH_BUFFER_SIZE; i++)
+  {
+    SD_Bench_Buffer[i] = (uint8_t)(i * 7 + (i >> 9));
+  }
+
+  /* 顺序写, 顺序读 */
+  for (pass = 0; pass < 2; pass++)
+  {
+    write = (pass == 0);
+    for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+    {
+      size = sizes[j];
+      cnt = size / 512;
+      ops = SD_BENCH_SEQ_BYTES / size;
+      if (ops * cnt > SD_BENCH_AREA_SECTORS)
+      {
+        ops = SD_BENCH_AREA_SECTORS / cnt;
+      }
+
+      SD_Bench_Begin(dev->Name, write ? "seq_write" : "seq_read", size);
+      for (i = 0; i < ops; i++)
+      {
+        start = SD_BENCH_GET_US();
+        res = write ? dev->Write(SD_Bench_Buffer, area + i * cnt, cnt) : dev->Read(SD_Bench_Buffer, area + i * cnt, cnt);
+        SD_Bench_Record(SD_BENCH_GET_US() - start, size, res);
+      }
+      if (write)
+      {
+        SD_Bench_Sync(dev);
+      }
+      SD_Bench_End();
+    }
+  }
+
+  /* 随机写, 随机读, 请求按请求大小对齐 */
+  size = SD_BENCH_RANDOM_SIZE;
+  cnt = size / 512;
+  for (pass = 0; pass < 2; pass++)
+  {
+    write = (pass == 0);
+    SD_Bench_Seed = 2463534242UL;
+    SD_Bench_Begin(dev->Name, write ? "rand_write" : "rand_read", size);
+    for (i = 0; i < SD_BENCH_RANDOM_OPS; i++)
+    {
+      sector = area + (SD_Bench_Rand() % (SD_BENCH_AREA_SECTORS / cnt)) * cnt;
+      start = SD_BENCH_GET_US();
+      res = write ? dev->Write(SD_Bench_Buffer, sector, cnt) : dev->Read(SD_Bench_Buffer, sector, cnt);
+      SD_Bench_Record(SD_BENCH_GET_US() - start, size, res);
+    }
+    if (write)
+    {
+      SD_Bench_Sync(dev);
+    }
+    SD_Bench_End();
+  }
+
+  return 0;
+}
+
+
+#ifdef SD_BENCH_USE_CRC
+/**
+  * @brief  CRC16测试
+  * @note   crc16: 对SD_BENCH_CRC_OPS个扇区的数据计算TFCARD_CRC16(), 结果格式与其他测试相同;
+  *         crc16_cost: 每个扇区的平均计算时间与当前SPI时钟下传输一个扇区(512字节数据 + 2字节CRC)的时间之比,
+  *         应只占百分之几, 否则应提高SD_CRC16_SLICES或者使用硬件CRC
+  *         {"backend":"spi","test":"crc16_cost","clock_hz":21000000,"crc_ns":6650,"xfer_ns":195809,"percent":3.39}
+  *         连续读(USE_SPI_DMA_READ_STREAM)时校验与下一个扇区的DMA同时进行, 实际增加的时间更少
+  * @param  无
+  * @retval 0: 成功, 其他: 失败
+  */
+int32_t SD_Bench_CRC(void)
+{
+  static volatile uint16_t sink;   // 防止计算被优化掉
+  uint32_t blocks = SD_BENCH_BUFFER_SIZE / 512;
+  uint32_t clock = SD_GetClock();
+  uint32_t start, i, crc_ns, xfer_ns, percent;
+  uint16_t crc = 0;
+
+  if (clock == 0)
+  {
+    SD_BENCH_PRINTF("{\"backend\":\"spi\",\"error\":\"init\"}\r\n");   // SPI_TFCard驱动没有初始化
+    return 1;
+  }
+
+  SD_Bench_Seed = 0x2545F491;
+  for (i = 0; i < SD_BENCH_BUFFER_SIZE; i++)
+  {
+    SD_Bench_Buffer[i] = (uint8_t)SD_Bench_Rand();
+  }
+
+  SD_Bench_Begin("spi", "crc16", 512);
+  for (i = 0; i < SD_BENCH_CRC_OPS; i++)
+  {
+    start = SD_BENCH_GET_US();
+    crc ^= TFCARD_CRC16(&SD_Bench_Buffer[(i % blocks) * 512], 512);
+    SD_Bench_Record(SD_BENCH_GET_US() - start, 512, 0);
+  }
+  sink = crc;
+  SD_Bench_End();
+
+  crc_ns = (uint32_t)((uint64_t)SD_Bench.Result.TotalTime * 1000 / SD_BENCH_CRC_OPS);
+  xfer_ns = (uint32_t)(514ULL * 8 * 1000000000 / clock);
+  percent = (uint32_t)((uint64_t)crc_ns * 10000 / xfer_ns);   // 单位0.01%
+
+  SD_BENCH_PRINTF("{\"backend\":\"spi\",\"test\":\"crc16_cost\",\"clock_hz\":%lu,\"crc_ns\":%lu,\"xfer_ns\":%lu,"
+                  "\"percent\":%lu.%02lu}\r\n",
+                  (unsigned long)clock, (unsigned long)crc_ns, (unsigned long)xfer_ns,
+                  (unsigned long)(percent / 100), (unsigned long)(percent % 100));
+  return 0;
+}
+#endif
+
+
+/*********************************************************************************
+  *
+  * @brief 各后端的块设备接口
+  *
+  *********************************************************************************/
+
+#ifdef SD_BENCH_USE_BSP
+static int32_t SD_Bench_BSP_Init(void)
+{
+  return SPI_SDCard.Init(SPI_SDCard.Handle);
+}
+
+static uint32_t SD_Bench_BSP_GetSectors(void)
+{
+  BSP_SD_CardInfo_t info;
+
+  if (SPI_SDCard.GetInfo(SPI_SDCard.Handle, &info) != 0)
+  {
+    return 0;
+  }
+  return info.BlocksCount;
+}
+
+static int32_t SD_Bench_BSP_Read(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  return SPI_SDCard.ReadSector(SPI_SDCard.Handle, buff, sector, cnt);
+}
+
+static int32_t SD_Bench_BSP_Write(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  return SPI_SDCard.WriteSector(SPI_SDCard.Handle, buff, sector, cnt);
+}
+
+static int32_t SD_Bench_BSP_Read_DMA(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  return SPI_SDCard.ReadSector_DMA(SPI_SDCard.Handle, buff, sector, cnt);
+}
+
+static int32_t SD_Bench_BSP_Write_DMA(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  return SPI_SDCard.WriteSector_DMA(SPI_SDCard.Handle, buff, sector, cnt);
+}
+
+static const SD_Bench_Device_t SD_Bench_BSP =
+{
+  "bsp", SD_Bench_BSP_Init, SD_Bench_BSP_Read, SD_Bench_BSP_Write, NULL, SD_Bench_BSP_GetSectors
+};
+
+static const SD_Bench_Device_t SD_Bench_BSP_DMA =
+{
+  "bsp_dma", SD_Bench_BSP_Init, SD_Bench_BSP_Read_DMA, SD_Bench_BSP_Write_DMA, NULL, SD_Bench_BSP_GetSectors
+};
+#endif
+
+
+#ifdef SD_BENCH_USE_DISKIO
+static int32_t SD_Bench_Diskio_Init(void)
+{
+  return (USER_Driver.disk_initialize(0) & STA_NOINIT) ? 1 : 0;
+}
+
+static uint32_t SD_Bench_Diskio_GetSectors(void)
+{
+  DWORD sectors = 0;
+
+  if (USER_Driver.disk_ioctl(0, GET_SECTOR_COUNT, &sectors) != RES_OK)
+  {
+    return 0;
+  }
+  return sectors;
+}
+
+static int32_t SD_Bench_Diskio_Read(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  return USER_Driver.disk_read(0, buff, sector, cnt) == RES_OK ? 0 : 1;
+}
+
+static int32_t SD_Bench_Diskio_Write(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  return USER_Driver.disk_write(0, buff, sector, cnt) == RES_OK ? 0 : 1;
+}
+
+static int32_t SD_Bench_Diskio_Sync(void)
+{
+  return USER_Driver.disk_ioctl(0, CTRL_SYNC, NULL) == RES_OK ? 0 : 1;
+}
+
+static const SD_Bench_Device_t SD_Bench_Diskio =
+{
+  "diskio", SD_Bench_Diskio_Init, SD_Bench_Diskio_Read, SD_Bench_Diskio_Write, SD_Bench_Diskio_Sync, SD_Bench_Diskio_GetSectors
+};
+#endif
+
+
+#if defined(SD_BENCH_USE_FX_DRIVER) || defined(SD_BENCH_USE_FILEX)
+/* FileX的测试媒体, 驱动请求通过它传递给fx_stm32_sd_driver, 测试时应用不能同时打开SD卡媒体 */
+static FX_MEDIA SD_Bench_Media;
+static UCHAR SD_Bench_MediaMemory[512 * 2] __attribute__ ((aligned (32)));
+static uint8_t SD_Bench_MediaOpen = 0;
+
+static UINT SD_Bench_MediaOpenClose(uint8_t open)
+{
+  UINT status = FX_SUCCESS;
+
+  if (SD_Bench_MediaOpen)
+  {
+    status = fx_media_close(&SD_Bench_Media);
+    SD_Bench_MediaOpen = 0;
+  }
+  if (open)
+  {
+    status = fx_media_open(&SD_Bench_Media, "SD_BENCH", fx_stm32_sd_driver, FX_NULL,
+                           SD_Bench_MediaMemory, sizeof(SD_Bench_MediaMemory));
+    SD_Bench_MediaOpen = (status == FX_SUCCESS);
+  }
+  return status;
+}
+#endif
+
+
+#ifdef SD_BENCH_USE_FX_DRIVER
+/**
+  * @brief  向fx_stm32_sd_driver发送驱动请求
+  * @note   FileX的逻辑扇区从分区开始, 块设备接口的绝对扇区号减去分区前的隐藏扇区数
+  */
+static int32_t SD_Bench_FX_Request(UINT request, uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  SD_Bench_Media.fx_media_driver_request = request;
+  SD_Bench_Media.fx_media_driver_logical_sector = sector - SD_Bench_Media.fx_media_hidden_sectors;
+  SD_Bench_Media.fx_media_driver_sectors = cnt;
+  SD_Bench_Media.fx_media_driver_buffer = buff;
+  SD_Bench_Media.fx_media_driver_status = FX_IO_ERROR;
+
+  fx_stm32_sd_driver(&SD_Bench_Media);
+
+  return SD_Bench_Media.fx_media_driver_status == FX_SUCCESS ? 0 : 1;
+}
+
+static int32_t SD_Bench_FX_Init(void)
+{
+  if (!SD_Bench_MediaOpen && SD_Bench_MediaOpenClose(1) != FX_SUCCESS)
+  {
+    return 1;
+  }
+  /* 驱动请求绕过FileX的扇区缓存, 先把缓存写回 */
+  return fx_media_flush(&SD_Bench_Media) == FX_SUCCESS ? 0 : 1;
+}
+
+static uint32_t SD_Bench_FX_GetSectors(void)
+{
+  return (uint32_t)(SD_Bench_Media.fx_media_hidden_sectors + SD_Bench_Media.fx_media_total_sectors);
+}
+
+static int32_t SD_Bench_FX_Read(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  return SD_Bench_FX_Request(FX_DRIVER_READ, buff, sector, cnt);
+}
+
+static int32_t SD_Bench_FX_Write(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  return SD_Bench_FX_Request(FX_DRIVER_WRITE, buff, sector, cnt);
+}
+
+static int32_t SD_Bench_FX_Sync(void)
+{
+  return SD_Bench_FX_Request(FX_DRIVER_FLUSH, NULL, SD_Bench_Media.fx_media_hidden_sectors, 0);
+}
+
+static const SD_Bench_Device_t SD_Bench_FX =
+{
+  "fx_driver", SD_Bench_FX_Init, SD_Bench_FX_Read, SD_Bench_FX_Write, SD_Bench_FX_Sync, SD_Bench_FX_GetSectors
+};
+#endif
+
+
+#ifdef SD_BENCH_USE_USB
+/* 注意: STORAGE_Read_FS/STORAGE_Write_FS总是返回USBD_OK, 读写错误不会计入errors */
+static int32_t SD_Bench_USB_Init(void)
+{
+  return USBD_Storage_Interface_fops_FS.Init(0) == USBD_OK ? 0 : 1;
+}
+
+static uint32_t SD_Bench_USB_GetSectors(void)
+{
+  uint32_t block_num = 0;
+  uint16_t block_size = 0;
+
+  if (USBD_Storage_Interface_fops_FS.GetCapacity(0, &block_num, &block_size) != USBD_OK || block_size != 512)
+  {
+    return 0;
+  }
+  return block_num;
+}
+
+static int32_t SD_Bench_USB_Read(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  return USBD_Storage_Interface_fops_FS.Read(0, buff, sector, (uint16_t)cnt) == USBD_OK ? 0 : 1;
+}
+
+static int32_t SD_Bench_USB_Write(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  return USBD_Storage_Interface_fops_FS.Write(0, buff, sector, (uint16_t)cnt) == USBD_OK ? 0 : 1;
+}
+
+static const SD_Bench_Device_t SD_Bench_USB =
+{
+  "usb_msc", SD_Bench_USB_Init, SD_Bench_USB_Read, SD_Bench_USB_Write, NULL, SD_Bench_USB_GetSectors
+};
+#endif
+
+
+/*********************************************************************************
+  *
+  * @brief 文件系统测试
+  *
+  *********************************************************************************/
+
+#ifdef SD_BENCH_USE_FATFS
+/**
+  * @brief  FatFs测试
+  * @note   mount: 强制挂载SD_BENCH_MOUNTS次(包括disk_initialize);
+  *         file_create: 在bench目录下创建SD_BENCH_FILES个文件, 每个追加写入SD_BENCH_FILE_APPENDS次后关闭,
+  *         延时是一个文件从创建到关闭的时间; file_delete: 删除这些文件
+  * @param  path: 逻辑驱动器, 如"0:"
+  * @retval 0: 成功, 其他: 失败
+  */
+int32_t SD_Bench_FatFs(const char *path)
+{
+  static FATFS fs;
+  static FIL file;
+  char dir[16], name[32];
+  uint32_t start, i, j;
+  FRESULT res, res2;
+  UINT bw;
+
+  /* 挂载 */
+  SD_Bench_Begin("fatfs", "mount", 0);
+  for (i = 0; i < SD_BENCH_MOUNTS; i++)
+  {
+    f_mount(NULL, path, 0);
+    start = SD_BENCH_GET_US();
+    res = f_mount(&fs, path, 1);
+    SD_Bench_Record(SD_BENCH_GET_US() - start, 0, res);
+  }
+  SD_Bench_End();
+  if (res != FR_OK)
+  {
+    return 1;
+  }
+
+  snprintf(dir, sizeof(dir), "%s/bench", path);
+  res = f_mkdir(dir);
+  if (res != FR_OK && res != FR_EXIST)
+  {
+    f_mount(NULL, path, 0);
+    return 1;
+  }
+
+  /* 小文件创建、追加写入、关闭 */
+  SD_Bench_Begin("fatfs", "file_create", SD_BENCH_FILE_APPENDS * SD_BENCH_APPEND_SIZE);
+  for (i = 0; i < SD_BENCH_FILES; i++)
+  {
+    snprintf(name, sizeof(name), "%s/f%03lu.bin", dir, (unsigned long)i);
+    start = SD_BENCH_GET_US();
+    res = f_open(&file, name, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res == FR_OK)
+    {
+      for (j = 0; j < SD_BENCH_FILE_APPENDS && res == FR_OK; j++)
+      {
+        res = f_write(&file, SD_Bench_Buffer, SD_BENCH_APPEND_SIZE, &bw);
+        if (res == FR_OK && bw != SD_BENCH_APPEND_SIZE)
+        {
+          res = FR_DENIED;   // 磁盘满
+        }
+      }
+      res2 = f_close(&file);
+      if (res == FR_OK)
+      {
+        res = res2;
+      }
+    }
+    SD_Bench_Record(SD_BENCH_GET_US() - start, SD_BENCH_FILE_APPENDS * SD_BENCH_APPEND_SIZE, res);
+  }
+  SD_Bench_End();
+
+  /* 删除 */
+  SD_Bench_Begin("fatfs", "file_delete", 0);
+  for (i = 0; i < SD_BENCH_FILES; i++)
+  {
+    snprintf(name, sizeof(name), "%s/f%03lu.bin", dir, (unsigned long)i);
+    start = SD_BENCH_GET_US();
+    res = f_unlink(name);
+    SD_Bench_Record(SD_BENCH_GET_US() - start, 0, res);
+  }
+  SD_Bench_End();
+
+  f_unlink(dir);
+  f_mount(NULL, path, 0);
+
+  return 0;
+}
+#endif
+
+
+#ifdef SD_BENCH_USE_FILEX
+/**
+  * @brief  FileX测试
+  * @note   mount: 打开媒体SD_BENCH_MOUNTS次(每次先关闭);
+  *         file_create: 同FatFs测试, 关闭文件后调用fx_media_flush()使结果和FatFs的f_close()可比;
+  *         file_delete: 删除这些文件; 测试结束时媒体保持打开, 供fx_driver测试使用
+  * @param  无
+  * @retval 0: 成功, 其他: 失败
+  */
+int32_t SD_Bench_FileX(void)
+{
+  static FX_FILE file;
+  char name[32];
+  uint32_t start, i, j;
+  UINT status, status2;
+
+  /* 挂载 */
+  SD_Bench_Begin("filex", "mount", 0);
+  for (i = 0; i < SD_BENCH_MOUNTS; i++)
+  {
+    SD_Bench_MediaOpenClose(0);
+    start = SD_BENCH_GET_US();
+    status = SD_Bench_MediaOpenClose(1);
+    SD_Bench_Record(SD_BENCH_GET_US() - start, 0, status);
+  }
+  SD_Bench_End();
+  if (status != FX_SUCCESS)
+  {
+    return 1;
+  }
+
+  status = fx_directory_create(&SD_Bench_Media, "bench");
+  if (status != FX_SUCCESS && status != FX_ALREADY_CREATED)
+  {
+    return 1;
+  }
+
+  /* 小文件创建、追加写入、关闭 */
+  SD_Bench_Begin("filex", "file_create", SD_BENCH_FILE_APPENDS * SD_BENCH_APPEND_SIZE);
+  for (i = 0; i < SD_BENCH_FILES; i++)
+  {
+    snprintf(name, sizeof(name), "bench/f%03lu.bin", (unsigned long)i);
+    start = SD_BENCH_GET_US();
+    status = fx_file_create(&SD_Bench_Media, name);
+    if (status == FX_SUCCESS || status == FX_ALREADY_CREATED)
+    {
+      status = fx_file_open(&SD_Bench_Media, &file, name, FX_OPEN_FOR_WRITE);
+    }
+    if (status == FX_SUCCESS)
+    {
+      status = fx_file_truncate(&file, 0);
+      for (j = 0; j < SD_BENCH_FILE_APPENDS && status == FX_SUCCESS; j++)
+      {
+        status = fx_file_write(&file, SD_Bench_Buffer, SD_BENCH_APPEND_SIZE);
+      }
+      status2 = fx_file_close(&file);
+      if (status == FX_SUCCESS)
+      {
+        status = status2;
+      }
+      status2 = fx_media_flush(&SD_Bench_Media);
+      if (status == FX_SUCCESS)
+      {
+        status = status2;
+      }
+    }
+    SD_Bench_Record(SD_BENCH_GET_US() - start, SD_BENCH_FILE_APPENDS * SD_BENCH_APPEND_SIZE, status);
+  }
+  SD_Bench_End();
+
+  /* 删除 */
+  SD_Bench_Begin("filex", "file_delete", 0);
+  for (i = 0; i < SD_BENCH_FILES; i++)
+  {
+    snprintf(name, sizeof(name), "bench/f%03lu.bin", (unsigned long)i);
+    start = SD_BENCH_GET_US();
+    status = fx_file_delete(&SD_Bench_Media, name);
+    if (status == FX_SUCCESS)
+    {
+      status = fx_media_flush(&SD_Bench_Media);
+    }
+    SD_Bench_Record(SD_BENCH_GET_US() - start, 0, status);
+  }
+  SD_Bench_End();
+
+  fx_directory_delete(&SD_Bench_Media, "bench");
+  fx_media_flush(&SD_Bench_Media);
+
+  return 0;
+}
+#endif
+
+
+/**
+  * @brief  依次测试所有定义的后端
+  * @note   先测试文件系统, 再测试会覆盖卡末尾数据的块设备;
+  *         测试前应用不能打开文件系统或USB MSC, 测试后需要重新挂载
+  * @param  无
+  * @retval 无
+  */
+void SD_Bench_Run(void)
+{
+#ifdef SD_BENCH_USE_FATFS
+  SD_Bench_FatFs("0:");
+#endif
+#ifdef SD_BENCH_USE_FILEX
+  SD_Bench_FileX();
+#endif
+
+#ifdef SD_BENCH_USE_DISKIO
+  SD_Bench_Block(&SD_Bench_Diskio);
+#endif
+#ifdef SD_BENCH_USE_FX_DRIVER
+  if (SD_Bench_Block(&SD_Bench_FX) == 0)
+  {
+    fx_media_cache_invalidate(&SD_Bench_Media);   // 驱动请求改写了测试区域, 丢弃缓存中的旧数据
+  }
+#endif
+#ifdef SD_BENCH_USE_BSP
+  SD_Bench_Block(&SD_Bench_BSP);
+  SD_Bench_Block(&SD_Bench_BSP_DMA);
+#endif
+#ifdef SD_BENCH_USE_USB
+  SD_Bench_Block(&SD_Bench_USB);
+#endif
+#ifdef SD_BENCH_USE_CRC
+  SD_Bench_CRC();   // 使用前面的测试初始化后的SPI时钟
+#endif
+
+#if defined(SD_BENCH_USE_FX_DRIVER) || defined(SD_BENCH_USE_FILEX)
+  SD_Bench_MediaOpenClose(0);
+#endif
+}
@@ -0,0 +1,93 @@
+#ifndef __SD_BENCHMARK_H__
+#define __SD_BENCHMARK_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+/*********************************************************************************
+  * !!! 警告: 块设备测试(SD_BENCH_USE_BSP/DISKIO/FX_DRIVER/USB)直接改写卡末尾
+  * !!! SD_BENCH_AREA_SECTORS(默认8192)个扇区, 其中的数据(文件)会丢失且不做备份,
+  * !!! 只在测试用的卡上运行
+  *********************************************************************************/
+
+
+/* 测试的后端, 工程中没有的后端注释掉.
+   SPI_TFCard和bsp_SPI_TFCard驱动都提供spi_tfcard.h且符号冲突, 只能启用其中一个驱动的后端 */
+
+/* SPI_TFCard驱动(本工程FatFs/FileX的底层接口使用该驱动) */
+#define SD_BENCH_USE_DISKIO               // FatFs底层接口USER_Driver
+#define SD_BENCH_USE_FATFS                // FatFs文件系统: 挂载时间和小文件操作
+#define SD_BENCH_USE_FX_DRIVER            // FileX驱动fx_stm32_sd_driver
+#define SD_BENCH_USE_FILEX                // FileX文件系统: 挂载时间和小文件操作
+#define SD_BENCH_USE_CRC                  // SPI_TFCard驱动的数据块CRC16计算时间(USE_SD_CRC), 与当前时钟下一个扇区的传输时间比较
+
+/* bsp_SPI_TFCard驱动(本工程USB MSC的底层接口使用该驱动), 定义时注释掉上面SPI_TFCard驱动的后端 */
+//#define SD_BENCH_USE_BSP                // BSP_SDCard_t的ReadSector/WriteSector和DMA接口
+//#define SD_BENCH_USE_USB                // USB MSC的USBD_Storage_Interface_fops_FS
+
+#if (defined(SD_BENCH_USE_BSP) || defined(SD_BENCH_USE_USB)) \
+    && (defined(SD_BENCH_USE_DISKIO) || defined(SD_BENCH_USE_FATFS) || defined(SD_BENCH_USE_FX_DRIVER) \
+        || defined(SD_BENCH_USE_FILEX) || defined(SD_BENCH_USE_CRC))
+#error "SD_BENCH_USE_BSP/USB(bsp_SPI_TFCard) and DISKIO/FATFS/FX_DRIVER/FILEX/CRC(SPI_TFCard) use different drivers"
+#endif
+
+/* 块设备测试 */
+#define SD_BENCH_AREA_SECTORS     8192    // 块设备测试使用卡末尾的扇区数, 其中的数据会被覆盖
+#define SD_BENCH_SEQ_BYTES        (512 * 1024)              // 每种请求大小顺序读写的总字节数
+#define SD_BENCH_SEQ_SIZES        {512, 4096, 32768}        // 顺序读写的请求大小, 单位字节, 必须是512的倍数
+#define SD_BENCH_RANDOM_SIZE      4096    // 随机读写的请求大小, 单位字节
+#define SD_BENCH_RANDOM_OPS       256     // 随机读写的请求次数
+#define SD_BENCH_BUFFER_SIZE      32768   // 数据缓冲区大小, 不能小于最大的请求大小
+#define SD_BENCH_CRC_OPS          256     // CRC16测试计算的扇区数
+
+/* 文件系统测试 */
+#define SD_BENCH_MOUNTS           5       // 挂载次数
+#define SD_BENCH_FILES            32      // 创建的小文件个数
+#define SD_BENCH_FILE_APPENDS     4       // 每个文件追加写入的次数
+#define SD_BENCH_APPEND_SIZE      512     // 每次追加写入的字节数
+
+#define SD_BENCH_MAX_SAMPLES      1024    // 记录延时的请求数, 超过时后面的请求只计入吞吐量不计入延时分位数
+
+#define SD_BENCH_GET_US()         SD_Bench_GetTick_us()   // 微秒计时, 默认DWT周期计数器(没有DWT的内核用HAL_GetTick(), 精度1ms)
+#define SD_BENCH_PRINTF           printf             // 结果输出
+
+
+/* 块设备接口, 扇区号都是卡上的绝对扇区号 */
+typedef struct
+{
+  const char *Name;                                                 // 输出结果中的后端名称
+  int32_t  (*Init)(void);                                           // 初始化, 0: 成功
+  int32_t  (*Read)(uint8_t *buff, uint32_t sector, uint32_t cnt);   // 读扇区, 0: 成功
+  int32_t  (*Write)(uint8_t *buff, uint32_t sector, uint32_t cnt);  // 写扇区, 0: 成功
+  int32_t  (*Sync)(void);                                           // 把缓存的数据写入SD卡, 没有缓存时为NULL
+  uint32_t (*GetSectors)(void);                                     // 卡的扇区数
+} SD_Bench_Device_t;
+
+/* 一项测试的结果 */
+typedef struct
+{
+  const char *Backend;    // 后端名称
+  const char *Test;       // 测试名称
+  uint32_t Size;          // 每次请求的字节数
+  uint32_t Ops;           // 请求次数
+  uint32_t Errors;        // 失败的请求次数
+  uint32_t Bytes;         // 读写的总字节数
+  uint32_t TotalTime;     // 总时间(包括最后的Sync), 单位us
+  uint32_t MinTime;       // 单次请求的最小延时, 单位us
+  uint32_t P50Time;       // 延时的50%分位数, 单位us
+  uint32_t P90Time;       // 延时的90%分位数, 单位us
+  uint32_t P99Time;       // 延时的99%分位数, 单位us
+  uint32_t MaxTime;       // 单次请求的最大延时, 单位us
+} SD_Bench_Result_t;
+
+
+void    SD_Bench_Run(void);                                          // 依次测试所有定义的后端
+int32_t SD_Bench_Block(const SD_Bench_Device_t *dev);                // 块设备测试: 顺序读写和随机读写
+int32_t SD_Bench_FatFs(const char *path);                           // FatFs测试: 挂载时间和小文件操作
+int32_t SD_Bench_FileX(void);                                       // FileX测试: 挂载时间和小文件操作
+int32_t SD_Bench_CRC(void);                                         // CRC16测试: 每个扇区的计算时间和占传输时间的比例
+void    SD_Bench_Printf(const SD_Bench_Result_t *result);           // 输出一项测试结果(一行JSON)
+uint32_t SD_Bench_GetTick_us(void);                                 // 默认的微秒计时
+
+#endif
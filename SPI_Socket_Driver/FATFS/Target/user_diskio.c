@@ -36,6 +36,7 @@
 #include <string.h>
 #include "ff_gen_drv.h"
 #include "spi_tfcard.h"
+#include "user_diskio_cache.h"
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 
@@ -83,6 +84,9 @@ DSTATUS USER_initialize (
   /* USER CODE BEGIN INIT */
 	
 	Stat = SD_Card_Init();
+#ifdef USE_SD_CACHE
+	SD_Cache_Init();
+#endif
 	if (Stat == 0)
 		return RES_OK;
 	else
@@ -129,7 +133,11 @@ DRESULT USER_read (
 {
   /* USER CODE BEGIN READ */
 	
+#ifdef USE_SD_CACHE
+  Stat = SD_Cache_Read(buff, sector, count);
+#else
   Stat = SD_ReadSector(buff, sector, count);
+#endif
   if (Stat == 0)
 		return RES_OK;
   else
@@ -157,7 +165,11 @@ DRESULT USER_write (
   /* USER CODE BEGIN WRITE */
   /* USER CODE HERE */
 	
+#ifdef USE_SD_CACHE
+  Stat = SD_Cache_Write(buff, sector, count);
+#else
   Stat = SD_WriteSector((uint8_t *)buff, sector, count);
+#endif
   if (Stat == 0)
 		return RES_OK;
   else
@@ -167,6 +179,29 @@ DRESULT USER_write (
 }
 #endif /* _USE_WRITE == 1 */
 
+#if _USE_TRIM == 1
+/**
+  * @brief  放弃扇区中的数据(CTRL_TRIM)
+  * @note   缓存中的扇区直接丢弃, 范围交给SD卡驱动合并, 在CTRL_SYNC时擦除其中完整的擦除单元
+  * @param  start: 起始扇区
+  * @param  end: 结束扇区(包括)
+  * @retval DRESULT: Operation result
+  */
+static DRESULT USER_trim(DWORD start, DWORD end)
+{
+  if (end < start)
+    return RES_PARERR;
+
+#ifdef USE_SD_CACHE
+  SD_Cache_Discard(start, end - start + 1);
+#endif
+  if (SD_DiscardSector(start, end - start + 1) == 0)
+    return RES_OK;
+  else
+    return RES_ERROR;
+}
+#endif /* _USE_TRIM == 1 */
+
 /**
   * @brief  I/O control operation
   * @param  pdrv: Physical drive number (0..)
@@ -186,7 +221,14 @@ DRESULT USER_ioctl (
   DRESULT res;
 	if (pdrv == 0) {
 	    switch(cmd) {
-		    case CTRL_SYNC: res = RES_OK; break;
+#ifdef USE_SD_CACHE
+		    case CTRL_SYNC: res = (SD_Cache_Flush() == 0 && SD_Stream_Close() == 0 && SD_Discard_Flush() == 0) ? RES_OK : RES_ERROR; break;
+#else
+		    case CTRL_SYNC: res = (SD_Stream_Close() == 0 && SD_Discard_Flush() == 0) ? RES_OK : RES_ERROR; break;
+#endif
+#if _USE_TRIM == 1
+		    case CTRL_TRIM: res = USER_trim(((DWORD*)buff)[0], ((DWORD*)buff)[1]); break;
+#endif
 		    case GET_SECTOR_SIZE: *(DWORD*)buff = 512; res = RES_OK; break;
 		    case GET_BLOCK_SIZE: *(WORD*)buff = 512; res = RES_OK; break;
 		    case GET_SECTOR_COUNT: *(DWORD*)buff = SD_GetSectorCount(); res = RES_OK; break;
@@ -0,0 +1,316 @@
+#include <string.h>
+#include "user_diskio_cache.h"
+
+#ifdef USE_SD_CACHE
+
+/* 缓存项和缓存数据, 数据按4字节对齐以便DMA访问 */
+static SD_Cache_Entry_typedef SD_Cache_Entry[SD_CACHE_SECTORS];
+static uint8_t SD_Cache_Data[SD_CACHE_SECTORS][512] __attribute__ ((aligned (4)));
+
+/* CLOCK替换算法的指针 */
+static uint16_t SD_Cache_Hand;
+
+/* 缓存统计 */
+static SD_Cache_Stats_typedef SD_Cache_Stats;
+
+
+/**
+  * @brief  清空缓存
+  * @note   修改过的扇区不会写回, 需要保留时先调用SD_Cache_Flush()
+  * @param  无
+  * @retval 无
+  */
+void SD_Cache_Init(void)
+{
+	memset(SD_Cache_Entry, 0, sizeof(SD_Cache_Entry));
+	memset(&SD_Cache_Stats, 0, sizeof(SD_Cache_Stats));
+	SD_Cache_Hand = 0;
+}
+
+
+/**
+  * @brief  查找扇区所在的缓存项
+  * @note   无
+  * @param  sector: 扇区号
+  * @retval 缓存项编号, -1: 未缓存
+  */
+static int16_t SD_Cache_Find(uint32_t sector)
+{
+	uint16_t i;
+
+	for (i = 0; i < SD_CACHE_SECTORS; i++)
+	{
+		if (SD_Cache_Entry[i].Valid && SD_Cache_Entry[i].Sector == sector)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+
+/**
+  * @brief  分配一个缓存项
+  * @note   CLOCK算法: 跳过最近访问过的项并清除其访问标志, 优先替换未修改的项;
+  *         转两圈仍然没有可替换的项时(全部修改过), 先把所有修改过的扇区写回SD卡
+  * @param  无
+  * @retval 缓存项编号, -1: 写回失败
+  */
+static int16_t SD_Cache_Alloc(void)
+{
+	SD_Cache_Entry_typedef *entry;
+	uint16_t i, n;
+
+	for (n = 0; n < 2 * SD_CACHE_SECTORS; n++)
+	{
+		i = SD_Cache_Hand;
+		SD_Cache_Hand = (SD_Cache_Hand + 1) % SD_CACHE_SECTORS;
+		entry = &SD_Cache_Entry[i];
+
+		if (!entry->Valid)
+		{
+			return i;
+		}
+		if (entry->Ref)
+		{
+			entry->Ref = 0;   // 给一次机会
+			continue;
+		}
+		if (!entry->Dirty)
+		{
+			return i;
+		}
+	}
+
+	if (SD_Cache_Flush() != 0)
+	{
+		return -1;
+	}
+
+	i = SD_Cache_Hand;
+	SD_Cache_Hand = (SD_Cache_Hand + 1) % SD_CACHE_SECTORS;
+	return i;
+}
+
+
+/**
+  * @brief  经过缓存读扇区
+  * @note   扇区数不小于SD_CACHE_BYPASS_SECTORS时直接从SD卡读取, 再用缓存中修改过的扇区覆盖;
+  *         否则命中的扇区从缓存拷贝, 连续未命中的扇区一次从SD卡读取后放入缓存
+  * @param  buff: 数据缓冲区
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @retval 0: 成功, 其他: 失败
+  */
+uint8_t SD_Cache_Read(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+	uint32_t run, j;
+	int16_t i;
+
+	if (cnt >= SD_CACHE_BYPASS_SECTORS)
+	{
+		if (SD_ReadSector(buff, sector, cnt) != 0)
+		{
+			return 1;
+		}
+
+		for (i = 0; i < SD_CACHE_SECTORS; i++)
+		{
+			if (SD_Cache_Entry[i].Valid && SD_Cache_Entry[i].Dirty && (SD_Cache_Entry[i].Sector - sector < cnt))
+			{
+				memcpy(buff + (SD_Cache_Entry[i].Sector - sector) * 512, SD_Cache_Data[i], 512);
+			}
+		}
+		return 0;
+	}
+
+	while (cnt)
+	{
+		i = SD_Cache_Find(sector);
+		if (i >= 0)   // 命中
+		{
+			memcpy(buff, SD_Cache_Data[i], 512);
+			SD_Cache_Entry[i].Ref = 1;
+			SD_Cache_Stats.ReadHits++;
+			run = 1;
+		}
+		else   // 未命中, 连续未命中的扇区一起读取
+		{
+			for (run = 1; run < cnt && SD_Cache_Find(sector + run) < 0; run++)
+			{
+			}
+
+			if (SD_ReadSector(buff, sector, run) != 0)
+			{
+				return 1;
+			}
+
+			for (j = 0; j < run; j++)
+			{
+				i = SD_Cache_Alloc();
+				if (i < 0)
+				{
+					return 1;
+				}
+				memcpy(SD_Cache_Data[i], buff + j * 512, 512);
+				SD_Cache_Entry[i].Sector = sector + j;
+				SD_Cache_Entry[i].Valid = 1;
+				SD_Cache_Entry[i].Dirty = 0;
+				SD_Cache_Entry[i].Ref = 0;   // 再次访问时才设置, 一次性读取的扇区先被替换
+			}
+			SD_Cache_Stats.ReadMisses += run;
+		}
+
+		buff += run * 512;
+		sector += run;
+		cnt -= run;
+	}
+
+	return 0;
+}
+
+
+/**
+  * @brief  经过缓存写扇区
+  * @note   扇区数不小于SD_CACHE_BYPASS_SECTORS时丢弃缓存中的旧数据, 直接写入SD卡;
+  *         否则只写入缓存并标记为修改, 在SD_Cache_Flush()或者被替换时写回SD卡
+  * @param  buff: 数据缓冲区
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @retval 0: 成功, 其他: 失败
+  */
+uint8_t SD_Cache_Write(const uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+	int16_t i;
+
+	if (cnt >= SD_CACHE_BYPASS_SECTORS)
+	{
+		for (i = 0; i < SD_CACHE_SECTORS; i++)
+		{
+			if (SD_Cache_Entry[i].Valid && (SD_Cache_Entry[i].Sector - sector < cnt))
+			{
+				SD_Cache_Entry[i].Valid = 0;   // 整个扇区会被覆盖, 旧数据不需要写回
+				SD_Cache_Entry[i].Dirty = 0;
+			}
+		}
+		return SD_WriteSector((uint8_t *)buff, sector, cnt);
+	}
+
+	while (cnt--)
+	{
+		i = SD_Cache_Find(sector);
+		if (i >= 0)
+		{
+			SD_Cache_Entry[i].Ref = 1;
+			SD_Cache_Stats.WriteHits++;
+		}
+		else
+		{
+			i = SD_Cache_Alloc();
+			if (i < 0)
+			{
+				return 1;
+			}
+			SD_Cache_Entry[i].Sector = sector;
+			SD_Cache_Entry[i].Valid = 1;
+			SD_Cache_Entry[i].Ref = 0;
+		}
+
+		memcpy(SD_Cache_Data[i], buff, 512);
+		SD_Cache_Entry[i].Dirty = 1;
+
+		buff += 512;
+		sector++;
+	}
+
+	return 0;
+}
+
+
+/**
+  * @brief  把修改过的扇区写回SD卡
+  * @note   按扇区号从小到大写回, 扇区号连续的项合并成一次多扇区写;
+  *         写回失败的扇区保持修改状态, 下次再写
+  * @param  无
+  * @retval 0: 成功, 其他: 失败
+  */
+uint8_t SD_Cache_Flush(void)
+{
+	uint16_t order[SD_CACHE_SECTORS];   // 按扇区号排序的修改过的缓存项
+	uint8_t *list[SD_CACHE_SECTORS];
+	uint16_t n = 0, i, j, run;
+	uint32_t sector;
+
+	for (i = 0; i < SD_CACHE_SECTORS; i++)
+	{
+		if (SD_Cache_Entry[i].Valid && SD_Cache_Entry[i].Dirty)
+		{
+			sector = SD_Cache_Entry[i].Sector;
+			for (j = n++; j > 0 && SD_Cache_Entry[order[j - 1]].Sector > sector; j--)
+			{
+				order[j] = order[j - 1];
+			}
+			order[j] = i;
+		}
+	}
+
+	for (i = 0; i < n; i += run)
+	{
+		sector = SD_Cache_Entry[order[i]].Sector;
+		for (run = 0; (i + run < n) && (SD_Cache_Entry[order[i + run]].Sector == sector + run); run++)
+		{
+			list[run] = SD_Cache_Data[order[i + run]];
+		}
+
+		if (SD_WriteSectorList(list, sector, run) != 0)
+		{
+			return 1;
+		}
+
+		for (j = 0; j < run; j++)
+		{
+			SD_Cache_Entry[order[i + j]].Dirty = 0;
+		}
+		SD_Cache_Stats.Flushes++;
+		SD_Cache_Stats.FlushSectors += run;
+	}
+
+	return 0;
+}
+
+
+/**
+  * @brief  丢弃缓存中的扇区
+  * @note   用于TRIM: 扇区中的数据已经不再需要, 修改过的也不写回
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @retval 无
+  */
+void SD_Cache_Discard(uint32_t sector, uint32_t cnt)
+{
+	uint16_t i;
+
+	for (i = 0; i < SD_CACHE_SECTORS; i++)
+	{
+		if (SD_Cache_Entry[i].Valid && (SD_Cache_Entry[i].Sector - sector < cnt))
+		{
+			SD_Cache_Entry[i].Valid = 0;
+			SD_Cache_Entry[i].Dirty = 0;
+		}
+	}
+}
+
+
+/**
+  * @brief  获取缓存统计
+  * @note   无
+  * @param  stats: 统计信息
+  * @retval 无
+  */
+void SD_Cache_GetStats(SD_Cache_Stats_typedef *stats)
+{
+	*stats = SD_Cache_Stats;
+}
+
+#endif
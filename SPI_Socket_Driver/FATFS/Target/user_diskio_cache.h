@@ -0,0 +1,42 @@
+#ifndef __USER_DISKIO_CACHE_H__
+#define __USER_DISKIO_CACHE_H__
+
+#include "spi_tfcard.h"
+
+
+//#define USE_SD_CACHE               // 定义FatFs读写经过扇区缓存(写回), 数据在CTRL_SYNC时才写入SD卡
+                                     // 只有FatFs经过缓存, FileX/USB MSC直接访问SD卡, 会读到缓存中未写回的旧数据,
+                                     // 缓存中也不会更新它们写入的扇区; 只在FatFs是唯一的访问者时定义
+
+#define SD_CACHE_SECTORS        16   // 缓存的扇区数, 每个扇区占用512字节RAM
+#define SD_CACHE_BYPASS_SECTORS 8    // 一次读写的扇区数达到该值时直接访问SD卡, 不经过缓存
+
+
+/* 缓存项 */
+typedef struct
+{
+  uint32_t Sector;        // 扇区号
+  uint8_t  Valid;         // 数据有效
+  uint8_t  Dirty;         // 数据已修改, 还没有写入SD卡
+  uint8_t  Ref;           // CLOCK替换算法的访问标志
+} SD_Cache_Entry_typedef;
+
+/* 缓存统计 */
+typedef struct
+{
+  uint32_t ReadHits;      // 读命中的扇区数
+  uint32_t ReadMisses;    // 读未命中的扇区数
+  uint32_t WriteHits;     // 写命中的扇区数(覆盖缓存中的扇区)
+  uint32_t Flushes;       // 写回SD卡的次数(合并后的多扇区写)
+  uint32_t FlushSectors;  // 写回SD卡的扇区数
+} SD_Cache_Stats_typedef;
+
+
+void    SD_Cache_Init(void);                                            // 清空缓存
+uint8_t SD_Cache_Read(uint8_t *buff, uint32_t sector, uint32_t cnt);     // 经过缓存读扇区
+uint8_t SD_Cache_Write(const uint8_t *buff, uint32_t sector, uint32_t cnt);  // 经过缓存写扇区
+uint8_t SD_Cache_Flush(void);                                           // 把修改过的扇区写回SD卡
+void    SD_Cache_Discard(uint32_t sector, uint32_t cnt);                // 丢弃缓存中的扇区(TRIM)
+void    SD_Cache_GetStats(SD_Cache_Stats_typedef *stats);               // 获取缓存统计
+
+#endif
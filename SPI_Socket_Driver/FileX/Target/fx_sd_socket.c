@@ -84,6 +84,33 @@ INT fx_stm32_sd_get_status(UINT Instance)
 }
 
 
+/**
+  * @brief  FileX底层的等待磁盘状态函数
+  * @note   在同一次片选内轮询SD卡状态, 代替反复调用fx_stm32_sd_get_status()
+  * @param  Instance: 磁盘编号
+  * @param  Timeout: 超时时间, 单位ms
+  * @retval 结果 0-成功，其他-失败
+  */
+INT fx_stm32_sd_wait_status(UINT Instance, UINT Timeout)
+{
+	int32_t res = 1;
+	
+	if (Instance == FX_STM32_SD_INSTANCE)
+	{
+		res = SD_WaitCardState(Timeout);
+	}
+	
+	if (res == 0)
+	{
+	  return 0;
+	}
+	else
+	{
+		return 1;
+	}
+}
+
+
 /**
   * @brief  FileX底层的读磁盘函数
   * @note   无
@@ -142,6 +169,65 @@ INT fx_stm32_sd_write_blocks(UINT Instance, UINT *Buffer, UINT StartSector, UINT
 }
 
 
+/**
+  * @brief  FileX底层的同步磁盘函数
+  * @note   关闭SD卡驱动中保持打开的连续读写传输, 擦除释放扇区时等待中的范围
+  * @param  Instance: 磁盘编号
+  * @retval 结果 0-成功，其他-失败
+  */
+INT fx_stm32_sd_flush(UINT Instance)
+{
+	int32_t res = 0;
+	
+	if (Instance == FX_STM32_SD_INSTANCE)
+	{
+		res = SD_Stream_Close();
+		if (SD_Discard_Flush() != 0)
+		{
+			res = 1;
+		}
+	}
+	
+	if (res == 0)
+	{
+	  return 0;
+	}
+	else
+	{
+		return 1;
+	}
+}
+
+
+/**
+  * @brief  FileX底层的释放扇区函数
+  * @note   FileX释放簇时调用, 扇区放入等待擦除的列表, 在fx_stm32_sd_flush()中擦除
+  * @param  Instance: 磁盘编号
+  * @param  StartSector: 扇区编号
+  * @param  NbrOfBlocks: 扇区数
+  * @retval 结果 0-成功，其他-失败
+  */
+INT fx_stm32_sd_release_blocks(UINT Instance, UINT StartSector, UINT NbrOfBlocks)
+{
+	int32_t res = 0;
+	
+	if (Instance == FX_STM32_SD_INSTANCE)
+	{
+		res = SD_DiscardSector(StartSector, NbrOfBlocks);
+	}
+	
+	if (res == 0)
+	{
+	  return 0;
+	}
+	else
+	{
+		return 1;
+	}
+}
+
+
+
 
 
 
@@ -35,17 +35,7 @@ static UINT is_initialized = 0;
 
 static INT check_sd_status(uint32_t instance)
 {
-  uint32_t start = FX_STM32_SD_CURRENT_TIME();
-
-  while (FX_STM32_SD_CURRENT_TIME() - start < FX_STM32_SD_DEFAULT_TIMEOUT)
-  {
-    if (fx_stm32_sd_get_status(instance) == 0)
-    {
-      return 0;
-    }
-  }
-
-  return 1;
+  return fx_stm32_sd_wait_status(instance, FX_STM32_SD_DEFAULT_TIMEOUT);
 }
 
 /**
@@ -89,6 +79,9 @@ VOID  fx_stm32_sd_driver(FX_MEDIA *media_ptr)
     {
       media_ptr->fx_media_driver_status = FX_SUCCESS;
 
+      /* request FX_DRIVER_RELEASE_SECTORS when clusters are freed */
+      media_ptr->fx_media_driver_free_sector_update = FX_TRUE;
+
       FX_STM32_SD_PRE_INIT(media_ptr);
 
 #if (FX_STM32_SD_INIT == 1)
@@ -162,11 +155,33 @@ VOID  fx_stm32_sd_driver(FX_MEDIA *media_ptr)
 
   case FX_DRIVER_FLUSH:
     {
+      /* close any multi-block transfer left open by the SD driver */
+      if (fx_stm32_sd_flush(FX_STM32_SD_INSTANCE) != 0)
+      {
+        media_ptr->fx_media_driver_status = FX_IO_ERROR;
+        break;
+      }
+
       /* Return driver success.  */
       media_ptr->fx_media_driver_status =  FX_SUCCESS;
       break;
     }
 
+  case FX_DRIVER_RELEASE_SECTORS:
+    {
+      /* queue the freed sectors for erase, they are erased on the next flush */
+      if (fx_stm32_sd_release_blocks(FX_STM32_SD_INSTANCE,
+                                     (UINT)(media_ptr->fx_media_driver_logical_sector + media_ptr->fx_media_hidden_sectors),
+                                     media_ptr->fx_media_driver_sectors) != 0)
+      {
+        media_ptr->fx_media_driver_status = FX_IO_ERROR;
+        break;
+      }
+
+      media_ptr->fx_media_driver_status =  FX_SUCCESS;
+      break;
+    }
+
   case FX_DRIVER_ABORT:
     {
       /* Return driver success.  */
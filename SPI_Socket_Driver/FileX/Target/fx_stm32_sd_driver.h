@@ -202,6 +202,10 @@ VOID  fx_stm32_sd_driver(FX_MEDIA *media_ptr);
 
 /* USER CODE BEGIN EFP */
 
+INT fx_stm32_sd_flush(UINT Instance);
+INT fx_stm32_sd_release_blocks(UINT Instance, UINT StartSector, UINT NbrOfBlocks);
+INT fx_stm32_sd_wait_status(UINT Instance, UINT Timeout);
+
 /* USER CODE END EFP */
 
 /* Private defines -----------------------------------------------------------*/
@@ -0,0 +1,897 @@
+#include "sd_card_sim.h"
+#include <stdlib.h>
+
+
+/* 卡的工作状态 */
+#define SIM_MODE_CMD            0   // 等待命令
+#define SIM_MODE_READ           1   // CMD17/CMD18数据输出
+#define SIM_MODE_WRITE_TOKEN    2   // CMD24/CMD25等待数据起始令牌
+#define SIM_MODE_WRITE_DATA     3   // CMD24/CMD25接收数据
+
+#define SIM_QUEUE_SIZE          1024
+
+/* 默认时序参数: 类型, 初始化轮询次数, 读访问延时, 编程时间, 擦除时间, 垃圾回收间隔和时间, 最大时钟, 高速模式 */
+const SD_Sim_Profile_t SD_Sim_Profile_SDHC = {SD_SIM_TYPE_SDHC, 8, 200, 250, 2000, 256, 40000, 50000000, 1};
+const SD_Sim_Profile_t SD_Sim_Profile_SDV2 = {SD_SIM_TYPE_SDV2, 8, 300, 400, 3000, 0, 0, 25000000, 0};
+const SD_Sim_Profile_t SD_Sim_Profile_SDV1 = {SD_SIM_TYPE_SDV1, 8, 500, 600, 4000, 0, 0, 25000000, 0};
+const SD_Sim_Profile_t SD_Sim_Profile_MMC  = {SD_SIM_TYPE_MMC,  8, 500, 800, 4000, 0, 0, 20000000, 0};
+
+/* 模拟卡状态 */
+static struct
+{
+  FILE *Image;
+  uint32_t Sectors;
+  SD_Sim_Profile_t Profile;
+  SD_Sim_Stats_t Stats;
+
+  uint8_t  CS;                // 片选电平
+  uint32_t Clock_Hz;          // SPI时钟
+  uint64_t Now_ns;            // 总线时间
+  uint64_t Busy_ns;           // 忙结束时间
+  uint64_t Ready_ns;          // 读数据就绪时间
+
+  uint8_t  Idle;              // 空闲状态(R1 bit0)
+  uint8_t  AppCmd;            // 上一条命令为CMD55
+  uint8_t  CrcOn;             // CMD59使能CRC
+  uint8_t  HighSpeed;         // CMD6切换到高速模式
+  uint32_t InitPolls;
+
+  uint8_t  Mode;
+  uint8_t  Multi;
+  uint32_t Block;             // 当前扇区
+  uint32_t EraseStart;
+  uint32_t EraseEnd;
+  uint32_t GcCount;
+
+  uint8_t  Cmd[6];
+  uint8_t  CmdLen;
+
+  uint8_t  Data[514];
+  uint32_t DataLen;
+
+  uint8_t  Queue[SIM_QUEUE_SIZE];
+  uint32_t QHead;
+  uint32_t QTail;
+} Sim;
+
+
+/**
+  * @brief  计算命令和CSD/CID使用的CRC7
+  * @note   多项式x^7 + x^3 + 1
+  * @param  buff: 数据
+  * @param  len: 数据长度
+  * @retval CRC7, 低7位有效
+  */
+static uint8_t Sim_CRC7(const uint8_t *buff, uint32_t len)
+{
+  uint8_t crc = 0;
+  uint32_t i, j;
+
+  for (i = 0; i < len; i++)
+  {
+    uint8_t byte = buff[i];
+    for (j = 0; j < 8; j++)
+    {
+      crc <<= 1;
+      if ((byte ^ crc) & 0x80)
+      {
+        crc ^= 0x09;
+      }
+      byte <<= 1;
+    }
+  }
+
+  return crc & 0x7F;
+}
+
+
+/**
+  * @brief  计算数据块使用的CRC16
+  * @note   CRC-16/XMODEM, 多项式x^16 + x^12 + x^5 + 1
+  * @param  buff: 数据
+  * @param  len: 数据长度
+  * @retval CRC16
+  */
+static uint16_t Sim_CRC16(const uint8_t *buff, uint32_t len)
+{
+  uint16_t crc = 0;
+  uint32_t i, j;
+
+  for (i = 0; i < len; i++)
+  {
+    crc ^= (uint16_t)buff[i] << 8;
+    for (j = 0; j < 8; j++)
+    {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+
+  return crc;
+}
+
+
+/**
+  * @brief  把一个字节放入卡的输出队列
+  * @note   主机之后每交换一个字节取出一个
+  * @param  byte: 输出的字节
+  * @retval 无
+  */
+static void Sim_Push(uint8_t byte)
+{
+  Sim.Queue[Sim.QTail] = byte;
+  Sim.QTail = (Sim.QTail + 1) % SIM_QUEUE_SIZE;
+}
+
+
+/**
+  * @brief  输出R1响应
+  * @note   响应前有一个字节的Ncr, 空闲位由卡的状态决定
+  * @param  r1: 响应中的错误位
+  * @retval 无
+  */
+static void Sim_PushR1(uint8_t r1)
+{
+  Sim_Push(0xFF);   // Ncr
+  Sim_Push(r1 | (Sim.Idle ? 0x01 : 0x00));
+}
+
+
+/**
+  * @brief  输出一个数据块
+  * @note   起始令牌0xFE + 数据 + CRC16
+  * @param  buff: 数据
+  * @param  len: 数据长度
+  * @retval 无
+  */
+static void Sim_PushBlock(const uint8_t *buff, uint32_t len)
+{
+  uint16_t crc = Sim_CRC16(buff, len);
+  uint32_t i;
+
+  Sim_Push(0xFE);
+  for (i = 0; i < len; i++)
+  {
+    Sim_Push(buff[i]);
+  }
+  Sim_Push((uint8_t)(crc >> 8));
+  Sim_Push((uint8_t)crc);
+}
+
+
+/**
+  * @brief  当前时钟是否超过卡允许的最大频率
+  * @note   超频时模拟卡返回或者写入错误的数据
+  * @param  无
+  * @retval 1: 超频, 0: 正常
+  */
+static uint8_t Sim_OverClocked(void)
+{
+  uint32_t limit = Sim.HighSpeed ? 50000000 : 25000000;
+
+  if (Sim.Profile.MaxClock_Hz < limit)
+  {
+    limit = Sim.Profile.MaxClock_Hz;
+  }
+
+  return Sim.Clock_Hz > limit;
+}
+
+
+/**
+  * @brief  生成CSD寄存器
+  * @note   SDHC为CSD 2.0, 其他卡为CSD 1.0, 容量由镜像扇区数决定
+  * @param  csd: 16字节CSD
+  * @retval 无
+  */
+static void Sim_BuildCSD(uint8_t *csd)
+{
+  memset(csd, 0, 16);
+
+  if (Sim.Profile.Type == SD_SIM_TYPE_SDHC)
+  {
+    uint32_t csize = Sim.Sectors / 1024 - 1;
+
+    csd[0] = 0x40;
+    csd[1] = 0x0E;
+    csd[2] = 0x00;
+    csd[3] = Sim.HighSpeed ? 0x5A : 0x32;
+    csd[4] = 0x5B;
+    csd[5] = 0x59;
+    csd[7] = (uint8_t)((csize >> 16) & 0x3F);
+    csd[8] = (uint8_t)(csize >> 8);
+    csd[9] = (uint8_t)csize;
+    csd[10] = 0x7F;
+    csd[11] = 0x80;
+    csd[12] = 0x0A;
+    csd[13] = 0x40;
+  }
+  else
+  {
+    uint32_t mult = 0, csize;
+
+    while (mult < 7 && (Sim.Sectors >> (mult + 2)) > 4096)
+    {
+      mult++;
+    }
+    csize = (Sim.Sectors >> (mult + 2)) - 1;
+
+    csd[0] = (Sim.Profile.Type == SD_SIM_TYPE_MMC) ? 0x90 : 0x00;
+    csd[1] = 0x26;
+    csd[2] = 0x00;
+    csd[3] = 0x32;
+    csd[4] = 0x5B;
+    csd[5] = 0x59;
+    csd[6] = (uint8_t)(0x80 | ((csize >> 10) & 0x03));
+    csd[7] = (uint8_t)(csize >> 2);
+    csd[8] = (uint8_t)((csize & 0x03) << 6);
+    csd[9] = (uint8_t)((mult >> 1) & 0x03);
+    csd[10] = (uint8_t)(((mult & 0x01) << 7) | 0x40 | 0x3F);
+    csd[11] = 0x80;
+    csd[12] = 0x16;
+    csd[13] = 0x40;
+  }
+
+  csd[15] = (uint8_t)((Sim_CRC7(csd, 15) << 1) | 0x01);
+}
+
+
+/**
+  * @brief  生成CID寄存器
+  * @note   无
+  * @param  cid: 16字节CID
+  * @retval 无
+  */
+static void Sim_BuildCID(uint8_t *cid)
+{
+  static const uint8_t cid_data[15] = {0x03, 'S', 'D', 'S', 'I', 'M', '0', '1', 0x10,
+                                       0x12, 0x34, 0x56, 0x78, 0x01, 0x8A};
+  memcpy(cid, cid_data, 15);
+  cid[15] = (uint8_t)((Sim_CRC7(cid, 15) << 1) | 0x01);
+}
+
+
+/**
+  * @brief  生成SCR寄存器
+  * @note   无
+  * @param  scr: 8字节SCR
+  * @retval 无
+  */
+static void Sim_BuildSCR(uint8_t *scr)
+{
+  memset(scr, 0, 8);
+  scr[0] = 0x02;                      // SD_SPEC 2.00
+  scr[1] = 0x35;                      // SD_SECURITY=3, SD_BUS_WIDTHS=1bit|4bit
+  scr[2] = 0x80;                      // SD_SPEC3
+  scr[3] = (Sim.Profile.Type == SD_SIM_TYPE_SDHC) ? 0x02 : 0x00;   // CMD23支持
+}
+
+
+/**
+  * @brief  生成SD状态寄存器SSR
+  * @note   无
+  * @param  ssr: 64字节SSR
+  * @retval 无
+  */
+static void Sim_BuildSSR(uint8_t *ssr)
+{
+  memset(ssr, 0, 64);
+  ssr[8] = 0x04;                      // SPEED_CLASS: Class 10
+  ssr[9] = 0x0A;                      // PERFORMANCE_MOVE: 10MB/s
+  ssr[10] = 0x90;                     // AU_SIZE: 4MB
+  ssr[11] = 0x00;
+  ssr[12] = 0x01;                     // ERASE_SIZE: 1AU
+  ssr[13] = 0x05;                     // ERASE_TIMEOUT: 1s, ERASE_OFFSET: 1s
+}
+
+
+/**
+  * @brief  从镜像文件读取一个扇区
+  * @note   超出镜像文件长度的部分读为0
+  * @param  block: 扇区号
+  * @param  buff: 数据
+  * @retval 0
+  */
+static int32_t Sim_ReadSector(uint32_t block, uint8_t *buff)
+{
+  if (fseek(Sim.Image, (long)block * 512, SEEK_SET) != 0 || fread(buff, 1, 512, Sim.Image) != 512)
+  {
+    memset(buff, 0, 512);
+  }
+  return 0;
+}
+
+
+/**
+  * @brief  向镜像文件写入一个扇区
+  * @note   无
+  * @param  block: 扇区号
+  * @param  buff: 数据
+  * @retval 0
+  */
+static int32_t Sim_WriteSector(uint32_t block, const uint8_t *buff)
+{
+  fseek(Sim.Image, (long)block * 512, SEEK_SET);
+  fwrite(buff, 1, 512, Sim.Image);
+  return 0;
+}
+
+
+/**
+  * @brief  命令参数中的地址转换为扇区号
+  * @note   SDHC为块地址, 其他卡为字节地址, 必须512字节对齐
+  * @param  arg: 命令参数
+  * @retval 扇区号, 0xFFFFFFFF: 地址错误
+  */
+static uint32_t Sim_Address(uint32_t arg)
+{
+  if (Sim.Profile.Type == SD_SIM_TYPE_SDHC)
+  {
+    return arg;
+  }
+  if (arg % 512)
+  {
+    return 0xFFFFFFFF;
+  }
+  return arg / 512;
+}
+
+
+/**
+  * @brief  执行收到的命令
+  * @note   响应和数据放入输出队列, 读写命令切换卡的工作状态
+  * @param  无
+  * @retval 无
+  */
+static void Sim_Execute(void)
+{
+  uint8_t cmd = Sim.Cmd[0] & 0x3F;
+  uint32_t arg = ((uint32_t)Sim.Cmd[1] << 24) | ((uint32_t)Sim.Cmd[2] << 16) | ((uint32_t)Sim.Cmd[3] << 8) | Sim.Cmd[4];
+  uint8_t app = Sim.AppCmd;
+  uint8_t buff[64];
+  uint32_t block;
+
+  Sim.AppCmd = 0;
+  Sim.Stats.Commands[cmd]++;
+
+  /* CMD0和CMD8总是检查CRC */
+  if ((Sim.CrcOn || cmd == 0 || cmd == 8) && (Sim.Cmd[5] != (uint8_t)((Sim_CRC7(Sim.Cmd, 5) << 1) | 0x01)))
+  {
+    Sim_PushR1(0x08);
+    return;
+  }
+
+  switch (cmd)
+  {
+    case 0:
+      Sim.Idle = 1;
+      Sim.CrcOn = 0;
+      Sim.HighSpeed = 0;
+      Sim.InitPolls = 0;
+      Sim.Mode = SIM_MODE_CMD;
+      Sim_PushR1(0x00);
+      break;
+
+    case 1:
+      if (Sim.Profile.Type != SD_SIM_TYPE_MMC)
+      {
+        Sim_PushR1(0x04);
+        break;
+      }
+      if (++Sim.InitPolls >= Sim.Profile.InitPolls)
+      {
+        Sim.Idle = 0;
+      }
+      Sim_PushR1(0x00);
+      break;
+
+    case 6:
+      Sim_PushR1(0x00);
+      memset(buff, 0, 64);
+      buff[0] = 0x00;
+      buff[1] = 0x64;                                   // 最大电流
+      buff[13] = Sim.Profile.HighSpeed ? 0x03 : 0x01;   // 功能组1支持的功能
+      if ((arg & 0x0F) == 0x01)
+      {
+        buff[16] = Sim.Profile.HighSpeed ? 0x01 : 0x0F;
+        if (Sim.Profile.HighSpeed && (arg & 0x80000000))
+        {
+          Sim.HighSpeed = 1;
+        }
+      }
+      Sim_PushBlock(buff, 64);
+      break;
+
+    case 8:
+      if (Sim.Profile.Type == SD_SIM_TYPE_SDV1 || Sim.Profile.Type == SD_SIM_TYPE_MMC)
+      {
+        Sim_PushR1(0x04);
+        break;
+      }
+      Sim_PushR1(0x00);
+      Sim_Push(0x00);
+      Sim_Push(0x00);
+      Sim_Push((uint8_t)((arg >> 8) & 0x0F));
+      Sim_Push((uint8_t)arg);
+      break;
+
+    case 9:
+      Sim_PushR1(0x00);
+      Sim_BuildCSD(buff);
+      Sim_PushBlock(buff, 16);
+      break;
+
+    case 10:
+      Sim_PushR1(0x00);
+      Sim_BuildCID(buff);
+      Sim_PushBlock(buff, 16);
+      break;
+
+    case 12:
+      Sim.Mode = SIM_MODE_CMD;
+      Sim.QHead = Sim.QTail;
+      Sim_Push(0xFF);   // stuff byte
+      Sim_PushR1(0x00);
+      Sim.Busy_ns = Sim.Now_ns + 4000;
+      break;
+
+    case 13:
+      Sim_PushR1(0x00);
+      if (app)
+      {
+        Sim_Push(0x00);
+        Sim_BuildSSR(buff);
+        Sim_PushBlock(buff, 64);
+      }
+      else
+      {
+        Sim_Push(0x00);
+      }
+      break;
+
+    case 16:
+      Sim_PushR1((arg != 512 && Sim.Profile.Type != SD_SIM_TYPE_SDHC) ? 0x40 : 0x00);
+      break;
+
+    case 17:
+    case 18:
+      block = Sim_Address(arg);
+      if (block == 0xFFFFFFFF)
+      {
+        Sim_PushR1(0x20);
+        break;
+      }
+      if (block >= Sim.Sectors)
+      {
+        Sim_PushR1(0x40);
+        break;
+      }
+      Sim_PushR1(0x00);
+      Sim.Mode = SIM_MODE_READ;
+      Sim.Multi = (cmd == 18);
+      Sim.Block = block;
+      Sim.Ready_ns = Sim.Now_ns + (uint64_t)Sim.Profile.AccessTime_us * 1000;
+      break;
+
+    case 23:
+      Sim_PushR1(0x00);
+      break;
+
+    case 24:
+    case 25:
+      block = Sim_Address(arg);
+      if (block == 0xFFFFFFFF)
+      {
+        Sim_PushR1(0x20);
+        break;
+      }
+      if (block >= Sim.Sectors)
+      {
+        Sim_PushR1(0x40);
+        break;
+      }
+      Sim_PushR1(0x00);
+      Sim.Mode = SIM_MODE_WRITE_TOKEN;
+      Sim.Multi = (cmd == 25);
+      Sim.Block = block;
+      break;
+
+    case 32:
+      Sim.EraseStart = Sim_Address(arg);
+      Sim_PushR1(Sim.EraseStart == 0xFFFFFFFF ? 0x20 : 0x00);
+      break;
+
+    case 33:
+      Sim.EraseEnd = Sim_Address(arg);
+      Sim_PushR1(Sim.EraseEnd == 0xFFFFFFFF ? 0x20 : 0x00);
+      break;
+
+    case 38:
+      if (Sim.EraseStart > Sim.EraseEnd || Sim.EraseEnd >= Sim.Sectors)
+      {
+        Sim_PushR1(0x10);
+        break;
+      }
+      {
+        uint8_t zero[512];
+        memset(zero, 0, 512);
+        for (block = Sim.EraseStart; block <= Sim.EraseEnd; block++)
+        {
+          Sim_WriteSector(block, zero);
+        }
+      }
+      Sim_PushR1(0x00);
+      Sim.Busy_ns = Sim.Now_ns + (uint64_t)Sim.Profile.EraseTime_us * 1000
+                    * ((Sim.EraseEnd - Sim.EraseStart) / 8192 + 1);
+      break;
+
+    case 41:
+      if (!app)
+      {
+        Sim_PushR1(0x04);
+        break;
+      }
+      if (Sim.Profile.Type == SD_SIM_TYPE_SDHC && !(arg & 0x40000000))
+      {
+        Sim_PushR1(0x00);   // SDHC卡未设置HCS时一直处于空闲状态
+        break;
+      }
+      if (++Sim.InitPolls >= Sim.Profile.InitPolls)
+      {
+        Sim.Idle = 0;
+      }
+      Sim_PushR1(0x00);
+      break;
+
+    case 51:
+      if (!app)
+      {
+        Sim_PushR1(0x04);
+        break;
+      }
+      Sim_PushR1(0x00);
+      Sim_BuildSCR(buff);
+      Sim_PushBlock(buff, 8);
+      break;
+
+    case 55:
+      if (Sim.Profile.Type == SD_SIM_TYPE_MMC)
+      {
+        Sim_PushR1(0x04);
+        break;
+      }
+      Sim.AppCmd = 1;
+      Sim_PushR1(0x00);
+      break;
+
+    case 58:
+      Sim_PushR1(0x00);
+      Sim_Push((uint8_t)((Sim.Idle ? 0x00 : 0x80) | ((Sim.Profile.Type == SD_SIM_TYPE_SDHC && !Sim.Idle) ? 0x40 : 0x00)));
+      Sim_Push(0xFF);
+      Sim_Push(0x80);
+      Sim_Push(0x00);
+      break;
+
+    case 59:
+      Sim.CrcOn = arg & 0x01;
+      Sim_PushR1(0x00);
+      break;
+
+    default:
+      Sim_PushR1(0x04);
+      break;
+  }
+}
+
+
+/**
+  * @brief  接收到完整的数据块
+  * @note   检查CRC后写入镜像文件, 输出数据响应并进入编程忙状态
+  * @param  无
+  * @retval 无
+  */
+static void Sim_WriteBlockDone(void)
+{
+  uint16_t crc = ((uint16_t)Sim.Data[512] << 8) | Sim.Data[513];
+  uint64_t busy = (uint64_t)Sim.Profile.ProgramTime_us * 1000;
+
+  if (Sim_OverClocked())
+  {
+    Sim.Data[100] ^= 0x10;  // 超频时数据出错
+  }
+
+  if (Sim.CrcOn && crc != Sim_CRC16(Sim.Data, 512))
+  {
+    Sim_Push(0xEB);   // CRC错误
+    Sim.Mode = Sim.Multi ? SIM_MODE_WRITE_TOKEN : SIM_MODE_CMD;
+    return;
+  }
+
+  Sim_WriteSector(Sim.Block++, Sim.Data);
+  Sim.Stats.BlocksWritten++;
+  Sim_Push(0xE5);
+
+  Sim.GcCount++;
+  if (Sim.Profile.GcInterval && (Sim.GcCount % Sim.Profile.GcInterval) == 0)
+  {
+    busy += (uint64_t)Sim.Profile.GcTime_us * 1000;
+  }
+  Sim.Busy_ns = Sim.Now_ns + busy;
+
+  Sim.Mode = Sim.Multi ? SIM_MODE_WRITE_TOKEN : SIM_MODE_CMD;
+}
+
+
+/**
+  * @brief  打开模拟卡
+  * @note   镜像文件不存在时自动创建
+  * @param  image: 镜像文件路径
+  * @param  sectors: 扇区数
+  * @param  profile: 卡类型和时序参数
+  * @retval 0: 成功, 其他: 失败
+  */
+int32_t SD_Sim_Open(const char *image, uint32_t sectors, const SD_Sim_Profile_t *profile)
+{
+  memset(&Sim, 0, sizeof(Sim));
+
+  Sim.Image = fopen(image, "r+b");
+  if (Sim.Image == NULL)
+  {
+    Sim.Image = fopen(image, "w+b");
+  }
+  if (Sim.Image == NULL)
+  {
+    return 1;
+  }
+
+  Sim.Sectors = sectors;
+  Sim.Profile = *profile;
+  Sim.CS = 1;
+  Sim.Idle = 1;
+  Sim.Clock_Hz = 400000;
+
+  return 0;
+}
+
+
+/**
+  * @brief  关闭模拟卡
+  * @note   无
+  * @param  无
+  * @retval 无
+  */
+void SD_Sim_Close(void)
+{
+  if (Sim.Image != NULL)
+  {
+    fclose(Sim.Image);
+    Sim.Image = NULL;
+  }
+}
+
+
+/**
+  * @brief  设置片选电平
+  * @note   无
+  * @param  level: 0: 选中, 1: 取消
+  * @retval 无
+  */
+void SD_Sim_SetCS(uint8_t level)
+{
+  if (Sim.CS != level)
+  {
+    Sim.Stats.CsToggles++;
+  }
+  Sim.CS = level;
+}
+
+
+/**
+  * @brief  读取MISO引脚电平
+  * @note   选中且忙时卡把MISO拉低
+  * @param  无
+  * @retval MISO电平
+  */
+uint8_t SD_Sim_GetMISO(void)
+{
+  return (Sim.CS == 0 && Sim.Now_ns < Sim.Busy_ns) ? 0 : 1;
+}
+
+
+/**
+  * @brief  交换一个字节
+  * @note   模拟SPI全双工传输, 每个字节消耗8个时钟周期
+  * @param  mosi: 主机发送的字节
+  * @retval 卡返回的字节
+  */
+uint8_t SD_Sim_Transfer(uint8_t mosi)
+{
+  uint8_t miso = 0xFF;
+
+  Sim.Now_ns += 8000000000ULL / Sim.Clock_Hz;
+  Sim.Stats.Bytes++;
+
+  if (Sim.CS)
+  {
+    return 0xFF;
+  }
+
+  /* 输出 */
+  if (Sim.QHead != Sim.QTail)
+  {
+    miso = Sim.Queue[Sim.QHead];
+    Sim.QHead = (Sim.QHead + 1) % SIM_QUEUE_SIZE;
+  }
+  else if (Sim.Now_ns < Sim.Busy_ns)
+  {
+    miso = 0x00;
+  }
+  else if (Sim.Mode == SIM_MODE_READ && Sim.Now_ns >= Sim.Ready_ns)
+  {
+    uint8_t buff[512];
+
+    if (Sim.Block >= Sim.Sectors)
+    {
+      Sim_Push(0x08);   // 地址超出范围
+      Sim.Mode = SIM_MODE_CMD;
+    }
+    else
+    {
+      Sim_ReadSector(Sim.Block++, buff);
+      Sim.Stats.BlocksRead++;
+      Sim_PushBlock(buff, 512);
+      if (Sim_OverClocked())
+      {
+        Sim.Queue[(Sim.QHead + 101) % SIM_QUEUE_SIZE] ^= 0x10;
+      }
+      if (Sim.Multi)
+      {
+        Sim.Ready_ns = Sim.Now_ns + 514ULL * 8000000000ULL / Sim.Clock_Hz + (uint64_t)Sim.Profile.AccessTime_us * 100;
+      }
+      else
+      {
+        Sim.Mode = SIM_MODE_CMD;
+      }
+    }
+    miso = Sim.Queue[Sim.QHead];
+    Sim.QHead = (Sim.QHead + 1) % SIM_QUEUE_SIZE;
+  }
+
+  /* 输入 */
+  if (Sim.Mode == SIM_MODE_WRITE_DATA)
+  {
+    Sim.Data[Sim.DataLen++] = mosi;
+    if (Sim.DataLen == 514)
+    {
+      Sim_WriteBlockDone();
+    }
+  }
+  else if (Sim.Mode == SIM_MODE_WRITE_TOKEN && Sim.CmdLen == 0 && Sim.Now_ns >= Sim.Busy_ns
+           && ((mosi == 0xFE && !Sim.Multi) || (mosi == 0xFC && Sim.Multi)))
+  {
+    Sim.Mode = SIM_MODE_WRITE_DATA;
+    Sim.DataLen = 0;
+  }
+  else if (Sim.Mode == SIM_MODE_WRITE_TOKEN && Sim.Multi && mosi == 0xFD && Sim.Now_ns >= Sim.Busy_ns)
+  {
+    Sim.Mode = SIM_MODE_CMD;
+    Sim_Push(0xFF);
+    Sim.Busy_ns = Sim.Now_ns + 16000 + 2ULL * 8000000000ULL / Sim.Clock_Hz;
+  }
+  else if (Sim.CmdLen > 0 || ((mosi & 0xC0) == 0x40 && Sim.Now_ns >= Sim.Busy_ns))
+  {
+    Sim.Cmd[Sim.CmdLen++] = mosi;
+    if (Sim.CmdLen == 6)
+    {
+      Sim.CmdLen = 0;
+      if (Sim.Mode == SIM_MODE_READ && (Sim.Cmd[0] & 0x3F) != 12)
+      {
+        return miso;  // 读数据时只响应CMD12
+      }
+      if (Sim.Mode == SIM_MODE_WRITE_TOKEN)
+      {
+        Sim.Mode = SIM_MODE_CMD;
+      }
+      Sim_Execute();
+    }
+  }
+
+  return miso;
+}
+
+
+/**
+  * @brief  设置SPI时钟
+  * @note   决定每个字节消耗的模拟时间
+  * @param  hz: SPI时钟, 单位Hz
+  * @retval 无
+  */
+void SD_Sim_SetClock(uint32_t hz)
+{
+  Sim.Clock_Hz = hz;
+}
+
+
+/**
+  * @brief  获取SPI时钟
+  * @note   无
+  * @param  无
+  * @retval SPI时钟, 单位Hz
+  */
+uint32_t SD_Sim_GetClock(void)
+{
+  return Sim.Clock_Hz;
+}
+
+
+/**
+  * @brief  获取模拟时间
+  * @note   模拟时间只由总线传输、延时和CPU时间推进, 同样的操作序列得到同样的时间
+  * @param  无
+  * @retval 模拟时间, 单位ns
+  */
+uint64_t SD_Sim_GetTime_ns(void)
+{
+  return Sim.Now_ns;
+}
+
+
+/**
+  * @brief  获取毫秒计时, 代替HAL_GetTick()
+  * @note   每次调用消耗SD_SIM_CPU_NS的模拟时间, 只查询时间的等待循环也能结束
+  * @param  无
+  * @retval 模拟时间, 单位ms
+  */
+uint32_t SD_Sim_GetTick(void)
+{
+  Sim.Now_ns += SD_SIM_CPU_NS;
+  return (uint32_t)(Sim.Now_ns / 1000000);
+}
+
+
+/**
+  * @brief  获取微秒计时
+  * @note   每次调用消耗SD_SIM_CPU_NS的模拟时间
+  * @param  无
+  * @retval 模拟时间, 单位us
+  */
+uint32_t SD_Sim_GetTick_us(void)
+{
+  Sim.Now_ns += SD_SIM_CPU_NS;
+  return (uint32_t)(Sim.Now_ns / 1000);
+}
+
+
+/**
+  * @brief  模拟时间前进
+  * @note   用于延时和等待中断
+  * @param  ns: 时间, 单位ns
+  * @retval 无
+  */
+void SD_Sim_Delay_ns(uint64_t ns)
+{
+  Sim.Now_ns += ns;
+}
+
+
+/**
+  * @brief  获取模拟卡统计
+  * @note   无
+  * @param  stats: 统计信息
+  * @retval 无
+  */
+void SD_Sim_GetStats(SD_Sim_Stats_t *stats)
+{
+  *stats = Sim.Stats;
+}
+
+
+/**
+  * @brief  清除模拟卡统计
+  * @note   无
+  * @param  无
+  * @retval 无
+  */
+void SD_Sim_ResetStats(void)
+{
+  memset(&Sim.Stats, 0, sizeof(Sim.Stats));
+}
@@ -0,0 +1,62 @@
+#ifndef __SD_CARD_SIM_H__
+#define __SD_CARD_SIM_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+
+#define SD_SIM_CPU_NS          100         // 每次查询时间消耗的模拟CPU时间, 单位ns
+#define SD_SIM_SPI_CLOCK       80000000    // SPI分频前的时钟, 单位Hz, 与SPI_BAUDRATEPRESCALER_xx对应
+
+
+/* 模拟卡类型 */
+#define  SD_SIM_TYPE_MMC       0x01
+#define  SD_SIM_TYPE_SDV1      0x02
+#define  SD_SIM_TYPE_SDV2      0x04
+#define  SD_SIM_TYPE_SDHC      0x06
+
+/* 模拟卡时序参数 */
+typedef struct
+{
+  uint8_t  Type;                // 卡类型
+  uint32_t InitPolls;           // ACMD41/CMD1退出空闲状态前需要的轮询次数
+  uint32_t AccessTime_us;       // 读访问延时(Nac)，即命令响应到数据令牌之间的时间
+  uint32_t ProgramTime_us;      // 单个扇区编程忙时间
+  uint32_t EraseTime_us;        // 每个擦除单元(AU)的擦除忙时间
+  uint32_t GcInterval;          // 每写入多少个扇区出现一次长时间的忙(垃圾回收), 0: 不模拟
+  uint32_t GcTime_us;           // 垃圾回收忙时间
+  uint32_t MaxClock_Hz;         // 卡支持的最大时钟, 超过时返回CRC错误数据
+  uint8_t  HighSpeed;           // 是否支持CMD6高速模式
+} SD_Sim_Profile_t;
+
+/* 模拟卡统计信息 */
+typedef struct
+{
+  uint64_t Bytes;               // SPI总线上传输的字节数
+  uint32_t Commands[64];        // 每条命令的次数
+  uint32_t BlocksRead;
+  uint32_t BlocksWritten;
+  uint32_t CsToggles;
+} SD_Sim_Stats_t;
+
+extern const SD_Sim_Profile_t SD_Sim_Profile_SDHC;
+extern const SD_Sim_Profile_t SD_Sim_Profile_SDV2;
+extern const SD_Sim_Profile_t SD_Sim_Profile_SDV1;
+extern const SD_Sim_Profile_t SD_Sim_Profile_MMC;
+
+int32_t  SD_Sim_Open(const char *image, uint32_t sectors, const SD_Sim_Profile_t *profile);
+void     SD_Sim_Close(void);
+void     SD_Sim_SetCS(uint8_t level);
+uint8_t  SD_Sim_GetMISO(void);
+uint8_t  SD_Sim_Transfer(uint8_t mosi);
+void     SD_Sim_SetClock(uint32_t hz);
+uint32_t SD_Sim_GetClock(void);
+uint64_t SD_Sim_GetTime_ns(void);
+uint32_t SD_Sim_GetTick(void);
+uint32_t SD_Sim_GetTick_us(void);
+void     SD_Sim_Delay_ns(uint64_t ns);
+void     SD_Sim_GetStats(SD_Sim_Stats_t *stats);
+void     SD_Sim_ResetStats(void);
+
+#endif
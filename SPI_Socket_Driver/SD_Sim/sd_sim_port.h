@@ -0,0 +1,39 @@
+#ifndef __SD_SIM_PORT_H__
+#define __SD_SIM_PORT_H__
+
+/* 在主机上编译时(定义SD_CARD_SIM)代替stm32_spi.h, 把驱动用到的HAL接口映射到SD卡模拟器 */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "sd_card_sim.h"
+
+
+#define HAL_OK                0
+
+#define GPIOB                 0
+#define GPIO_PIN_14           0x4000
+#define GPIO_PIN_RESET        0
+#define GPIO_PIN_SET          1
+
+#define SPI2_CS_Pin           0
+#define SPI2_CS_GPIO_Port     0
+
+/* 片选和MISO引脚连接到模拟卡, 不区分端口和引脚 */
+#define HAL_GPIO_WritePin(port, pin, state)   SD_Sim_SetCS(state)
+#define HAL_GPIO_ReadPin(port, pin)           SD_Sim_GetMISO()
+
+#define HAL_GetTick()         SD_Sim_GetTick()
+#define HAL_RCC_GetPCLK1Freq()  SD_SIM_SPI_CLOCK
+#define __WFI()               SD_Sim_Delay_ns(1000)   // 等待中断, 模拟时间前进1us
+
+/* SPI分频系数, 与STM32 HAL的取值相同, 时钟为SD_SIM_SPI_CLOCK / 2^(n+1) */
+#define SPI_BAUDRATEPRESCALER_2     0x00
+#define SPI_BAUDRATEPRESCALER_4     0x08
+#define SPI_BAUDRATEPRESCALER_8     0x10
+#define SPI_BAUDRATEPRESCALER_16    0x18
+#define SPI_BAUDRATEPRESCALER_32    0x20
+#define SPI_BAUDRATEPRESCALER_64    0x28
+#define SPI_BAUDRATEPRESCALER_128   0x30
+#define SPI_BAUDRATEPRESCALER_256   0x38
+
+#endif
@@ -0,0 +1,137 @@
+#include "spi_socket.h"
+
+
+/**
+  * @brief  通过SPI总线读写一个字节数据
+  * @note   主机上与模拟卡交换一个字节
+  * @param  txdata: 写入的数据
+  * @retval 读取的数据
+  */
+uint8_t SD_ReadWriteByte(uint8_t Byte)
+{
+  return SD_Sim_Transfer(Byte);
+}
+
+
+/**
+  * @brief  通过SPI总线读数据(不使用DMA)
+  * @note   发送0xFF
+  * @param  RxData: 读取的数据
+  * @param  Size: 数据长度
+  * @retval 结果 0-成功，其他-失败
+  */
+int8_t SD_ReadBuffer(uint8_t *RxData, uint16_t Size)
+{
+  while (Size--)
+  {
+    *RxData++ = SD_Sim_Transfer(0xFF);
+  }
+
+  return 0;
+}
+
+
+/**
+  * @brief  通过SPI总线读数据
+  * @note   模拟器中没有DMA, 与SD_ReadBuffer()相同
+  * @param  RxData: 读取的数据
+  * @param  Size: 数据长度
+  * @retval 结果 0-成功，其他-失败
+  */
+int8_t SD_ReadBuffer_DMA(uint8_t *RxData, uint16_t Size)
+{
+  return SD_ReadBuffer(RxData, Size);
+}
+
+
+/**
+  * @brief  通过SPI总线写数据
+  * @note   忽略读到的数据
+  * @param  TxData: 写入的数据
+  * @param  Size: 数据长度
+  * @retval 结果 0-成功，其他-失败
+  */
+int8_t SD_WriteBuffer_DMA(uint8_t *TxData, uint16_t Size)
+{
+  while (Size--)
+  {
+    SD_Sim_Transfer(*TxData++);
+  }
+
+  return 0;
+}
+
+
+/**
+  * @brief  通过SPI总线启动DMA读数据
+  * @note   模拟器中传输完成后才返回, SD_WaitBuffer_DMA()不需要等待
+  * @param  RxData: 读取的数据
+  * @param  Size: 数据长度
+  * @retval 结果 0-成功，其他-失败
+  */
+int8_t SD_ReadBuffer_DMA_Start(uint8_t *RxData, uint16_t Size)
+{
+  return SD_ReadBuffer(RxData, Size);
+}
+
+
+/**
+  * @brief  等待SPI总线DMA传输完成
+  * @note   无
+  * @param  无
+  * @retval 结果 0-成功，其他-超时
+  */
+int8_t SD_WaitBuffer_DMA(void)
+{
+  return 0;
+}
+
+
+/**
+  * @brief  获取微秒计时
+  * @note   返回模拟时间
+  * @param  无
+  * @retval 微秒计数值
+  */
+uint32_t SD_GetTick_us(void)
+{
+  return SD_Sim_GetTick_us();
+}
+
+
+/**
+  * @brief  微秒延时
+  * @note   模拟时间直接前进, 不占用主机时间
+  * @param  us: 延时时间, 单位us
+  * @retval 无
+  */
+void SD_Delay_us(uint32_t us)
+{
+  SD_Sim_Delay_ns((uint64_t)us * 1000);
+}
+
+
+/**
+  * @brief  设置SPI总线速度
+  * @note   改变模拟卡每个字节的传输时间
+  * @param  SPI_BaudRate_Prescaler: SPI总线分频系数, SPI_BAUDRATEPRESCALER_2 ~ SPI_BAUDRATEPRESCALER_256
+  * @retval 无
+  */
+int8_t SD_SPI_SetSpeed(uint8_t SPI_BaudRatePrescaler)
+{
+  SD_Sim_SetClock(SD_SIM_SPI_CLOCK >> ((SPI_BaudRatePrescaler >> 3) + 1));
+
+  return 0;
+}
+
+
+/**
+  * @brief  初始化SPI总线
+  * @note   模拟卡需要先用SD_Sim_Open()打开
+  * @param  无
+  * @retval 0
+  */
+int8_t SD_SPI_Init(void)
+{
+  return 0;
+}
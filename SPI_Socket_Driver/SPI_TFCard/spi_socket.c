@@ -1,6 +1,15 @@
 #include "spi_socket.h"			
 
 
+/* 读数据时使用的发送缓存, 内容固定为0xFF, 必须是静态变量以便DMA在函数返回后继续访问;
+   发送DMA地址不递增时只用到第一个字节, 缓冲区只用于不使用DMA的SD_ReadBuffer() */
+#ifdef USE_SPI_DMA_FIXED_TX
+#define SD_DUMMY_TX_SIZE   SD_BUSY_BATCH_SIZE
+#else
+#define SD_DUMMY_TX_SIZE   (512 + 2 + SD_READ_STREAM_LOOKAHEAD)
+#endif
+static uint8_t SD_DummyTxData[SD_DUMMY_TX_SIZE];
+
 
 /**
   * @brief  通过SPI总线读写一个字节数据
@@ -18,41 +27,184 @@ uint8_t SD_ReadWriteByte(uint8_t Byte)
 
 
 /**
-  * @brief  通过SPI总线读数据
-  * @note   无
+  * @brief  通过SPI总线读数据(不使用DMA)
+  * @note   用于读取少量数据, 例如批量检测忙状态; 超过发送缓存长度时分段读取
   * @param  RxData: 读取的数据
-  * @param  Size: 数据长度，不能超过512字节
+  * @param  Size: 数据长度
   * @retval 结果 0-成功，其他-失败
   */
-int8_t SD_ReadBuffer_DMA(uint8_t *RxData, uint16_t Size)
+int8_t SD_ReadBuffer(uint8_t *RxData, uint16_t Size)
 {
-  uint8_t txdata[512];		// 发送缓存
-
-  memset(txdata, 0xFF, 512);
+  uint16_t len;
 
-  TFCARD_SPI_TransferData_DMA(&TFCARD_SPI_HANDLE, txdata, RxData, Size); 
+  while (Size)
+  {
+    len = (Size > sizeof(SD_DummyTxData)) ? sizeof(SD_DummyTxData) : Size;
+    TFCARD_SPI_TransferData(&TFCARD_SPI_HANDLE, SD_DummyTxData, RxData, len);
+    RxData += len;
+    Size -= len;
+  }
 
   return 0;
 }
 
 
+/**
+  * @brief  通过SPI总线读数据
+  * @note   发送静态的0xFF数据, 不占用栈空间
+  * @param  RxData: 读取的数据
+  * @param  Size: 数据长度，未定义USE_SPI_DMA_FIXED_TX时不能超过(514 + SD_READ_STREAM_LOOKAHEAD)字节
+  * @retval 结果 0-成功，其他-失败
+  */
+int8_t SD_ReadBuffer_DMA(uint8_t *RxData, uint16_t Size)
+{
+  if (SD_ReadBuffer_DMA_Start(RxData, Size) != 0)
+  {
+    return 1;
+  }
+
+  return SD_WaitBuffer_DMA();
+}
+
+
 /**
   * @brief  通过SPI总线写数据
-  * @note   无
+  * @note   只发送不接收, 不需要接收缓冲区; 收到的数据留在SPI接收寄存器中,
+  *         传输结束时HAL清除溢出标志
   * @param  TxData: 写入的数据
-  * @param  Size: 数据长度，不能超过512字节
+  * @param  Size: 数据长度
   * @retval 结果 0-成功，其他-失败
   */
 int8_t SD_WriteBuffer_DMA(uint8_t *TxData, uint16_t Size)
 {
-  uint8_t rxdata[512];		// 接收缓存
-	
-  TFCARD_SPI_TransferData_DMA(&TFCARD_SPI_HANDLE, TxData, rxdata, Size); 
+#ifdef USE_SPI_DMA_FIXED_TX
+  TFCARD_SPI_DMA_TX_INC();    // 发送数据时内存地址递增
+#endif
+
+  if (TFCARD_SPI_TransmitData_DMA_IT(&TFCARD_SPI_HANDLE, TxData, Size) != HAL_OK)
+  {
+    return 1;
+  }
+
+  return SD_WaitBuffer_DMA();
+}
+
+
+/**
+  * @brief  通过SPI总线启动DMA读数据, 不等待传输完成
+  * @note   传输结束前不能访问RxData, 需调用SD_WaitBuffer_DMA()等待完成
+  * @param  RxData: 读取的数据
+  * @param  Size: 数据长度，未定义USE_SPI_DMA_FIXED_TX时不能超过(514 + SD_READ_STREAM_LOOKAHEAD)字节
+  * @retval 结果 0-成功，其他-失败
+  */
+int8_t SD_ReadBuffer_DMA_Start(uint8_t *RxData, uint16_t Size)
+{
+#ifdef USE_SPI_DMA_FIXED_TX
+  TFCARD_SPI_DMA_TX_FIXED();  // 反复发送SD_DummyTxData[0]
+#else
+  if (Size > sizeof(SD_DummyTxData))
+  {
+    return 1;
+  }
+#endif
+
+  if (TFCARD_SPI_TransferData_DMA_IT(&TFCARD_SPI_HANDLE, SD_DummyTxData, RxData, Size) != HAL_OK)
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+
+/**
+  * @brief  等待SPI总线DMA传输完成
+  * @note   超时时间为TFCARD_SPI_TIMEOUT, 超时时中止DMA传输, 避免随后的命令与仍在进行的DMA冲突
+  * @param  无
+  * @retval 结果 0-成功，其他-超时
+  */
+int8_t SD_WaitBuffer_DMA(void)
+{
+  uint32_t tickstart = HAL_GetTick();
+
+  while (TFCARD_SPI_IsBusy())
+  {
+    if (HAL_GetTick() - tickstart > TFCARD_SPI_TIMEOUT)
+    {
+      HAL_SPI_Abort(&TFCARD_SPI_HANDLE);
+      return 1;
+    }
+  }
 
   return 0;
 }
 
 
+#if !defined(DWT_CTRL_CYCCNTENA_Msk)
+/**
+  * @brief  获取SysTick合成的周期计数
+  * @note   没有DWT周期计数器的内核(Cortex-M0/M0+)使用, 要求SysTick是HAL的时基(1ms);
+  *         SysTick中断被屏蔽期间计数值会回退, 此时的计时不准确
+  * @param  无
+  * @retval 周期计数值
+  */
+uint32_t SD_GetCycles_SysTick(void)
+{
+  uint32_t tick, val;
+
+  do
+  {
+    tick = HAL_GetTick();
+    val = SysTick->VAL;
+  }
+  while (tick != HAL_GetTick());   // 读取期间发生了SysTick中断, 重新读取
+
+  return tick * (SysTick->LOAD + 1) + (SysTick->LOAD - val);
+}
+#endif
+
+
+/**
+  * @brief  获取微秒计时
+  * @note   移植时用户需要修改的接口函数, 默认使用DWT周期计数器(没有DWT时见SD_GetCycles_SysTick())
+  *         两次调用的间隔不能超过周期计数器的溢出时间(80MHz时约53秒)
+  * @param  无
+  * @retval 微秒计数值
+  */
+uint32_t SD_GetTick_us(void)
+{
+  static uint32_t lastcycles = 0;
+  static uint32_t remain = 0;
+  static uint32_t tick_us = 0;
+  uint32_t cycles, elapsed;
+
+  cycles = TFCARD_GET_CYCLES();
+  elapsed = cycles - lastcycles + remain;
+  lastcycles = cycles;
+
+  tick_us += elapsed / TFCARD_CYCLES_PER_US;
+  remain = elapsed % TFCARD_CYCLES_PER_US;
+
+  return tick_us;
+}
+
+
+/**
+  * @brief  微秒延时
+  * @note   移植时用户需要修改的接口函数, 用于定时轮询SD卡忙状态
+  * @param  us: 延时时间, 单位us
+  * @retval 无
+  */
+void SD_Delay_us(uint32_t us)
+{
+  uint32_t tickstart = SD_GetTick_us();
+
+  while (SD_GetTick_us() - tickstart < us)
+  {
+  }
+}
+
+
 /**
   * @brief  设置SPI总线速度
   * @note   移植时用户需要修改的接口函数
@@ -76,11 +228,33 @@ int8_t SD_SPI_SetSpeed(uint8_t SPI_BaudRatePrescaler)
 int8_t SD_SPI_Init(void)
 {
   TFCARD_SPI_Init(TFCARD_SPI_PERIPHERAL, &TFCARD_SPI_HANDLE, SPI_MODE_0);
+  memset(SD_DummyTxData, 0xFF, sizeof(SD_DummyTxData));
+
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+  /* 使能DWT周期计数器, 用于微秒计时 */
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
   
   return 0;
 }
 
 
+#ifdef USE_SD_CRC_HW
+extern CRC_HandleTypeDef TFCARD_CRC_HANDLE;
+
+/**
+  * @brief  用CRC外设计算数据块的CRC16
+  * @note   移植时用户需要修改的接口函数, CRC外设的配置见spi_socket.h中的USE_SD_CRC_HW
+  * @param  buff: 数据
+  * @param  len: 数据长度
+  * @retval CRC16
+  */
+uint16_t SD_CRC16_HW(const uint8_t *buff, uint32_t len)
+{
+  return (uint16_t)HAL_CRC_Calculate(&TFCARD_CRC_HANDLE, (uint32_t *)buff, len);
+}
+#endif
 
 
 
@@ -1,34 +1,130 @@
 #ifndef __SPI_SOCKET_H__
 #define __SPI_SOCKET_H__	 
 
+#ifdef SD_CARD_SIM
+#include "sd_sim_port.h"     // 在主机上用SD卡模拟器运行, 见SD_Sim/readme.txt
+#else
 #include "stm32_spi.h"
+#endif
 
 
 #define TFCARD_SPI_HANDLE       hspi2
 #define TFCARD_SPI_PERIPHERAL   SPI2
 #define TFCARD_SPI_TIMEOUT      10        // 单位ms
+#define TFCARD_SPI_CLOCK        HAL_RCC_GetPCLK1Freq()   // SPI分频前的时钟(SPI2在APB1上), 单位Hz
 
 #define TFCARD_SPI_CS_PIN   SPI2_CS_Pin          // SPI_CS引脚编号
 #define	TFCARD_SPI_CS_PORT  SPI2_CS_GPIO_Port    // SPI_CS引脚端口
 
+#define TFCARD_SPI_MISO_PIN   GPIO_PIN_14         // SPI_MISO引脚编号, 用于检测SD卡忙状态
+#define TFCARD_SPI_MISO_PORT  GPIOB               // SPI_MISO引脚端口
+
 #define TFCARD_SPI_CS_LOW()   HAL_GPIO_WritePin(TFCARD_SPI_CS_PORT, TFCARD_SPI_CS_PIN, GPIO_PIN_RESET)
 #define TFCARD_SPI_CS_HIGH()  HAL_GPIO_WritePin(TFCARD_SPI_CS_PORT, TFCARD_SPI_CS_PIN, GPIO_PIN_SET)
+#define TFCARD_SPI_MISO_READ() HAL_GPIO_ReadPin(TFCARD_SPI_MISO_PORT, TFCARD_SPI_MISO_PIN)
 
 #define TFCARD_SPI_Init                STM32_SPI_Init
 #define TFCARD_SPI_TransferData	       STM32_SPI_TransferData
 #define TFCARD_SPI_TransferData_DMA    STM32_SPI_TransferData_DMA
 #define TFCARD_SPI_SetSpeed            STM32_SPI_SetSpeed
+#define TFCARD_SPI_TransferData_DMA_IT HAL_SPI_TransmitReceive_DMA    // 启动DMA传输后立即返回
+#define TFCARD_SPI_TransmitData_DMA_IT HAL_SPI_Transmit_DMA           // 启动只发送的DMA传输后立即返回, 写数据不需要接收缓冲区
+#define TFCARD_SPI_IsBusy()            (HAL_SPI_GetState(&TFCARD_SPI_HANDLE) != HAL_SPI_STATE_READY)
 
 #define USE_SPI_DMA_READ_SECTOR    // 定义SPI使用DMA进行数据读扇区
 #define USE_SPI_DMA_WRITE_SECTOR   // 定义SPI使用DMA进行数据写扇区
 #define USE_SPI_DMA_SEND_CMD       // 定义SPI使用DMA进行数据发送CMD
+#define USE_SPI_DMA_READ_STREAM    // 定义CMD18连续读使用双缓冲DMA流水线
+
+/* 读数据时MOSI必须保持0xFF(全双工主机的HAL_SPI_Receive_DMA会把接收缓冲区的内容发送出去, 不能使用).
+   定义USE_SPI_DMA_FIXED_TX时发送DMA的内存地址不递增, 整个读操作反复发送同一个0xFF字节,
+   不需要与读取长度相同的0xFF缓冲区; 否则使用(514 + SD_READ_STREAM_LOOKAHEAD)字节的静态0xFF缓冲区.
+   该选项直接修改发送DMA的配置寄存器, 下面按DMA类型选择寄存器: F2/F4/F7/H7的DMA数据流(H7的BDMA不支持)
+   和F0/F1/F3/L4/G4等的DMA通道, 其他型号需要自己定义TFCARD_SPI_DMA_TX_FIXED()/TFCARD_SPI_DMA_TX_INC() */
+//#define USE_SPI_DMA_FIXED_TX
+#if defined(USE_SPI_DMA_FIXED_TX) && !defined(TFCARD_SPI_DMA_TX_FIXED)
+#if defined(DMA_SxCR_MINC)
+#define TFCARD_SPI_DMA_TX_CR       (((DMA_Stream_TypeDef *)TFCARD_SPI_HANDLE.hdmatx->Instance)->CR)   // H7的Instance为void *
+#define TFCARD_SPI_DMA_TX_MINC     DMA_SxCR_MINC
+#elif defined(DMA_CCR_MINC)
+#define TFCARD_SPI_DMA_TX_CR       (((DMA_Channel_TypeDef *)TFCARD_SPI_HANDLE.hdmatx->Instance)->CCR)
+#define TFCARD_SPI_DMA_TX_MINC     DMA_CCR_MINC
+#else
+#error "USE_SPI_DMA_FIXED_TX: unknown DMA type, define TFCARD_SPI_DMA_TX_FIXED() and TFCARD_SPI_DMA_TX_INC()"
+#endif
+#define TFCARD_SPI_DMA_TX_FIXED()  CLEAR_BIT(TFCARD_SPI_DMA_TX_CR, TFCARD_SPI_DMA_TX_MINC)   // 发送DMA内存地址不递增
+#define TFCARD_SPI_DMA_TX_INC()    SET_BIT(TFCARD_SPI_DMA_TX_CR, TFCARD_SPI_DMA_TX_MINC)     // 发送DMA内存地址递增
+#endif
+
+//#define USE_SD_STREAM_CONTINUE   // 定义连续的读写请求保持CMD18/CMD25传输不关闭(传输期间保持片选, SPI总线上有其他设备时不要定义)
+                                   // 空闲传输由SD_Stream_Poll()关闭: 读写和查询状态时自动检查, 应用还必须在主循环中周期调用SD_Stream_Poll(),
+                                   // 否则最后一次请求之后片选一直保持到下一次访问SD卡
+
+#define SD_READ_STREAM_LOOKAHEAD   8   // 每个扇区DMA时额外读取的字节数, 用于提前捕获下一个扇区的起始令牌
+#define SD_STREAM_IDLE_TIMEOUT     20  // 连续读写传输空闲超时, 单位ms
+
+/* SD卡忙检测方式 */
+#define SD_BUSY_POLL_BYTE          0   // 逐字节轮询
+#define SD_BUSY_POLL_BATCH         1   // 每次读取SD_BUSY_BATCH_SIZE个字节后检查
+#define SD_BUSY_POLL_BACKOFF       2   // 按定时间隔轮询, 间隔根据上次忙时间自适应调整
+#define SD_BUSY_MISO_EVENT         3   // 检测MISO引脚电平, 忙时等待中断事件(需要配置MISO引脚的EXTI上升沿中断)
+
+#define SD_BUSY_STRATEGY           SD_BUSY_POLL_BATCH
+#define SD_BUSY_TIMEOUT            500    // SD卡忙超时时间, 单位ms
+#define SD_BUSY_BATCH_SIZE         16     // 批量轮询时每次读取的字节数
+#define SD_BUSY_BACKOFF_MIN_US     20     // 定时轮询的最小间隔, 单位us
+#define SD_BUSY_BACKOFF_MAX_US     2000   // 定时轮询的最大间隔, 单位us
+
+#define TFCARD_BUSY_DELAY_US(us)   SD_Delay_us(us)   // 定时轮询的延时, 使用RTOS时可以替换为任务延时
+#define TFCARD_BUSY_WAIT_EVENT()   __WFI()           // 等待MISO引脚中断事件, 使用RTOS时可以替换为等待信号量
+
+#define USE_SD_DISCARD             // 定义TRIM时擦除SD卡: 合并相邻的范围, 同步时擦除其中完整的擦除单元(预擦除后写入更快)
+#define SD_DISCARD_RANGES          4      // 等待擦除的范围个数
+#define SD_ERASE_MAX_UNITS         16     // 一次CMD38最多擦除的擦除单元数, 限制单次擦除的忙时间
+#define SD_ERASE_TIMEOUT           250    // SSR中没有擦除超时信息时每个擦除单元的超时时间, 单位ms
+
+#define USE_SD_CLOCK_TRAINING      // 定义初始化时训练SPI时钟: 从低速逐级提高, 取读测试CRC正确的最高时钟; 连续出现CRC/令牌错误时降低一级
+#define USE_SD_HIGH_SPEED          // 定义初始化时用CMD6切换到高速模式(最大时钟50MHz)
+#define SD_TRAIN_START_CLOCK       5000000   // 训练的起始时钟, 初始化后读取卡信息也使用该时钟, 单位Hz
+#define SD_TRAIN_SECTOR            0      // 读测试使用的扇区, 只读不写
+#define SD_TRAIN_READS             4      // 每级时钟读测试的次数, 全部正确才使用该时钟
+#define SD_CLOCK_ERROR_LIMIT       3      // 连续出现CRC/令牌错误的次数达到该值时时钟降低一级
+
+#define USE_SD_CRC                 // 定义开启CRC校验(CMD59): 命令带CRC7, 读写数据块校验CRC16, CRC错误的请求自动重试
+#define SD_CRC_RETRIES             3      // CRC错误时读写请求的重试次数, 不小于SD_CLOCK_ERROR_LIMIT时最后的重试使用降低后的时钟
+#define SD_CRC16_SLICES            8      // 查表计算CRC16时每次处理的字节数(1/4/8), 每张查找表占用512字节RAM
+//#define USE_SD_CRC_HW            // 定义用CRC外设计算数据块CRC16(需要支持可编程多项式的型号, 如F0/F3/F7/L4/G4/H7),
+                                  // CubeMX中配置: 多项式0x1021, 16位, 初值0, 输入输出不反转, 输入格式为字节
+#define TFCARD_CRC_HANDLE          hcrc
+#ifdef USE_SD_CRC_HW
+#define TFCARD_CRC16(buff, len)    SD_CRC16_HW(buff, len)
+#else
+#define TFCARD_CRC16(buff, len)    SD_CRC16(buff, len)   // 数据块CRC16(CRC-16/XMODEM), 软件查表计算
+#endif
+
+#define USE_SD_STATS               // 定义统计命令延时、忙等待和错误次数(每次请求增加两次微秒计时)
+#define SD_STATS_BUCKETS           20     // 延时直方图的桶数, 第i个桶统计[2^i, 2^(i+1))us, 最后一个桶包含所有更长的延时
+
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+#define TFCARD_GET_CYCLES()        (DWT->CYCCNT)                  // 微秒计时使用的周期计数器
+#else
+#define TFCARD_GET_CYCLES()        SD_GetCycles_SysTick()         // Cortex-M0/M0+没有DWT周期计数器, 由HAL_GetTick()和SysTick计数值合成
+#endif
+#define TFCARD_CYCLES_PER_US       (SystemCoreClock / 1000000)    // 每微秒的计数值
 
 
 uint8_t SD_ReadWriteByte(uint8_t Byte);
+int8_t SD_ReadBuffer(uint8_t *RxData, uint16_t Size);
 int8_t SD_ReadBuffer_DMA(uint8_t *RxData, uint16_t Size);
 int8_t SD_WriteBuffer_DMA(uint8_t *TxData, uint16_t Size);
+int8_t SD_ReadBuffer_DMA_Start(uint8_t *RxData, uint16_t Size);
+int8_t SD_WaitBuffer_DMA(void);
+uint32_t SD_GetTick_us(void);
+uint32_t SD_GetCycles_SysTick(void);
+void SD_Delay_us(uint32_t us);
 int8_t SD_SPI_SetSpeed(uint8_t SPI_BaudRatePrescaler);
 int8_t SD_SPI_Init(void);
+uint16_t SD_CRC16_HW(const uint8_t *buff, uint32_t len);
 
 #endif
 
@@ -4,6 +4,219 @@
 /* SD卡信息 */
 SDCard_Information_typedef SDCard_Information;
 
+/* 最近一次SD卡忙的时间, 单位us */
+static uint32_t SD_BusyTime;
+
+/* 连续读写传输状态 */
+static SD_Stream_typedef SD_Stream;
+
+/* 是否处于命令序列中(保持片选, 命令之间不再重新片选和等待准备) */
+static uint8_t SD_InTransaction;
+
+#ifdef USE_SD_STATS
+/* 驱动统计 */
+static SD_Stats_typedef SD_Stats;
+static void SD_Stats_Cmd(uint8_t index, uint32_t start, uint32_t bytes, uint8_t err);
+static void SD_Stats_Busy(uint32_t time, uint8_t err);
+#define SD_STATS_TICK()                           SD_GetTick_us()
+#define SD_STATS_RECORD(index, start, bytes, err) SD_Stats_Cmd(index, start, bytes, err)
+#define SD_STATS_BUSY(time, err)                  SD_Stats_Busy(time, err)
+#define SD_STATS_ADD(field, n)                    (SD_Stats.field += (n))
+#else
+#define SD_STATS_TICK()                           0
+#define SD_STATS_RECORD(index, start, bytes, err)
+#define SD_STATS_BUSY(time, err)
+#define SD_STATS_ADD(field, n)
+#endif
+
+/* SPI时钟, 分频序号i对应TFCARD_SPI_CLOCK / 2^(i+1) */
+static const uint8_t SD_Prescaler[8] = {SPI_BAUDRATEPRESCALER_2, SPI_BAUDRATEPRESCALER_4, SPI_BAUDRATEPRESCALER_8,
+                                        SPI_BAUDRATEPRESCALER_16, SPI_BAUDRATEPRESCALER_32, SPI_BAUDRATEPRESCALER_64,
+                                        SPI_BAUDRATEPRESCALER_128, SPI_BAUDRATEPRESCALER_256};
+static uint8_t SD_ClockIndex;     // 当前的分频序号
+
+/* 最近一次接收的数据块CRC16 */
+static uint16_t SD_RecvCRC;
+
+#if defined(USE_SD_CRC) || defined(USE_SD_CLOCK_TRAINING)
+/* CRC16查找表, 第k张表是第0张表的值再经过k个字节的移位, 第一次计算CRC时生成 */
+static uint16_t SD_CRC16_Table[SD_CRC16_SLICES][256];
+static uint8_t SD_CRC16_Ready;
+#endif
+
+#ifdef USE_SD_CRC
+static uint8_t SD_CrcFailed;      // 本次请求中出现了CRC错误, 可以重试
+#define SD_CRC_ERROR()                            (SD_CrcFailed = 1)
+#else
+#define SD_CRC_ERROR()
+#endif
+
+#ifdef USE_SD_CLOCK_TRAINING
+static uint8_t SD_ClockErrors;    // 连续的CRC/令牌错误次数
+static uint8_t SD_ClockTraining;  // 训练中, 读测试的错误不降低时钟
+static void SD_Clock_Error(void);
+#define SD_CLOCK_ERROR()                          SD_Clock_Error()
+#define SD_CLOCK_OK()                             (SD_ClockErrors = 0)
+#else
+#define SD_CLOCK_ERROR()
+#define SD_CLOCK_OK()
+#endif
+
+#ifdef USE_SD_DISCARD
+/* 等待擦除的TRIM范围 */
+static SD_Discard_typedef SD_Discard[SD_DISCARD_RANGES];
+static void SD_Discard_Clip(uint32_t sector, uint32_t cnt);
+#endif
+
+#ifdef USE_SPI_DMA_READ_STREAM
+/* 流水线读的双缓冲区: 数据 + CRC + 预读字节 */
+#define SD_STREAM_BLOCK_SIZE  (512 + 2 + SD_READ_STREAM_LOOKAHEAD)
+static uint8_t SD_StreamBuffer[2][SD_STREAM_BLOCK_SIZE];
+#endif
+
+#if defined(USE_SD_CRC) || defined(USE_SD_CLOCK_TRAINING)
+/**
+  * @brief  生成CRC16查找表
+  * @note   T0[b]为字节b的CRC, Tk[b] = (Tk-1[b] << 8) ^ T0[Tk-1[b] >> 8]
+  * @param  无
+  * @retval 无
+  */
+static void SD_CRC16_Init(void)
+{
+	uint16_t crc;
+	uint16_t b;
+	uint8_t i;
+	
+	for (b = 0; b < 256; b++)
+	{
+		crc = b << 8;
+		for (i = 0; i < 8; i++)
+		{
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+		}
+		SD_CRC16_Table[0][b] = crc;
+	}
+	
+	for (i = 1; i < SD_CRC16_SLICES; i++)
+	{
+		for (b = 0; b < 256; b++)
+		{
+			crc = SD_CRC16_Table[i - 1][b];
+			SD_CRC16_Table[i][b] = (uint16_t)(crc << 8) ^ SD_CRC16_Table[0][crc >> 8];
+		}
+	}
+	
+	SD_CRC16_Ready = 1;
+}
+
+
+/**
+  * @brief  计算数据块的CRC16
+  * @note   CRC-16/XMODEM, 多项式x^16 + x^12 + x^5 + 1, 初值0.
+  *         每次查表处理SD_CRC16_SLICES个字节(slice-by-N): 前两个字节与CRC异或后查最高的两张表,
+  *         其余字节各查一张表, 各表之间没有依赖, 比逐字节查表快2~3倍
+  * @param  buff: 数据
+  * @param  len: 数据长度
+  * @retval CRC16
+  */
+uint16_t SD_CRC16(const uint8_t *buff, uint32_t len)
+{
+	uint16_t crc = 0;
+#if SD_CRC16_SLICES > 1
+	uint32_t value;
+	uint8_t i;
+#endif
+	
+	if (!SD_CRC16_Ready)
+	{
+		SD_CRC16_Init();
+	}
+	
+#if SD_CRC16_SLICES > 1
+	while (len >= SD_CRC16_SLICES)
+	{
+		crc ^= ((uint16_t)buff[0] << 8) | buff[1];
+		value = SD_CRC16_Table[SD_CRC16_SLICES - 1][crc >> 8] ^ SD_CRC16_Table[SD_CRC16_SLICES - 2][crc & 0xFF];
+		for (i = 2; i < SD_CRC16_SLICES; i++)
+		{
+			value ^= SD_CRC16_Table[SD_CRC16_SLICES - 1 - i][buff[i]];
+		}
+		crc = (uint16_t)value;
+		buff += SD_CRC16_SLICES;
+		len -= SD_CRC16_SLICES;
+	}
+#endif
+	
+	while (len--)
+	{
+		crc = (uint16_t)(crc << 8) ^ SD_CRC16_Table[0][(crc >> 8) ^ *buff++];
+	}
+	
+	return crc;
+}
+#endif
+
+
+#ifdef USE_SD_CRC
+/**
+  * @brief  计算命令的CRC7
+  * @note   多项式x^7 + x^3 + 1, 计算命令的前5个字节, 返回值包含结束位
+  * @param  cmd: 命令
+  * @param  arg: 命令参数
+  * @retval 命令的最后一个字节
+  */
+static uint8_t SD_CRC7(uint8_t cmd, uint32_t arg)
+{
+	uint8_t data[5];
+	uint8_t crc = 0;
+	uint8_t i, j;
+	
+	data[0] = cmd | 0x40;
+	data[1] = (uint8_t)(arg >> 24);
+	data[2] = (uint8_t)(arg >> 16);
+	data[3] = (uint8_t)(arg >> 8);
+	data[4] = (uint8_t)arg;
+	
+	for (i = 0; i < 5; i++)
+	{
+		for (j = 0; j < 8; j++)
+		{
+			crc <<= 1;
+			if (((data[i] << j) ^ crc) & 0x80)
+			{
+				crc ^= 0x09;
+			}
+		}
+	}
+	
+	return (uint8_t)((crc << 1) | 0x01);
+}
+#endif
+
+
+/**
+  * @brief  校验接收的数据块
+  * @note   未开启USE_SD_CRC时总是成功; CRC错误时计入统计并标记本次请求可以重试
+  * @param  buff: 数据
+  * @param  len: 数据长度
+  * @param  crc: 接收的CRC16
+  * @retval 0: 正确, 1: CRC错误
+  */
+static uint8_t SD_CheckData(const uint8_t *buff, uint32_t len, uint16_t crc)
+{
+#ifdef USE_SD_CRC
+	if (TFCARD_CRC16(buff, len) != crc)
+	{
+		SD_STATS_ADD(CrcErrors, 1);
+		SD_CLOCK_ERROR();
+		SD_CRC_ERROR();
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+
 /**
   * @brief  取消选择, 释放SPI总线
   * @note   无
@@ -41,26 +254,165 @@ uint8_t SD_Select(void)
 
 
 /**
-  * @brief  等待SD卡准备
-  * @note   SD卡返回0x00时表示忙，返回0xFF表示准备就绪
+  * @brief  开始一个命令序列
+  * @note   只进行一次片选和等待准备, 直到SD_EndTransaction()之前的所有命令都在同一次片选内发送,
+  *         适用于CMD55+ACMD、CMD13轮询等响应为R1/R2的命令序列; 序列中发送R1b命令或写数据之后, 
+  *         需要先调用SD_WaitReady()再发送下一条命令
   * @param  无
   * @retval 0: 成功, 其他: 失败
   */
-uint8_t SD_WaitReady(void)
+uint8_t SD_BeginTransaction(void)
+{
+	if (SD_Stream.Mode != SD_STREAM_NONE)
+	{
+		SD_Stream_Close();  // 连续读写传输占用片选, 先关闭
+	}
+	
+	SD_DisSelect();  // 取消上次片选
+	if (SD_Select() == 1)
+	{
+		return 1;  // 片选失效
+	}
+	
+	SD_InTransaction = 1;
+	return 0;
+}
+
+
+/**
+  * @brief  结束命令序列, 取消片选
+  * @note   无
+  * @param  无
+  * @retval 无
+  */
+void SD_EndTransaction(void)
 {
-	uint16_t count = 0;
+	SD_InTransaction = 0;
+	SD_DisSelect();
+}
+
+
+/**
+  * @brief  等待SD卡忙结束
+  * @note   SD卡返回0x00时表示忙，返回0xFF表示准备就绪
+  *         忙检测方式由SD_BUSY_STRATEGY选择
+  * @param  timeout: 超时时间, 单位ms
+  * @retval 0: 成功, 其他: 失败
+  */
+static uint8_t SD_WaitBusy(uint32_t timeout)
+{
+	uint32_t tickstart, busystart;
+	uint8_t retval = 1;
+	
+	if (SD_ReadWriteByte(0xFF) == 0xFF)
+	{
+		return 0;  // 没有忙, 直接返回
+	}
+	
+	busystart = SD_GetTick_us();
+	tickstart = HAL_GetTick();
+	
+#if (SD_BUSY_STRATEGY == SD_BUSY_POLL_BATCH)
+	uint8_t rxbuff[SD_BUSY_BATCH_SIZE];
+	do
+	{
+		SD_ReadBuffer(rxbuff, SD_BUSY_BATCH_SIZE);
+		if (rxbuff[SD_BUSY_BATCH_SIZE - 1] == 0xFF)  // 忙结束后MISO保持高电平, 只需检查最后一个字节
+		{
+			retval = 0;
+			break;
+		}
+	}
+	while (HAL_GetTick() - tickstart < timeout);
 	
+#elif (SD_BUSY_STRATEGY == SD_BUSY_POLL_BACKOFF)
+	uint32_t delay = SD_BusyTime / 2;  // 第一次按上次忙时间的一半等待
+	uint32_t interval = SD_BUSY_BACKOFF_MIN_US;
 	do
 	{
+		if (delay < SD_BUSY_BACKOFF_MIN_US)
+		{
+			delay = SD_BUSY_BACKOFF_MIN_US;
+		}
+		else if (delay > SD_BUSY_BACKOFF_MAX_US)
+		{
+			delay = SD_BUSY_BACKOFF_MAX_US;
+		}
+		
+		TFCARD_BUSY_DELAY_US(delay);
 		if (SD_ReadWriteByte(0xFF) == 0xFF)
 		{
-			return 0;
+			retval = 0;
+			break;
+		}
+		
+		delay = interval;  // 之后的间隔从最小值开始加倍, 最大到SD_BUSY_BACKOFF_MAX_US
+		if (interval < SD_BUSY_BACKOFF_MAX_US)
+		{
+			interval *= 2;
 		}
-		count++;		  	
 	}
-	while (count < 0xFFF0); 
+	while (HAL_GetTick() - tickstart < timeout);
 	
-	return 1;
+#elif (SD_BUSY_STRATEGY == SD_BUSY_MISO_EVENT)
+	do
+	{
+		if (TFCARD_SPI_MISO_READ() == GPIO_PIN_SET)
+		{
+			if (SD_ReadWriteByte(0xFF) == 0xFF)  // MISO变高后通过SPI确认
+			{
+				retval = 0;
+				break;
+			}
+		}
+		else
+		{
+			TFCARD_BUSY_WAIT_EVENT();  // 等待MISO上升沿中断或系统节拍中断唤醒
+		}
+	}
+	while (HAL_GetTick() - tickstart < timeout);
+	
+#else
+	do
+	{
+		if (SD_ReadWriteByte(0xFF) == 0xFF)
+		{
+			retval = 0;
+			break;
+		}
+	}
+	while (HAL_GetTick() - tickstart < timeout);
+	
+#endif
+	
+	SD_BusyTime = SD_GetTick_us() - busystart;
+	SD_STATS_BUSY(SD_BusyTime, retval);
+	
+	return retval;
+}
+
+
+/**
+  * @brief  等待SD卡准备
+  * @note   超时时间为SD_BUSY_TIMEOUT
+  * @param  无
+  * @retval 0: 成功, 其他: 失败
+  */
+uint8_t SD_WaitReady(void)
+{
+	return SD_WaitBusy(SD_BUSY_TIMEOUT);
+}
+
+
+/**
+  * @brief  获取最近一次SD卡忙的时间
+  * @note   只记录SD_WaitReady()中检测到的忙, 超时时为超时前等待的时间
+  * @param  无
+  * @retval 忙时间, 单位us
+  */
+uint32_t SD_GetBusyTime(void)
+{
+	return SD_BusyTime;
 }
 
 
@@ -79,8 +431,12 @@ uint8_t SD_GetResponse(uint8_t Response)
 		count--;  // 等待得到准确的回应  	  
 	}
 	
+	SD_STATS_ADD(TokenRetries, 0x1FFF - count);
+	
 	if (count == 0)		// 超时退出
 	{
+		SD_STATS_ADD(TokenTimeouts, 1);
+		SD_CLOCK_ERROR();
 		return MSD_RESPONSE_FAILURE;  // 回应失败  
 	}		
 	else		// 正常退出
@@ -104,23 +460,118 @@ uint8_t SD_RecvData(uint8_t *buff, uint32_t len)
 		return 1;   // 读取失败
 	}
 
-#ifndef  SPI_DMA_READ_SECTOR 
-  while (len--)  // 开始接收数据
+#ifndef  USE_SPI_DMA_READ_SECTOR
+	uint32_t count;
+  for (count = 0; count < len; count++)  // 开始接收数据
   {
-		*buff = SD_ReadWriteByte(0xFF);   // 接收数据
-    buff++;
+		buff[count] = SD_ReadWriteByte(0xFF);   // 接收数据
   }
-	SD_ReadWriteByte(0xFF);   // 忽略CRC
-	SD_ReadWriteByte(0xFF);
+	SD_RecvCRC = (uint16_t)SD_ReadWriteByte(0xFF) << 8;   // 接收CRC
+	SD_RecvCRC |= SD_ReadWriteByte(0xFF);
 #else
 	uint8_t crcdata[2];
 	SD_ReadBuffer_DMA(buff, len);   // 接收数据
-  SD_ReadBuffer_DMA(crcdata, 2);  // 忽略CRC
+  SD_ReadBuffer_DMA(crcdata, 2);  // 接收CRC
+	SD_RecvCRC = ((uint16_t)crcdata[0] << 8) | crcdata[1];
 #endif
+	if (SD_CheckData(buff, len, SD_RecvCRC) != 0)
+	{
+		return 1;   // CRC错误
+	}
+	SD_CLOCK_OK();
   
   return 0;   // 读取成功
 }
 
+
+#ifdef USE_SPI_DMA_READ_STREAM
+/**
+  * @brief  以双缓冲DMA流水线方式连续接收多个扇区
+  * @note   用于CMD18之后. 每次DMA除了接收512字节数据和2字节CRC外, 还额外读取
+  *         SD_READ_STREAM_LOOKAHEAD个字节, 下一个扇区的起始令牌通常就在其中, 
+  *         省去了逐字节等待令牌的过程; 同时在DMA接收第N+1个扇区时, CPU把第N个
+  *         扇区从另一个缓冲区拷贝到用户缓冲区
+  * @param  buff: 数据缓冲区
+  * @param  cnt: 扇区数
+  * @retval 0: 成功, 其他: 失败
+  */
+uint8_t SD_RecvStream(uint8_t *buff, uint32_t cnt)
+{
+	uint8_t  cur = 0;           // 当前DMA使用的缓冲区
+	uint16_t head = 0;          // 当前缓冲区中已经由上一次预读收到的数据字节数
+	uint16_t len;
+	uint16_t i;
+	uint8_t *pending = 0;       // 等待拷贝到用户缓冲区的扇区
+	uint8_t err = 0;
+
+	if (SD_GetResponse(0xFE) != MSD_RESPONSE_NO_ERROR)    // 等待第一个扇区的起始令牌
+	{
+		return 1;
+	}
+
+	while (cnt--)
+	{
+		/* 最后一个扇区不预读, 避免读到下一个扇区的数据 */
+		len = 514 - head + (cnt ? SD_READ_STREAM_LOOKAHEAD : 0);
+		if (SD_ReadBuffer_DMA_Start(&SD_StreamBuffer[cur][head], len) != 0)
+		{
+			return 1;
+		}
+
+		/* DMA进行的同时, 校验上一个扇区并交给用户 */
+		if (pending)
+		{
+			err = SD_CheckData(pending, 512, ((uint16_t)pending[512] << 8) | pending[513]);
+			memcpy(buff, pending, 512);
+			buff += 512;
+		}
+
+		if ((SD_WaitBuffer_DMA() != 0) || (err != 0))
+		{
+			return 1;
+		}
+		pending = SD_StreamBuffer[cur];
+
+		if (cnt == 0)
+		{
+			break;
+		}
+
+		/* 在预读的字节中查找下一个扇区的起始令牌 */
+		head = 0;
+		for (i = 514; i < SD_STREAM_BLOCK_SIZE; i++)
+		{
+			if (pending[i] != 0xFF)
+			{
+				break;
+			}
+		}
+
+		if (i == SD_STREAM_BLOCK_SIZE)   // 预读中没有令牌, 继续逐字节等待
+		{
+			if (SD_GetResponse(0xFE) != MSD_RESPONSE_NO_ERROR)
+			{
+				return 1;
+			}
+		}
+		else if (pending[i] == 0xFE)     // 令牌之后的字节已经属于下一个扇区
+		{
+			head = SD_STREAM_BLOCK_SIZE - i - 1;
+			memcpy(SD_StreamBuffer[cur ^ 1], &pending[i + 1], head);
+		}
+		else
+		{
+			return 1;   // 数据错误令牌
+		}
+
+		cur ^= 1;
+	}
+
+	memcpy(buff, pending, 512);
+	return SD_CheckData(pending, 512, ((uint16_t)pending[512] << 8) | pending[513]);
+}
+#endif
+
 	
 /**
   * @brief  按扇区向SD卡发送数据
@@ -142,25 +593,41 @@ uint8_t SD_SendBlock(uint8_t *buff, uint8_t cmd)
 	SD_ReadWriteByte(cmd);
 	if (cmd != 0xFD)   // 不是结束指令
 	{
+#ifdef USE_SD_CRC
+		uint16_t crc = TFCARD_CRC16(buff, 512);
+		crcdata[0] = (uint8_t)(crc >> 8);
+		crcdata[1] = (uint8_t)crc;
+#endif
 		
-#ifndef  SPI_DMA_WRITE_SECTOR 
+#ifndef  USE_SPI_DMA_WRITE_SECTOR
 		uint16_t count;	
 		for (count = 0; count < 512; count++)
 		{
 		  SD_ReadWriteByte(buff[count]);   // 发送数据
 		}
-	  SD_ReadWriteByte(crcdata[0]);   	// 忽略CRC
+	  SD_ReadWriteByte(crcdata[0]);   	// CRC, 未开启USE_SD_CRC时卡不检查
 		SD_ReadWriteByte(crcdata[1]);
 #else
 	  SD_WriteBuffer_DMA(buff, 512);   	// 发送数据
-		SD_WriteBuffer_DMA(crcdata, 2);  	// 忽略CRC
+		SD_WriteBuffer_DMA(crcdata, 2);  	// CRC, 未开启USE_SD_CRC时卡不检查
 #endif
 		
 		retval = SD_ReadWriteByte(0xFF);   // 接收响应
 		if ((retval & 0x1F) != MSD_DATA_OK)			 // 正常响应为xxx00101
 		{
+			if ((retval & 0x1F) == MSD_DATA_CRC_ERROR)
+			{
+				SD_STATS_ADD(CrcErrors, 1);
+				SD_CLOCK_ERROR();
+				SD_CRC_ERROR();
+			}
+			else
+			{
+				SD_STATS_ADD(DataErrors, 1);
+			}
 			return 2;    // 响应错误		
 		}
+		SD_CLOCK_OK();
 		
 		/* 延时等待SD卡内部数据写入完成，上面的操作只是把数据发送到SD卡控制器缓存中，还没有写入到SD卡闪存内 */
 		if (SD_WaitReady() == 1)
@@ -178,7 +645,7 @@ uint8_t SD_SendBlock(uint8_t *buff, uint8_t cmd)
   * @note   无
   * @param  cmd: 命令
   * @param  arg: 命令参数
-  * @param  crc: CRC
+  * @param  crc: CRC, 开启USE_SD_CRC时由驱动计算, 不使用该参数
   * @retval SD卡返回的响应
   */
 uint8_t SD_SendCmd(uint8_t cmd, uint32_t arg, uint8_t crc)
@@ -186,13 +653,33 @@ uint8_t SD_SendCmd(uint8_t cmd, uint32_t arg, uint8_t crc)
   uint8_t retval;	
 	uint8_t count = 0xFF; 
 	
-	SD_DisSelect();  // 取消上次片选
-	if (SD_Select() == 1)
+	if (SD_Stream.Mode != SD_STREAM_NONE)
+	{
+		SD_Stream_Close();  // 发送其他命令前关闭连续读写传输
+	}
+
+	if (cmd == TF_CMD12)
 	{
-		return 0xFF;  // 片选失效 
+		TFCARD_SPI_CS_LOW();  // 读数据期间MISO上是数据而不是忙信号, 停止命令不等待准备直接发送
 	}
+	else if (SD_InTransaction)
+	{
+		SD_ReadWriteByte(0xFF);  // 命令序列中保持片选, 只需要间隔8个时钟
+	}
+	else
+	{
+		SD_DisSelect();  // 取消上次片选
+		if (SD_Select() == 1)
+		{
+			return 0xFF;  // 片选失效 
+		}
+	}
+
+#ifdef USE_SD_CRC
+	crc = SD_CRC7(cmd, arg);   // CMD59开启CRC后每个命令都要带正确的CRC7
+#endif
 
-#ifndef  SPI_DMA_SEND_CMD
+#ifndef  USE_SPI_DMA_SEND_CMD
   SD_ReadWriteByte(cmd | 0x40);   // 分别写入命令
   SD_ReadWriteByte(arg >> 24);
   SD_ReadWriteByte(arg >> 16);
@@ -222,6 +709,19 @@ uint8_t SD_SendCmd(uint8_t cmd, uint32_t arg, uint8_t crc)
 	}
 	while ((retval & 0x80) && count--);	 
 	
+	if (retval & MSD_COM_CRC_ERROR)
+	{
+		SD_STATS_ADD(CrcErrors, 1);
+		SD_CLOCK_ERROR();
+		SD_CRC_ERROR();
+	}
+	else if ((retval & 0xFE) && retval != (MSD_ILLEGAL_COMMAND | MSD_IN_IDLE_STATE))
+	{
+		// 无响应(0xFF)或者有错误位, 空闲位除外; 空闲状态下的非法命令是初始化时的卡类型探测
+		// (V1.0卡和MMC卡不支持CMD8, MMC卡不支持CMD55+ACMD41), 不计入
+		SD_STATS_ADD(ResponseErrors, 1);
+	}
+	
   return retval;  	// 返回状态值
 }		
 
@@ -282,73 +782,539 @@ uint8_t SD_GetCSD(uint8_t *csd)
 
 
 /**
-  * @brief  获取SD卡的总扇区数
-  * @note   1扇区等于512字节
-  * @param  无
-  * @retval SD卡的总扇区数
+  * @brief  获取SD卡的SCR信息
+  * @note   ACMD51, MMC卡不支持
+  * @param  scr: 存放SCR的缓冲区，至少8Byte
+  * @retval 0: 成功, 其他: 失败
   */
-uint32_t SD_GetSectorCount(void)
+uint8_t SD_GetSCR(uint8_t *scr)
 {
-  uint8_t csd[16];
-  uint32_t capacity, csize, n;
-	  
-	// 获取CSD信息
-  if (SD_GetCSD(csd) != 0)
+	uint8_t retval;
+	
+	if (SD_BeginTransaction() != 0)
 	{
-		return 0;
+		return 1;
 	}
+	SD_SendCmd(TF_CMD55, 0, 0x01);
+	retval = SD_SendCmd(TF_CMD51, 0, 0x01);  // 发ACMD51命令, 读SCR
+	if (retval == 0)
+	{
+		retval = SD_RecvData(scr, 8);   // 接收8个字节的数据
+	}
+	
+	SD_EndTransaction();  // 取消片选
+	return (retval == 0) ? 0 : 1;
+}
 
-  // 如果为SDHC卡, 按照下面方式计算
-  if((csd[0] & 0xC0) == 0x40)	 // SDV2.0的卡
-  {
-	  csize = csd[9] + ((uint32_t)csd[8] << 8) + ((uint32_t)(csd[7] & 63) << 16) + 1;
-		capacity = csize << 9;
-  }
-	else   // SDV1.0的卡
-  {	
-	  n = (csd[5] & 15) + ((csd[10] & 128) >> 7) + ((csd[9] & 3) << 1) + 2;
-		csize = (csd[8] >> 6) + ((uint16_t)csd[7] << 2) + ((uint16_t)(csd[6] & 3) << 10) + 1;
-		capacity= (uint32_t)csize << (n - 9);  // 得到扇区数   
-  }
+
+/**
+  * @brief  获取SD卡的SD状态寄存器SSR
+  * @note   ACMD13, 响应为R2格式, MMC卡不支持
+  * @param  ssr: 存放SSR的缓冲区，至少64Byte
+  * @retval 0: 成功, 其他: 失败
+  */
+uint8_t SD_GetSSR(uint8_t *ssr)
+{
+	uint8_t retval;
+	
+	if (SD_BeginTransaction() != 0)
+	{
+		return 1;
+	}
+	SD_SendCmd(TF_CMD55, 0, 0x01);
+	retval = SD_SendCmd(TF_CMD13, 0, 0x01);  // 发ACMD13命令, 读SSR
+	if (retval == 0)
+	{
+		SD_ReadWriteByte(0xFF);   // R2的第二个字节
+		retval = SD_RecvData(ssr, 64);   // 接收64个字节的数据
+	}
+	
+	SD_EndTransaction();  // 取消片选
+	return (retval == 0) ? 0 : 1;
+}
+
+
+/**
+  * @brief  从寄存器数据中取出一个字段
+  * @note   位编号与SD规范一致, 最后一个字节的最低位为bit0
+  * @param  data: 寄存器数据, 高位在前
+  * @param  size: 寄存器字节数
+  * @param  msb: 字段最高位的编号
+  * @param  width: 字段位数, 不超过32
+  * @retval 字段值
+  */
+static uint32_t SD_GetBits(const uint8_t *data, uint8_t size, uint16_t msb, uint8_t width)
+{
+	uint32_t value = 0;
+	uint16_t bit;
+	
+	for (bit = msb + 1 - width; bit <= msb; bit++)
+	{
+		if (data[size - 1 - bit / 8] & (1 << (bit % 8)))
+		{
+			value |= (uint32_t)1 << (bit - (msb + 1 - width));
+		}
+	}
+	
+	return value;
+}
+
+
+/**
+  * @brief  解码CSD中的TRAN_SPEED
+  * @note   bit2~0: 速率单位 100kbit/s, 1Mbit/s, 10Mbit/s, 100Mbit/s
+  *         bit6~3: 倍数 1.0, 1.2, 1.3, 1.5, 2.0, 2.5, 3.0, 3.5, 4.0, 4.5, 5.0, 5.5, 6.0, 7.0, 8.0
+  * @param  transpeed: TRAN_SPEED
+  * @retval 最大时钟, 单位Hz
+  */
+static uint32_t SD_Decode_TranSpeed(uint8_t transpeed)
+{
+	static const uint8_t value[16] = {0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80};
+	static const uint32_t unit[4] = {10000, 100000, 1000000, 10000000};
+	
+	if ((transpeed & 0x07) > 3)
+	{
+		return 0;   // 保留值
+	}
+	return unit[transpeed & 0x07] * value[(transpeed >> 3) & 0x0F];
+}
+
+
+/**
+  * @brief  解码CSD寄存器, 计算扇区数和容量
+  * @note   SDV1.0卡和MMC卡按V1.0格式计算, SDHC/SDXC卡按V2.0格式计算, 
+  *         V3.0(SDUC)卡的扇区数超过32位时按最大值处理
+  * @param  csd: 16字节CSD数据
+  * @retval 无
+  */
+static void SD_Decode_CSD(const uint8_t *csd)
+{
+	SD_CSD_typedef *reg = &SDCard_Information.CSD;
+	uint64_t blocknbr;
+	
+	reg->CSDStruct          = SD_GetBits(csd, 16, 127, 2);
+	reg->TAAC               = SD_GetBits(csd, 16, 119, 8);
+	reg->NSAC               = SD_GetBits(csd, 16, 111, 8);
+	reg->MaxBusClkFreq      = SD_GetBits(csd, 16, 103, 8);
+	reg->CardComdClasses    = SD_GetBits(csd, 16, 95, 12);
+	reg->RdBlockLen         = SD_GetBits(csd, 16, 83, 4);
+	reg->PartBlockRead      = SD_GetBits(csd, 16, 79, 1);
+	reg->WrBlockMisalign    = SD_GetBits(csd, 16, 78, 1);
+	reg->RdBlockMisalign    = SD_GetBits(csd, 16, 77, 1);
+	reg->DSRImpl            = SD_GetBits(csd, 16, 76, 1);
+	reg->EraseBlockEnable   = SD_GetBits(csd, 16, 46, 1);
+	reg->EraseSectorSize    = SD_GetBits(csd, 16, 45, 7);
+	reg->WrProtectGrSize    = SD_GetBits(csd, 16, 38, 7);
+	reg->WrProtectGrEnable  = SD_GetBits(csd, 16, 31, 1);
+	reg->WrSpeedFact        = SD_GetBits(csd, 16, 28, 3);
+	reg->MaxWrBlockLen      = SD_GetBits(csd, 16, 25, 4);
+	reg->WriteBlockPaPartial = SD_GetBits(csd, 16, 21, 1);
+	reg->FileFormatGroup    = SD_GetBits(csd, 16, 15, 1);
+	reg->CopyFlag           = SD_GetBits(csd, 16, 14, 1);
+	reg->PermWrProtect      = SD_GetBits(csd, 16, 13, 1);
+	reg->TempWrProtect      = SD_GetBits(csd, 16, 12, 1);
+	reg->FileFormat         = SD_GetBits(csd, 16, 11, 2);
+	reg->CSD_CRC            = SD_GetBits(csd, 16, 7, 7);
+	
+	if (SDCard_Information.Card_Type != TF_TYPE_MMC && reg->CSDStruct == 1)   // V2.0, C_SIZE为22位
+	{
+		reg->DeviceSize = SD_GetBits(csd, 16, 69, 22);
+		blocknbr = ((uint64_t)reg->DeviceSize + 1) << 10;
+	}
+	else if (SDCard_Information.Card_Type != TF_TYPE_MMC && reg->CSDStruct == 2)   // V3.0, C_SIZE为28位
+	{
+		reg->DeviceSize = SD_GetBits(csd, 16, 75, 28);
+		blocknbr = ((uint64_t)reg->DeviceSize + 1) << 10;
+	}
+	else   // V1.0
+	{
+		reg->DeviceSize         = SD_GetBits(csd, 16, 73, 12);
+		reg->MaxRdCurrentVDDMin = SD_GetBits(csd, 16, 61, 3);
+		reg->MaxRdCurrentVDDMax = SD_GetBits(csd, 16, 58, 3);
+		reg->MaxWrCurrentVDDMin = SD_GetBits(csd, 16, 55, 3);
+		reg->MaxWrCurrentVDDMax = SD_GetBits(csd, 16, 52, 3);
+		reg->DeviceSizeMul      = SD_GetBits(csd, 16, 49, 3);
+		blocknbr = ((uint64_t)reg->DeviceSize + 1) << (reg->DeviceSizeMul + 2 + reg->RdBlockLen - 9);
+	}
+	
+	if (blocknbr > 0xFFFFFFFF)
+	{
+		blocknbr = 0xFFFFFFFF;
+	}
+	SDCard_Information.Card_BlockNbr = (uint32_t)blocknbr;
+	SDCard_Information.Card_BlockSize = 512;
+	SDCard_Information.Card_Capacity = (uint32_t)(blocknbr / 2);
+	
+	/* 擦除单元: 支持单块擦除的卡为1个扇区, 否则为SECTOR_SIZE个写数据块 */
+	if (reg->EraseBlockEnable)
+	{
+		SDCard_Information.Card_EraseSize = 1;
+	}
+	else
+	{
+		SDCard_Information.Card_EraseSize = ((uint32_t)reg->EraseSectorSize + 1) << reg->MaxWrBlockLen >> 9;
+	}
+	
+	SDCard_Information.Card_MaxClock = SD_Decode_TranSpeed(reg->MaxBusClkFreq);
+}
+
+
+/**
+  * @brief  解码CID寄存器
+  * @note   无
+  * @param  cid: 16字节CID数据
+  * @retval 无
+  */
+static void SD_Decode_CID(const uint8_t *cid)
+{
+	SD_CID_typedef *reg = &SDCard_Information.CID;
+	uint8_t i;
+	
+	reg->ManufacturerID = SD_GetBits(cid, 16, 127, 8);
+	reg->OEM_AppliID    = SD_GetBits(cid, 16, 119, 16);
+	for (i = 0; i < 5; i++)
+	{
+		reg->ProdName[i] = (char)cid[3 + i];
+	}
+	reg->ProdName[5]    = '\0';
+	reg->ProdRev        = SD_GetBits(cid, 16, 63, 8);
+	reg->ProdSN         = SD_GetBits(cid, 16, 55, 32);
+	reg->ManufactDate   = SD_GetBits(cid, 16, 19, 12);
+	reg->CID_CRC        = SD_GetBits(cid, 16, 7, 7);
+}
+
+
+/**
+  * @brief  解码SCR寄存器
+  * @note   无
+  * @param  scr: 8字节SCR数据
+  * @retval 无
+  */
+static void SD_Decode_SCR(const uint8_t *scr)
+{
+	SD_SCR_typedef *reg = &SDCard_Information.SCR;
 	
-	capacity = SD_GetCapacity() * 2;
-  return capacity;
+	reg->SCRStruct          = SD_GetBits(scr, 8, 63, 4);
+	reg->SDSpec             = SD_GetBits(scr, 8, 59, 4);
+	reg->DataStatAfterErase = SD_GetBits(scr, 8, 55, 1);
+	reg->SDSecurity         = SD_GetBits(scr, 8, 54, 3);
+	reg->SDBusWidths        = SD_GetBits(scr, 8, 51, 4);
+	reg->SDSpec3            = SD_GetBits(scr, 8, 47, 1);
+	reg->ExSecurity         = SD_GetBits(scr, 8, 46, 4);
+	reg->SDSpec4            = SD_GetBits(scr, 8, 42, 1);
+	reg->SDSpecX            = SD_GetBits(scr, 8, 41, 4);
+	reg->CmdSupport         = SD_GetBits(scr, 8, 35, 4);
+}
+
+
+/**
+  * @brief  解码SD状态寄存器SSR
+  * @note   AU_SIZE有效时用它作为擦除单元大小
+  * @param  ssr: 64字节SSR数据
+  * @retval 无
+  */
+static void SD_Decode_SSR(const uint8_t *ssr)
+{
+	SD_SSR_typedef *reg = &SDCard_Information.SSR;
+	
+	reg->DataBusWidth          = SD_GetBits(ssr, 64, 511, 2);
+	reg->SecuredMode           = SD_GetBits(ssr, 64, 509, 1);
+	reg->CardType              = SD_GetBits(ssr, 64, 495, 16);
+	reg->ProtectedAreaSize     = SD_GetBits(ssr, 64, 479, 32);
+	reg->SpeedClass            = SD_GetBits(ssr, 64, 447, 8);
+	reg->PerformanceMove       = SD_GetBits(ssr, 64, 439, 8);
+	reg->AllocationUnitSize    = SD_GetBits(ssr, 64, 431, 4);
+	reg->EraseSize             = SD_GetBits(ssr, 64, 423, 16);
+	reg->EraseTimeout          = SD_GetBits(ssr, 64, 407, 6);
+	reg->EraseOffset           = SD_GetBits(ssr, 64, 401, 2);
+	reg->UhsSpeedGrade         = SD_GetBits(ssr, 64, 399, 4);
+	reg->UhsAllocationUnitSize = SD_GetBits(ssr, 64, 395, 4);
+	reg->VideoSpeedClass       = SD_GetBits(ssr, 64, 391, 8);
+	reg->VscAllocationUnitSize = SD_GetBits(ssr, 64, 377, 10);
+	reg->SusAddr               = SD_GetBits(ssr, 64, 367, 22);
+	reg->AppPerfClass          = SD_GetBits(ssr, 64, 339, 4);
+	
+	/* AU_SIZE: 1~10为16KB*2^(n-1), 11~15为12MB/16MB/24MB/32MB/64MB */
+	if (reg->AllocationUnitSize >= 1 && reg->AllocationUnitSize <= 10)
+	{
+		SDCard_Information.Card_EraseSize = (uint32_t)32 << (reg->AllocationUnitSize - 1);
+	}
+	else if (reg->AllocationUnitSize > 10)
+	{
+		static const uint8_t ausize_mb[5] = {12, 16, 24, 32, 64};
+		SDCard_Information.Card_EraseSize = (uint32_t)ausize_mb[reg->AllocationUnitSize - 11] * 2048;
+	}
+}
+
+
+/**
+  * @brief  读取并解码SD卡的寄存器信息
+  * @note   在SD_Card_Init()中调用一次, 之后所有的容量和速度查询都直接使用SDCard_Information
+  * @param  无
+  * @retval 0: 成功, 其他: 失败(读CSD失败)
+  */
+static uint8_t SD_Card_ReadInfo(void)
+{
+	uint8_t buff[64];
+	
+	if (SD_GetCSD(SDCard_Information.Card_RawCSD) != 0)
+	{
+		return 1;   // 无法得到容量
+	}
+	SD_Decode_CSD(SDCard_Information.Card_RawCSD);
+	
+	if (SD_GetCID(SDCard_Information.Card_RawCID) == 0)
+	{
+		SD_Decode_CID(SDCard_Information.Card_RawCID);
+	}
+	
+	if (SD_SendCmd(TF_CMD58, 0, 0x01) == 0)   // 读OCR
+	{
+		SDCard_Information.Card_OCR  = (uint32_t)SD_ReadWriteByte(0xFF) << 24;
+		SDCard_Information.Card_OCR |= (uint32_t)SD_ReadWriteByte(0xFF) << 16;
+		SDCard_Information.Card_OCR |= (uint32_t)SD_ReadWriteByte(0xFF) << 8;
+		SDCard_Information.Card_OCR |= (uint32_t)SD_ReadWriteByte(0xFF);
+	}
+	SD_DisSelect();
+	
+	if (SDCard_Information.Card_Type != TF_TYPE_MMC)
+	{
+		if (SD_GetSCR(buff) == 0)
+		{
+			SD_Decode_SCR(buff);
+		}
+		if (SD_GetSSR(buff) == 0)
+		{
+			SD_Decode_SSR(buff);
+		}
+	}
+	
+	/* 容量超过32GB的V2.0卡为SDXC卡 */
+	if (SDCard_Information.Card_Type == TF_TYPE_SDHC && SDCard_Information.Card_Capacity > 32 * 1024 * 1024)
+	{
+		SDCard_Information.Card_Type = TF_TYPE_SDXC;
+	}
+	
+	return 0;
+}
+
+
+/**
+  * @brief  获取SD卡的总扇区数
+  * @note   1扇区等于512字节, 从SD_Card_Init()读取的CSD中得到, 不访问SD卡
+  * @param  无
+  * @retval SD卡的总扇区数
+  */
+uint32_t SD_GetSectorCount(void)
+{
+	return SDCard_Information.Card_BlockNbr;
 }
 
 
 /**
   * @brief  获取SD卡的容量，单位KiByte
-  * @note   单位KiByte
+  * @note   从SD_Card_Init()读取的CSD中得到, 不访问SD卡
   * @param  无
   * @retval SD卡的容量
   */
 uint32_t SD_GetCapacity(void)
 {
-  uint8_t csd[16];
-  uint32_t capacity;
-  uint16_t n;
-  uint32_t csize; 
+	return SDCard_Information.Card_Capacity;
+}
+
+
+/**
+  * @brief  获取SD卡的扇区大小
+  * @note   不访问SD卡
+  * @param  无
+  * @retval 扇区大小, 单位字节
+  */
+uint32_t SD_GetBlockSize(void)
+{
+	return SDCard_Information.Card_BlockSize;
+}
+
+
+/**
+  * @brief  获取SD卡的擦除单元大小
+  * @note   优先使用SSR中的AU_SIZE, 否则使用CSD中的SECTOR_SIZE, 不访问SD卡
+  * @param  无
+  * @retval 擦除单元大小, 单位扇区
+  */
+uint32_t SD_GetEraseSize(void)
+{
+	return SDCard_Information.Card_EraseSize;
+}
+
+
+/**
+  * @brief  获取SD卡支持的最大时钟
+  * @note   由CSD中的TRAN_SPEED得到, 进入高速模式后为50MHz, 不访问SD卡
+  * @param  无
+  * @retval 最大时钟, 单位Hz
+  */
+uint32_t SD_GetMaxClock(void)
+{
+	return SDCard_Information.Card_MaxClock;
+}
 
-  // 获取CSD信息
-  if (SD_GetCSD(csd) != 0)
+
+/**
+  * @brief  获取当前使用的SPI时钟
+  * @note   由分频系数计算, 训练或出错降低时钟后改变
+  * @param  无
+  * @retval SPI时钟, 单位Hz
+  */
+uint32_t SD_GetClock(void)
+{
+	return SDCard_Information.Card_Clock;
+}
+
+
+/**
+  * @brief  设置SPI时钟
+  * @note   无
+  * @param  index: 分频序号, 0 ~ 7
+  * @retval 无
+  */
+static void SD_Clock_Set(uint8_t index)
+{
+	SD_ClockIndex = index;
+	SDCard_Information.Card_Clock = TFCARD_SPI_CLOCK >> (index + 1);
+	SD_SPI_SetSpeed(SD_Prescaler[index]);
+}
+
+
+#ifdef USE_SD_CLOCK_TRAINING
+/* 读测试的数据缓冲区 */
+static uint8_t SD_TrainBuffer[512];
+
+/**
+  * @brief  得到不超过指定时钟的最快分频序号
+  * @note   无
+  * @param  clock: 时钟, 单位Hz
+  * @retval 分频序号, 0 ~ 7
+  */
+static uint8_t SD_Clock_Index(uint32_t clock)
+{
+	uint32_t index = 0;
+	
+	while ((index < 7U) && (((uint32_t)TFCARD_SPI_CLOCK >> (index + 1U)) > clock))  // TFCARD_SPI_CLOCK可能定义为有符号常数
 	{
-		return 0;
-	}	 
+		index++;
+	}
+	
+	return (uint8_t)index;
+}
 
-  if ((csd[0] & 0xC0) == 0x40)  // 判断bit126是否为1
-  { 
-    csize = csd[9] + ((uint32_t)csd[8] << 8) + ((uint32_t)(csd[7] & 63) << 16) + 1;
-    capacity = csize << 9; 
-  }
-  else
-  { 
-    n = (csd[5] & 0x0F) + ((csd[10] & 0x80) >> 7) + ((csd[9] & 0x03) << 1) + 2;
-    csize = (csd[8] >> 6) + ((uint16_t)csd[7] << 2) + ((uint16_t)(csd[6] & 0x03) << 10) + 1;
-    capacity = (uint32_t)csize << (n - 10);
-  }
+
+/**
+  * @brief  在当前时钟下读测试
+  * @note   读取SD_TRAIN_SECTOR扇区SD_TRAIN_READS次, 每次的CRC16都要正确且相同
+  * @param  crc: 返回数据的CRC16
+  * @retval 0: 成功, 其他: 失败
+  */
+static uint8_t SD_Clock_Test(uint16_t *crc)
+{
+	uint8_t retval;
+	uint8_t i;
 	
-  return capacity;
-} 
+	for (i = 0; i < SD_TRAIN_READS; i++)
+	{
+		retval = SD_SendCmd(TF_CMD17, SDCard_Information.Card_BlockAddr ? SD_TRAIN_SECTOR : SD_TRAIN_SECTOR * 512, 0x01);
+		if (retval == 0)
+		{
+			retval = SD_RecvData(SD_TrainBuffer, 512);
+		}
+		SD_DisSelect();
+		
+		if ((retval != 0) || (SD_RecvCRC != SD_CRC16(SD_TrainBuffer, 512)) || ((i > 0) && (SD_RecvCRC != *crc)))
+		{
+			return 1;
+		}
+		*crc = SD_RecvCRC;
+	}
+	
+	return 0;
+}
+
+
+/**
+  * @brief  连续出现CRC/令牌错误时降低SPI时钟
+  * @note   在检测到错误的地方调用, 成功收发数据块时清除计数
+  * @param  无
+  * @retval 无
+  */
+static void SD_Clock_Error(void)
+{
+	if (SD_ClockTraining)
+	{
+		return;
+	}
+	
+	if ((++SD_ClockErrors >= SD_CLOCK_ERROR_LIMIT) && (SD_ClockIndex < 7))
+	{
+		SD_ClockErrors = 0;
+		SD_Clock_Set(SD_ClockIndex + 1);
+		SD_STATS_ADD(ClockDowns, 1);
+	}
+}
+#endif
+
+
+/**
+  * @brief  训练SPI时钟
+  * @note   上限为CSD的TRAN_SPEED(CMD6切换到高速模式后为50MHz). 先在SD_TRAIN_START_CLOCK下读测试,
+  *         失败时降低时钟直到成功; 然后逐级提高时钟, 取读测试CRC正确且数据与起始时钟一致的最高一级.
+  *         线路较差时能自动降低时钟, 好的卡和线路可以使用最高时钟
+  * @param  无
+  * @retval 0: 成功, 其他: 最低时钟也无法正确读取
+  */
+uint8_t SD_Clock_Train(void)
+{
+#ifdef USE_SD_CLOCK_TRAINING
+	uint32_t limit = SDCard_Information.Card_MaxClock ? SDCard_Information.Card_MaxClock : 25000000;
+	uint8_t top = SD_Clock_Index(limit);
+	uint8_t index = SD_Clock_Index(SD_TRAIN_START_CLOCK);
+	uint16_t ref, crc;
+	
+	if (index < top)
+	{
+		index = top;
+	}
+	
+	SD_Stream_Close();
+	SD_ClockTraining = 1;
+	
+	/* 起始时钟下得到参考数据 */
+	SD_Clock_Set(index);
+	while (SD_Clock_Test(&ref) != 0)
+	{
+		if (index == 7)
+		{
+			SD_ClockTraining = 0;
+			return 1;
+		}
+		SD_Clock_Set(++index);
+	}
+	
+	/* 逐级提高时钟, 直到读测试失败或者达到上限 */
+	while (index > top)
+	{
+		SD_Clock_Set(index - 1);
+		if ((SD_Clock_Test(&crc) != 0) || (crc != ref))
+		{
+			break;
+		}
+		index--;
+	}
+	
+	SD_Clock_Set(index);
+	SD_ClockErrors = 0;
+	SD_ClockTraining = 0;
+#endif
+	return 0;
+}
 
 
 /**
@@ -363,10 +1329,11 @@ uint8_t SD_Card_Init(void)
 	uint16_t count = 0x20;
 	uint8_t rxbuff[4];  
 	uint8_t i;
+	memset(&SDCard_Information, 0, sizeof(SDCard_Information));
 	SDCard_Information.Card_Type = TF_TYPE_ERROR;
 	
 	SD_SPI_Init();		// 初始化SD卡使用的SPI总线
-	SD_SPI_SetSpeed(SPI_BAUDRATEPRESCALER_256);	// 设置到低速模式400KHz以下
+	SD_Clock_Set(7);	// 设置到低速模式400KHz以下
 	
 	for (i = 0; i < 16; i++)
 	{
@@ -392,12 +1359,14 @@ uint8_t SD_Card_Init(void)
 			if (rxbuff[2] == 0x01 && rxbuff[3] == 0xAA)  // SD卡是否支持2.7~3.6V
 			{
 				count = 0x1FFF;
+				SD_BeginTransaction();
 				do 	// 等待退出空闲模式
 				{
 					SD_SendCmd(TF_CMD55, 0, 0x01);
 					retval = SD_SendCmd(TF_CMD41, 0x40000000, 0x01);
 				}
 				while (retval && count--);
+				SD_EndTransaction();
 					
 				
 				if (count && SD_SendCmd(TF_CMD58, 0, 0x01) == 0)   // 鉴别SD卡2.0版本开始
@@ -408,6 +1377,7 @@ uint8_t SD_Card_Init(void)
 					}
 					if (rxbuff[0] & 0x40)
 					{
+						SDCard_Information.Card_BlockAddr = 1;
 						SDCard_Information.Card_Type = TF_TYPE_SDHC;    // 检查CCS
 					}
 					else 
@@ -420,6 +1390,7 @@ uint8_t SD_Card_Init(void)
 		
 		else  // SD卡V1.0 / MMC
 		{
+			SD_BeginTransaction();
 			SD_SendCmd(TF_CMD55, 0, 0x01);
 			retval = SD_SendCmd(TF_CMD41, 0, 0x01);
 			if (retval <= 1)
@@ -444,6 +1415,7 @@ uint8_t SD_Card_Init(void)
 				}
 				while(retval && count--);
 			}
+			SD_EndTransaction();
 			
 			if(count == 0 || SD_SendCmd(TF_CMD16, 512, 0x01) != 0)
 			{
@@ -452,8 +1424,40 @@ uint8_t SD_Card_Init(void)
 		}
 	}
 	
+#ifdef USE_SD_CRC
+	if (SDCard_Information.Card_Type != TF_TYPE_ERROR && SD_SendCmd(TF_CMD59, 1, 0x01) != 0)   // 开启CRC校验
+	{
+		SDCard_Information.Card_Type = TF_TYPE_ERROR;
+	}
+#endif
+	
 	SD_DisSelect();  // 取消片选
-	SD_SPI_SetSpeed(SPI_BAUDRATEPRESCALER_4);   // 高速20MHz
+#ifdef USE_SD_CLOCK_TRAINING
+	SD_Clock_Set(SD_Clock_Index(SD_TRAIN_START_CLOCK));   // 训练前用起始时钟读取卡信息
+#else
+	SD_Clock_Set(1);   // 高速20MHz
+#endif
+	
+	if (SDCard_Information.Card_Type != TF_TYPE_ERROR && SD_Card_ReadInfo() != 0)
+	{
+		SDCard_Information.Card_Type = TF_TYPE_ERROR;
+	}
+	
+#ifdef USE_SD_HIGH_SPEED
+	/* CCC的bit10: 支持CMD6切换功能, 切换失败时保持默认速度 */
+	if ((SDCard_Information.Card_Type != TF_TYPE_ERROR) && (SDCard_Information.Card_Type != TF_TYPE_MMC) &&
+	    (SDCard_Information.CSD.CardComdClasses & (1 << 10)))
+	{
+		SD_Set_HighSpeedMode();
+	}
+#endif
+	
+#ifdef USE_SD_CLOCK_TRAINING
+	if (SDCard_Information.Card_Type != TF_TYPE_ERROR && SD_Clock_Train() != 0)
+	{
+		SDCard_Information.Card_Type = TF_TYPE_ERROR;
+	}
+#endif
 	
 	if (SDCard_Information.Card_Type >= 1)
 	{
@@ -461,110 +1465,606 @@ uint8_t SD_Card_Init(void)
 	}
 	else
 	{
-		return 0xEE;   // 其他错误
+		return 0xEE;   // 其他错误
+	}
+}
+
+
+/**
+  * @brief  判断请求是否紧接在上一次同方向的请求之后
+  * @note   未开启USE_SD_STREAM_CONTINUE时总是返回0
+  * @param  mode: SD_STREAM_READ / SD_STREAM_WRITE
+  * @param  sector: 起始扇区
+  * @retval 1: 连续, 0: 不连续
+  */
+static uint8_t SD_Stream_IsSequential(uint8_t mode, uint32_t sector)
+{
+#ifdef USE_SD_STREAM_CONTINUE
+	return (SD_Stream.Dir == mode) && (SD_Stream.NextSector == sector);
+#else
+	return 0;
+#endif
+}
+
+
+/**
+  * @brief  打开连续读写传输
+  * @note   读发送CMD18, 写发送(ACMD23 +)CMD25, 成功后保持片选
+  * @param  mode: SD_STREAM_READ / SD_STREAM_WRITE
+  * @param  sector: 起始扇区
+  * @param  cnt: 本次请求的扇区数, 用于ACMD23预擦除
+  * @retval 0: 成功, 其他: 失败
+  */
+static uint8_t SD_Stream_Open(uint8_t mode, uint32_t sector, uint32_t cnt)
+{
+	uint8_t retval;
+
+	if (!SDCard_Information.Card_BlockAddr)
+	{
+		sector *= 512;   // 转换为字节地址
+	}
+
+	if (mode == SD_STREAM_READ)
+	{
+		retval = SD_SendCmd(TF_CMD18, sector, 0x01);   // 连续读命令
+	}
+	else
+	{
+		if (cnt > 1 && SDCard_Information.Card_Type != TF_TYPE_MMC)
+		{
+			if (SD_BeginTransaction() != 0)   // ACMD23和CMD25在同一次片选内发送
+			{
+				return 0xFF;
+			}
+			SD_SendCmd(TF_CMD55, 0, 0x01);	
+			SD_SendCmd(TF_CMD23, (cnt > TF_ACMD23_MAX_BLOCKS) ? TF_ACMD23_MAX_BLOCKS : cnt, 0x01);
+		}
+		retval = SD_SendCmd(TF_CMD25, sector, 0x01);  // 连续写命令
+		SD_InTransaction = 0;
+	}
+
+	if (retval == 0)
+	{
+		SD_Stream.Mode = mode;   // 保持片选, 由SD_Stream_Close()释放
+	}
+	else
+	{
+		SD_DisSelect();
+	}
+	return retval;
+}
+
+
+/**
+  * @brief  关闭连续读写传输
+  * @note   读发送CMD12, 写发送停止令牌0xFD, 然后释放片选
+  * @param  无
+  * @retval 0: 成功, 其他: 失败
+  */
+uint8_t SD_Stream_Close(void)
+{
+	uint8_t retval = 0;
+	uint8_t mode = SD_Stream.Mode;
+
+	SD_Stream.Mode = SD_STREAM_NONE;   // 先清除状态, SD_SendCmd()中不再重复关闭
+
+	if (mode == SD_STREAM_READ)
+	{
+		uint32_t start = SD_STATS_TICK();
+		uint8_t res = SD_SendCmd(TF_CMD12, 0, 0x01);	  // 发送停止命令, 数据已经全部收到, 不检查响应
+		SD_STATS_RECORD(SD_STATS_CMD12, start, 0, res);
+	}
+	else if (mode == SD_STREAM_WRITE)
+	{
+		retval = SD_SendBlock(0, 0xFD);  // 发送停止令牌
+	}
+	else
+	{
+		return 0;
+	}
+
+	SD_DisSelect();  // 取消片选
+	return retval;
+}
+
+
+/**
+  * @brief  连续读写传输的空闲超时检查
+  * @note   空闲超过SD_STREAM_IDLE_TIMEOUT后关闭传输. 读写扇区和查询卡状态时自动调用,
+  *         长时间不访问SD卡时需要在主循环中周期调用, 否则传输一直保持片选
+  * @param  无
+  * @retval 无
+  */
+void SD_Stream_Poll(void)
+{
+#ifdef USE_SD_STREAM_CONTINUE
+	if ((SD_Stream.Mode != SD_STREAM_NONE) && (HAL_GetTick() - SD_Stream.LastTick >= SD_STREAM_IDLE_TIMEOUT))
+	{
+		SD_Stream_Close();
+	}
+#endif
+}
+
+
+/**
+  * @brief  请求完成后更新连续传输状态
+  * @note   未开启USE_SD_STREAM_CONTINUE时立即关闭传输
+  * @param  mode: SD_STREAM_READ / SD_STREAM_WRITE
+  * @param  sector: 下一个连续的扇区
+  * @param  retval: 本次请求的结果
+  * @retval 本次请求的结果
+  */
+static uint8_t SD_Stream_Done(uint8_t mode, uint32_t sector, uint8_t retval)
+{
+	uint8_t res;
+
+#ifdef USE_SD_STREAM_CONTINUE
+	SD_Stream.Dir = mode;
+	SD_Stream.NextSector = sector;
+	SD_Stream.LastTick = HAL_GetTick();
+	if (retval == 0)
+	{
+		return 0;
+	}
+	SD_Stream.Dir = SD_STREAM_NONE;
+#endif
+
+	res = SD_Stream_Close();
+	return retval ? retval : res;
+}
+
+
+/**
+  * @brief  读取一次扇区数据
+  * @note   SD_ReadSector()的一次尝试
+  * @param  buff: 数据缓冲区
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @retval 0: 成功, 其他: 失败
+  */
+static uint8_t SD_ReadOnce(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+	uint8_t retval = 0;
+	uint32_t next = sector + cnt;
+	uint32_t start = SD_STATS_TICK();
+
+	if (cnt == 0)
+	{
+		return 0;
+	}
+
+	SD_Stream_Poll();
+
+	if (SD_Stream.Mode != SD_STREAM_READ || SD_Stream.NextSector != sector)
+	{
+		if (cnt == 1 && !SD_Stream_IsSequential(SD_STREAM_READ, sector))   // 随机的单扇区读
+		{
+			retval = SD_SendCmd(TF_CMD17, SDCard_Information.Card_BlockAddr ? sector : sector * 512, 0x01);  // 读命令
+			if (retval == 0)  // 指令发送成功
+			{
+				retval = SD_RecvData(buff, 512);   // 接收512个字节	   
+			}
+			SD_DisSelect();  // 取消片选
+			SD_STATS_RECORD(SD_STATS_CMD17, start, 512, retval);
+#ifdef USE_SD_STREAM_CONTINUE
+			SD_Stream.Dir = (retval == 0) ? SD_STREAM_READ : SD_STREAM_NONE;   // 失败的请求之后不按连续处理
+			SD_Stream.NextSector = next;
+#endif
+			return retval;
+		}
+
+		retval = SD_Stream_Open(SD_STREAM_READ, sector, cnt);
+		if (retval != 0)
+		{
+			SD_STATS_RECORD(SD_STATS_CMD18, start, 0, retval);
+			return retval;
+		}
+	}
+
+#ifdef USE_SPI_DMA_READ_STREAM
+	retval = SD_RecvStream(buff, cnt);
+#else
+	do
+	{
+		retval = SD_RecvData(buff, 512);   // 接收512个字节	 
+		buff += 512;
+	}
+	while (--cnt && retval == 0); 
+#endif
+
+	retval = SD_Stream_Done(SD_STREAM_READ, next, retval);
+	SD_STATS_RECORD(SD_STATS_CMD18, start, (next - sector) * 512, retval);
+	return retval;
+}
+
+
+/**
+  * @brief  按扇区读取SD卡数据
+  * @note   SD卡的1个扇区固定为512字节. 开启USE_SD_STREAM_CONTINUE时, 多扇区读结束后
+  *         不发送CMD12, 下一次请求紧接本次请求时直接继续接收数据;
+  *         开启USE_SD_CRC时, 因CRC错误失败的请求重新读取, 最多重试SD_CRC_RETRIES次
+  * @param  buff: 数据缓冲区
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @retval 0: 成功, 其他: 失败
+  */
+uint8_t SD_ReadSector(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+#ifdef USE_SD_CRC
+	uint8_t retval;
+	uint8_t retry = 0;
+	
+	SD_CrcFailed = 0;
+	retval = SD_ReadOnce(buff, sector, cnt);
+	while ((retval != 0) && SD_CrcFailed && (retry++ < SD_CRC_RETRIES))
+	{
+		SD_STATS_ADD(CrcRetries, 1);
+		SD_CrcFailed = 0;
+		retval = SD_ReadOnce(buff, sector, cnt);
+	}
+	return retval;
+#else
+	return SD_ReadOnce(buff, sector, cnt);
+#endif
+}
+
+
+/**
+  * @brief  写入一次连续的扇区
+  * @note   SD_WriteBlocks()的一次尝试
+  * @param  buff: 数据缓冲区, list不为空时不使用
+  * @param  list: 每个扇区的数据缓冲区, 为空时使用buff
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @retval 0: 成功, 其他: 失败
+  */
+static uint8_t SD_WriteOnce(uint8_t *buff, uint8_t * const *list, uint32_t sector, uint32_t cnt)
+{
+	uint8_t retval = 0;
+	uint32_t next = sector + cnt;
+	uint32_t start = SD_STATS_TICK();
+
+	if (cnt == 0)
+	{
+		return 0;
+	}
+
+#ifdef USE_SD_DISCARD
+	SD_Discard_Clip(sector, cnt);   // 写入的扇区不能再被擦除
+#endif
+
+	SD_Stream_Poll();
+
+	if (SD_Stream.Mode != SD_STREAM_WRITE || SD_Stream.NextSector != sector)
+	{
+		if (cnt == 1 && !SD_Stream_IsSequential(SD_STREAM_WRITE, sector))   // 随机的单扇区写
+		{
+			retval = SD_SendCmd(TF_CMD24, SDCard_Information.Card_BlockAddr ? sector : sector * 512, 0x01);  // 写命令
+			if (retval == 0x00)  // 指令发送成功
+			{
+				retval = SD_SendBlock(list ? list[0] : buff, 0xFE);  // 写512个字节
+			}
+			
+			else
+			{
+				SD_Card_Init();
+			}
+			SD_DisSelect();  // 取消片选
+			SD_STATS_RECORD(SD_STATS_CMD24, start, 512, retval);
+#ifdef USE_SD_STREAM_CONTINUE
+			SD_Stream.Dir = (retval == 0) ? SD_STREAM_WRITE : SD_STREAM_NONE;   // 失败的请求之后不按连续处理
+			SD_Stream.NextSector = next;
+#endif
+			return retval;
+		}
+
+		retval = SD_Stream_Open(SD_STREAM_WRITE, sector, cnt);
+		if (retval != 0)
+		{
+			SD_STATS_RECORD(SD_STATS_CMD25, start, 0, retval);
+			return retval;
+		}
+	}
+
+	do
+	{
+		if (list)
+		{
+			retval = SD_SendBlock(*list++, 0xFC);  // 发送512个字节
+		}
+		else
+		{
+			retval = SD_SendBlock(buff, 0xFC);  // 发送512个字节	 
+			buff += 512;
+		}
+	}
+	while (--cnt && retval == 0);
+
+	retval = SD_Stream_Done(SD_STREAM_WRITE, next, retval);
+	SD_STATS_RECORD(SD_STATS_CMD25, start, (next - sector) * 512, retval);
+	return retval;
+}
+
+
+/**
+  * @brief  写入连续的扇区, 数据来自一个缓冲区或者缓冲区列表
+  * @note   SD_WriteSector()和SD_WriteSectorList()的公共部分;
+  *         开启USE_SD_CRC时, 因CRC错误失败的请求从头重新写入, 最多重试SD_CRC_RETRIES次
+  * @param  buff: 数据缓冲区, list不为空时不使用
+  * @param  list: 每个扇区的数据缓冲区, 为空时使用buff
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @retval 0: 成功, 其他: 失败
+  */
+static uint8_t SD_WriteBlocks(uint8_t *buff, uint8_t * const *list, uint32_t sector, uint32_t cnt)
+{
+#ifdef USE_SD_CRC
+	uint8_t retval;
+	uint8_t retry = 0;
+	
+	SD_CrcFailed = 0;
+	retval = SD_WriteOnce(buff, list, sector, cnt);
+	while ((retval != 0) && SD_CrcFailed && (retry++ < SD_CRC_RETRIES))
+	{
+		SD_STATS_ADD(CrcRetries, 1);
+		SD_CrcFailed = 0;
+		retval = SD_WriteOnce(buff, list, sector, cnt);
+	}
+	return retval;
+#else
+	return SD_WriteOnce(buff, list, sector, cnt);
+#endif
+}
+
+
+/**
+  * @brief  按扇区写入SD卡数据
+  * @note   SD卡的1个扇区固定为512字节. 开启USE_SD_STREAM_CONTINUE时, 多扇区写结束后
+  *         不发送停止令牌, 下一次请求紧接本次请求时直接继续发送数据
+  * @param  buff: 数据缓冲区
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @retval 0: 成功, 其他: 失败
+  */
+uint8_t SD_WriteSector(uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+	return SD_WriteBlocks(buff, 0, sector, cnt);
+}
+
+
+/**
+  * @brief  按扇区写入SD卡数据, 每个扇区的数据在单独的缓冲区中
+  * @note   用于把内存中不连续、扇区号连续的数据合并成一次多扇区写
+  * @param  list: 每个扇区的数据缓冲区, 共cnt个
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @retval 0: 成功, 其他: 失败
+  */
+uint8_t SD_WriteSectorList(uint8_t * const *list, uint32_t sector, uint32_t cnt)
+{
+	return SD_WriteBlocks(0, list, sector, cnt);
+}
+
+
+/**
+  * @brief  判断SD卡是否支持擦除
+  * @note   MMC卡使用CMD35/CMD36设置擦除范围, 不支持; SD卡需要支持命令类5(擦除)
+  * @param  无
+  * @retval 1: 支持, 0: 不支持
+  */
+static uint8_t SD_EraseSupported(void)
+{
+	return (SDCard_Information.Card_Type != TF_TYPE_MMC) && (SDCard_Information.CSD.CardComdClasses & (1 << 5));
+}
+
+
+/**
+  * @brief  获取擦除对齐的单位
+  * @note   擦除单元大小未知时按单个扇区
+  * @param  无
+  * @retval 擦除单元大小, 单位扇区
+  */
+static uint32_t SD_GetEraseUnit(void)
+{
+	return SDCard_Information.Card_EraseSize ? SDCard_Information.Card_EraseSize : 1;
+}
+
+
+/**
+  * @brief  计算擦除的超时时间
+  * @note   SSR中有擦除信息时为 ERASE_TIMEOUT / ERASE_SIZE * 擦除单元数 + ERASE_OFFSET,
+  *         否则每个擦除单元SD_ERASE_TIMEOUT, 再加上普通的忙超时
+  * @param  units: 擦除单元数
+  * @retval 超时时间, 单位ms
+  */
+static uint32_t SD_EraseTimeout(uint32_t units)
+{
+	SD_SSR_typedef *ssr = &SDCard_Information.SSR;
+
+	if (ssr->EraseSize != 0 && ssr->EraseTimeout != 0)
+	{
+		return (uint32_t)ssr->EraseTimeout * 1000 * units / ssr->EraseSize + (uint32_t)ssr->EraseOffset * 1000 + SD_BUSY_TIMEOUT;
 	}
+	return SD_ERASE_TIMEOUT * units + SD_BUSY_TIMEOUT;
 }
 
 
 /**
-  * @brief  按扇区读取SD卡数据
-  * @note   SD卡的1个扇区固定为512字节
-  * @param  buff: 数据缓冲区
+  * @brief  擦除SD卡扇区
+  * @note   CMD32/CMD33设置擦除的起始和结束扇区, CMD38擦除后等待忙结束; 每次最多擦除SD_ERASE_MAX_UNITS个
+  *         擦除单元, 限制单次忙等待的时间. 擦除后读出的数据全为0或全为1(SCR的DATA_STAT_AFTER_ERASE),
+  *         之后写入这些扇区时卡不需要先擦除, 写入速度更快
   * @param  sector: 起始扇区
   * @param  cnt: 扇区数
-  * @retval 0: 成功, 其他: 失败
+  * @retval 0: 成功, 0xFE: 卡不支持擦除, 其他: 失败
   */
-uint8_t SD_ReadSector(uint8_t *buff, uint32_t sector, uint8_t cnt)
+uint8_t SD_EraseSector(uint32_t sector, uint32_t cnt)
 {
-	uint8_t retval;
+	uint32_t max = SD_GetEraseUnit() * SD_ERASE_MAX_UNITS;
+	uint32_t n, start, end;
+	uint8_t retval = 0;
 
-	if (SDCard_Information.Card_Type != TF_TYPE_SDHC)
+	if (!SD_EraseSupported())
 	{
-		sector *= 512;   // 转换为字节地址
+		return 0xFE;
 	}
 
-	if (cnt == 1)
+	while (cnt != 0 && retval == 0)
 	{
-		retval = SD_SendCmd(TF_CMD17, sector, 0x01);  // 读命令
-		if(retval == 0)  // 指令发送成功
+		n = (cnt > max) ? max : cnt;
+		start = sector;
+		end = sector + n - 1;
+		if (!SDCard_Information.Card_BlockAddr)
 		{
-			retval = SD_RecvData(buff, 512);   // 接收512个字节	   
+			start *= 512;   // 转换为字节地址
+			end *= 512;
 		}
-	}
-	
-	else
-	{
-		retval = SD_SendCmd(TF_CMD18, sector, 0x01);   // 连续读命令
-		do
+
+		retval = SD_SendCmd(TF_CMD32, start, 0x01);   // 擦除起始扇区
+		if (retval == 0)
 		{
-			retval = SD_RecvData(buff, 512);   // 接收512个字节	 
-			buff += 512;
+			retval = SD_SendCmd(TF_CMD33, end, 0x01);   // 擦除结束扇区
 		}
-		while (--cnt && retval == 0); 
-		
-		SD_SendCmd(TF_CMD12, 0, 0x01);	  // 发送停止命令
+		if (retval == 0)
+		{
+			retval = SD_SendCmd(TF_CMD38, 0, 0x01);   // 擦除, R1b响应, 之后MISO保持低电平直到擦除完成
+		}
+		if (retval == 0 && SD_WaitBusy(SD_EraseTimeout((n + SD_GetEraseUnit() - 1) / SD_GetEraseUnit())) != 0)
+		{
+			retval = 0xFD;   // 擦除超时
+		}
+		SD_DisSelect();
+
+		sector += n;
+		cnt -= n;
 	}
-	
-	SD_DisSelect();  // 取消片选
+
 	return retval;
 }
 
 
 /**
-  * @brief  按扇区写入SD卡数据
-  * @note   SD卡的1个扇区固定为512字节
-  * @param  buff: 数据缓冲区
+  * @brief  放弃扇区中的数据(TRIM)
+  * @note   范围先放入等待列表, 和列表中重叠或相邻的范围合并, 在SD_Discard_Flush()中擦除;
+  *         列表满时先擦除列表中的范围. 之后写入的扇区会从等待的范围中去掉, 不会被擦除.
+  *         未定义USE_SD_DISCARD时不做任何操作
   * @param  sector: 起始扇区
   * @param  cnt: 扇区数
   * @retval 0: 成功, 其他: 失败
   */
-uint8_t SD_WriteSector(uint8_t *buff, uint32_t sector, uint32_t cnt)
+uint8_t SD_DiscardSector(uint32_t sector, uint32_t cnt)
 {
-	uint8_t retval;
+#ifdef USE_SD_DISCARD
+	SD_Discard_typedef *range, *slot;
+	uint32_t end = sector + cnt;
+	uint8_t merged, retval = 0;
+	uint16_t i;
 
-	if (SDCard_Information.Card_Type != TF_TYPE_SDHC)
+	if (cnt == 0)
 	{
-		sector *= 512;  // 转换为字节地址
+		return 0;
 	}
-	
-	if (cnt == 1)
+
+	/* 合并后的范围可能又和前面检查过的范围相邻, 重复直到不能再合并 */
+	do
 	{
-		retval = SD_SendCmd(TF_CMD24, sector, 0x01);  // 写命令
-		if (retval == 0x00)  // 指令发送成功
-		{
-			retval = SD_SendBlock(buff, 0xFE);  // 写512个字节
-		}
-		
-		else
+		merged = 0;
+		slot = 0;
+		for (i = 0; i < SD_DISCARD_RANGES; i++)
 		{
-			SD_Card_Init();
+			range = &SD_Discard[i];
+			if (range->End > range->Start && range->Start <= end && sector <= range->End)
+			{
+				sector = (range->Start < sector) ? range->Start : sector;
+				end = (range->End > end) ? range->End : end;
+				range->Start = range->End = 0;
+				merged = 1;
+			}
+			if (range->End <= range->Start && slot == 0)
+			{
+				slot = range;
+			}
 		}
 	}
-	
-	else
+	while (merged);
+
+	if (slot == 0)
+	{
+		retval = SD_Discard_Flush();
+		slot = &SD_Discard[0];
+	}
+
+	slot->Start = sector;
+	slot->End = end;
+	return retval;
+#else
+	return 0;
+#endif
+}
+
+
+/**
+  * @brief  擦除等待中的TRIM范围
+  * @note   每个范围只擦除其中完整的擦除单元(起始向上、结束向下对齐到擦除单元), 不完整的部分直接丢弃;
+  *         在CTRL_SYNC/FX_DRIVER_FLUSH时调用, 卡不支持擦除时只清空列表
+  * @param  无
+  * @retval 0: 成功, 其他: 失败
+  */
+uint8_t SD_Discard_Flush(void)
+{
+	uint8_t retval = 0;
+#ifdef USE_SD_DISCARD
+	uint32_t unit = SD_GetEraseUnit();
+	uint32_t start, end;
+	uint16_t i;
+
+	for (i = 0; i < SD_DISCARD_RANGES; i++)
 	{
-		if (SDCard_Information.Card_Type != TF_TYPE_MMC)
+		start = (SD_Discard[i].Start + unit - 1) / unit * unit;
+		end = SD_Discard[i].End / unit * unit;
+		SD_Discard[i].Start = SD_Discard[i].End = 0;
+
+		if (end > start && SD_EraseSupported() && SD_EraseSector(start, end - start) != 0)
 		{
-			SD_SendCmd(TF_CMD55, 0, 0x01);	
-			SD_SendCmd(TF_CMD23, cnt, 0x01);
+			retval = 1;
 		}
-		
- 		retval = SD_SendCmd(TF_CMD25, sector, 0x01);  // 连续写命令
-		if (retval == 0)
+	}
+#endif
+	return retval;
+}
+
+
+#ifdef USE_SD_DISCARD
+/**
+  * @brief  从等待擦除的范围中去掉要写入的扇区
+  * @note   写入的扇区在范围中间时, 保留较长的一段, 较短的一段不再擦除
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @retval 无
+  */
+static void SD_Discard_Clip(uint32_t sector, uint32_t cnt)
+{
+	SD_Discard_typedef *range;
+	uint32_t end = sector + cnt;
+	uint16_t i;
+
+	for (i = 0; i < SD_DISCARD_RANGES; i++)
+	{
+		range = &SD_Discard[i];
+		if (range->End > range->Start && range->Start < end && sector < range->End)
 		{
-			do
+			if (range->End > end && (range->Start >= sector || range->End - end > sector - range->Start))
+			{
+				range->Start = end;    // 保留写入之后的部分
+			}
+			else
 			{
-				retval = SD_SendBlock(buff, 0xFC);  // 发送512个字节	 
-				buff += 512;
+				range->End = sector;   // 保留写入之前的部分, 没有时范围为空
 			}
-			while (--cnt && retval == 0);
-			retval = SD_SendBlock(0, 0xFD);  // 接收512个字节 
 		}
 	}
-	
-	SD_DisSelect();  // 取消片选
-	return retval;
 }
+#endif
 
 
 /**
@@ -575,11 +2075,22 @@ uint8_t SD_WriteSector(uint8_t *buff, uint32_t sector, uint32_t cnt)
 uint8_t SD_GetCardState(void)
 {
   uint8_t retval[2];
+  uint32_t start;
+
+  SD_Stream_Poll();   // 文件系统查询状态时顺便关闭空闲超时的连续传输
+
+  /* 连续读写传输打开时卡一定处于传输状态, 不发送CMD13以免关闭传输 */
+  if (SD_Stream.Mode != SD_STREAM_NONE)
+  {
+    return 0;
+  }
 
   /* Send CMD13 (SD_SEND_STATUS) to get SD status */
+  start = SD_STATS_TICK();
   retval[0] = SD_SendCmd(TF_CMD13, 0, 0xFF);
 	retval[1] = SD_ReadWriteByte(0xFF);
   SD_DisSelect();
+  SD_STATS_RECORD(SD_STATS_CMD13, start, 0, retval[0] | retval[1]);
 
   /* Find SD status according to card state */
   if (( retval[0] == 0) && ( retval[1] == 0))
@@ -592,6 +2103,56 @@ uint8_t SD_GetCardState(void)
 	}
 }
 
+/**
+  * @brief  等待SD卡进入可以读写的状态
+  * @note   在同一次片选内用CMD13轮询, 直到状态正常或超时; 两次查询的间隔
+  *         从SD_BUSY_BACKOFF_MIN_US开始加倍, 最大到SD_BUSY_BACKOFF_MAX_US
+  * @param  timeout: 超时时间, 单位ms
+  * @retval 0: 成功, 其他: 超时或出错
+  */
+uint8_t SD_WaitCardState(uint32_t timeout)
+{
+	uint32_t tickstart = HAL_GetTick();
+	uint32_t interval = SD_BUSY_BACKOFF_MIN_US;
+	uint8_t retval[2];
+
+	SD_Stream_Poll();
+
+	if (SD_Stream.Mode != SD_STREAM_NONE)
+	{
+		return 0;   // 连续读写传输打开时卡一定处于传输状态
+	}
+
+	if (SD_BeginTransaction() != 0)
+	{
+		return 1;
+	}
+
+	do
+	{
+		uint32_t start = SD_STATS_TICK();
+		retval[0] = SD_SendCmd(TF_CMD13, 0, 0xFF);
+		retval[1] = SD_ReadWriteByte(0xFF);
+		SD_STATS_RECORD(SD_STATS_CMD13, start, 0, retval[0] | retval[1]);
+		if ((retval[0] == 0) && (retval[1] == 0))
+		{
+			SD_EndTransaction();
+			return 0;
+		}
+
+		TFCARD_BUSY_DELAY_US(interval);
+		if (interval < SD_BUSY_BACKOFF_MAX_US)
+		{
+			interval *= 2;
+		}
+	}
+	while (HAL_GetTick() - tickstart < timeout);
+
+	SD_EndTransaction();
+	return 1;
+}
+
+
 /**
   * @brief  SD卡进入空闲模式
   * @note   无
@@ -624,7 +2185,7 @@ uint8_t SD_Set_IdleMode(void)
 
 /**
   * @brief  SD卡进入高速模式
-  * @note   无
+  * @note   成功后卡的最大时钟为50MHz, 开启USE_SD_CLOCK_TRAINING时需要再调用SD_Clock_Train()提高时钟
   * @param  无
 	* @retval 0: 成功，其他: 失败
   */
@@ -635,6 +2196,7 @@ uint8_t SD_Set_HighSpeedMode(void)
 	uint8_t temp[64];
 	uint8_t count = 0xFF;
 
+	SD_Stream_Close();
 	SD_SPI_SetSpeed(SPI_BAUDRATEPRESCALER_256);	// 312.5KHz = 0.3125MHz
 	
 	do
@@ -645,6 +2207,8 @@ uint8_t SD_Set_HighSpeedMode(void)
 	
 	if (SD_GetResponse(0xFE) != 0)
 	{
+		SD_DisSelect();
+		SD_Clock_Set(SD_ClockIndex);   // 恢复原来的时钟
 		return 1;   // 等待SD卡发回数据起始指令0xFE
 	}
 	
@@ -657,7 +2221,8 @@ uint8_t SD_Set_HighSpeedMode(void)
 	
 	if ((temp[16] & 0x0F) != 0x01)
 	{
-		SD_SPI_SetSpeed(SPI_BAUDRATEPRESCALER_4);   // 20MHz
+		SD_DisSelect();
+		SD_Clock_Set(SD_ClockIndex);   // 恢复原来的时钟
 		return 1;	// 不支持HighSpeedMode
 	}
 	
@@ -669,6 +2234,8 @@ uint8_t SD_Set_HighSpeedMode(void)
 	
 	if (SD_GetResponse(0xFE) != 0)
 	{
+		SD_DisSelect();
+		SD_Clock_Set(SD_ClockIndex);   // 恢复原来的时钟
 		return 1;   // 等待SD卡发回数据起始指令0xFE
 	}
 	
@@ -681,11 +2248,18 @@ uint8_t SD_Set_HighSpeedMode(void)
 	
 	if ((temp[16] & 0x0F) != 0x01)
 	{
-		SD_SPI_SetSpeed(SPI_BAUDRATEPRESCALER_4);   // 20MHz
+		SD_DisSelect();
+		SD_Clock_Set(SD_ClockIndex);   // 恢复原来的时钟
 		return 1;	// 不支持HighSpeedMode
 	}
 	
-	SD_SPI_SetSpeed(SPI_BAUDRATEPRESCALER_2);   // 40MHz
+	SD_DisSelect();
+	SDCard_Information.Card_MaxClock = 50000000;   // 高速模式50MHz
+#ifdef USE_SD_CLOCK_TRAINING
+	SD_Clock_Set(SD_ClockIndex);   // 由SD_Clock_Train()按新的最大时钟提高
+#else
+	SD_Clock_Set(0);   // 40MHz
+#endif
 	return retval;
 }
 
@@ -698,17 +2272,7 @@ uint8_t SD_Set_HighSpeedMode(void)
   */
 uint8_t SD_Information_Printf(void)
 {
-	/* 获取TF卡大小 */
-	SDCard_Information.Card_Capacity = SD_GetCapacity();
-	
-	/* 判断是否为SD_XC的卡 */
-	if ((SDCard_Information.Card_Capacity / 1024 > 1024 * 32)
-				&& (SDCard_Information.Card_Type == TF_TYPE_SDHC))
-	{
-		SDCard_Information.Card_Type = TF_TYPE_SDXC;
-	}
-	
-	/* 打印TF卡类型 */
+	/* 打印TF卡类型, 类型和容量在SD_Card_Init()中已经得到 */
 	if (SDCard_Information.Card_Type == TF_TYPE_MMC)
 	{
 		printf("\r\nSD_MMC,");
@@ -748,3 +2312,185 @@ uint8_t SD_Information_Printf(void)
 }
 
 
+#ifdef USE_SD_STATS
+/**
+  * @brief  计算延时所在的直方图桶
+  * @note   第i个桶统计[2^i, 2^(i+1))us, 第0个桶包含0us
+  * @param  time: 延时, 单位us
+  * @retval 桶编号
+  */
+static uint8_t SD_Stats_Bucket(uint32_t time)
+{
+	uint8_t i = 0;
+
+	while (time > 1 && i < SD_STATS_BUCKETS - 1)
+	{
+		time >>= 1;
+		i++;
+	}
+	return i;
+}
+
+
+/**
+  * @brief  记录一条命令的延时和结果
+  * @note   无
+  * @param  index: SD_STATS_CMDxx
+  * @param  start: 开始时间, SD_GetTick_us()
+  * @param  bytes: 传输的数据字节数
+  * @param  err: 0: 成功, 其他: 失败
+  * @retval 无
+  */
+static void SD_Stats_Cmd(uint8_t index, uint32_t start, uint32_t bytes, uint8_t err)
+{
+	SD_CmdStats_typedef *cmd = &SD_Stats.Cmd[index];
+	uint32_t time = SD_GetTick_us() - start;
+
+	cmd->Count++;
+	cmd->TotalTime += time;
+	if (time > cmd->MaxTime)
+	{
+		cmd->MaxTime = time;
+	}
+	cmd->Hist[SD_Stats_Bucket(time)]++;
+
+	if (err)
+	{
+		cmd->Errors++;
+	}
+	else if (index == SD_STATS_CMD17 || index == SD_STATS_CMD18)
+	{
+		cmd->Bytes += bytes;
+		SD_Stats.BytesRead += bytes;
+	}
+	else
+	{
+		cmd->Bytes += bytes;
+		SD_Stats.BytesWritten += bytes;
+	}
+}
+
+
+/**
+  * @brief  记录一次忙等待
+  * @note   由SD_WaitReady()在检测到忙时调用
+  * @param  time: 忙时间, 单位us
+  * @param  err: 0: 正常结束, 其他: 超时
+  * @retval 无
+  */
+static void SD_Stats_Busy(uint32_t time, uint8_t err)
+{
+	SD_Stats.BusyCount++;
+	SD_Stats.BusyTime += time;
+	if (time > SD_Stats.BusyMaxTime)
+	{
+		SD_Stats.BusyMaxTime = time;
+	}
+	SD_Stats.BusyHist[SD_Stats_Bucket(time)]++;
+
+	if (err)
+	{
+		SD_Stats.BusyTimeouts++;
+	}
+}
+
+
+/**
+  * @brief  清除统计
+  * @note   无
+  * @param  无
+  * @retval 无
+  */
+void SD_Stats_Reset(void)
+{
+	memset(&SD_Stats, 0, sizeof(SD_Stats));
+}
+
+
+/**
+  * @brief  获取统计
+  * @note   同时计算每条命令的P99Time
+  * @param  stats: 统计信息
+  * @retval 无
+  */
+void SD_Stats_Get(SD_Stats_typedef *stats)
+{
+	uint8_t i;
+
+	*stats = SD_Stats;
+	for (i = 0; i < SD_STATS_CMDS; i++)
+	{
+		stats->Cmd[i].P99Time = SD_Stats_Percentile(&stats->Cmd[i], 99);
+	}
+}
+
+
+/**
+  * @brief  按直方图估计延时的百分位数
+  * @note   返回所在桶的上限, 不超过最大延时
+  * @param  cmd: 命令统计
+  * @param  percent: 百分位, 1~100
+  * @retval 延时, 单位us
+  */
+uint32_t SD_Stats_Percentile(const SD_CmdStats_typedef *cmd, uint8_t percent)
+{
+	uint32_t target, sum = 0;
+	uint8_t i;
+
+	if (cmd->Count == 0)
+	{
+		return 0;
+	}
+
+	target = ((uint64_t)cmd->Count * percent + 99) / 100;
+	for (i = 0; i < SD_STATS_BUCKETS - 1; i++)
+	{
+		sum += cmd->Hist[i];
+		if (sum >= target)
+		{
+			break;
+		}
+	}
+
+	if (i == SD_STATS_BUCKETS - 1 || ((uint32_t)2 << i) - 1 > cmd->MaxTime)
+	{
+		return cmd->MaxTime;
+	}
+	return ((uint32_t)2 << i) - 1;
+}
+
+
+/**
+  * @brief  打印统计
+  * @note   其中调用了printf函数，注意包含头文件stdio.h
+  * @param  无
+  * @retval 无
+  */
+void SD_Stats_Printf(void)
+{
+	static const char * const name[SD_STATS_CMDS] = {"CMD17", "CMD18", "CMD24", "CMD25", "CMD12", "CMD13"};
+	SD_Stats_typedef stats;
+	SD_CmdStats_typedef *cmd;
+	uint8_t i;
+
+	SD_Stats_Get(&stats);
+
+	printf("\r\ncmd    count  err   avg(us)  p99(us)  max(us)  KiB\r\n");
+	for (i = 0; i < SD_STATS_CMDS; i++)
+	{
+		cmd = &stats.Cmd[i];
+		printf("%s %6lu %4lu %9lu %8lu %8lu %8lu\r\n", name[i], (unsigned long)cmd->Count, (unsigned long)cmd->Errors,
+		       (unsigned long)(cmd->Count ? cmd->TotalTime / cmd->Count : 0), (unsigned long)cmd->P99Time,
+		       (unsigned long)cmd->MaxTime, (unsigned long)(cmd->Bytes / 1024));
+	}
+
+	printf("read:%luKiB write:%luKiB\r\n", (unsigned long)(stats.BytesRead / 1024), (unsigned long)(stats.BytesWritten / 1024));
+	printf("busy:%lu timeout:%lu total:%lums max:%luus\r\n", (unsigned long)stats.BusyCount, (unsigned long)stats.BusyTimeouts,
+	       (unsigned long)(stats.BusyTime / 1000), (unsigned long)stats.BusyMaxTime);
+	printf("token retry:%lu timeout:%lu crc:%lu response:%lu data:%lu\r\n", (unsigned long)stats.TokenRetries,
+	       (unsigned long)stats.TokenTimeouts, (unsigned long)stats.CrcErrors, (unsigned long)stats.ResponseErrors,
+	       (unsigned long)stats.DataErrors);
+	printf("clock:%luHz down:%lu crc retry:%lu\r\n", (unsigned long)SD_GetClock(), (unsigned long)stats.ClockDowns,
+	       (unsigned long)stats.CrcRetries);
+}
+#endif
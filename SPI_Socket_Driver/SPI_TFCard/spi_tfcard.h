@@ -20,17 +20,19 @@
 #define  TF_CMD9    9       // 命令9 ，读CSD数据
 #define  TF_CMD10   10      // 命令10，读CID数据
 #define  TF_CMD12   12      // 命令12，停止数据传输
-#define  TF_CMD13   13      // 命令13，读状态
+#define  TF_CMD13   13      // 命令13，读状态 (ACMD13，读SD状态寄存器SSR)
 #define  TF_CMD16   16      // 命令16，设置块大小 应返回0x00
 #define  TF_CMD17   17      // 命令17，读单个扇区
 #define  TF_CMD18   18      // 命令18，读多个扇区
 #define  TF_CMD23   23      // 命令23，设置多sector写入前预先擦除N个block
+#define  TF_ACMD23_MAX_BLOCKS  0x7FFFFF   // ACMD23的预擦除块数只有23位
 #define  TF_CMD24   24      // 命令24，写单个扇区
 #define  TF_CMD25   25      // 命令25，写多个扇区
 #define  TF_CMD32   32      // 命令32，设置要擦除的起始地址
 #define  TF_CMD33   33      // 命令33，设置要擦除的结束地址
 #define  TF_CMD38   38      // 命令38，擦除指定区间的内容
 #define  TF_CMD41   41      // 命令41，应返回0x00
+#define  TF_CMD51   51      // 命令51，读SCR (ACMD)
 #define  TF_CMD55   55      // 命令55，应返回0x01
 #define  TF_CMD58   58      // 命令58，读OCR信息
 #define  TF_CMD59   59      // 命令59，使能/禁止CRC，应返回0x00
@@ -53,33 +55,215 @@
 #define MSD_RESPONSE_FAILURE       0xFF
 
 
-/* SD卡信息 */
+/* CSD寄存器, 按CSD_STRUCTURE解码 (V1.0/V2.0/V3.0, MMC按V1.0格式解码) */
 typedef struct
 {
-  uint8_t Card_Type;
-  uint32_t Card_Capacity;
+  uint8_t  CSDStruct;           // CSD结构版本 0: V1.0, 1: V2.0, 2: V3.0
+  uint8_t  TAAC;                // 数据读取访问时间1
+  uint8_t  NSAC;                // 数据读取访问时间2, 单位100个时钟
+  uint8_t  MaxBusClkFreq;       // 最大数据传输速率 TRAN_SPEED
+  uint16_t CardComdClasses;     // 卡命令类 CCC
+  uint8_t  RdBlockLen;          // 最大读数据块长度 READ_BL_LEN
+  uint8_t  PartBlockRead;       // 允许部分块读
+  uint8_t  WrBlockMisalign;     // 写块不对齐
+  uint8_t  RdBlockMisalign;     // 读块不对齐
+  uint8_t  DSRImpl;             // DSR实现
+  uint32_t DeviceSize;          // 设备容量 C_SIZE (V1.0: 12位, V2.0: 22位, V3.0: 28位)
+  uint8_t  MaxRdCurrentVDDMin;  // 最小VDD时的最大读电流 (仅V1.0)
+  uint8_t  MaxRdCurrentVDDMax;  // 最大VDD时的最大读电流 (仅V1.0)
+  uint8_t  MaxWrCurrentVDDMin;  // 最小VDD时的最大写电流 (仅V1.0)
+  uint8_t  MaxWrCurrentVDDMax;  // 最大VDD时的最大写电流 (仅V1.0)
+  uint8_t  DeviceSizeMul;       // 设备容量乘数 C_SIZE_MULT (仅V1.0)
+  uint8_t  EraseBlockEnable;    // 允许按单个块擦除 ERASE_BLK_EN
+  uint8_t  EraseSectorSize;     // 擦除扇区大小 SECTOR_SIZE, 单位写数据块
+  uint8_t  WrProtectGrSize;     // 写保护组大小
+  uint8_t  WrProtectGrEnable;   // 写保护组使能
+  uint8_t  WrSpeedFact;         // 写速度因子 R2W_FACTOR
+  uint8_t  MaxWrBlockLen;       // 最大写数据块长度 WRITE_BL_LEN
+  uint8_t  WriteBlockPaPartial; // 允许部分块写
+  uint8_t  FileFormatGroup;     // 文件格式组
+  uint8_t  CopyFlag;            // 复制标志
+  uint8_t  PermWrProtect;       // 永久写保护
+  uint8_t  TempWrProtect;       // 临时写保护
+  uint8_t  FileFormat;          // 文件格式
+  uint8_t  CSD_CRC;             // CRC7
+} SD_CSD_typedef;
+
+/* CID寄存器 */
+typedef struct
+{
+  uint8_t  ManufacturerID;      // 制造商ID
+  uint16_t OEM_AppliID;         // OEM/应用ID
+  char     ProdName[6];         // 产品名称, 5个字符
+  uint8_t  ProdRev;             // 产品版本
+  uint32_t ProdSN;              // 产品序列号
+  uint16_t ManufactDate;        // 生产日期, 高8位: 年(从2000年起), 低4位: 月
+  uint8_t  CID_CRC;             // CRC7
+} SD_CID_typedef;
+
+/* SCR寄存器, MMC卡没有 */
+typedef struct
+{
+  uint8_t  SCRStruct;           // SCR结构版本
+  uint8_t  SDSpec;              // SD规范版本 SD_SPEC
+  uint8_t  DataStatAfterErase;  // 擦除后的数据状态
+  uint8_t  SDSecurity;          // CPRM安全规范版本
+  uint8_t  SDBusWidths;         // 支持的数据总线宽度
+  uint8_t  SDSpec3;             // SD_SPEC3
+  uint8_t  ExSecurity;          // 扩展安全
+  uint8_t  SDSpec4;             // SD_SPEC4
+  uint8_t  SDSpecX;             // SD_SPECX
+  uint8_t  CmdSupport;          // 支持的命令 bit0: CMD20, bit1: CMD23, bit2: CMD48/49, bit3: CMD58/59
+} SD_SCR_typedef;
+
+/* SD状态寄存器SSR, MMC卡没有 */
+typedef struct
+{
+  uint8_t  DataBusWidth;        // 当前数据总线宽度
+  uint8_t  SecuredMode;         // 安全模式
+  uint16_t CardType;            // 卡类型
+  uint32_t ProtectedAreaSize;   // 保护区大小
+  uint8_t  SpeedClass;          // 速度等级
+  uint8_t  PerformanceMove;     // 移动性能, 单位MB/s
+  uint8_t  AllocationUnitSize;  // AU大小
+  uint16_t EraseSize;           // 一次擦除的AU数
+  uint8_t  EraseTimeout;        // 擦除ERASE_SIZE个AU的超时时间, 单位s
+  uint8_t  EraseOffset;         // 擦除时间偏移, 单位s
+  uint8_t  UhsSpeedGrade;       // UHS速度等级
+  uint8_t  UhsAllocationUnitSize; // UHS AU大小
+  uint8_t  VideoSpeedClass;     // 视频速度等级
+  uint16_t VscAllocationUnitSize; // 视频速度等级AU大小, 单位MB
+  uint32_t SusAddr;             // 视频录制暂停地址
+  uint8_t  AppPerfClass;        // 应用性能等级
+} SD_SSR_typedef;
+
+/* SD卡信息, 在SD_Card_Init()中读取一次, 之后的查询不再访问SD卡 */
+typedef struct
+{
+  uint8_t  Card_Type;
+  uint32_t Card_Capacity;       // 容量, 单位KiByte
+  uint8_t  Card_BlockAddr;      // 1: 块地址(SDHC/SDXC), 0: 字节地址
+  uint32_t Card_BlockNbr;       // 扇区数
+  uint32_t Card_BlockSize;      // 扇区大小, 固定为512字节
+  uint32_t Card_EraseSize;      // 擦除单元大小, 单位扇区
+  uint32_t Card_MaxClock;       // 卡支持的最大时钟, 单位Hz
+  uint32_t Card_Clock;          // 当前使用的SPI时钟, 单位Hz
+  uint32_t Card_OCR;            // OCR寄存器
+  uint8_t  Card_RawCSD[16];     // 原始CSD数据
+  uint8_t  Card_RawCID[16];     // 原始CID数据
+  SD_CSD_typedef CSD;
+  SD_CID_typedef CID;
+  SD_SCR_typedef SCR;
+  SD_SSR_typedef SSR;
 	/* 用户可再添加... */
 	
 } SDCard_Information_typedef;
 
+/* 连续读写传输状态 */
+#define SD_STREAM_NONE     0
+#define SD_STREAM_READ     1    // CMD18传输中
+#define SD_STREAM_WRITE    2    // CMD25传输中
+
+typedef struct
+{
+  uint8_t  Mode;          // 当前打开的传输
+  uint8_t  Dir;           // 上一次请求的方向
+  uint32_t NextSector;    // 上一次请求之后的扇区
+  uint32_t LastTick;      // 上一次请求完成的时间
+} SD_Stream_typedef;
+
+/* 等待擦除的TRIM范围 */
+typedef struct
+{
+  uint32_t Start;         // 起始扇区
+  uint32_t End;           // 结束扇区(不包括), End <= Start时为空
+} SD_Discard_typedef;
+
+/* 统计的命令 */
+#define SD_STATS_CMD17     0    // 单扇区读
+#define SD_STATS_CMD18     1    // 多扇区读(保持传输时后续的请求也计入)
+#define SD_STATS_CMD24     2    // 单扇区写
+#define SD_STATS_CMD25     3    // 多扇区写(保持传输时后续的请求也计入)
+#define SD_STATS_CMD12     4    // 停止读传输
+#define SD_STATS_CMD13     5    // 读状态
+#define SD_STATS_CMDS      6
+
+/* 单条命令的统计, 延时从发送命令到数据传输完成(一次读写请求), 单位us */
+typedef struct
+{
+  uint32_t Count;                       // 次数
+  uint32_t Errors;                      // 失败次数
+  uint64_t Bytes;                       // 成功传输的数据字节数
+  uint64_t TotalTime;                   // 总延时
+  uint32_t MaxTime;                     // 最大延时
+  uint32_t P99Time;                     // 99%的请求不超过该延时(按直方图估计), 由SD_Stats_Get()计算
+  uint32_t Hist[SD_STATS_BUCKETS];      // log2延时直方图
+} SD_CmdStats_typedef;
+
+/* SD卡驱动统计 */
+typedef struct
+{
+  SD_CmdStats_typedef Cmd[SD_STATS_CMDS];
+  uint64_t BytesRead;                   // 读取的数据字节数
+  uint64_t BytesWritten;                // 写入的数据字节数
+  uint32_t BusyCount;                   // SD_WaitReady()检测到忙的次数
+  uint32_t BusyTimeouts;                // 忙超时次数
+  uint64_t BusyTime;                    // 忙等待总时间, 单位us
+  uint32_t BusyMaxTime;                 // 最长的一次忙等待, 单位us (卡内部垃圾回收时明显变长)
+  uint32_t BusyHist[SD_STATS_BUCKETS];  // 忙等待时间的log2直方图
+  uint32_t TokenRetries;                // 等待数据起始令牌时读到的空闲字节数
+  uint32_t TokenTimeouts;               // 等待数据起始令牌超时次数
+  uint32_t CrcErrors;                   // CRC错误(命令响应的CRC错误位、写数据响应0x0B和读数据CRC16不符)
+  uint32_t CrcRetries;                  // CRC错误后重试读写请求的次数
+  uint32_t ResponseErrors;              // 命令无响应或响应中有错误位
+  uint32_t DataErrors;                  // 写数据响应中的其他错误
+  uint32_t ClockDowns;                  // 连续出错后降低SPI时钟的次数
+} SD_Stats_typedef;
+
 /* SD卡API */
+uint8_t  SD_BeginTransaction(void);						// 开始命令序列, 保持片选
+void     SD_EndTransaction(void);							// 结束命令序列, 取消片选
 uint8_t  SD_WaitReady(void);									// 等待SD卡准备
+uint32_t SD_GetBusyTime(void);								// 获取最近一次SD卡忙的时间(us)
 uint8_t  SD_GetResponse(uint8_t Response);		// 获取SD卡响应
 uint8_t  SD_SendCmd(uint8_t cmd, uint32_t arg, uint8_t crc);		// CMD指令发送
 uint8_t  SD_RecvData(uint8_t *buff, uint32_t len);
+uint8_t  SD_RecvStream(uint8_t *buff, uint32_t cnt);  // CMD18双缓冲DMA流水线接收
 uint8_t  SD_SendBlock(uint8_t *buff, uint8_t cmd);
 uint8_t  SD_GetCID(uint8_t *cid_data);        // 获取SD卡CID
 uint8_t  SD_GetCSD(uint8_t *csd_data);        // 获取SD卡CSD
 uint32_t SD_GetSectorCount(void);   					// 获取SD卡扇区数
 uint32_t SD_GetCapacity(void);								// 获取SD卡容量
+uint32_t SD_GetBlockSize(void);								// 获取SD卡扇区大小
+uint32_t SD_GetEraseSize(void);								// 获取SD卡擦除单元大小(扇区)
+uint32_t SD_GetMaxClock(void);								// 获取SD卡支持的最大时钟
+uint32_t SD_GetClock(void);									// 获取当前使用的SPI时钟
+uint8_t  SD_Clock_Train(void);                // 训练SPI时钟
+uint16_t SD_CRC16(const uint8_t *buff, uint32_t len);  // 计算数据块CRC16
+uint8_t  SD_GetSCR(uint8_t *scr_data);        // 获取SD卡SCR
+uint8_t  SD_GetSSR(uint8_t *ssr_data);        // 获取SD卡状态寄存器SSR
 uint8_t  SD_Set_IdleMode(void);								// SD卡进入空闲模式
 uint8_t  SD_Set_HighSpeedMode(void);					// SD卡进入高速模式
 uint8_t  SD_Information_Printf(void);					// 打印SD卡的类型和容量信息
 uint8_t  SD_GetCardState(void);               // 获取SD卡状态
+uint8_t  SD_WaitCardState(uint32_t timeout);  // 等待SD卡状态正常
 
 uint8_t  SD_Card_Init(void);									// SD卡初始化
-uint8_t  SD_ReadSector(uint8_t *buff, uint32_t sector, uint8_t cnt);		  // 按扇区读取SD卡数据
+uint8_t  SD_ReadSector(uint8_t *buff, uint32_t sector, uint32_t cnt);		  // 按扇区读取SD卡数据
 uint8_t  SD_WriteSector(uint8_t *buff, uint32_t sector, uint32_t cnt);		// 按扇区写入SD卡数据
+uint8_t  SD_WriteSectorList(uint8_t * const *list, uint32_t sector, uint32_t cnt);  // 按扇区写入SD卡数据(每个扇区单独的缓冲区)
+uint8_t  SD_EraseSector(uint32_t sector, uint32_t cnt);     // 擦除SD卡扇区
+uint8_t  SD_DiscardSector(uint32_t sector, uint32_t cnt);   // 放弃扇区数据(TRIM), 合并后按擦除单元擦除
+uint8_t  SD_Discard_Flush(void);              // 擦除等待中的TRIM范围
+uint8_t  SD_Stream_Close(void);               // 关闭连续读写传输
+void     SD_Stream_Poll(void);                // 连续读写传输空闲超时检查
+
+#ifdef USE_SD_STATS
+void     SD_Stats_Reset(void);                // 清除统计
+void     SD_Stats_Get(SD_Stats_typedef *stats);   // 获取统计
+uint32_t SD_Stats_Percentile(const SD_CmdStats_typedef *cmd, uint8_t percent);  // 按直方图估计延时百分位数
+void     SD_Stats_Printf(void);               // 打印统计
+#endif
 
 #endif
 
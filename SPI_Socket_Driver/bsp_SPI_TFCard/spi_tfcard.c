@@ -1,22 +1,124 @@
 #include "spi_tfcard.h"		
 
 
-/* SD卡信息 */
-SD_CardInfo_t SDCard_Info;
+/* 异步读写状态 */
+#define SPI_SD_ASYNC_IDLE     0
+#define SPI_SD_ASYNC_TOKEN    1     // 等待读数据令牌
+#define SPI_SD_ASYNC_BLOCK    2     // 发送写数据块
+#define SPI_SD_ASYNC_BUSY     3     // 等待写编程完成
+#define SPI_SD_ASYNC_STOP     4     // 等待停止命令/停止令牌后的忙结束
+
+/* 默认的SD卡, SPI2和TFCARD_SPI_CS引脚 */
+SPI_SD_Card_t SPI_SD_Card0 = SPI_SD_CARD(&BSP_SPI2, TFCARD_SPI_CS_PORT, TFCARD_SPI_CS_PIN);
+
+/* 每条SPI总线的状态 */
+static struct
+{
+  bsp_spi_t     *Spi;
+  SPI_SD_Card_t *Last;      // 最近一次设置时钟的卡, 切换到同一总线上的其他卡时需要重新设置时钟
+  SPI_SD_Card_t *Owner;     // 片选有效的卡, 释放前同一总线上的其他卡不能选中
+} SD_Bus[SPI_SD_MAX_BUSES];
+
+static int32_t SD_Async_Transfer(SPI_SD_Card_t *card, uint8_t op, uint8_t *buff, uint32_t sector, uint32_t cnt,
+                                 int8_t prio, uint32_t deadline);
+static void SD_Clock_Error(SPI_SD_Card_t *card);
+
+/**
+  * @brief  得到SD卡所在的总线
+  * @note   第一次使用一条总线时分配
+  * @param  card: SD卡
+  * @retval 总线序号, 总线数超过SPI_SD_MAX_BUSES时为-1
+  */
+static int32_t SD_Bus_Index(SPI_SD_Card_t *card)
+{
+  int32_t i;
+
+  for (i = 0; i < SPI_SD_MAX_BUSES; i++)
+  {
+    if (SD_Bus[i].Spi == NULL)
+    {
+      SD_Bus[i].Spi = card->Spi;
+    }
+    if (SD_Bus[i].Spi == card->Spi)
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+
+/**
+  * @brief  得到占用SD卡所在总线的卡
+  * @param  card: SD卡
+  * @retval 片选有效的卡, 总线空闲时为NULL
+  */
+static SPI_SD_Card_t *SD_Bus_Owner(SPI_SD_Card_t *card)
+{
+  int32_t bus = SD_Bus_Index(card);
+
+  return (bus >= 0) ? SD_Bus[bus].Owner : NULL;
+}
+
+
+/**
+  * @brief  SD卡所在的总线是否被其他卡占用
+  * @param  card: SD卡
+  * @retval 1: 同一总线上的其他卡片选有效, 0: 空闲或被本卡占用
+  */
+static int32_t SD_Bus_Busy(SPI_SD_Card_t *card)
+{
+  SPI_SD_Card_t *owner = SD_Bus_Owner(card);
+
+  return (owner != NULL) && (owner != card);
+}
+
+
+/**
+  * @brief  把SD卡的时钟设置到总线上
+  * @note   总线上次使用的是其他卡或者force为1时设置
+  * @param  card: SD卡
+  * @param  force: 1: 总是设置
+  * @retval 无
+  */
+static void SD_Bus_Clock(SPI_SD_Card_t *card, uint8_t force)
+{
+  int32_t bus = SD_Bus_Index(card);
+
+  if (force || (bus < 0) || (SD_Bus[bus].Last != card))
+  {
+    bsp_spi_set_max_clk_freq(card->Spi, card->Clock);
+  }
+  if (bus >= 0)
+  {
+    SD_Bus[bus].Last = card;
+  }
+}
 
-uint8_t spi_temp[32];
 
 /**
   * @brief  取消选择, 释放SPI总线
-  * @note   无
-  * @param  无
+  * @note   总线被同一总线上的其他卡占用时不产生时钟, 以免打断它的传输
+  * @param  card: SD卡
   * @retval 0
   */
-int32_t SD_Release(void)
+int32_t SD_Release(SPI_SD_Card_t *card)
 {
-  TFCARD_SPI_CS_RELEASE();
+  int32_t bus = SD_Bus_Index(card);
+
+  TFCARD_SPI_CS_RELEASE(card);
+  if ((bus >= 0) && (SD_Bus[bus].Owner != NULL) && (SD_Bus[bus].Owner != card))
+  {
+    return 0;
+  }
+
   /* 延时 */
-  bsp_spi_read(&BSP_SPI2, &spi_temp[0], 1);
+  bsp_spi_read(card->Spi, &card->Temp[0], 1);
+  if (bus >= 0)
+  {
+    SD_Bus[bus].Owner = NULL;
+  }
   
   return 0;
 }
@@ -24,23 +126,32 @@ int32_t SD_Release(void)
 
 /**
   * @brief  选中SD卡, 等待SD卡准备
-  * @note   SD卡返回0x00时表示忙，返回0xFF表示准备就绪
-  * @param  无
-  * @retval 0: 成功, 其他: 失败
+  * @note   SD卡返回0x00时表示忙，返回0xFF表示准备就绪; 同一总线上的其他卡片选有效时失败
+  * @param  card: SD卡
+  * @retval 0: 成功, 1: 等待准备超时, 2: 总线被其他卡占用或总线数超过SPI_SD_MAX_BUSES
   */
-int32_t SD_Select(void)
+int32_t SD_Select(SPI_SD_Card_t *card)
 {
-  TFCARD_SPI_CS_SELECT();
+  int32_t bus = SD_Bus_Index(card);
+
+  if ((bus < 0) || ((SD_Bus[bus].Owner != NULL) && (SD_Bus[bus].Owner != card)))
+  {
+    return 2;
+  }
+  SD_Bus[bus].Owner = card;
+  SD_Bus_Clock(card, 0);
+
+  TFCARD_SPI_CS_SELECT(card);
   /* 延时 */
-  bsp_spi_read(&BSP_SPI2, &spi_temp[0], 1);
+  bsp_spi_read(card->Spi, &card->Temp[0], 1);
 
-  if (SD_WaitReady() == 0)
+  if (SD_WaitReady(card) == 0)
   {
     return 0; // 等待成功
   }
   else
   {
-    SD_Release();
+    SD_Release(card);
     return 1; // 等待失败
   }
 }
@@ -48,26 +159,25 @@ int32_t SD_Select(void)
 
 /**
   * @brief  等待SD卡准备
-  * @note   SD卡返回0x00时表示忙，返回0xFF表示准备就绪
-  * @param  无
+  * @note   SD卡返回0x00时表示忙，返回0xFF表示准备就绪, 超时时间SPI_SD_BUSY_TIMEOUT
+  * @param  card: SD卡
   * @retval 0: 成功, 其他: 失败
   */
-int32_t SD_WaitReady(void)
+int32_t SD_WaitReady(SPI_SD_Card_t *card)
 {
-  uint16_t count = 0;
+  uint32_t tickstart = HAL_GetTick();
 
   do
   {
     /* 检查SD卡返回的数据 */
-    bsp_spi_read(&BSP_SPI2, &spi_temp[0], 1);
+    bsp_spi_read(card->Spi, &card->Temp[0], 1);
     
-    if (spi_temp[0] == 0xFF)
+    if (card->Temp[0] == 0xFF)
     {
       return 0;
     }
-    count++;
   }
-  while (count < 0x8000); 
+  while (HAL_GetTick() - tickstart < SPI_SD_BUSY_TIMEOUT);   // 按时间计算超时, 与SPI时钟无关
 
   return 1;
 }
@@ -76,10 +186,11 @@ int32_t SD_WaitReady(void)
 /**
   * @brief  等待SD卡回应
   * @note   无
+  * @param  card: SD卡
   * @param  Response: 回应值
   * @retval 0: 成功, 其他: 失败
   */
-int32_t SD_GetResponse(uint8_t Response)
+int32_t SD_GetResponse(SPI_SD_Card_t *card, uint8_t Response)
 {
   /* 等待次数 */
   uint16_t count = 0x1FFF;
@@ -87,10 +198,10 @@ int32_t SD_GetResponse(uint8_t Response)
   do
   {
     /* 等待得到准确的回应 */
-    bsp_spi_read(&BSP_SPI2, &spi_temp[0], 1);
+    bsp_spi_read(card->Spi, &card->Temp[0], 1);
     count--;
   }
-  while ((spi_temp[0] != Response) && count);
+  while ((card->Temp[0] != Response) && count);
 
   if (count == 0)		// 超时退出
   {
@@ -106,20 +217,24 @@ int32_t SD_GetResponse(uint8_t Response)
 /**
   * @brief  按扇区从SD卡读取数据
   * @note   SD卡的1个扇区固定为512字节
+  * @param  card: SD卡
   * @param  buf: 数据缓存区
   * @param  len: 数据缓存区长度
   * @retval 0: 成功, 其他: 失败
   */
-int32_t SD_RecvData(uint8_t *buff, uint32_t len)
+int32_t SD_RecvData(SPI_SD_Card_t *card, uint8_t *buff, uint32_t len)
 {			  	  
-  if (SD_GetResponse(0xFE) != MSD_RESPONSE_NO_ERROR)    // 等待SD卡发回数据起始指令0xFE
+  if (SD_GetResponse(card, 0xFE) != MSD_RESPONSE_NO_ERROR)    // 等待SD卡发回数据起始指令0xFE
   {
+    card->Stats.TokenErrors++;
+    SD_Clock_Error(card);
     return 1;   // 读取失败
   }
+  card->ClockErrors = 0;
 
   /* 接收数据和CRC */
-  bsp_spi_read(&BSP_SPI2, buff, len);
-  bsp_spi_read(&BSP_SPI2, spi_temp, 2);   
+  bsp_spi_read(card->Spi, buff, len);
+  bsp_spi_read(card->Spi, card->Temp, 2);   
 
   return 0;   // 读取成功
 }
@@ -128,35 +243,42 @@ int32_t SD_RecvData(uint8_t *buff, uint32_t len)
 /**
   * @brief  按扇区向SD卡发送数据
   * @note   SD卡的1个扇区固定为512字节
+  * @param  card: SD卡
   * @param  buff: 数据缓存区
   * @param  cmd: 指令
   * @retval 0: 成功, 其他: 失败
   */
-int32_t SD_SendBlock(uint8_t *buff, uint8_t cmd)
+int32_t SD_SendBlock(SPI_SD_Card_t *card, uint8_t *buff, uint8_t cmd)
 {	
-  int32_t retval;
+  uint8_t retval;
 
-  if (SD_WaitReady() == 1)
+  if (SD_WaitReady(card) == 1)
   {
     return 1;  // 等待准备失效
   }
 
-  bsp_spi_write(&BSP_SPI2, &cmd, 1);
+  bsp_spi_write(card->Spi, &cmd, 1);
   if (cmd != 0xFD)   // 不是结束指令
   {
     /* 发送数据并接收CRC */
-    bsp_spi_write(&BSP_SPI2, buff, 512);
-    bsp_spi_read(&BSP_SPI2, spi_temp, 2);  
+    bsp_spi_write(card->Spi, buff, 512);
+    bsp_spi_read(card->Spi, card->Temp, 2);  
     
     // 接收响应
-    bsp_spi_read(&BSP_SPI2, &retval, 1);   
+    bsp_spi_read(card->Spi, &retval, 1);   
     if ((retval & 0x1F) != MSD_DATA_OK)			 // 正常响应为xxx00101
     {
+      if ((retval & 0x1F) == MSD_DATA_CRC_ERROR)
+      {
+        card->Stats.CrcErrors++;
+        SD_Clock_Error(card);
+      }
       return 2;    // 响应错误		
     }
+    card->ClockErrors = 0;
     
     /* 延时等待SD卡内部数据写入完成，上面的操作只是把数据发送到SD卡控制器缓存中，还没有写入到SD卡闪存内 */
-    if (SD_WaitReady() == 1)
+    if (SD_WaitReady(card) == 1)
     {
       return 1;  // 等待准备失效
     }
@@ -169,20 +291,24 @@ int32_t SD_SendBlock(uint8_t *buff, uint8_t cmd)
 /**
   * @brief  按扇区从SD卡读取数据
   * @note   SD卡的1个扇区固定为512字节
+  * @param  card: SD卡
   * @param  buf: 数据缓存区
   * @param  len: 数据缓存区长度
   * @retval 0: 成功, 其他: 失败
   */
-int32_t SD_RecvData_DMA(uint8_t *buff, uint32_t len)
+int32_t SD_RecvData_DMA(SPI_SD_Card_t *card, uint8_t *buff, uint32_t len)
 {			  	  
-  if (SD_GetResponse(0xFE) != MSD_RESPONSE_NO_ERROR)    // 等待SD卡发回数据起始指令0xFE
+  if (SD_GetResponse(card, 0xFE) != MSD_RESPONSE_NO_ERROR)    // 等待SD卡发回数据起始指令0xFE
   {
+    card->Stats.TokenErrors++;
+    SD_Clock_Error(card);
     return 1;   // 读取失败
   }
+  card->ClockErrors = 0;
 
   /* 接收数据和CRC */
-  bsp_spi_read_dma(&BSP_SPI2, buff, len);
-  bsp_spi_read_dma(&BSP_SPI2, spi_temp, 2);  
+  bsp_spi_read_dma(card->Spi, buff, len);
+  bsp_spi_read_dma(card->Spi, card->Temp, 2);  
 
   return 0;   // 读取成功
 }
@@ -191,30 +317,37 @@ int32_t SD_RecvData_DMA(uint8_t *buff, uint32_t len)
 /**
   * @brief  按扇区向SD卡发送数据
   * @note   SD卡的1个扇区固定为512字节
+  * @param  card: SD卡
   * @param  buff: 数据缓存区
   * @param  cmd: 指令
   * @retval 0: 成功, 其他: 失败
   */
-int32_t SD_SendBlock_DMA(uint8_t *buff, uint8_t cmd)
+int32_t SD_SendBlock_DMA(SPI_SD_Card_t *card, uint8_t *buff, uint8_t cmd)
 {	
-  int32_t retval;
+  uint8_t retval;
 
-  bsp_spi_write(&BSP_SPI2, &cmd, 1);
+  bsp_spi_write(card->Spi, &cmd, 1);
   if (cmd != 0xFD)   // 不是结束指令
   {
     /* 发送数据并接收CRC */
-    bsp_spi_write_dma(&BSP_SPI2, buff, 512);
-    bsp_spi_read_dma(&BSP_SPI2, spi_temp, 2); 
+    bsp_spi_write_dma(card->Spi, buff, 512);
+    bsp_spi_read_dma(card->Spi, card->Temp, 2); 
     
     // 接收响应
-    bsp_spi_read(&BSP_SPI2, &retval, 1);   
+    bsp_spi_read(card->Spi, &retval, 1);   
     if ((retval & 0x1F) != MSD_DATA_OK)			 // 正常响应为xxx00101
     {
+      if ((retval & 0x1F) == MSD_DATA_CRC_ERROR)
+      {
+        card->Stats.CrcErrors++;
+        SD_Clock_Error(card);
+      }
       return 2;    // 响应错误		
     }
+    card->ClockErrors = 0;
     
     /* 延时等待SD卡内部数据写入完成，上面的操作只是把数据发送到SD卡控制器缓存中，还没有写入到SD卡闪存内 */
-    if (SD_WaitReady() == 1)
+    if (SD_WaitReady(card) == 1)
     {
       return 1;  // 等待准备失效
     }
@@ -227,48 +360,55 @@ int32_t SD_SendBlock_DMA(uint8_t *buff, uint8_t cmd)
 /**
   * @brief  向SD卡发送命令
   * @note   无
+  * @param  card: SD卡
   * @param  cmd: 命令
   * @param  arg: 命令参数
   * @param  crc: CRC
   * @retval SD卡返回的响应
   */
-int32_t SD_SendCmd(uint8_t cmd, uint32_t arg, uint8_t crc)
+int32_t SD_SendCmd(SPI_SD_Card_t *card, uint8_t cmd, uint32_t arg, uint8_t crc)
 {
-  int32_t retval;	
+  uint8_t retval;	
   uint8_t count = 0xFF; 
 
-  SD_Release();  // 取消上次片选
-  if (SD_Select() == 1)
+  SD_Release(card);  // 取消上次片选
+  if (SD_Select(card) != 0)
   {
     return 0xFF;  // 片选失效 
   }
 
-  spi_temp[0] = (uint8_t)(cmd | 0x40);
-  spi_temp[1] = (uint8_t)(arg >> 24);
-  spi_temp[2] = (uint8_t)(arg >> 16);
-  spi_temp[3] = (uint8_t)(arg >> 8);
-  spi_temp[4] = (uint8_t)(arg);
-  spi_temp[5] = (uint8_t)(crc);
+  card->Temp[0] = (uint8_t)(cmd | 0x40);
+  card->Temp[1] = (uint8_t)(arg >> 24);
+  card->Temp[2] = (uint8_t)(arg >> 16);
+  card->Temp[3] = (uint8_t)(arg >> 8);
+  card->Temp[4] = (uint8_t)(arg);
+  card->Temp[5] = (uint8_t)(crc);
 
   /* 写入命令 */
   #ifdef  SPI_DMA_SEND_CMD
-  bsp_spi_write(&BSP_SPI2, spi_temp, 6);
+  bsp_spi_write(card->Spi, card->Temp, 6);
   #else
-  bsp_spi_write_dma(&BSP_SPI2, spi_temp, 6);
+  bsp_spi_write_dma(card->Spi, card->Temp, 6);
   #endif
 
   if (cmd == TF_CMD12)
   {
-    bsp_spi_read(&BSP_SPI2, &spi_temp[0], 1);  // Skip a stuff byte when stop reading
+    bsp_spi_read(card->Spi, &card->Temp[0], 1);  // Skip a stuff byte when stop reading
   }
 
   /* 等待响应, 或超时退出 */
   do
   {
-    bsp_spi_read(&BSP_SPI2, &retval, 1);
+    bsp_spi_read(card->Spi, &retval, 1);
   }
   while ((retval & 0x80) && count--);	 
 
+  if (((retval & 0x80) == 0) && (retval & MSD_COM_CRC_ERROR))
+  {
+    card->Stats.CrcErrors++;
+    SD_Clock_Error(card);
+  }
+
   /* 返回状态值 */
   return retval;
 }		
@@ -277,20 +417,21 @@ int32_t SD_SendCmd(uint8_t cmd, uint32_t arg, uint8_t crc)
 /**
   * @brief  获取SD卡的CID信息
   * @note   包括制造商信息
+  * @param  card: SD卡
   * @param  cid: 存放CID的缓冲区，至少16Byte
   * @retval 0: 成功, 其他: 失败
   */
-int32_t SD_GetCID(uint8_t *cid)
+int32_t SD_GetCID(SPI_SD_Card_t *card, uint8_t *cid)
 {
   int32_t retval;	
 
-  retval = SD_SendCmd(TF_CMD10, 0, 0x39);  // 发CMD10命令, 读CID
+  retval = SD_SendCmd(card, TF_CMD10, 0, 0x39);  // 发CMD10命令, 读CID
   if (retval == 0x00)
   {
-    retval = SD_RecvData(cid, 16);  // 接收16个字节的数据	 
+    retval = SD_RecvData(card, cid, 16);  // 接收16个字节的数据	 
   }
 
-  SD_Release();  // 取消片选
+  SD_Release(card);  // 取消片选
   if (retval == 1)
   {
     return 1;
@@ -305,19 +446,20 @@ int32_t SD_GetCID(uint8_t *cid)
 /**
   * @brief  获取SD卡的CSD信息
   * @note   包括容量和速度信息
+  * @param  card: SD卡
   * @param  csd: 存放CSD的缓冲区，至少16Byte
   * @retval 0: 成功, 其他: 失败
   */
-int32_t SD_GetCSD(uint8_t *csd)
+int32_t SD_GetCSD(SPI_SD_Card_t *card, uint8_t *csd)
 {
   int32_t retval;	 
-  retval = SD_SendCmd(TF_CMD9, 0, 0xAF);  // 发CMD9命令, 读CSD
+  retval = SD_SendCmd(card, TF_CMD9, 0, 0xAF);  // 发CMD9命令, 读CSD
   if (retval == 0)
   {
-    retval = SD_RecvData(csd, 16);   // 接收16个字节的数据 
+    retval = SD_RecvData(card, csd, 16);   // 接收16个字节的数据 
   }
 
-  SD_Release();  // 取消片选
+  SD_Release(card);  // 取消片选
   if (retval == 1)
   {
     return 1;
@@ -331,27 +473,23 @@ int32_t SD_GetCSD(uint8_t *csd)
 
 /**
   * @brief  获取SD卡的总扇区数
-  * @note   1扇区等于512字节
-  * @param  无
+  * @note   1扇区等于512字节, 使用SD_Card_Init()中读取的CSD, 不访问SD卡
+  * @param  card: SD卡
   * @retval SD卡的总扇区数
   */
-uint32_t SD_GetSectorCount(void)
+uint32_t SD_GetSectorCount(SPI_SD_Card_t *card)
 {
-  uint32_t capacity;
-
-  capacity = SD_GetCapacity() * 2;
-
-  return capacity;
+  return card->Info.BlocksCount;
 }
 
 
 /**
   * @brief  获取SD卡的扇区大小
   * @note   1扇区等于512字节
-  * @param  无
+  * @param  card: SD卡
   * @retval 512字节
   */
-uint32_t SD_GetSectorSize(void)
+uint32_t SD_GetSectorSize(SPI_SD_Card_t *card)
 {
   return 512;
 }
@@ -359,99 +497,359 @@ uint32_t SD_GetSectorSize(void)
 
 /**
   * @brief  获取SD卡的容量，单位KiByte
-  * @note   单位KiByte
-  * @param  无
+  * @note   使用SD_Card_Init()中读取的CSD, 不访问SD卡
+  * @param  card: SD卡
   * @retval SD卡的容量
   */
-uint32_t SD_GetCapacity(void)
+uint32_t SD_GetCapacity(SPI_SD_Card_t *card)
 {
-  uint8_t csd[16];
-  uint32_t capacity;
-  uint16_t n;
-  uint32_t csize; 
+  return card->Info.Capacity;
+} 
 
-  // 获取CSD信息
-  if (SD_GetCSD(csd) != 0)
-  {
-    return 0;
-  }	 
+
+/**
+  * @brief  由CSD计算SD卡的总扇区数
+  * @note   CSD V2.0按22位C_SIZE计算, V1.0按C_SIZE、C_SIZE_MULT和READ_BL_LEN计算
+  * @param  csd: 16字节CSD数据
+  * @retval SD卡的总扇区数
+  */
+static uint32_t SD_CSD_GetSectorCount(const uint8_t *csd)
+{
+  uint32_t csize;
+  uint16_t n;
 
   if ((csd[0] & 0xC0) == 0x40)  // 判断bit126是否为1
   { 
     csize = csd[9] + ((uint32_t)csd[8] << 8) + ((uint32_t)(csd[7] & 63) << 16) + 1;
-    capacity = csize << 9; 
+    return csize << 10; 
   }
   else
   { 
     n = (csd[5] & 0x0F) + ((csd[10] & 0x80) >> 7) + ((csd[9] & 0x03) << 1) + 2;
     csize = (csd[8] >> 6) + ((uint16_t)csd[7] << 2) + ((uint16_t)(csd[6] & 0x03) << 10) + 1;
-    capacity = (uint32_t)csize << (n - 10);
+    return csize << (n - 9);
   }
+}
 
-  return capacity;
-} 
+
+/**
+  * @brief  由CSD计算SD卡的擦除组大小
+  * @note   CCC(bit95:84)的第5位表示支持擦除命令; 擦除组为(SECTOR_SIZE+1)个写块,
+  *         SECTOR_SIZE为bit45:39, 写块大小为2^WRITE_BL_LEN(bit25:22)字节. CSD V2.0固定为64KB
+  * @param  csd: 16字节CSD数据
+  * @retval 擦除组的扇区数, 0: 不支持擦除
+  */
+static uint32_t SD_CSD_GetEraseGroup(const uint8_t *csd)
+{
+  uint16_t ccc = ((uint16_t)csd[4] << 4) | (csd[5] >> 4);
+  uint8_t sector_size = ((csd[10] & 0x3F) << 1) | (csd[11] >> 7);
+  uint8_t write_bl_len = ((csd[12] & 0x03) << 2) | (csd[13] >> 6);
+
+  if ((ccc & (1 << 5)) == 0 || write_bl_len < 9)
+  {
+    return 0;
+  }
+
+  return (uint32_t)(sector_size + 1) << (write_bl_len - 9);
+}
+
+
+/**
+  * @brief  由CSD的TRAN_SPEED(bit103:96)计算卡支持的最大时钟
+  * @note   bit2~0: 速率单位 100kbit/s, 1Mbit/s, 10Mbit/s, 100Mbit/s
+  *         bit6~3: 倍数 1.0, 1.2, 1.3, 1.5, 2.0, 2.5, 3.0, 3.5, 4.0, 4.5, 5.0, 5.5, 6.0, 7.0, 8.0
+  * @param  csd: 16字节CSD数据
+  * @retval 最大时钟, 单位Hz, 0: 保留值
+  */
+static uint32_t SD_CSD_GetMaxClock(const uint8_t *csd)
+{
+  static const uint8_t value[16] = {0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80};
+  static const uint32_t unit[4] = {10000, 100000, 1000000, 10000000};
+
+  if ((csd[3] & 0x07) > 3)
+  {
+    return 0;
+  }
+  return unit[csd[3] & 0x07] * value[(csd[3] >> 3) & 0x0F];
+}
+
+
+/**
+  * @brief  设置SD卡的SPI时钟
+  * @note   立即设置到SPI总线上
+  * @param  card: SD卡
+  * @param  clock: 时钟, 单位Hz
+  * @retval 无
+  */
+static void SD_Clock_Set(SPI_SD_Card_t *card, uint32_t clock)
+{
+  card->Clock = clock;
+  SD_Bus_Clock(card, 1);
+}
+
+
+/**
+  * @brief  得到SD卡可以使用的最高时钟
+  * @note   不超过TFCARD_SPI_MAX_CLOCK和卡支持的最大时钟
+  * @param  card: SD卡
+  * @retval 时钟, 单位Hz
+  */
+static uint32_t SD_Clock_Limit(SPI_SD_Card_t *card)
+{
+  return (card->MaxClock < TFCARD_SPI_MAX_CLOCK) ? card->MaxClock : TFCARD_SPI_MAX_CLOCK;
+}
+
+
+/**
+  * @brief  连续出现CRC/令牌错误时降低SPI时钟
+  * @note   在检测到错误的地方调用, 成功收发数据块时清除计数; 每次减半, 不低于SPI_SD_TRAIN_MIN_CLOCK
+  * @param  card: SD卡
+  * @retval 无
+  */
+static void SD_Clock_Error(SPI_SD_Card_t *card)
+{
+#ifdef USE_SPI_SD_CLOCK_TRAINING
+  if (card->Training)
+  {
+    return;
+  }
+
+  if ((++card->ClockErrors >= SPI_SD_CLOCK_ERROR_LIMIT) && (card->Clock / 2 >= SPI_SD_TRAIN_MIN_CLOCK))
+  {
+    card->ClockErrors = 0;
+    SD_Clock_Set(card, card->Clock / 2);
+    card->Stats.ClockDowns++;
+  }
+#endif
+}
+
+
+#ifdef USE_SPI_SD_HIGH_SPEED
+/**
+  * @brief  用CMD6切换到高速模式
+  * @note   先查询功能组1是否支持高速(功能1), 再切换; 成功后卡支持的最大时钟为50MHz
+  * @param  card: SD卡
+  * @retval 0: 成功, 其他: 不支持或失败, 保持默认速度模式
+  */
+static int32_t SD_SwitchHighSpeed(SPI_SD_Card_t *card)
+{
+  uint8_t status[64];
+  int32_t retval;
+
+  /* 查询模式 */
+  retval = SD_SendCmd(card, TF_CMD6, 0x00FFFFF1, 0x01);
+  if (retval == 0)
+  {
+    retval = SD_RecvData(card, status, 64);
+  }
+  SD_Release(card);
+  if ((retval != 0) || ((status[13] & 0x02) == 0) || ((status[16] & 0x0F) != 0x01))
+  {
+    return 1;
+  }
+
+  /* 切换模式 */
+  retval = SD_SendCmd(card, TF_CMD6, 0x80FFFFF1, 0x01);
+  if (retval == 0)
+  {
+    retval = SD_RecvData(card, status, 64);
+  }
+  SD_Release(card);
+  if ((retval != 0) || ((status[16] & 0x0F) != 0x01))
+  {
+    return 1;
+  }
+
+  card->MaxClock = 50 * 1000 * 1000;
+  return 0;
+}
+#endif
+
+
+#ifdef USE_SPI_SD_CLOCK_TRAINING
+/* 读测试的数据缓冲区, 各张卡的训练依次进行 */
+static uint8_t SD_TrainBuffer[512];
+
+/**
+  * @brief  计算数据块的CRC16
+  * @note   CRC-16/XMODEM, 多项式x^16 + x^12 + x^5 + 1, 初值0
+  * @param  buff: 数据
+  * @param  len: 数据长度
+  * @retval CRC16
+  */
+static uint16_t SD_CRC16(const uint8_t *buff, uint32_t len)
+{
+  uint16_t crc = 0;
+  uint8_t i;
+
+  while (len--)
+  {
+    crc ^= (uint16_t)(*buff++) << 8;
+    for (i = 0; i < 8; i++)
+    {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+
+  return crc;
+}
+
+
+/**
+  * @brief  在当前时钟下读测试
+  * @note   读取SPI_SD_TRAIN_SECTOR扇区SPI_SD_TRAIN_READS次, 每次的CRC16都要正确且相同
+  * @param  card: SD卡
+  * @param  crc: 返回数据的CRC16
+  * @retval 0: 成功, 其他: 失败
+  */
+static int32_t SD_Clock_Test(SPI_SD_Card_t *card, uint16_t *crc)
+{
+  uint32_t sector = SPI_SD_TRAIN_SECTOR;
+  uint16_t value;
+  int32_t retval;
+  uint8_t i;
+
+  if (card->Info.Type < TF_TYPE_SDHC)   // SDHC/SDXC卡使用块地址
+  {
+    sector *= 512;   // 转换为字节地址
+  }
+
+  for (i = 0; i < SPI_SD_TRAIN_READS; i++)
+  {
+    retval = SD_SendCmd(card, TF_CMD17, sector, 0x01);
+    if (retval == 0)
+    {
+      retval = SD_RecvData(card, SD_TrainBuffer, 512);
+    }
+    value = ((uint16_t)card->Temp[0] << 8) | card->Temp[1];   // SD_Release()会覆盖Temp
+    SD_Release(card);
+
+    if (retval != 0)
+    {
+      return 1;
+    }
+    if (value != SD_CRC16(SD_TrainBuffer, 512))
+    {
+      card->Stats.CrcErrors++;
+      return 1;
+    }
+    if ((i > 0) && (value != *crc))
+    {
+      return 1;
+    }
+    *crc = value;
+  }
+
+  return 0;
+}
+#endif
+
+
+/**
+  * @brief  更新SD卡的读写统计
+  * @note   无
+  * @param  card: SD卡
+  * @param  op: SPI_SD_OP_READ / SPI_SD_OP_WRITE
+  * @param  cnt: 扇区数
+  * @param  retval: 请求的结果, 0: 成功
+  * @retval 无
+  */
+static void SD_Stats_Update(SPI_SD_Card_t *card, uint8_t op, uint32_t cnt, int32_t retval)
+{
+  if (op == SPI_SD_OP_READ)
+  {
+    if (retval == 0)
+    {
+      card->Stats.ReadSectors += cnt;
+    }
+    else
+    {
+      card->Stats.ReadErrors++;
+    }
+  }
+  else
+  {
+    if (retval == 0)
+    {
+      card->Stats.WriteSectors += cnt;
+    }
+    else
+    {
+      card->Stats.WriteErrors++;
+    }
+  }
+}
 
 
 /**
   * @brief  初始化SD卡
   * @note   SD卡的1个扇区固定为512字节
-  * @param  无
+  * @param  card: SD卡
   * @retval 0: 成功, 其他: 失败
   */
-int32_t SD_Card_Init(void)
+int32_t SD_Card_Init(SPI_SD_Card_t *card)
 {
   int32_t retval;
   uint16_t count = 20;
   uint8_t rxbuff[4];
-  SDCard_Info.Type = TF_TYPE_ERROR;
+  uint8_t csd[16];
+
+  /* 同一总线上的其他卡正在传输时不能重新初始化总线, 保留本卡原来的状态 */
+  if (SD_Bus_Busy(card))
+  {
+    return 1;
+  }
+  card->Info.Type = TF_TYPE_ERROR;
 
   /* 初始化SPI总线，设置到低速模式400KHz以下 */
-  bsp_spi_init(&BSP_SPI2, SPI_MODE_0, 400 * 1000);
+  bsp_spi_init(card->Spi, SPI_MODE_0, 400 * 1000);
+  card->Clock = 400 * 1000;
+  SD_Bus_Clock(card, 0);
 
   /* 延时(8 * 10)个时钟周期 */
-  bsp_spi_read(&BSP_SPI2, spi_temp, 10);
+  bsp_spi_read(card->Spi, card->Temp, 10);
 
-  TFCARD_SPI_CS_SELECT();
+  TFCARD_SPI_CS_SELECT(card);
 
   /* 进入空闲状态 */
-  retval = SD_SendCmd(TF_CMD0, 0, 0x95); 
+  retval = SD_SendCmd(card, TF_CMD0, 0, 0x95); 
   while ((retval != 0x01) && (count--))
   {
-    retval = SD_SendCmd(TF_CMD0, 0, 0x95);
+    retval = SD_SendCmd(card, TF_CMD0, 0, 0x95);
   }
 
   if (retval == 0x01)
   {
     /* SD卡V2.0 */
-    if (SD_SendCmd(TF_CMD8, 0x000001AA, 0x87) == 0x01)
+    if (SD_SendCmd(card, TF_CMD8, 0x000001AA, 0x87) == 0x01)
     {
       /* 接收SD卡返回数据 */
-      bsp_spi_read(&BSP_SPI2, rxbuff, 4);
+      bsp_spi_read(card->Spi, rxbuff, 4);
       
       /* SD卡是否支持2.7~3.6V */
       if ((rxbuff[0] == 0x00) && (rxbuff[1] == 0x00) && (rxbuff[2] == 0x01) && (rxbuff[3] == 0xAA))
       {
         count = 100;
-        SD_SendCmd(TF_CMD55, 0, 0x01);
-        retval = SD_SendCmd(TF_CMD41, 0x40000000, 0x01);
+        SD_SendCmd(card, TF_CMD55, 0, 0x01);
+        retval = SD_SendCmd(card, TF_CMD41, 0x40000000, 0x01);
         while (retval && (count--))
         {
-          SD_SendCmd(TF_CMD55, 0, 0x01);
-          retval = SD_SendCmd(TF_CMD41, 0x40000000, 0x01);
+          SD_SendCmd(card, TF_CMD55, 0, 0x01);
+          retval = SD_SendCmd(card, TF_CMD41, 0x40000000, 0x01);
         }
         
         /* 判断SD卡2.0版本 */
-        if (count && SD_SendCmd(TF_CMD58, 0, 0x01) == 0)   
+        if (count && SD_SendCmd(card, TF_CMD58, 0, 0x01) == 0)   
         {
           /* 接收OCR值，检查CCS */
-          bsp_spi_read(&BSP_SPI2, rxbuff, 4);
+          bsp_spi_read(card->Spi, rxbuff, 4);
           if (rxbuff[0] & 0x40)
           {
-            SDCard_Info.Type = TF_TYPE_SDHC;
+            card->Info.Type = TF_TYPE_SDHC;
           }
           else 
           {
-            SDCard_Info.Type = TF_TYPE_SDV2;
+            card->Info.Type = TF_TYPE_SDV2;
           }
         }
       }
@@ -460,56 +858,87 @@ int32_t SD_Card_Init(void)
     /* SD卡V1.0 */
     else
     {
-      SD_SendCmd(TF_CMD55, 0, 0x01);
-      retval = SD_SendCmd(TF_CMD41, 0, 0x01);
+      SD_SendCmd(card, TF_CMD55, 0, 0x01);
+      retval = SD_SendCmd(card, TF_CMD41, 0, 0x01);
       if (retval <= 1)
       {		
-        SDCard_Info.Type = TF_TYPE_SDV1;
+        card->Info.Type = TF_TYPE_SDV1;
         count = 0x1FFF;
         
         /* 等待退出空闲模式 */
-        SD_SendCmd(TF_CMD55, 0, 0x01);
-        retval = SD_SendCmd(TF_CMD41, 0, 0x01);
+        SD_SendCmd(card, TF_CMD55, 0, 0x01);
+        retval = SD_SendCmd(card, TF_CMD41, 0, 0x01);
         while (retval && (count--))
         {
-          SD_SendCmd(TF_CMD55, 0, 0x01);
-          retval = SD_SendCmd(TF_CMD41, 0, 0x01);
+          SD_SendCmd(card, TF_CMD55, 0, 0x01);
+          retval = SD_SendCmd(card, TF_CMD41, 0, 0x01);
         }
       }
       
       else
       {
         /* 错误的卡 */
-        SDCard_Info.Type = TF_TYPE_ERROR;
+        card->Info.Type = TF_TYPE_ERROR;
       }
       
-      if(count == 0 || SD_SendCmd(TF_CMD16, 512, 0x01) != 0)
+      if(count == 0 || SD_SendCmd(card, TF_CMD16, 512, 0x01) != 0)
       {
         /* 错误的卡 */
-        SDCard_Info.Type = TF_TYPE_ERROR;
+        card->Info.Type = TF_TYPE_ERROR;
       }
     }
   }
 
   /* 取消片选 */
-  SD_Release();
+  SD_Release(card);
+
+  /* 读取卡信息时使用默认速度模式的时钟, 训练时使用起始时钟 */
+  card->MaxClock = 25 * 1000 * 1000;
+#ifdef USE_SPI_SD_CLOCK_TRAINING
+  SD_Clock_Set(card, SPI_SD_TRAIN_START_CLOCK);
+#else
+  SD_Clock_Set(card, SD_Clock_Limit(card));
+#endif
+
+  /* 读取一次CSD, 得到TF卡大小 */
+  if ((card->Info.Type != TF_TYPE_ERROR) && (SD_GetCSD(card, csd) == 0))
+  {
+    if (SD_CSD_GetMaxClock(csd) != 0)
+    {
+      card->MaxClock = SD_CSD_GetMaxClock(csd);
+    }
+    card->Info.BlocksCount = SD_CSD_GetSectorCount(csd);
+    card->EraseGroup = (card->Info.Type == TF_TYPE_MMC) ? 0 : SD_CSD_GetEraseGroup(csd);   // MMC卡的擦除命令不同
+    card->Info.BlockSize = SD_GetSectorSize(card);
+    card->Info.Capacity = card->Info.BlocksCount / 2;
+  }
+  else
+  {
+    card->Info.Type = TF_TYPE_ERROR;
+  }
 
-  /* 设置到25MHz */
-  bsp_spi_set_max_clk_freq(&BSP_SPI2, 25 * 1000 * 1000);
+  /* 判断是否为SD_XC的卡 */
+  if ((card->Info.Capacity / 1024 > 1024 * 32)
+        && (card->Info.Type == TF_TYPE_SDHC))
+  {
+    card->Info.Type = TF_TYPE_SDXC;
+  }
 
-  /* 获取TF卡大小 */
-  SDCard_Info.Capacity = SD_GetCapacity();
-  SDCard_Info.BlockSize = SD_GetSectorSize();
-  SDCard_Info.BlocksCount = SD_GetSectorCount();
+#ifdef USE_SPI_SD_HIGH_SPEED
+  /* CCC(bit95:84)的bit10: 支持CMD6切换功能, 切换失败时保持默认速度模式 */
+  if ((card->Info.Type != TF_TYPE_ERROR) && (((((uint16_t)csd[4] << 4) | (csd[5] >> 4)) & (1 << 10)) != 0))
+  {
+    SD_SwitchHighSpeed(card);
+  }
+#endif
 
-  /* 判断是否为SD_XC的卡 */
-  if ((SDCard_Info.Capacity / 1024 > 1024 * 32)
-        && (SDCard_Info.Type == TF_TYPE_SDHC))
+  /* 设置到训练得到的时钟 */
+  if ((card->Info.Type != TF_TYPE_ERROR) && (SPI_SD_Card_TrainClock(card) != 0))
   {
-    SDCard_Info.Type = TF_TYPE_SDXC;
+    card->Info.Type = TF_TYPE_ERROR;
   }
 
-  if (SDCard_Info.Type >= 1)
+  if (card->Info.Type >= 1)
   {
     return 0;
   }
@@ -523,86 +952,146 @@ int32_t SD_Card_Init(void)
 
 
 /**
-  * @brief  打印SD卡的类型和容量信息
-  * @note   其中调用了printf函数，注意包含头文件stdio.h
-  * @param  无
-	* @retval 0: 成功，其他: 失败
+  * @brief  训练SPI时钟
+  * @note   上限为TFCARD_SPI_MAX_CLOCK和卡支持的最大时钟(CSD的TRAN_SPEED, 高速模式50MHz). 从上限逐级减半得到
+  *         不超过SPI_SD_TRAIN_START_CLOCK的一级作为起始时钟读测试, 失败时继续减半直到成功; 然后逐级加倍,
+  *         取读测试CRC正确且数据与起始时钟一致的最高一级. 未定义USE_SPI_SD_CLOCK_TRAINING时直接使用上限.
+  *         SD_Card_Init()中调用, 之后可以在空闲时重新训练(有异步请求时返回失败)
+  * @param  Handle: SD卡, SPI_SD_Card_t指针, NULL为SPI_SD_Card0
+  * @retval 0: 成功, 其他: 失败
   */
-int32_t SD_Information_Printf(void)
+int32_t SPI_SD_Card_TrainClock(void *Handle)
 {
-  /* 打印TF卡类型 */
-  if (SDCard_Info.Type == TF_TYPE_SDXC)
-  {
-    printf("\r\nSD_XC,");
-  }
-  else if (SDCard_Info.Type == TF_TYPE_SDHC)
-  {
-    printf("\r\nSD_HC,");
-  }
-  else if (SDCard_Info.Type == TF_TYPE_SDV2)
+  SPI_SD_Card_t *card = SD_CARD(Handle);
+#ifdef USE_SPI_SD_CLOCK_TRAINING
+  uint32_t top = SD_Clock_Limit(card);
+  uint16_t ref, crc;
+  uint8_t level = 0;
+
+  if ((card->Async.Active != NULL) || (card->Async.Pending != NULL) || SD_Bus_Busy(card))
   {
-    printf("\r\nSD_V2,");
+    return 1;
   }
-  else if (SDCard_Info.Type == TF_TYPE_SDV1)
+
+  while (((top >> level) > SPI_SD_TRAIN_START_CLOCK) && ((top >> (level + 1)) >= SPI_SD_TRAIN_MIN_CLOCK))
   {
-    printf("\r\nSD_V1,");
+    level++;
   }
-  else
+
+  card->Training = 1;
+
+  /* 起始时钟下得到参考数据 */
+  SD_Clock_Set(card, top >> level);
+  while (SD_Clock_Test(card, &ref) != 0)
   {
-    printf("\r\nSD ERROR,");
+    if ((top >> (level + 1)) < SPI_SD_TRAIN_MIN_CLOCK)
+    {
+      card->Training = 0;
+      return 1;
+    }
+    level++;
+    SD_Clock_Set(card, top >> level);
   }
 
-  /* 打印TF卡容量 */
-  if (SDCard_Info.Capacity / 1024 > 1024)
+  /* 逐级提高时钟, 直到读测试失败或者达到上限 */
+  while (level > 0)
   {
-    printf("Capacity:%4.1lfGB\r\n", (float)SDCard_Info.Capacity / 1024 / 1024);
-  }
-  else
-  {
-    printf("Capacity:%4.1lfMB\r\n", (float)SDCard_Info.Capacity / 1024);
+    SD_Clock_Set(card, top >> (level - 1));
+    if ((SD_Clock_Test(card, &crc) != 0) || (crc != ref))
+    {
+      break;
+    }
+    level--;
   }
 
+  SD_Clock_Set(card, top >> level);
+  card->ClockErrors = 0;
+  card->Training = 0;
+#else
+  SD_Clock_Set(card, SD_Clock_Limit(card));
+#endif
+
   return 0;
 }
 
 
-BSP_SDCard_t SPI_SDCard = 
+/**
+  * @brief  打印SD卡的类型和容量信息
+  * @note   其中调用了printf函数，注意包含头文件stdio.h
+  * @param  card: SD卡
+	* @retval 0: 成功，其他: 失败
+  */
+int32_t SD_Information_Printf(SPI_SD_Card_t *card)
 {
-  0,
-  SPI_SD_Card_Init,
-  SPI_SD_Card_DeInit,
-  SPI_SD_Card_GetState,
-  SPI_SD_Card_GetInfo,
-  SPI_SD_Card_WriteSector,
-  SPI_SD_Card_ReadSector,
-  SPI_SD_Card_WriteSector_DMA,
-  SPI_SD_Card_ReadSector_DMA,
-};
+  /* 打印TF卡类型 */
+  if (card->Info.Type == TF_TYPE_SDXC)
+  {
+    printf("\r\nSD_XC,");
+  }
+  else if (card->Info.Type == TF_TYPE_SDHC)
+  {
+    printf("\r\nSD_HC,");
+  }
+  else if (card->Info.Type == TF_TYPE_SDV2)
+  {
+    printf("\r\nSD_V2,");
+  }
+  else if (card->Info.Type == TF_TYPE_SDV1)
+  {
+    printf("\r\nSD_V1,");
+  }
+  else
+  {
+    printf("\r\nSD ERROR,");
+  }
+
+  /* 打印TF卡容量 */
+  if (card->Info.Capacity / 1024 > 1024)
+  {
+    printf("Capacity:%4.1lfGB\r\n", (float)card->Info.Capacity / 1024 / 1024);
+  }
+  else
+  {
+    printf("Capacity:%4.1lfMB\r\n", (float)card->Info.Capacity / 1024);
+  }
+
+  return 0;
+}
+
+
+BSP_SDCard_t SPI_SDCard = SPI_SD_BSP_CARD(&SPI_SD_Card0);
 
 
 
 int32_t SPI_SD_Card_Init(void *Handle)
 {
-  return SD_Card_Init();
+  SPI_SD_Card_t *card = SD_CARD(Handle);
+  return SD_Card_Init(card);
 }
 
 
 int32_t SPI_SD_Card_DeInit(void *Handle)
 {
+  SPI_SD_Card_t *card = SD_CARD(Handle);
   int32_t retval;
   uint8_t count = 20;
 
-  TFCARD_SPI_CS_RELEASE();
+  if (SD_Bus_Busy(card))
+  {
+    return 0xFF;   // 同一总线上的其他卡正在传输
+  }
+
+  TFCARD_SPI_CS_RELEASE(card);
   /* 延时 */
-  bsp_spi_read(&BSP_SPI2, spi_temp, 16);
+  bsp_spi_read(card->Spi, card->Temp, 16);
 
-  TFCARD_SPI_CS_SELECT();
+  TFCARD_SPI_CS_SELECT(card);
 
   /* 进入空闲状态 */
-  retval = SD_SendCmd(TF_CMD0, 0, 0x95); 
+  retval = SD_SendCmd(card, TF_CMD0, 0, 0x95); 
   while ((retval != 0x01) && (count--))
   {
-    retval = SD_SendCmd(TF_CMD0, 0, 0x95);
+    retval = SD_SendCmd(card, TF_CMD0, 0, 0x95);
   }
 
   return retval;
@@ -611,7 +1100,14 @@ int32_t SPI_SD_Card_DeInit(void *Handle)
 
 int32_t SPI_SD_Card_GetState(void *Handle)
 {
-  if (SD_WaitReady() == 0)
+  SPI_SD_Card_t *card = SD_CARD(Handle);
+  /* 异步传输进行中, 或者同一总线上的其他卡正在传输(不能查询忙信号) */
+  if ((card->Async.Active != NULL) || SD_Bus_Busy(card))
+  {
+    return 1;
+  }
+
+  if (SD_WaitReady(card) == 0)
   {
     return 0;
   }
@@ -624,17 +1120,19 @@ int32_t SPI_SD_Card_GetState(void *Handle)
 
 int32_t SPI_SD_Card_GetInfo(void *Handle, SD_CardInfo_t *Card_Info)
 {
-  Card_Info->Type = SDCard_Info.Type;
-  Card_Info->Capacity = SDCard_Info.Capacity;
-  Card_Info->BlocksCount = SDCard_Info.BlocksCount;
-  Card_Info->BlockSize = SDCard_Info.BlockSize;
+  SPI_SD_Card_t *card = SD_CARD(Handle);
+  Card_Info->Type = card->Info.Type;
+  Card_Info->Capacity = card->Info.Capacity;
+  Card_Info->BlocksCount = card->Info.BlocksCount;
+  Card_Info->BlockSize = card->Info.BlockSize;
   return 0;
 }
 
 
 /**
   * @brief  按扇区读取SD卡数据
-  * @note   SD卡的1个扇区固定为512字节
+  * @note   SD卡的1个扇区固定为512字节; 请求放入异步队列, 和其他同步、异步请求一起按电梯/EDF调度和合并,
+  *         调用SPI_SD_Card_Poll()直到完成后返回
   * @param  buff: 数据缓冲区
   * @param  sector: 起始扇区
   * @param  cnt: 扇区数
@@ -642,175 +1140,944 @@ int32_t SPI_SD_Card_GetInfo(void *Handle, SD_CardInfo_t *Card_Info)
   */
 int32_t SPI_SD_Card_ReadSector(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt)
 {
-  int32_t retval;
+  SPI_SD_Card_t *card = SD_CARD(Handle);
 
-  if (SDCard_Info.Type != TF_TYPE_SDHC)
+  if (cnt == 0)
   {
-    sector *= 512;   // 转换为字节地址
+    return 0;
+  }
+
+  return SD_Async_Transfer(card, SPI_SD_OP_READ, buff, sector, cnt, SPI_SD_PRIO_NORMAL, 0);
+}
+
+
+/**
+  * @brief  按扇区写入SD卡数据
+  * @note   SD卡的1个扇区固定为512字节; 经过异步队列调度, 见SPI_SD_Card_ReadSector()
+  * @param  buff: 数据缓冲区
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @retval 0: 成功, 其他: 失败
+  */
+int32_t SPI_SD_Card_WriteSector(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  SPI_SD_Card_t *card = SD_CARD(Handle);
+
+  if (cnt == 0)
+  {
+    return 0;
+  }
+
+  return SD_Async_Transfer(card, SPI_SD_OP_WRITE, buff, sector, cnt, SPI_SD_PRIO_NORMAL, 0);
+}
+
+
+/* 异步队列的数据收发都使用DMA, DMA接口和上面的同步接口相同 */
+int32_t SPI_SD_Card_ReadSector_DMA(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  return SPI_SD_Card_ReadSector(Handle, buff, sector, cnt);
+}
+
+
+int32_t SPI_SD_Card_WriteSector_DMA(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt)
+{
+  return SPI_SD_Card_WriteSector(Handle, buff, sector, cnt);
+}
+
+
+/**
+  * @brief  擦除SD卡扇区
+  * @note   只擦除其中完整的擦除组(起始向上、结束向下对齐), 不完整的部分不擦除;
+  *         CMD32/CMD33设置起始和结束地址, CMD38擦除后等待忙结束, 每次最多擦除SPI_SD_ERASE_MAX_BLOCKS个扇区.
+  *         异步传输进行中时返回失败
+  * @param  Handle: SD卡, SPI_SD_Card_t指针, NULL为SPI_SD_Card0
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @retval 0: 成功, 0xFE: 卡不支持擦除, 其他: 失败
+  */
+int32_t SPI_SD_Card_Erase(void *Handle, uint32_t sector, uint32_t cnt)
+{
+  SPI_SD_Card_t *card = SD_CARD(Handle);
+  int32_t retval = 0;
+  uint32_t start, end, n, tick;
+
+  if (card->EraseGroup == 0)
+  {
+    return 0xFE;
+  }
+  if (card->Async.Active != NULL || card->Async.Pending != NULL || SD_Bus_Busy(card))
+  {
+    return 1;
   }
 
-  if (cnt == 1)
+  start = (sector + card->EraseGroup - 1) / card->EraseGroup * card->EraseGroup;
+  end = (sector + cnt) / card->EraseGroup * card->EraseGroup;
+
+  while (start < end && retval == 0)
   {
-    retval = SD_SendCmd(TF_CMD17, sector, 0x01);  // 读命令
-    if(retval == 0)  // 指令发送成功
+    n = end - start;
+    if (n > SPI_SD_ERASE_MAX_BLOCKS)
     {
-      retval = SD_RecvData(buff, 512);   // 接收512个字节	   
+      n = SPI_SD_ERASE_MAX_BLOCKS / card->EraseGroup * card->EraseGroup;
+      n = (n == 0) ? card->EraseGroup : n;
     }
+
+    if (card->Info.Type < TF_TYPE_SDHC)   // SDHC/SDXC卡使用块地址
+    {
+      retval = SD_SendCmd(card, TF_CMD32, start * 512, 0x01);
+      retval = (retval == 0) ? SD_SendCmd(card, TF_CMD33, (start + n - 1) * 512, 0x01) : retval;
+    }
+    else
+    {
+      retval = SD_SendCmd(card, TF_CMD32, start, 0x01);
+      retval = (retval == 0) ? SD_SendCmd(card, TF_CMD33, start + n - 1, 0x01) : retval;
+    }
+    retval = (retval == 0) ? SD_SendCmd(card, TF_CMD38, 0, 0x01) : retval;
+
+    /* R1b响应, 擦除期间SD卡返回0x00 */
+    tick = HAL_GetTick();
+    while (retval == 0)
+    {
+      bsp_spi_read(card->Spi, &card->Temp[0], 1);
+      if (card->Temp[0] == 0xFF)
+      {
+        break;
+      }
+      if (HAL_GetTick() - tick > SPI_SD_ERASE_TIMEOUT)
+      {
+        retval = 0xFD;
+      }
+    }
+
+    start += n;
   }
 
-  else
+  SD_Release(card);  // 取消片选
+  return retval;
+}
+
+
+/**
+  * @brief  在有限的字节数内等待SD卡返回指定字节
+  * @note   最多检查SPI_SD_ASYNC_POLL_BYTES个字节, 不会长时间占用CPU
+  * @param  card: SD卡
+  * @param  value: 0xFE等待读数据令牌, 0xFF等待忙结束
+  * @retval 0: 收到, 1: 未收到, 2: 收到错误令牌
+  */
+static int32_t SD_Async_PollByte(SPI_SD_Card_t *card, uint8_t value)
+{
+  uint32_t count;
+
+  for (count = 0; count < SPI_SD_ASYNC_POLL_BYTES; count++)
   {
-    retval = SD_SendCmd(TF_CMD18, sector, 0x01);   // 连续读命令
-    do
+    bsp_spi_read(card->Spi, &card->Temp[0], 1);
+
+    if (card->Temp[0] == value)
+    {
+      return 0;
+    }
+    if ((value == 0xFE) && (card->Temp[0] != 0xFF))
     {
-      retval = SD_RecvData(buff, 512);   // 接收512个字节	 
-      buff += 512;
+      return 2;
     }
-    while (--cnt && retval == 0); 
-    
-    SD_SendCmd(TF_CMD12, 0, 0x01);	  // 发送停止命令
   }
 
-  SD_Release();  // 取消片选
-  return retval;
+  return 1;
 }
 
 
 /**
-  * @brief  按扇区写入SD卡数据
-  * @note   SD卡的1个扇区固定为512字节
-  * @param  buff: 数据缓冲区
-  * @param  sector: 起始扇区
-  * @param  cnt: 扇区数
-  * @retval 0: 成功, 其他: 失败
+  * @brief  计算请求距离截止时间的剩余时间
+  * @note   没有截止时间的请求排在最后
+  * @param  req: 请求
+  * @param  now: 当前时间
+  * @retval 剩余时间, 单位ms, 已超时为负数
   */
-int32_t SPI_SD_Card_WriteSector(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt)
+static int32_t SD_Sched_Slack(SPI_SD_Request_t *req, uint32_t now)
 {
-  int32_t retval;
+  if (req->Deadline == 0)
+  {
+    return 0x7FFFFFFF;
+  }
+  return (int32_t)(req->Deadline - now);
+}
+
+
+/**
+  * @brief  把请求放入完成通知
+  * @note   有回调时调用回调, 否则放入完成队列
+  * @param  card: SD卡
+  * @param  req: 请求
+  * @param  status: SPI_SD_REQ_DONE / SPI_SD_REQ_ERROR / SPI_SD_REQ_TIMEOUT
+  * @retval 无
+  */
+static void SD_Async_Complete(SPI_SD_Card_t *card, SPI_SD_Request_t *req, int32_t status)
+{
+  req->Status = status;
+  SD_Stats_Update(card, req->Op, req->Done, (status == SPI_SD_REQ_DONE) ? 0 : 1);
+  if (status == SPI_SD_REQ_TIMEOUT)
+  {
+    card->Stats.Timeouts++;
+  }
+  if ((req->Deadline != 0) && (SD_Sched_Slack(req, HAL_GetTick()) < 0))
+  {
+    card->Stats.DeadlineMisses++;
+  }
 
-  if (SDCard_Info.Type != TF_TYPE_SDHC)
+  if (req->Callback != NULL)
+  {
+    req->Callback(req);
+  }
+  else
   {
-    sector *= 512;  // 转换为字节地址
+    req->Next = NULL;
+    SPI_SD_ENTER_CRITICAL();
+    if (card->Async.CompletedTail == NULL)
+    {
+      card->Async.Completed = req;
+    }
+    else
+    {
+      card->Async.CompletedTail->Next = req;
+    }
+    card->Async.CompletedTail = req;
+    SPI_SD_EXIT_CRITICAL();
   }
+}
 
-  if (cnt == 1)
+
+/**
+  * @brief  完成当前的异步请求
+  * @note   出错时结束卡的连续传输
+  * @param  card: SD卡
+  * @param  status: SPI_SD_REQ_DONE / SPI_SD_REQ_ERROR / SPI_SD_REQ_TIMEOUT
+  * @retval 无
+  */
+static void SD_Async_Finish(SPI_SD_Card_t *card, int32_t status)
+{
+  SPI_SD_Request_t *req = card->Async.Active;
+
+  if ((status != SPI_SD_REQ_DONE) && (card->Async.State != SPI_SD_ASYNC_IDLE) && card->Async.Multi)
   {
-    retval = SD_SendCmd(TF_CMD24, sector, 0x01);  // 写命令
-    if (retval == 0x00)  // 指令发送成功
+    if (req->Op == SPI_SD_OP_READ)
     {
-      retval = SD_SendBlock(buff, 0xFE);  // 写512个字节
+      SD_SendCmd(card, TF_CMD12, 0, 0x01);
     }
-    
     else
     {
-      SD_Card_Init();
+      SD_SendBlock(card, 0, 0xFD);
     }
   }
+  SD_Release(card);
 
+  card->Async.Active = NULL;
+  card->Async.State = SPI_SD_ASYNC_IDLE;
+  card->Async.Requeue = 0;
+  SD_Async_Complete(card, req, status);
+}
+
+
+/**
+  * @brief  结束被抢占的请求的传输, 剩余的扇区放回等待队列头部
+  * @note   停止命令/停止令牌后的忙结束后调用. 放在队列头部保持与后提交的重叠请求的先后顺序
+  * @param  card: SD卡
+  * @retval 无
+  */
+static void SD_Async_Requeue(SPI_SD_Card_t *card)
+{
+  SPI_SD_Request_t *req = card->Async.Active;
+
+  SD_Release(card);
+  card->Async.Active = NULL;
+  card->Async.State = SPI_SD_ASYNC_IDLE;
+  card->Async.Requeue = 0;
+  card->Stats.Preemptions++;
+
+  SPI_SD_ENTER_CRITICAL();
+  req->Status = SPI_SD_REQ_PENDING;
+  req->Next = card->Async.Pending;
+  card->Async.Pending = req;
+  if (card->Async.PendingTail == NULL)
+  {
+    card->Async.PendingTail = req;
+  }
+  SPI_SD_EXIT_CRITICAL();
+}
+
+
+/**
+  * @brief  从等待队列中删除请求
+  * @note   在临界区中调用
+  * @param  card: SD卡
+  * @param  prev: 前一个请求, 为NULL时req是队列头
+  * @param  req: 请求
+  * @retval 无
+  */
+static void SD_Sched_Unlink(SPI_SD_Card_t *card, SPI_SD_Request_t *prev, SPI_SD_Request_t *req)
+{
+  if (prev == NULL)
+  {
+    card->Async.Pending = req->Next;
+  }
   else
   {
-    SD_SendCmd(TF_CMD55, 0, 0x01);	
-    SD_SendCmd(TF_CMD23, cnt, 0x01);
-    
-    retval = SD_SendCmd(TF_CMD25, sector, 0x01);  // 连续写命令
-    if (retval == 0)
+    prev->Next = req->Next;
+  }
+  if (card->Async.PendingTail == req)
+  {
+    card->Async.PendingTail = prev;
+  }
+  req->Next = NULL;
+}
+
+
+/**
+  * @brief  检查请求是否必须等待队列中更早的请求
+  * @note   扇区重叠且其中一个是写请求时必须按提交顺序传输; 在临界区中调用
+  * @param  card: SD卡
+  * @param  req: 请求
+  * @retval 1: 必须等待, 0: 可以调度
+  */
+static int32_t SD_Sched_Blocked(SPI_SD_Card_t *card, SPI_SD_Request_t *req)
+{
+  SPI_SD_Request_t *prev;
+
+  for (prev = card->Async.Pending; prev != req; prev = prev->Next)
+  {
+    if (((prev->Op == SPI_SD_OP_WRITE) || (req->Op == SPI_SD_OP_WRITE)) &&
+        (prev->Sector < req->Sector + req->Count) && (req->Sector < prev->Sector + prev->Count))
     {
-      do
-      {
-        retval = SD_SendBlock(buff, 0xFC);  // 发送512个字节	 
-        buff += 512;
-      }
-      while (--cnt && retval == 0);
-      retval = SD_SendBlock(0, 0xFD);  // 接收512个字节 
+      return 1;
     }
   }
 
-  SD_Release();  // 取消片选
-  return retval;
+  return 0;
 }
 
 
-int32_t SPI_SD_Card_ReadSector_DMA(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt)
+/**
+  * @brief  从等待队列中取出接在请求后面的同方向同优先级请求
+  * @note   用于合并: 取出的请求在当前的CMD18/CMD25传输中继续传输, 不需要新的命令
+  * @param  card: SD卡
+  * @param  last: 前一个请求
+  * @param  remove: 1: 从队列中取出, 0: 只查找
+  * @retval 请求, 没有时返回NULL
+  */
+static SPI_SD_Request_t *SD_Sched_Follower(SPI_SD_Card_t *card, SPI_SD_Request_t *last, uint8_t remove)
 {
-  int32_t retval;
+  SPI_SD_Request_t *req, *prev = NULL;
 
-  if (SDCard_Info.Type != TF_TYPE_SDHC)
+  SPI_SD_ENTER_CRITICAL();
+  for (req = card->Async.Pending; req != NULL; prev = req, req = req->Next)
   {
-    sector *= 512;   // 转换为字节地址
+    if ((req->Op == last->Op) && (req->Priority == last->Priority) &&
+        (req->Sector == last->Sector + last->Count) && !SD_Sched_Blocked(card, req))
+    {
+      break;
+    }
   }
+  if ((req != NULL) && remove)
+  {
+    SD_Sched_Unlink(card, prev, req);
+  }
+  SPI_SD_EXIT_CRITICAL();
+
+  return req;
+}
+
+
+/**
+  * @brief  检查是否有需要优先处理的读请求
+  * @note   最早的读请求等待超过SPI_SD_SCHED_READ_EXPIRE, 或已连续调度SPI_SD_SCHED_WRITE_BATCH个写请求
+  * @param  card: SD卡
+  * @retval 1: 有, 0: 没有
+  */
+static int32_t SD_Sched_ReadUrgent(SPI_SD_Card_t *card)
+{
+  SPI_SD_Request_t *req;
+  int32_t urgent = 0;
 
-  if (cnt == 1)
+  SPI_SD_ENTER_CRITICAL();
+  for (req = card->Async.Pending; req != NULL; req = req->Next)
   {
-    retval = SD_SendCmd(TF_CMD17, sector, 0x01);  // 读命令
-    if(retval == 0)  // 指令发送成功
+    if (req->Op == SPI_SD_OP_READ)
     {
-      retval = SD_RecvData_DMA(buff, 512);   // 接收512个字节	   
+      urgent = (HAL_GetTick() - req->Tick > SPI_SD_SCHED_READ_EXPIRE) ||
+               (card->Async.Writes >= SPI_SD_SCHED_WRITE_BATCH);
+      break;
     }
   }
+  SPI_SD_EXIT_CRITICAL();
 
-  else
+  return urgent;
+}
+
+
+/**
+  * @brief  把请求设为当前传输的请求
+  * @note   更新电梯的扫描位置和连续写请求数
+  * @param  card: SD卡
+  * @param  req: 请求
+  * @retval 无
+  */
+static void SD_Sched_Dispatch(SPI_SD_Card_t *card, SPI_SD_Request_t *req)
+{
+  card->Async.Active = req;
+  card->Async.Position = req->Sector + req->Count;
+  card->Async.Writes = (req->Op == SPI_SD_OP_WRITE) ? card->Async.Writes + 1 : 0;
+  req->Status = SPI_SD_REQ_ACTIVE;
+}
+
+
+/**
+  * @brief  查找等待队列中可以调度的请求的最高优先级
+  * @note   在临界区中调用
+  * @param  card: SD卡
+  * @param  prio: 返回最高优先级
+  * @retval 1: 有可以调度的请求, 0: 没有
+  */
+static int32_t SD_Sched_MaxPriority(SPI_SD_Card_t *card, int8_t *prio)
+{
+  SPI_SD_Request_t *req;
+  int32_t found = 0;
+
+  for (req = card->Async.Pending; req != NULL; req = req->Next)
   {
-    retval = SD_SendCmd(TF_CMD18, sector, 0x01);   // 连续读命令
-    do
+    if (!SD_Sched_Blocked(card, req) && (!found || (req->Priority > *prio)))
     {
-      retval = SD_RecvData_DMA(buff, 512);   // 接收512个字节	 
-      buff += 512;
+      *prio = req->Priority;
+      found = 1;
     }
-    while (--cnt && retval == 0); 
-    
-    SD_SendCmd(TF_CMD12, 0, 0x01);	  // 发送停止命令
   }
 
-  SD_Release();  // 取消片选
-  return retval;
+  return found;
 }
 
 
-int32_t SPI_SD_Card_WriteSector_DMA(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt)
+/**
+  * @brief  检查当前传输的请求是否需要让出SD卡
+  * @note   等待队列中有优先级更高的请求时, 在扇区之间结束当前传输, 剩余的扇区重新排队
+  * @param  card: SD卡
+  * @retval 1: 需要让出, 0: 继续传输
+  */
+static int32_t SD_Sched_Preempt(SPI_SD_Card_t *card)
 {
-  int32_t retval;
+  int32_t preempt;
+  int8_t prio;
 
-  if (SDCard_Info.Type != TF_TYPE_SDHC)
+  SPI_SD_ENTER_CRITICAL();
+  preempt = SD_Sched_MaxPriority(card, &prio) && (prio > card->Async.Active->Priority);
+  SPI_SD_EXIT_CRITICAL();
+
+  return preempt;
+}
+
+
+/**
+  * @brief  从等待队列中选出下一个请求
+  * @note   先取可以调度的请求中优先级最高的一级. SPI_SD_PRIO_REALTIME按截止时间最早优先(EDF);
+  *         其他优先级按扇区号单向扫描: 取扇区号不小于上次传输结束位置的最小请求, 没有时回到最小扇区号(C-LOOK).
+  *         与更早的请求扇区重叠且有写请求时不参与排序;
+  *         读请求等待超过SPI_SD_SCHED_READ_EXPIRE, 或有读请求时已连续调度SPI_SD_SCHED_WRITE_BATCH个写请求,
+  *         取最早的读请求, 避免长时间的连续写入阻塞读取
+  * @param  card: SD卡
+  * @retval 请求, 队列为空时返回NULL
+  */
+static SPI_SD_Request_t *SD_Sched_Pick(SPI_SD_Card_t *card)
+{
+  SPI_SD_Request_t *req, *prev = NULL;
+  SPI_SD_Request_t *edf = NULL, *edf_prev = NULL;
+  SPI_SD_Request_t *read = NULL, *read_prev = NULL;
+  SPI_SD_Request_t *ahead = NULL, *ahead_prev = NULL;
+  SPI_SD_Request_t *lowest = NULL, *lowest_prev = NULL;
+  uint32_t now = HAL_GetTick();
+  int8_t prio;
+
+  SPI_SD_ENTER_CRITICAL();
+  if (!SD_Sched_MaxPriority(card, &prio))
   {
-    sector *= 512;  // 转换为字节地址
+    SPI_SD_EXIT_CRITICAL();
+    return NULL;
   }
 
-  if (cnt == 1)
+  for (req = card->Async.Pending; req != NULL; prev = req, req = req->Next)
   {
-    retval = SD_SendCmd(TF_CMD24, sector, 0x01);  // 写命令
-    if (retval == 0x00)  // 指令发送成功
+    if ((req->Priority != prio) || SD_Sched_Blocked(card, req))
     {
-      retval = SD_SendBlock_DMA(buff, 0xFE);  // 写512个字节
+      continue;
     }
-    
-    else
+    if ((edf == NULL) || (SD_Sched_Slack(req, now) < SD_Sched_Slack(edf, now)))
     {
-      SD_Card_Init();
+      edf = req;
+      edf_prev = prev;
+    }
+    if ((req->Op == SPI_SD_OP_READ) && (read == NULL))
+    {
+      read = req;         // 队列按提交顺序排列, 第一个可以调度的读请求就是最早的
+      read_prev = prev;
+    }
+    if ((req->Sector >= card->Async.Position) && ((ahead == NULL) || (req->Sector < ahead->Sector)))
+    {
+      ahead = req;
+      ahead_prev = prev;
+    }
+    if ((lowest == NULL) || (req->Sector < lowest->Sector))
+    {
+      lowest = req;
+      lowest_prev = prev;
     }
   }
 
+  if (prio == SPI_SD_PRIO_REALTIME)
+  {
+    req = edf;
+    prev = edf_prev;
+  }
+  else if ((read != NULL) && ((now - read->Tick > SPI_SD_SCHED_READ_EXPIRE) ||
+                              (card->Async.Writes >= SPI_SD_SCHED_WRITE_BATCH)))
+  {
+    req = read;
+    prev = read_prev;
+  }
+  else if (ahead != NULL)
+  {
+    req = ahead;
+    prev = ahead_prev;
+  }
   else
   {
-    SD_SendCmd(TF_CMD55, 0, 0x01);	
-    SD_SendCmd(TF_CMD23, cnt, 0x01);
-    
-    retval = SD_SendCmd(TF_CMD25, sector, 0x01);  // 连续写命令
-    if (retval == 0)
+    req = lowest;
+    prev = lowest_prev;
+  }
+
+  SD_Sched_Unlink(card, prev, req);
+  SPI_SD_EXIT_CRITICAL();
+
+  return req;
+}
+
+
+/**
+  * @brief  开始传输一个异步请求
+  * @note   发送读写命令. 请求多于一个扇区或队列中有接在后面的同方向请求时使用CMD18/CMD25,
+  *         后面的请求在同一次传输中继续
+  * @param  card: SD卡
+  * @param  req: 请求
+  * @retval 0: 成功, 其他: 失败
+  */
+static int32_t SD_Async_Start(SPI_SD_Card_t *card, SPI_SD_Request_t *req)
+{
+  SPI_SD_Request_t *next;
+  uint32_t sector = req->Sector + req->Done;   // 被打断的请求从剩余的扇区继续
+  uint32_t count = req->Count - req->Done;
+
+  /* 统计可以合并的扇区数, 作为ACMD23的预擦除块数 */
+  next = req;
+  while ((next = SD_Sched_Follower(card, next, 0)) != NULL)
+  {
+    count += next->Count;
+  }
+  card->Async.Multi = (count > 1);
+
+  if (card->Info.Type < TF_TYPE_SDHC)   // SDHC/SDXC卡使用块地址
+  {
+    sector *= 512;   // 转换为字节地址
+  }
+
+  if (req->Op == SPI_SD_OP_READ)
+  {
+    if (SD_SendCmd(card, card->Async.Multi ? TF_CMD18 : TF_CMD17, sector, 0x01) != 0)
+    {
+      return 1;
+    }
+    card->Async.State = SPI_SD_ASYNC_TOKEN;
+  }
+  else
+  {
+    if (card->Async.Multi)
+    {
+      SD_SendCmd(card, TF_CMD55, 0, 0x01);
+      SD_SendCmd(card, TF_CMD23, (count > TF_ACMD23_MAX_BLOCKS) ? TF_ACMD23_MAX_BLOCKS : count, 0x01);
+    }
+    if (SD_SendCmd(card, card->Async.Multi ? TF_CMD25 : TF_CMD24, sector, 0x01) != 0)
+    {
+      return 1;
+    }
+    card->Async.State = SPI_SD_ASYNC_BLOCK;
+  }
+
+  card->Async.Tick = HAL_GetTick();
+  return 0;
+}
+
+
+/**
+  * @brief  当前请求传输完所有扇区后继续下一个请求
+  * @note   等待队列中有接在后面的同方向请求时, 完成当前请求并在同一次传输中继续, 否则需要结束传输.
+  *         连续写入时有需要优先处理的读请求也结束传输
+  * @param  card: SD卡
+  * @retval 1: 继续传输, 0: 需要结束传输
+  */
+static int32_t SD_Async_Continue(SPI_SD_Card_t *card)
+{
+  SPI_SD_Request_t *req = card->Async.Active;
+  SPI_SD_Request_t *next;
+
+  if (!card->Async.Multi)
+  {
+    return 0;
+  }
+  if (((req->Op == SPI_SD_OP_WRITE) && SD_Sched_ReadUrgent(card)) || SD_Sched_Preempt(card))
+  {
+    return 0;
+  }
+
+  next = SD_Sched_Follower(card, req, 1);
+  if (next == NULL)
+  {
+    return 0;
+  }
+
+  SD_Async_Complete(card, req, SPI_SD_REQ_DONE);
+  SD_Sched_Dispatch(card, next);
+  card->Stats.Merged++;
+
+  return 1;
+}
+
+
+/**
+  * @brief  同步请求的完成回调
+  * @note   同步请求不进入完成队列, 由SD_Async_Transfer()等待状态变化
+  * @param  req: 请求
+  * @retval 无
+  */
+static void SD_Async_SyncCallback(SPI_SD_Request_t *req)
+{
+}
+
+
+/**
+  * @brief  经过异步队列进行同步读写
+  * @note   同步读写都放入队列, 和其他请求一起排序合并; 调用SPI_SD_Card_Poll()直到完成
+  * @param  card: SD卡
+  * @param  op: SPI_SD_OP_READ / SPI_SD_OP_WRITE
+  * @param  buff: 数据缓冲区
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @param  prio: 优先级, SPI_SD_PRIO_xxx
+  * @param  deadline: 截止时间, 0: 无
+  * @retval 0: 成功, 其他: 失败
+  */
+static int32_t SD_Async_Transfer(SPI_SD_Card_t *card, uint8_t op, uint8_t *buff, uint32_t sector, uint32_t cnt,
+                                 int8_t prio, uint32_t deadline)
+{
+  SPI_SD_Request_t req = {0};
+  SPI_SD_Card_t *owner;
+
+  req.Op = op;
+  req.Buff = buff;
+  req.Sector = sector;
+  req.Count = cnt;
+  req.Callback = SD_Async_SyncCallback;
+  req.Priority = prio;
+  req.Deadline = deadline;
+
+  if (SPI_SD_Card_Submit(card, &req) != 0)
+  {
+    return 1;
+  }
+  while ((req.Status == SPI_SD_REQ_PENDING) || (req.Status == SPI_SD_REQ_ACTIVE))
+  {
+    owner = SD_Bus_Owner(card);
+    if ((owner != NULL) && (owner != card))
     {
-      do
+      SPI_SD_Card_Poll(owner);   // 同一总线上的其他卡正在异步传输, 推进它直到释放总线
+    }
+    SPI_SD_Card_Poll(card);
+  }
+
+  return (req.Status == SPI_SD_REQ_DONE) ? 0 : 1;
+}
+
+
+/**
+  * @brief  实时读扇区
+  * @note   以SPI_SD_PRIO_REALTIME优先级经过异步队列读取, 打断正在传输的低优先级请求(如后台日志写入);
+  *         超过截止时间时仍然完成读取, 计入Stats.DeadlineMisses
+  * @param  Handle: SD卡, SPI_SD_Card_t指针, NULL为SPI_SD_Card0
+  * @param  buff: 数据缓冲区
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @param  timeout: 从现在开始的截止时间, 单位ms
+  * @retval 0: 成功, 其他: 失败
+  */
+int32_t SPI_SD_Card_ReadSector_RT(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt, uint32_t timeout)
+{
+  SPI_SD_Card_t *card = SD_CARD(Handle);
+  uint32_t deadline = HAL_GetTick() + timeout;
+
+  return SD_Async_Transfer(card, SPI_SD_OP_READ, buff, sector, cnt, SPI_SD_PRIO_REALTIME, (deadline != 0) ? deadline : 1);
+}
+
+
+/**
+  * @brief  实时写扇区
+  * @note   以SPI_SD_PRIO_REALTIME优先级经过异步队列写入, 见SPI_SD_Card_ReadSector_RT()
+  * @param  Handle: SD卡, SPI_SD_Card_t指针, NULL为SPI_SD_Card0
+  * @param  buff: 数据缓冲区
+  * @param  sector: 起始扇区
+  * @param  cnt: 扇区数
+  * @param  timeout: 从现在开始的截止时间, 单位ms
+  * @retval 0: 成功, 其他: 失败
+  */
+int32_t SPI_SD_Card_WriteSector_RT(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt, uint32_t timeout)
+{
+  SPI_SD_Card_t *card = SD_CARD(Handle);
+  uint32_t deadline = HAL_GetTick() + timeout;
+
+  return SD_Async_Transfer(card, SPI_SD_OP_WRITE, buff, sector, cnt, SPI_SD_PRIO_REALTIME, (deadline != 0) ? deadline : 1);
+}
+
+
+/**
+  * @brief  提交异步读写请求
+  * @note   立即返回, 请求由SPI_SD_Card_Poll()推进, 可以同时提交多个请求;
+  *         请求按优先级和扇区号调度, 不保证按提交顺序完成, 接在一起的同方向同优先级请求在一次传输中完成
+  * @param  Handle: SD卡, SPI_SD_Card_t指针, NULL为SPI_SD_Card0
+  * @param  req: 请求, 需填写Op/Buff/Sector/Count/Callback/Priority/Deadline
+  * @retval 0: 成功, 其他: 失败
+  */
+int32_t SPI_SD_Card_Submit(void *Handle, SPI_SD_Request_t *req)
+{
+  SPI_SD_Card_t *card = SD_CARD(Handle);
+  if ((req == NULL) || (req->Buff == NULL) || (req->Count == 0))
+  {
+    return 1;
+  }
+
+  req->Status = SPI_SD_REQ_PENDING;
+  req->Done = 0;
+  req->Next = NULL;
+  req->Tick = HAL_GetTick();
+
+  SPI_SD_ENTER_CRITICAL();
+  if (card->Async.PendingTail == NULL)
+  {
+    card->Async.Pending = req;
+  }
+  else
+  {
+    card->Async.PendingTail->Next = req;
+  }
+  card->Async.PendingTail = req;
+  SPI_SD_EXIT_CRITICAL();
+
+  return 0;
+}
+
+
+/**
+  * @brief  推进异步读写
+  * @note   在主循环或定时任务中周期调用. 每次调用最多传输一个扇区, 等待数据令牌和
+  *         写编程忙时只检查SPI_SD_ASYNC_POLL_BYTES个字节就返回, 不会阻塞等待SD卡
+  * @param  Handle: SD卡, SPI_SD_Card_t指针, NULL为SPI_SD_Card0
+  * @retval 未完成的请求数
+  */
+int32_t SPI_SD_Card_Poll(void *Handle)
+{
+  SPI_SD_Card_t *card = SD_CARD(Handle);
+  SPI_SD_Request_t *req;
+  int32_t retval;
+  int32_t count = 0;
+
+  /* 两次轮询之间总线可能被同一总线上的其他卡(或其他设备)改了时钟, 继续传输前恢复本卡的时钟 */
+  if (card->Async.Active != NULL)
+  {
+    SD_Bus_Clock(card, 1);
+  }
+
+  /* 同一总线上的其他卡正在传输时请求留在队列中, 等总线空闲再开始 */
+  if ((card->Async.Active == NULL) && !SD_Bus_Busy(card))
+  {
+    req = SD_Sched_Pick(card);
+    if (req != NULL)
+    {
+      SD_Sched_Dispatch(card, req);
+      if (SD_Async_Start(card, req) != 0)
       {
-        retval = SD_SendBlock_DMA(buff, 0xFC);  // 发送512个字节	 
-        buff += 512;
+        SD_Async_Finish(card, SPI_SD_REQ_ERROR);
       }
-      while (--cnt && retval == 0);
-      retval = SD_SendBlock_DMA(0, 0xFD);  // 接收512个字节 
     }
   }
 
-  SD_Release();  // 取消片选
-  return retval;
+  req = card->Async.Active;
+  switch ((req != NULL) ? card->Async.State : SPI_SD_ASYNC_IDLE)
+  {
+    case SPI_SD_ASYNC_TOKEN:
+      retval = SD_Async_PollByte(card, 0xFE);
+      if (retval == 1)
+      {
+        if (HAL_GetTick() - card->Async.Tick > SPI_SD_ASYNC_READ_TIMEOUT)
+        {
+          SD_Async_Finish(card, SPI_SD_REQ_TIMEOUT);
+          card->Stats.TokenErrors++;
+          SD_Clock_Error(card);
+        }
+        break;
+      }
+      if (retval == 2)
+      {
+        SD_Async_Finish(card, SPI_SD_REQ_ERROR);
+        card->Stats.TokenErrors++;
+        SD_Clock_Error(card);
+        break;
+      }
+      card->ClockErrors = 0;
+
+      /* 接收数据和CRC */
+      bsp_spi_read_dma(card->Spi, req->Buff + req->Done * 512, 512);
+      bsp_spi_read_dma(card->Spi, card->Temp, 2);
+      req->Done++;
+      card->Async.Tick = HAL_GetTick();
+
+      if ((req->Done == req->Count) && !SD_Async_Continue(card))
+      {
+        if (!card->Async.Multi)
+        {
+          SD_Async_Finish(card, SPI_SD_REQ_DONE);
+          break;
+        }
+        SD_SendCmd(card, TF_CMD12, 0, 0x01);	  // 发送停止命令
+        card->Async.State = SPI_SD_ASYNC_STOP;
+      }
+      else if ((req->Done < req->Count) && SD_Sched_Preempt(card))
+      {
+        SD_SendCmd(card, TF_CMD12, 0, 0x01);	  // 在扇区之间让出SD卡, 剩余的扇区重新排队
+        card->Async.State = SPI_SD_ASYNC_STOP;
+        card->Async.Requeue = 1;
+      }
+      break;
+
+    case SPI_SD_ASYNC_BUSY:
+      retval = SD_Async_PollByte(card, 0xFF);
+      if (retval != 0)
+      {
+        if (HAL_GetTick() - card->Async.Tick > SPI_SD_ASYNC_WRITE_TIMEOUT)
+        {
+          SD_Async_Finish(card, SPI_SD_REQ_TIMEOUT);
+        }
+        break;
+      }
+
+      if ((req->Done == req->Count) && !SD_Async_Continue(card))
+      {
+        if (!card->Async.Multi)
+        {
+          SD_Async_Finish(card, SPI_SD_REQ_DONE);
+          break;
+        }
+        card->Temp[0] = 0xFD;   // 停止令牌
+        bsp_spi_write(card->Spi, &card->Temp[0], 1);
+        card->Async.State = SPI_SD_ASYNC_STOP;
+        card->Async.Tick = HAL_GetTick();
+        break;
+      }
+      if ((req->Done < req->Count) && SD_Sched_Preempt(card))
+      {
+        card->Temp[0] = 0xFD;   // 在扇区之间让出SD卡, 剩余的扇区重新排队
+        bsp_spi_write(card->Spi, &card->Temp[0], 1);
+        card->Async.State = SPI_SD_ASYNC_STOP;
+        card->Async.Tick = HAL_GetTick();
+        card->Async.Requeue = 1;
+        break;
+      }
+      /* 忙结束后直接发送下一个扇区, 可能是合并的下一个请求 */
+      card->Async.State = SPI_SD_ASYNC_BLOCK;
+      req = card->Async.Active;
+      /* fall through */
+
+    case SPI_SD_ASYNC_BLOCK:
+      card->Temp[0] = card->Async.Multi ? 0xFC : 0xFE;
+      bsp_spi_write(card->Spi, &card->Temp[0], 1);
+      bsp_spi_write_dma(card->Spi, req->Buff + req->Done * 512, 512);
+      bsp_spi_read_dma(card->Spi, card->Temp, 2);
+
+      /* 接收响应, 正常响应为xxx00101 */
+      bsp_spi_read(card->Spi, &card->Temp[0], 1);
+      if ((card->Temp[0] & 0x1F) != MSD_DATA_OK)
+      {
+        retval = card->Temp[0] & 0x1F;
+        SD_Async_Finish(card, SPI_SD_REQ_ERROR);
+        if (retval == MSD_DATA_CRC_ERROR)
+        {
+          card->Stats.CrcErrors++;
+          SD_Clock_Error(card);
+        }
+        break;
+      }
+      card->ClockErrors = 0;
+      req->Done++;
+      card->Async.State = SPI_SD_ASYNC_BUSY;
+      card->Async.Tick = HAL_GetTick();
+      break;
+
+    case SPI_SD_ASYNC_STOP:
+      if (SD_Async_PollByte(card, 0xFF) == 0)
+      {
+        if (card->Async.Requeue)
+        {
+          SD_Async_Requeue(card);
+        }
+        else
+        {
+          SD_Async_Finish(card, SPI_SD_REQ_DONE);
+        }
+      }
+      else if (HAL_GetTick() - card->Async.Tick > SPI_SD_ASYNC_WRITE_TIMEOUT)
+      {
+        SD_Async_Finish(card, SPI_SD_REQ_TIMEOUT);
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  SPI_SD_ENTER_CRITICAL();
+  for (req = card->Async.Pending; req != NULL; req = req->Next)
+  {
+    count++;
+  }
+  SPI_SD_EXIT_CRITICAL();
+
+  return count + ((card->Async.Active != NULL) ? 1 : 0);
 }
 
 
+/**
+  * @brief  从完成队列中取出一个已完成的请求
+  * @note   只有没有设置回调的请求会进入完成队列
+  * @param  Handle: SD卡, SPI_SD_Card_t指针, NULL为SPI_SD_Card0
+  * @retval 已完成的请求, 没有时返回NULL
+  */
+SPI_SD_Request_t *SPI_SD_Card_Reap(void *Handle)
+{
+  SPI_SD_Card_t *card = SD_CARD(Handle);
+  SPI_SD_Request_t *req;
 
+  SPI_SD_ENTER_CRITICAL();
+  req = card->Async.Completed;
+  if (req != NULL)
+  {
+    card->Async.Completed = req->Next;
+    if (card->Async.Completed == NULL)
+    {
+      card->Async.CompletedTail = NULL;
+    }
+    req->Next = NULL;
+  }
+  SPI_SD_EXIT_CRITICAL();
 
+  return req;
+}
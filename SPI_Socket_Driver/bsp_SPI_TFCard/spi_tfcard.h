@@ -5,11 +5,15 @@
 #include "bsp_sdcard.h"
 
 
+// 默认SD卡SPI_SD_Card0的片选引脚, 其他SD卡在SPI_SD_CARD()中指定
 #define TFCARD_SPI_CS_PIN  SPI2_CS_Pin
 #define	TFCARD_SPI_CS_PORT SPI2_CS_GPIO_Port
 
-#define TFCARD_SPI_CS_SELECT()   HAL_GPIO_WritePin(TFCARD_SPI_CS_PORT, TFCARD_SPI_CS_PIN, GPIO_PIN_RESET)
-#define TFCARD_SPI_CS_RELEASE()  HAL_GPIO_WritePin(TFCARD_SPI_CS_PORT, TFCARD_SPI_CS_PIN, GPIO_PIN_SET)
+#define TFCARD_SPI_CS_SELECT(card)   HAL_GPIO_WritePin((card)->CS_Port, (card)->CS_Pin, GPIO_PIN_RESET)
+#define TFCARD_SPI_CS_RELEASE(card)  HAL_GPIO_WritePin((card)->CS_Port, (card)->CS_Pin, GPIO_PIN_SET)
+
+#define TFCARD_SPI_MAX_CLOCK     (50 * 1000 * 1000)   // 初始化完成后SPI时钟的上限(同时不超过卡的TRAN_SPEED), 单位Hz
+#define SPI_SD_BUSY_TIMEOUT      500                  // 同步读写等待SD卡忙结束的超时, 单位ms
 
 
 // TF卡类型定义  
@@ -33,6 +37,7 @@
 #define  TF_CMD17   17      // 命令17，读单个扇区
 #define  TF_CMD18   18      // 命令18，读多个扇区
 #define  TF_CMD23   23      // 命令23，设置多sector写入前预先擦除N个block
+#define  TF_ACMD23_MAX_BLOCKS  0x7FFFFF   // ACMD23的预擦除块数只有23位
 #define  TF_CMD24   24      // 命令24，写单个扇区
 #define  TF_CMD25   25      // 命令25，写多个扇区
 #define  TF_CMD32   32      // 命令32，设置要擦除的起始地址
@@ -82,25 +87,160 @@
 #define SD_CardInfo_t BSP_SD_CardInfo_t
 
 
+// 异步读写配置
+#define SPI_SD_ASYNC_POLL_BYTES      16      // 每次轮询最多检查的字节数(等待令牌/忙)
+#define SPI_SD_ASYNC_READ_TIMEOUT    100     // 读等待数据令牌超时, 单位ms
+#define SPI_SD_ASYNC_WRITE_TIMEOUT   500     // 写等待编程完成超时, 单位ms
+
+// 异步队列调度配置
+#define SPI_SD_SCHED_READ_EXPIRE     20      // 读请求最长等待时间, 超过时优先于写请求调度, 单位ms
+#define SPI_SD_SCHED_WRITE_BATCH     16      // 有读请求等待时最多连续调度的写请求数
+
+// 时钟训练配置
+#define USE_SPI_SD_CLOCK_TRAINING            // 定义初始化时训练SPI时钟: 从低速逐级提高, 取读测试CRC正确的最高时钟; 连续出现CRC/令牌错误时时钟减半
+#define USE_SPI_SD_HIGH_SPEED                // 定义初始化时用CMD6切换到高速模式(最大时钟50MHz)
+#define SPI_SD_TRAIN_START_CLOCK     (5 * 1000 * 1000)    // 训练的起始时钟, 读取卡信息也使用该时钟, 单位Hz
+#define SPI_SD_TRAIN_MIN_CLOCK       (400 * 1000)         // 训练和出错降低时钟的下限, 单位Hz
+#define SPI_SD_TRAIN_SECTOR          0       // 读测试使用的扇区, 只读不写
+#define SPI_SD_TRAIN_READS           4       // 每级时钟读测试的次数, 全部正确才使用该时钟
+#define SPI_SD_CLOCK_ERROR_LIMIT     3       // 连续出现CRC/令牌错误的次数达到该值时时钟减半
+
+// 擦除配置
+#define SPI_SD_ERASE_MAX_BLOCKS      8192    // 一次CMD38最多擦除的扇区数, 限制单次擦除的忙时间
+#define SPI_SD_ERASE_TIMEOUT         2000    // 每次CMD38的擦除超时, 单位ms
+
+// 总线配置
+#define SPI_SD_MAX_BUSES             2       // 挂有SD卡的SPI总线数, 每条总线记录当前的时钟和占用总线的卡
+
+#define SPI_SD_ENTER_CRITICAL()      __disable_irq()
+#define SPI_SD_EXIT_CRITICAL()       __enable_irq()
+
+// 异步请求类型
+#define SPI_SD_OP_READ               0
+#define SPI_SD_OP_WRITE              1
+
+// 异步请求状态
+#define SPI_SD_REQ_DONE              0       // 完成
+#define SPI_SD_REQ_PENDING           1       // 排队中
+#define SPI_SD_REQ_ACTIVE            2       // 传输中
+#define SPI_SD_REQ_ERROR             -1      // 传输错误
+#define SPI_SD_REQ_TIMEOUT           -2      // 超时
+
+// 异步请求优先级, 优先调度高优先级的请求; 高优先级请求到达时, 正在传输的低优先级请求在扇区之间让出SD卡
+#define SPI_SD_PRIO_BACKGROUND       -1      // 后台请求, 如日志刷新
+#define SPI_SD_PRIO_NORMAL           0       // 普通请求(默认), 按扇区号电梯调度
+#define SPI_SD_PRIO_REALTIME         1       // 实时请求, 按截止时间最早优先调度
+
+typedef struct SPI_SD_Request SPI_SD_Request_t;
+typedef void (*SPI_SD_Callback_t)(SPI_SD_Request_t *req);
+
+/* 异步读写请求, 内存由调用者提供, 完成前不能释放 */
+struct SPI_SD_Request
+{
+  uint8_t  Op;                    // SPI_SD_OP_READ / SPI_SD_OP_WRITE
+  uint8_t *Buff;                  // 数据缓冲区
+  uint32_t Sector;                // 起始扇区
+  uint32_t Count;                 // 扇区数
+  SPI_SD_Callback_t Callback;     // 完成回调, 为空时放入完成队列
+  void    *UserData;
+  int8_t   Priority;              // SPI_SD_PRIO_xxx, 0为SPI_SD_PRIO_NORMAL
+  uint32_t Deadline;              // 截止时间(HAL_GetTick()), 0: 无; 完成时超过截止时间计入Stats.DeadlineMisses
+
+  volatile int32_t Status;        // SPI_SD_REQ_xxx
+  uint32_t Done;                  // 已完成的扇区数
+  uint32_t Tick;                  // 提交时间
+  SPI_SD_Request_t *Next;
+};
+
+
+/* 一张SD卡的状态, 每个卡槽一个; 多张卡可以在同一条或不同的SPI总线上, 同一总线上的卡片选不同.
+   一张卡片选有效(包括异步传输进行中)时占用总线, 同一总线上的其他卡不能选中, 异步请求等到总线空闲再开始 */
+typedef struct
+{
+  bsp_spi_t     *Spi;             // SPI总线
+  GPIO_TypeDef  *CS_Port;         // 片选引脚端口
+  uint16_t       CS_Pin;          // 片选引脚编号
+  uint32_t       Clock;           // 当前的SPI时钟, 同一总线上切换卡时重新设置, 单位Hz
+  uint32_t       MaxClock;        // 卡支持的最大时钟(CSD的TRAN_SPEED, CMD6切换到高速模式后为50MHz), 单位Hz
+  uint8_t        ClockErrors;     // 连续的CRC/令牌错误次数
+  uint8_t        Training;        // 训练中, 读测试的错误不降低时钟
+
+  SD_CardInfo_t  Info;            // SD卡信息, 在SD_Card_Init()中读取
+  uint32_t       EraseGroup;      // 擦除组大小, 单位扇区, 0: 卡不支持擦除
+  uint8_t        Temp[32];        // 命令、CRC和令牌的收发缓冲
+
+  struct
+  {
+    SPI_SD_Request_t *Pending;        // 等待队列
+    SPI_SD_Request_t *PendingTail;
+    SPI_SD_Request_t *Completed;      // 完成队列
+    SPI_SD_Request_t *CompletedTail;
+    SPI_SD_Request_t *Active;         // 当前传输的请求
+    uint8_t  State;
+    uint8_t  Requeue;                 // 当前传输被更高优先级的请求抢占, 停止后剩余的扇区重新排队
+    uint8_t  Multi;                   // 当前传输使用CMD18/CMD25, 接在后面的请求可以合并
+    uint16_t Writes;                  // 连续调度的写请求数
+    uint32_t Position;                // 电梯扫描位置, 上次调度的请求的结束扇区
+    uint32_t Tick;                    // 当前等待开始的时间
+  } Async;                        // 异步读写队列, 按优先级和扇区号电梯调度
+
+  struct
+  {
+    uint32_t ReadSectors;         // 读取的扇区数
+    uint32_t WriteSectors;        // 写入的扇区数
+    uint32_t ReadErrors;          // 失败的读请求数
+    uint32_t WriteErrors;         // 失败的写请求数
+    uint32_t Timeouts;            // 异步请求超时次数
+    uint32_t Merged;              // 合并到前一个请求的传输中的请求数
+    uint32_t CrcErrors;           // CRC错误(命令响应的CRC错误位、写数据响应0x0B、训练时读数据的CRC16错误)
+    uint32_t TokenErrors;         // 等待数据令牌超时或收到错误令牌的次数
+    uint32_t ClockDowns;          // 连续出错后降低SPI时钟的次数
+    uint32_t DeadlineMisses;      // 完成时超过截止时间的请求数
+    uint32_t Preemptions;         // 被高优先级请求打断的传输次数
+  } Stats;                        // 统计
+} SPI_SD_Card_t;
+
+/* SPI_SD_Card_t的初始值: SPI总线、片选端口、片选引脚 */
+#define SPI_SD_CARD(spi, cs_port, cs_pin)    { .Spi = (spi), .CS_Port = (cs_port), .CS_Pin = (cs_pin) }
+
+/* BSP_SDCard_t的初始值, handle为SPI_SD_Card_t指针 */
+#define SPI_SD_BSP_CARD(handle)   \
+{                                 \
+  (handle),                       \
+  SPI_SD_Card_Init,               \
+  SPI_SD_Card_DeInit,             \
+  SPI_SD_Card_GetState,           \
+  SPI_SD_Card_GetInfo,            \
+  SPI_SD_Card_WriteSector,        \
+  SPI_SD_Card_ReadSector,         \
+  SPI_SD_Card_WriteSector_DMA,    \
+  SPI_SD_Card_ReadSector_DMA,     \
+}
+
+/* Handle为NULL时使用默认的SD卡 */
+#define SD_CARD(Handle)   (((Handle) != NULL) ? (SPI_SD_Card_t *)(Handle) : &SPI_SD_Card0)
+
+
 /* SD卡API */
-int32_t  SD_Release(void);
-int32_t  SD_Select(void);
-int32_t  SD_WaitReady(void);
-int32_t  SD_GetResponse(uint8_t Response);
-int32_t  SD_SendCmd(uint8_t cmd, uint32_t arg, uint8_t crc);
-int32_t  SD_RecvData(uint8_t *buff, uint32_t len);
-int32_t  SD_SendBlock(uint8_t *buff, uint8_t cmd);
-int32_t  SD_RecvData_DMA(uint8_t *buff, uint32_t len);
-int32_t  SD_SendBlock_DMA(uint8_t *buff, uint8_t cmd);
-int32_t  SD_GetCID(uint8_t *cid_data);
-int32_t  SD_GetCSD(uint8_t *csd_data);
-uint32_t SD_GetSectorCount(void);
-uint32_t SD_GetSectorSize(void);
-uint32_t SD_GetCapacity(void);
-int32_t  SD_Information_Printf(void);
-int32_t  SD_Card_Init(void);
+int32_t  SD_Release(SPI_SD_Card_t *card);
+int32_t  SD_Select(SPI_SD_Card_t *card);
+int32_t  SD_WaitReady(SPI_SD_Card_t *card);
+int32_t  SD_GetResponse(SPI_SD_Card_t *card, uint8_t Response);
+int32_t  SD_SendCmd(SPI_SD_Card_t *card, uint8_t cmd, uint32_t arg, uint8_t crc);
+int32_t  SD_RecvData(SPI_SD_Card_t *card, uint8_t *buff, uint32_t len);
+int32_t  SD_SendBlock(SPI_SD_Card_t *card, uint8_t *buff, uint8_t cmd);
+int32_t  SD_RecvData_DMA(SPI_SD_Card_t *card, uint8_t *buff, uint32_t len);
+int32_t  SD_SendBlock_DMA(SPI_SD_Card_t *card, uint8_t *buff, uint8_t cmd);
+int32_t  SD_GetCID(SPI_SD_Card_t *card, uint8_t *cid_data);
+int32_t  SD_GetCSD(SPI_SD_Card_t *card, uint8_t *csd_data);
+uint32_t SD_GetSectorCount(SPI_SD_Card_t *card);
+uint32_t SD_GetSectorSize(SPI_SD_Card_t *card);
+uint32_t SD_GetCapacity(SPI_SD_Card_t *card);
+int32_t  SD_Information_Printf(SPI_SD_Card_t *card);
+int32_t  SD_Card_Init(SPI_SD_Card_t *card);
 
 
+extern SPI_SD_Card_t SPI_SD_Card0;
 extern BSP_SDCard_t SPI_SDCard;
 int32_t SPI_SD_Card_Init(void *Handle);
 int32_t SPI_SD_Card_DeInit(void *Handle);
@@ -110,6 +250,14 @@ int32_t SPI_SD_Card_ReadSector(void *Handle, uint8_t *buff, uint32_t sector, uin
 int32_t SPI_SD_Card_WriteSector(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt);
 int32_t SPI_SD_Card_ReadSector_DMA(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt);
 int32_t SPI_SD_Card_WriteSector_DMA(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt);
+int32_t SPI_SD_Card_Erase(void *Handle, uint32_t sector, uint32_t cnt);
+int32_t SPI_SD_Card_TrainClock(void *Handle);
+int32_t SPI_SD_Card_ReadSector_RT(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt, uint32_t timeout);
+int32_t SPI_SD_Card_WriteSector_RT(void *Handle, uint8_t *buff, uint32_t sector, uint32_t cnt, uint32_t timeout);
+
+int32_t SPI_SD_Card_Submit(void *Handle, SPI_SD_Request_t *req);
+int32_t SPI_SD_Card_Poll(void *Handle);
+SPI_SD_Request_t *SPI_SD_Card_Reap(void *Handle);
 
 #endif
 